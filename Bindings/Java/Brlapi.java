@@ -19,6 +19,8 @@
 
 package org.a11y.BrlAPI;
 
+import java.nio.ByteBuffer;
+
 public class Brlapi extends Native implements Constants {
   protected final ConnectionSettings settings;
   protected final int fileDescriptor;
@@ -87,4 +89,48 @@ public class Brlapi extends Native implements Constants {
     }
     writeTextNative(cursor, text);
   }
+
+  private static byte[] getRemaining (ByteBuffer buffer) {
+    byte array[] = new byte[buffer.remaining()];
+    buffer.duplicate().get(array);
+    return array;
+  }
+
+  public void writeDots (ByteBuffer dots) throws Error {
+    if (dots.isDirect()) {
+      writeDotsNative(dots, dots.position(), dots.remaining());
+    } else {
+      writeDots(getRemaining(dots));
+    }
+  }
+
+  public int sendRaw (ByteBuffer buffer) throws Error {
+    int result;
+
+    if (buffer.isDirect()) {
+      result = sendRawNative(buffer, buffer.position(), buffer.remaining());
+    } else {
+      result = sendRaw(getRemaining(buffer));
+    }
+
+    buffer.position(buffer.limit());
+    return result;
+  }
+
+  public int recvRaw (ByteBuffer buffer) throws Error {
+    int size = buffer.remaining();
+    int result;
+
+    if (buffer.isDirect()) {
+      result = recvRawNative(buffer, buffer.position(), size);
+    } else {
+      byte array[] = new byte[size];
+      result = recvRaw(array);
+      buffer.duplicate().put(array, 0, Math.min(result, size));
+    }
+
+    // the packet may have been longer than the buffer
+    buffer.position(buffer.position() + Math.min(result, size));
+    return result;
+  }
 }
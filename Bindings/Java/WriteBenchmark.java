@@ -0,0 +1,113 @@
+/*
+ * libbrlapi - A library providing access to braille terminals for applications.
+ *
+ * Copyright (C) 2006-2014 by
+ *   Samuel Thibault <Samuel.Thibault@ens-lyon.org>
+ *   Sébastien Hinderer <Sebastien.Hinderer@ens-lyon.org>
+ *
+ * libbrlapi comes with ABSOLUTELY NO WARRANTY.
+ *
+ * This is free software, placed under the terms of the
+ * GNU Lesser General Public License, as published by the Free Software
+ * Foundation; either version 2.1 of the License, or (at your option) any
+ * later version. Please see the file LICENSE-LGPL for details.
+ *
+ * Web Page: http://mielke.cc/brltty/
+ *
+ * This software is maintained by Dave Mielke <dave@mielke.cc>.
+ */
+
+package org.a11y.BrlAPI;
+
+import java.nio.ByteBuffer;
+
+public class WriteBenchmark {
+  public static void main(String argv[]) {
+    ConnectionSettings settings = new ConnectionSettings();
+    int count = 10000;
+
+    {
+      int argi = 0;
+      while (argi < argv.length) {
+        String arg = argv[argi++];
+
+        if (arg.equals("-host")) {
+          if (argi == argv.length) {
+            System.err.println("Missing host specification.");
+            System.exit(2);
+          }
+
+          settings.host = argv[argi++];
+          continue;
+        }
+
+        if (arg.equals("-count")) {
+          if (argi == argv.length) {
+            System.err.println("Missing write count.");
+            System.exit(2);
+          }
+
+          count = Integer.parseInt(argv[argi++]);
+          continue;
+        }
+
+        System.err.println("Invalid option: " + arg);
+        System.exit(2);
+      }
+    }
+
+    try {
+      Brlapi brlapi = new Brlapi(settings);
+      DisplaySize size = brlapi.getDisplaySize();
+      int cells = size.getWidth() * size.getHeight();
+      brlapi.enterTtyMode();
+
+      byte array[] = new byte[cells];
+      ByteBuffer buffer = ByteBuffer.allocateDirect(cells);
+
+      // warm up both paths before timing them
+      for (int i=0; i<count/10; i+=1) {
+        brlapi.writeDots(array);
+        brlapi.writeDots(buffer);
+      }
+
+      {
+        long start = System.nanoTime();
+
+        for (int i=0; i<count; i+=1) {
+          array[i % cells] = (byte) i;
+          brlapi.writeDots(array);
+        }
+
+        report("byte[]", count, System.nanoTime() - start);
+      }
+
+      {
+        long start = System.nanoTime();
+
+        for (int i=0; i<count; i+=1) {
+          buffer.put(i % cells, (byte) i);
+          brlapi.writeDots(buffer);
+        }
+
+        report("ByteBuffer", count, System.nanoTime() - start);
+      }
+
+      brlapi.leaveTtyMode();
+      brlapi.closeConnection();
+    } catch (Error error) {
+      System.out.println("got error: " + error);
+      System.exit(3);
+    }
+  }
+
+  private static void report (String path, int count, long elapsed) {
+    if (count > 0) {
+      System.out.println(path + ": " + count + " writes in " +
+                         (elapsed / 1000000) + "ms (" +
+                         (elapsed / count) + "ns per write)");
+    } else {
+      System.out.println(path + ": no writes");
+    }
+  }
+}
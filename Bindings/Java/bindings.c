@@ -31,10 +31,36 @@
 #define ERR_NULLPTR 0
 #define ERR_OUTOFMEM 1
 #define ERR_INDEX 2
+#define ERR_ILLEGAL 3
 
 /* TODO: threads */
 static JNIEnv *env;
 
+/* Class references and member IDs are resolved once, by JNI_OnLoad,
+ * rather than on every call.
+ */
+static jfieldID nativeHandleID;
+
+static jclass jcerror;
+static jmethodID errorInitID;
+static struct {
+  jfieldID brlerrno, libcerrno, gaierrno, errfun;
+} errorIDs;
+
+static jclass jcexception;
+static jmethodID exceptionInitID;
+
+static jclass jcdisplaySize;
+static jmethodID displaySizeInitID;
+
+static struct {
+  jfieldID displayNumber, regionBegin, regionSize, text, andMask, orMask, cursor;
+} writeArgumentsIDs;
+
+static struct {
+  jfieldID type, command, argument, flags;
+} keyIDs;
+
 static void ThrowException(JNIEnv *jenv, int code, const char *msg) {
   jclass excep;
   const char *exception;
@@ -43,6 +69,7 @@ static void ThrowException(JNIEnv *jenv, int code, const char *msg) {
     case ERR_NULLPTR:  exception = "java/lang/NullPointerException";      break;
     case ERR_OUTOFMEM: exception = "java/lang/OutOfMemoryError";          break;
     case ERR_INDEX:    exception = "java/lang/IndexOutOfBoundsException"; break;
+    case ERR_ILLEGAL:  exception = "java/lang/IllegalArgumentException";  break;
     default:           exception = "java/lang/UnknownError";              break;
   }
 
@@ -58,8 +85,6 @@ static void ThrowError(JNIEnv *jenv, const char *msg) {
   const char *error = brlapi_strerror(&brlapi_error);
   int lenmsg = strlen(msg);
   int lenerr = strlen(error);
-  jclass jcexcep;
-  jmethodID jinit;
   jthrowable jexcep;
   jstring errfun = NULL;
 
@@ -67,17 +92,9 @@ static void ThrowError(JNIEnv *jenv, const char *msg) {
     char message[lenmsg + 2 + lenerr + 1];
     snprintf(message, sizeof(message), "%s: %s", msg, error);
 
-    if (!(jcexcep = (*jenv)->FindClass(jenv, "org/a11y/BrlAPI/Error"))) {
-      ThrowException(jenv, ERR_NULLPTR, "ThrowBrlapiErrorFindClass");
-      return;
-    }
-    if (!(jinit = (*jenv)->GetMethodID(jenv, jcexcep, "<init>", "(IIILjava/lang/String;)V"))) {
-      ThrowException(jenv, ERR_NULLPTR, "ThrowBrlapiErrorGetMethodID");
-      return;
-    }
     if (brlapi_errfun)
       errfun = (*jenv)->NewStringUTF(jenv, brlapi_errfun);
-    if (!(jexcep = (*jenv)->NewObject(jenv, jcexcep, jinit, brlapi_errno, brlapi_libcerrno, brlapi_gaierrno, errfun))) {
+    if (!(jexcep = (*jenv)->NewObject(jenv, jcerror, errorInitID, brlapi_errno, brlapi_libcerrno, brlapi_gaierrno, errfun))) {
       ThrowException(jenv, ERR_NULLPTR, "ThrowBrlapiErrorNewObject");
       return;
     }
@@ -88,8 +105,6 @@ static void ThrowError(JNIEnv *jenv, const char *msg) {
 
 static void BRLAPI_STDCALL exceptionHandler(brlapi_handle_t *handle, int err, brlapi_packetType_t type, const void *buf, size_t size) {
   jarray jbuf;
-  jclass jcexcep;
-  jmethodID jinit;
   jthrowable jexcep;
 
   if (!(jbuf = (*env)->NewByteArray(env, size))) {
@@ -98,15 +113,7 @@ static void BRLAPI_STDCALL exceptionHandler(brlapi_handle_t *handle, int err, br
   }
   (*env)->SetByteArrayRegion(env, jbuf, 0, size, (jbyte *) buf);
 
-  if (!(jcexcep = (*env)->FindClass(env, "org/a11y/BrlAPI/Exception"))) {
-    ThrowException(env, ERR_NULLPTR, "exceptionHandlerFindClass");
-    return;
-  }
-  if (!(jinit = (*env)->GetMethodID(env, jcexcep, "<init>", "(JII[B)V"))) {
-    ThrowException(env, ERR_NULLPTR, "exceptionHandlerGetMethodID");
-    return;
-  }
-  if (!(jexcep = (*env)->NewObject(env, jcexcep, jinit, (jlong)(intptr_t) handle, err, type, jbuf))) {
+  if (!(jexcep = (*env)->NewObject(env, jcexception, exceptionInitID, (jlong)(intptr_t) handle, err, type, jbuf))) {
     ThrowException(env, ERR_NULLPTR, "exceptionHandlerNewObject");
     return;
   }
@@ -127,16 +134,116 @@ static void BRLAPI_STDCALL exceptionHandler(brlapi_handle_t *handle, int err, br
   }
 #define GET_HANDLE(jenv, jobj, ret) \
   brlapi_handle_t *handle; \
-  jclass jcls; \
-  jfieldID handleID; \
-  GET_CLASS(jenv, jcls, jobj, ret); \
-  GET_ID(jenv, handleID, jcls, "handle", "J", ret); \
-  handle = (void*) (intptr_t) (*jenv)->GetLongField(jenv, jobj, handleID); \
+  handle = (void*) (intptr_t) (*jenv)->GetLongField(jenv, jobj, nativeHandleID); \
   if (!handle) { \
     ThrowException((jenv), ERR_NULLPTR, "connection has been closed"); \
     return ret; \
   }
 
+#define FIND_CLASS(jenv, class, name, ret) \
+  { \
+    jclass local; \
+    if (!(local = (*(jenv))->FindClass((jenv), "org/a11y/BrlAPI/" name))) \
+      return ret; \
+    (class) = (*(jenv))->NewGlobalRef((jenv), local); \
+    (*(jenv))->DeleteLocalRef((jenv), local); \
+    if (!(class)) \
+      return ret; \
+  }
+#define GET_METHOD_ID(jenv, id, class, method, sig, ret) \
+  if (!((id) = (*(jenv))->GetMethodID((jenv), (class), (method), (sig)))) \
+    return ret;
+#define GET_FIELD_ID(jenv, id, class, field, sig, ret) \
+  if (!((id) = (*(jenv))->GetFieldID((jenv), (class), (field), (sig)))) \
+    return ret;
+
+static int resolveMembers(JNIEnv *jenv) {
+  jclass jcls;
+
+  FIND_CLASS(jenv, jcls, "Native", 0);
+  GET_FIELD_ID(jenv, nativeHandleID, jcls, "handle", "J", 0);
+  (*jenv)->DeleteGlobalRef(jenv, jcls);
+
+  FIND_CLASS(jenv, jcerror, "Error", 0);
+  GET_METHOD_ID(jenv, errorInitID, jcerror, "<init>", "(IIILjava/lang/String;)V", 0);
+  GET_FIELD_ID(jenv, errorIDs.brlerrno,  jcerror, "brlerrno",  "I", 0);
+  GET_FIELD_ID(jenv, errorIDs.libcerrno, jcerror, "libcerrno", "I", 0);
+  GET_FIELD_ID(jenv, errorIDs.gaierrno,  jcerror, "gaierrno",  "I", 0);
+  GET_FIELD_ID(jenv, errorIDs.errfun,    jcerror, "errfun",    "Ljava/lang/String;", 0);
+
+  FIND_CLASS(jenv, jcexception, "Exception", 0);
+  GET_METHOD_ID(jenv, exceptionInitID, jcexception, "<init>", "(JII[B)V", 0);
+
+  FIND_CLASS(jenv, jcdisplaySize, "DisplaySize", 0);
+  GET_METHOD_ID(jenv, displaySizeInitID, jcdisplaySize, "<init>", "(II)V", 0);
+
+  FIND_CLASS(jenv, jcls, "WriteArguments", 0);
+  GET_FIELD_ID(jenv, writeArgumentsIDs.displayNumber, jcls, "displayNumber", "I", 0);
+  GET_FIELD_ID(jenv, writeArgumentsIDs.regionBegin,   jcls, "regionBegin",   "I", 0);
+  GET_FIELD_ID(jenv, writeArgumentsIDs.regionSize,    jcls, "regionSize",    "I", 0);
+  GET_FIELD_ID(jenv, writeArgumentsIDs.text,          jcls, "text",          "Ljava/lang/String;", 0);
+  GET_FIELD_ID(jenv, writeArgumentsIDs.andMask,       jcls, "andMask",       "[B", 0);
+  GET_FIELD_ID(jenv, writeArgumentsIDs.orMask,        jcls, "orMask",        "[B", 0);
+  GET_FIELD_ID(jenv, writeArgumentsIDs.cursor,        jcls, "cursor",        "I", 0);
+  (*jenv)->DeleteGlobalRef(jenv, jcls);
+
+  FIND_CLASS(jenv, jcls, "Key", 0);
+  GET_FIELD_ID(jenv, keyIDs.type,     jcls, "type",     "I", 0);
+  GET_FIELD_ID(jenv, keyIDs.command,  jcls, "command",  "I", 0);
+  GET_FIELD_ID(jenv, keyIDs.argument, jcls, "argument", "I", 0);
+  GET_FIELD_ID(jenv, keyIDs.flags,    jcls, "flags",    "I", 0);
+  (*jenv)->DeleteGlobalRef(jenv, jcls);
+
+  return 1;
+}
+
+JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM *vm, void *reserved) {
+  JNIEnv *jenv;
+
+  if ((*vm)->GetEnv(vm, (void **) &jenv, JNI_VERSION_1_4) != JNI_OK)
+    return JNI_ERR;
+
+  if (!resolveMembers(jenv))
+    return JNI_ERR;
+
+  return JNI_VERSION_1_4;
+}
+
+JNIEXPORT void JNICALL JNI_OnUnload(JavaVM *vm, void *reserved) {
+  JNIEnv *jenv;
+
+  if ((*vm)->GetEnv(vm, (void **) &jenv, JNI_VERSION_1_4) != JNI_OK)
+    return;
+
+  if (jcerror) (*jenv)->DeleteGlobalRef(jenv, jcerror);
+  if (jcexception) (*jenv)->DeleteGlobalRef(jenv, jcexception);
+  if (jcdisplaySize) (*jenv)->DeleteGlobalRef(jenv, jcdisplaySize);
+}
+
+/* Returns the address of the count bytes at offset within a direct buffer. */
+static void *getBufferAddress(JNIEnv *jenv, jobject jbuf, jint offset, jint count, const char *function) {
+  jbyte *address;
+  jlong capacity;
+
+  if (!jbuf) {
+    ThrowException(jenv, ERR_NULLPTR, function);
+    return NULL;
+  }
+
+  if (!(address = (*jenv)->GetDirectBufferAddress(jenv, jbuf))) {
+    ThrowException(jenv, ERR_ILLEGAL, function);
+    return NULL;
+  }
+
+  capacity = (*jenv)->GetDirectBufferCapacity(jenv, jbuf);
+  if ((offset < 0) || (count < 0) || ((jlong) offset + count > capacity)) {
+    ThrowException(jenv, ERR_INDEX, function);
+    return NULL;
+  }
+
+  return address + offset;
+}
+
 JNIEXPORT jint JNICALL Java_org_a11y_BrlAPI_Native_openConnection(JNIEnv *jenv, jobject jobj, jobject JclientSettings , jobject JusedSettings) {
   jclass jcclientSettings, jcusedSettings;
   jfieldID clientAuthID = NULL, clientHostID = NULL, usedAuthID, usedHostID;
@@ -145,19 +252,15 @@ JNIEXPORT jint JNICALL Java_org_a11y_BrlAPI_Native_openConnection(JNIEnv *jenv,
   int result;
   jstring auth = NULL, host = NULL;
   const char *str;
-  jfieldID handleID;
   brlapi_handle_t *handle;
-  jclass jcls;
 
-  GET_CLASS(jenv, jcls, jobj, -1);
-  GET_ID(jenv, handleID, jcls, "handle", "J", -1);
   handle = malloc(brlapi_getHandleSize());
   if (!handle) {
     ThrowException(jenv, ERR_OUTOFMEM, __func__);
     return -1;
   }
 
-  (*jenv)->SetLongField(jenv, jobj, handleID, (jlong) (intptr_t) handle);
+  (*jenv)->SetLongField(jenv, jobj, nativeHandleID, (jlong) (intptr_t) handle);
 
   env = jenv;
 
@@ -233,7 +336,7 @@ JNIEXPORT void JNICALL Java_org_a11y_BrlAPI_Native_closeConnection(JNIEnv *jenv,
 
   brlapi__closeConnection(handle);
   free((void*) (intptr_t) handle);
-  (*jenv)->SetLongField(jenv, jobj, handleID, (jlong) (intptr_t) NULL);
+  (*jenv)->SetLongField(jenv, jobj, nativeHandleID, (jlong) (intptr_t) NULL);
 }
 
 JNIEXPORT jstring JNICALL Java_org_a11y_BrlAPI_Native_getDriverName(JNIEnv *jenv, jobject jobj) {
@@ -253,8 +356,6 @@ JNIEXPORT jstring JNICALL Java_org_a11y_BrlAPI_Native_getDriverName(JNIEnv *jenv
 
 JNIEXPORT jobject JNICALL Java_org_a11y_BrlAPI_Native_getDisplaySize(JNIEnv *jenv, jobject jobj) {
   unsigned int x, y;
-  jclass jcsize;
-  jmethodID jinit;
   jobject jsize;
   GET_HANDLE(jenv, jobj, NULL);
 
@@ -265,15 +366,7 @@ JNIEXPORT jobject JNICALL Java_org_a11y_BrlAPI_Native_getDisplaySize(JNIEnv *jen
     return NULL;
   }
 
-  if (!(jcsize = (*jenv)->FindClass(jenv, "org/a11y/BrlAPI/DisplaySize"))) {
-    ThrowException(jenv, ERR_NULLPTR, __func__);
-    return NULL;
-  }
-  if (!(jinit = (*jenv)->GetMethodID(jenv, jcsize, "<init>", "(II)V"))) {
-    ThrowException(jenv, ERR_NULLPTR, __func__);
-    return NULL;
-  }
-  if (!(jsize = (*jenv)->NewObject(jenv, jcsize, jinit, x, y))) {
+  if (!(jsize = (*jenv)->NewObject(jenv, jcdisplaySize, displaySizeInitID, x, y))) {
     ThrowException(jenv, ERR_NULLPTR, __func__);
     return NULL;
   }
@@ -418,13 +511,35 @@ JNIEXPORT void JNICALL Java_org_a11y_BrlAPI_Native_writeDots(JNIEnv *jenv, jobje
   }
 }
 
+JNIEXPORT void JNICALL Java_org_a11y_BrlAPI_Native_writeDotsNative(JNIEnv *jenv, jobject jobj, jobject jbuf, jint joffset, jint jcount) {
+  unsigned char *dots;
+  unsigned int x, y;
+  GET_HANDLE(jenv, jobj, );
+
+  env = jenv;
+
+  if (!(dots = getBufferAddress(jenv, jbuf, joffset, jcount, __func__))) return;
+
+  if (brlapi__getDisplaySize(handle, &x, &y) < 0) {
+    ThrowError(jenv, __func__);
+    return;
+  }
+
+  if ((unsigned int) jcount < x*y) {
+    ThrowException(jenv, ERR_INDEX, __func__);
+    return;
+  }
+
+  if (brlapi__writeDots(handle, dots) < 0) {
+    ThrowError(jenv, __func__);
+    return;
+  }
+}
+
 JNIEXPORT void JNICALL Java_org_a11y_BrlAPI_Native_write(JNIEnv *jenv, jobject jobj, jobject jarguments) {
   brlapi_writeArguments_t arguments = BRLAPI_WRITEARGUMENTS_INITIALIZER;
   int result;
   jstring text, andMask, orMask;
-  jclass jcwriteArguments;
-  jfieldID displayNumberID, regionBeginID, regionSizeID,
-	   textID, andMaskID, orMaskID, cursorID; 
   GET_HANDLE(jenv, jobj, );
 
   env = jenv;
@@ -434,32 +549,22 @@ JNIEXPORT void JNICALL Java_org_a11y_BrlAPI_Native_write(JNIEnv *jenv, jobject j
     return;
   }
 
-  GET_CLASS(jenv, jcwriteArguments, jarguments,);
-
-  GET_ID(jenv, displayNumberID,jcwriteArguments, "displayNumber", "I",);
-  GET_ID(jenv, regionBeginID,  jcwriteArguments, "regionBegin",   "I",);
-  GET_ID(jenv, regionSizeID,   jcwriteArguments, "regionSize",    "I",);
-  GET_ID(jenv, textID,         jcwriteArguments, "text",          "Ljava/lang/String;",);
-  GET_ID(jenv, andMaskID,      jcwriteArguments, "andMask",       "[B",);
-  GET_ID(jenv, orMaskID,       jcwriteArguments, "orMask",        "[B",);
-  GET_ID(jenv, cursorID,       jcwriteArguments, "cursor",        "I",);
-
-  arguments.displayNumber = (*jenv)->GetIntField(jenv, jarguments, displayNumberID);
-  arguments.regionBegin   = (*jenv)->GetIntField(jenv, jarguments, regionBeginID);
-  arguments.regionSize    = (*jenv)->GetIntField(jenv, jarguments, regionSizeID);
-  if ((text  = (*jenv)->GetObjectField(jenv, jarguments, textID)))
+  arguments.displayNumber = (*jenv)->GetIntField(jenv, jarguments, writeArgumentsIDs.displayNumber);
+  arguments.regionBegin   = (*jenv)->GetIntField(jenv, jarguments, writeArgumentsIDs.regionBegin);
+  arguments.regionSize    = (*jenv)->GetIntField(jenv, jarguments, writeArgumentsIDs.regionSize);
+  if ((text  = (*jenv)->GetObjectField(jenv, jarguments, writeArgumentsIDs.text)))
     arguments.text   = (char *)(*jenv)->GetStringUTFChars(jenv, text, NULL);
   else 
     arguments.text  = NULL;
-  if ((andMask = (*jenv)->GetObjectField(jenv, jarguments, andMaskID)))
+  if ((andMask = (*jenv)->GetObjectField(jenv, jarguments, writeArgumentsIDs.andMask)))
     arguments.andMask  = (unsigned char *)(*jenv)->GetByteArrayElements(jenv, andMask, NULL);
   else
     arguments.andMask = NULL;
-  if ((orMask  = (*jenv)->GetObjectField(jenv, jarguments, orMaskID)))
+  if ((orMask  = (*jenv)->GetObjectField(jenv, jarguments, writeArgumentsIDs.orMask)))
     arguments.orMask   = (unsigned char *)(*jenv)->GetByteArrayElements(jenv, orMask, NULL);
   else
     arguments.orMask  = NULL;
-  arguments.cursor     = (*jenv)->GetIntField(jenv, jarguments, cursorID);
+  arguments.cursor     = (*jenv)->GetIntField(jenv, jarguments, writeArgumentsIDs.cursor);
   arguments.charset = "UTF-8";
 
   result = brlapi__write(handle, &arguments);
@@ -680,6 +785,23 @@ JNIEXPORT jint JNICALL Java_org_a11y_BrlAPI_Native_sendRaw(JNIEnv *jenv, jobject
   return (jint) result;
 }
 
+JNIEXPORT jint JNICALL Java_org_a11y_BrlAPI_Native_sendRawNative(JNIEnv *jenv, jobject jobj, jobject jbuf, jint joffset, jint jcount) {
+  unsigned char *buf;
+  int result;
+  GET_HANDLE(jenv, jobj, -1);
+
+  env = jenv;
+
+  if (!(buf = getBufferAddress(jenv, jbuf, joffset, jcount, __func__))) return -1;
+
+  if ((result = brlapi__sendRaw(handle, buf, jcount)) < 0) {
+    ThrowError(jenv, __func__);
+    return -1;
+  }
+
+  return (jint) result;
+}
+
 JNIEXPORT jint JNICALL Java_org_a11y_BrlAPI_Native_recvRaw(JNIEnv *jenv, jobject jobj, jbyteArray jbuf) {
   jbyte *buf;
   unsigned int n;
@@ -708,6 +830,23 @@ JNIEXPORT jint JNICALL Java_org_a11y_BrlAPI_Native_recvRaw(JNIEnv *jenv, jobject
   return (jint) result;
 }
 
+JNIEXPORT jint JNICALL Java_org_a11y_BrlAPI_Native_recvRawNative(JNIEnv *jenv, jobject jobj, jobject jbuf, jint joffset, jint jcount) {
+  unsigned char *buf;
+  int result;
+  GET_HANDLE(jenv, jobj, -1);
+
+  env = jenv;
+
+  if (!(buf = getBufferAddress(jenv, jbuf, joffset, jcount, __func__))) return -1;
+
+  if ((result = brlapi__recvRaw(handle, buf, jcount)) < 0) {
+    ThrowError(jenv, __func__);
+    return -1;
+  }
+
+  return (jint) result;
+}
+
 JNIEXPORT jstring JNICALL Java_org_a11y_BrlAPI_Native_getPacketTypeName(JNIEnv *jenv, jclass jcls, jlong jtype) {
   const char *type;
 
@@ -722,24 +861,16 @@ JNIEXPORT jstring JNICALL Java_org_a11y_BrlAPI_Native_getPacketTypeName(JNIEnv *
 }
 
 JNIEXPORT jstring JNICALL Java_org_a11y_BrlAPI_Error_toString (JNIEnv *jenv, jobject jerr) {
-  jclass jcerr;
-  jfieldID brlerrnoID, libcerrnoID, gaierrnoID, errfunID;
   jstring jerrfun;
   brlapi_error_t error;
   const char *res;
 
   env = jenv;
 
-  GET_CLASS(jenv, jcerr, jerr, NULL);
-  GET_ID(jenv, brlerrnoID,  jcerr, "brlerrno",  "I", NULL);
-  GET_ID(jenv, libcerrnoID, jcerr, "libcerrno", "I", NULL);
-  GET_ID(jenv, gaierrnoID,  jcerr, "gaierrno",  "I", NULL);
-  GET_ID(jenv, errfunID,    jcerr, "errfun",    "Ljava/lang/String;", NULL);
-
-  error.brlerrno  = (*jenv)->GetIntField(jenv, jerr, brlerrnoID);
-  error.libcerrno = (*jenv)->GetIntField(jenv, jerr, libcerrnoID);
-  error.gaierrno  = (*jenv)->GetIntField(jenv, jerr, gaierrnoID);
-  if (!(jerrfun = (*jenv)->GetObjectField(jenv, jerr, errfunID))) {
+  error.brlerrno  = (*jenv)->GetIntField(jenv, jerr, errorIDs.brlerrno);
+  error.libcerrno = (*jenv)->GetIntField(jenv, jerr, errorIDs.libcerrno);
+  error.gaierrno  = (*jenv)->GetIntField(jenv, jerr, errorIDs.gaierrno);
+  if (!(jerrfun = (*jenv)->GetObjectField(jenv, jerr, errorIDs.errfun))) {
     error.errfun = NULL;
   } else if (!(error.errfun = (char *)(*jenv)->GetStringUTFChars(jenv, jerrfun, NULL))) {
     ThrowException(jenv, ERR_OUTOFMEM, __func__);
@@ -788,20 +919,12 @@ JNIEXPORT jstring JNICALL Java_org_a11y_BrlAPI_Exception_toString (JNIEnv *jenv,
 }
 
 JNIEXPORT void JNICALL Java_org_a11y_BrlAPI_Key_expandKeyCode (JNIEnv *jenv, jobject obj, jlong jkey) {
-  jclass jckey;
-  jfieldID typeID, commandID, argumentID, flagsID;
   brlapi_keyCode_t key = jkey;
   brlapi_expandedKeyCode_t ekc;
 
-  GET_CLASS(jenv, jckey, obj, );
-  GET_ID(jenv, typeID,     jckey, "type",     "I", );
-  GET_ID(jenv, commandID,  jckey, "command",  "I", );
-  GET_ID(jenv, argumentID, jckey, "argument", "I", );
-  GET_ID(jenv, flagsID,    jckey, "flags",    "I", );
-
   brlapi_expandKeyCode(key, &ekc);
-  (*jenv)->SetIntField(jenv, obj, typeID,     ekc.type);
-  (*jenv)->SetIntField(jenv, obj, commandID,  ekc.command);
-  (*jenv)->SetIntField(jenv, obj, argumentID, ekc.argument);
-  (*jenv)->SetIntField(jenv, obj, flagsID,    ekc.flags);
+  (*jenv)->SetIntField(jenv, obj, keyIDs.type,     ekc.type);
+  (*jenv)->SetIntField(jenv, obj, keyIDs.command,  ekc.command);
+  (*jenv)->SetIntField(jenv, obj, keyIDs.argument, ekc.argument);
+  (*jenv)->SetIntField(jenv, obj, keyIDs.flags,    ekc.flags);
 }
@@ -75,9 +75,29 @@ except brlapi.ConnectionError as e:
 ###############################################################################
 
 cimport c_brlapi
+from cpython.buffer cimport PyObject_GetBuffer, PyBuffer_Release, PyBUF_SIMPLE
 import errno
 include "constants.auto.pyx"
 
+cdef char *copyBuffer(val, encoding, int *size) except NULL:
+	"""Copies a unicode string, once encoded, or any object supporting the buffer protocol (bytes, bytearray, memoryview, array...) into a \0-terminated C string"""
+	cdef Py_buffer view
+	cdef char *c_val
+	if (type(val) == unicode):
+		val = val.encode(encoding)
+	PyObject_GetBuffer(val, &view, PyBUF_SIMPLE)
+	try:
+		c_val = <char*>c_brlapi.malloc(view.len+1)
+		if (not c_val):
+			raise MemoryError()
+		c_brlapi.memcpy(<void*>c_val, view.buf, view.len)
+		c_val[view.len] = 0
+		if (size):
+			size[0] = view.len
+	finally:
+		PyBuffer_Release(&view)
+	return c_val
+
 class OperationError(Exception):
 	"""Error while performing some operation"""
 	def __init__(self):
@@ -171,22 +191,15 @@ cdef class WriteStruct:
 			else:
 				return self.props.text
 		def __set__(self, val):
-			cdef c_brlapi.size_t size
-			cdef char *c_val
+			cdef int size
 			if (type(val) == unicode):
-				val = val.encode('UTF-8')
 				self.charset = 'UTF-8'.encode("ASCII")
 			if (self.props.text):
 				c_brlapi.free(self.props.text)
+				self.props.text = NULL
 			if (val):
-				size = len(val)
-				c_val = val
-				self.props.text = <char*>c_brlapi.malloc(size+1)
-				c_brlapi.memcpy(<void*>self.props.text,<void*>c_val,size)
-				self.props.text[size] = 0
+				self.props.text = copyBuffer(val, 'UTF-8', &size)
 				self.props.textSize = size
-			else:
-				self.props.text = NULL
 
 	property cursor:
 		"""CURSOR_LEAVE == don't touch, CURSOR_OFF == turn off, 1 = 1st char of display, ..."""
@@ -203,20 +216,11 @@ cdef class WriteStruct:
 			else:
 				return self.props.charset
 		def __set__(self, val):
-			cdef c_brlapi.size_t size
-			cdef char *c_val
 			if (self.props.charset):
 				c_brlapi.free(self.props.charset)
-			if (val):
-				if (type(val) == unicode):
-					val = val.encode('ASCII')
-				size = len(val)
-				c_val = val
-				self.props.charset = <char*>c_brlapi.malloc(size+1)
-				c_brlapi.memcpy(<void*>self.props.charset,<void*>c_val,size)
-				self.props.charset[size] = 0
-			else:
 				self.props.charset = NULL
+			if (val):
+				self.props.charset = copyBuffer(val, 'ASCII', NULL)
 
 	property attrAnd:
 		"""And attributes; applied first"""
@@ -226,20 +230,11 @@ cdef class WriteStruct:
 			else:
 				return <char*>self.props.andMask
 		def __set__(self, val):
-			cdef c_brlapi.size_t size
-			cdef char *c_val
 			if (self.props.andMask):
 				c_brlapi.free(self.props.andMask)
-			if (val):
-				if (type(val) == unicode):
-					val = val.encode('latin1')
-				size = len(val)
-				c_val = val
-				self.props.andMask = <unsigned char*>c_brlapi.malloc(size+1)
-				c_brlapi.memcpy(<void*>self.props.andMask,<void*>c_val,size)
-				self.props.andMask[size] = 0
-			else:
 				self.props.andMask = NULL
+			if (val):
+				self.props.andMask = <unsigned char*>copyBuffer(val, 'latin1', NULL)
 
 	property attrOr:
 		"""Or attributes; applied after ANDing"""
@@ -249,20 +244,11 @@ cdef class WriteStruct:
 			else:
 				return <char*>self.props.orMask
 		def __set__(self, val):
-			cdef c_brlapi.size_t size
-			cdef char *c_val
 			if (self.props.orMask):
 				c_brlapi.free(self.props.orMask)
-			if (val):
-				if (type(val) == unicode):
-					val = val.encode('latin1')
-				size = len(val)
-				c_val = val
-				self.props.orMask = <unsigned char*>c_brlapi.malloc(size+1)
-				c_brlapi.memcpy(<void*>self.props.orMask,<void*>c_val,size)
-				self.props.orMask[size] = 0
-			else:
 				self.props.orMask = NULL
+			if (val):
+				self.props.orMask = <unsigned char*>copyBuffer(val, 'latin1', NULL)
 
 cdef class Connection:
 	"""Class which manages the bridge between your program and BrlAPI"""
@@ -294,18 +280,22 @@ cdef class Connection:
 
 		self.h = <c_brlapi.brlapi_handle_t*> c_brlapi.malloc(c_brlapi.brlapi_getHandleSize())
 
-		c_brlapi.Py_BEGIN_ALLOW_THREADS
-		self.fd = c_brlapi.brlapi__openConnection(self.h, &client, &self.settings)
-		c_brlapi.Py_END_ALLOW_THREADS
+		with nogil:
+			self.fd = c_brlapi.brlapi__openConnection(self.h, &client, &self.settings)
 		c_brlapi.brlapi_protocolExceptionInit(self.h)
 		if self.fd == -1:
 			c_brlapi.free(self.h)
+			self.h = NULL
 			raise ConnectionError(self.settings.host, self.settings.auth)
 
 	def __del__(self):
 		"""Close the BrlAPI conection"""
-		c_brlapi.brlapi__closeConnection(self.h)
+		if not self.h:
+			return
+		with nogil:
+			c_brlapi.brlapi__closeConnection(self.h)
 		c_brlapi.free(self.h)
+		self.h = NULL
 
 	property host:
 		"""To get authorized to connect, libbrlapi has to tell the BrlAPI server a secret key, for security reasons. This is the path to the file which holds it; it will hence have to be readable by the application."""
@@ -329,9 +319,8 @@ cdef class Connection:
 			cdef unsigned int x
 			cdef unsigned int y
 			cdef int retval
-			c_brlapi.Py_BEGIN_ALLOW_THREADS
-			retval = c_brlapi.brlapi__getDisplaySize(self.h, &x, &y)
-			c_brlapi.Py_END_ALLOW_THREADS
+			with nogil:
+				retval = c_brlapi.brlapi__getDisplaySize(self.h, &x, &y)
 			if retval == -1:
 				raise OperationError()
 			else:
@@ -343,9 +332,8 @@ cdef class Connection:
 		def __get__(self):
 			cdef char name[21]
 			cdef int retval
-			c_brlapi.Py_BEGIN_ALLOW_THREADS
-			retval = c_brlapi.brlapi__getDriverName(self.h, name, sizeof(name))
-			c_brlapi.Py_END_ALLOW_THREADS
+			with nogil:
+				retval = c_brlapi.brlapi__getDriverName(self.h, name, sizeof(name))
 			if retval == -1:
 				raise OperationError()
 			else:
@@ -369,9 +357,8 @@ cdef class Connection:
 			if (type(driver) == unicode):
 				driver = driver.encode('ASCII')
 			c_driver = driver
-		c_brlapi.Py_BEGIN_ALLOW_THREADS
-		retval = c_brlapi.brlapi__enterTtyMode(self.h, c_tty, c_driver)
-		c_brlapi.Py_END_ALLOW_THREADS
+		with nogil:
+			retval = c_brlapi.brlapi__enterTtyMode(self.h, c_tty, c_driver)
 		if retval == -1:
 			raise OperationError()
 		else:
@@ -404,9 +391,8 @@ cdef class Connection:
 			if (type(driver) == unicode):
 				driver = driver.encode('ASCII')
 			c_driver = driver
-		c_brlapi.Py_BEGIN_ALLOW_THREADS
-		retval = c_brlapi.brlapi__enterTtyModeWithPath(self.h, c_ttys, c_nttys, c_driver)
-		c_brlapi.Py_END_ALLOW_THREADS
+		with nogil:
+			retval = c_brlapi.brlapi__enterTtyModeWithPath(self.h, c_ttys, c_nttys, c_driver)
 		if (c_ttys):
 			c_brlapi.free(c_ttys)
 		if retval == -1:
@@ -418,9 +404,8 @@ cdef class Connection:
 		"""Stop controlling the tty
 		See brlapi_leaveTtyMode(3)."""
 		cdef int retval
-		c_brlapi.Py_BEGIN_ALLOW_THREADS
-		retval = c_brlapi.brlapi__leaveTtyMode(self.h)
-		c_brlapi.Py_END_ALLOW_THREADS
+		with nogil:
+			retval = c_brlapi.brlapi__leaveTtyMode(self.h)
 		if retval == -1:
 			raise OperationError()
 		else:
@@ -433,9 +418,8 @@ cdef class Connection:
 		cdef int retval
 		cdef int c_tty
 		c_tty = tty
-		c_brlapi.Py_BEGIN_ALLOW_THREADS
-		retval = c_brlapi.brlapi__setFocus(self.h, c_tty)
-		c_brlapi.Py_END_ALLOW_THREADS
+		with nogil:
+			retval = c_brlapi.brlapi__setFocus(self.h, c_tty)
 		if retval == -1:
 			raise OperationError()
 		else:
@@ -477,9 +461,8 @@ cdef class Connection:
 			writeArguments.cursor = cursor
 		if charset:
 			writeArguments.charset = charset
-		c_brlapi.Py_BEGIN_ALLOW_THREADS
-		retval = c_brlapi.brlapi__write(self.h, &writeArguments.props)
-		c_brlapi.Py_END_ALLOW_THREADS
+		with nogil:
+			retval = c_brlapi.brlapi__write(self.h, &writeArguments.props)
 		if retval == -1:
 			raise OperationError()
 		else:
@@ -488,21 +471,32 @@ cdef class Connection:
 	def writeDots(self, dots):
 		"""Write the given dots array to the display.
 		See brlapi_writeDots(3).
-		* dots : points on an array of dot information, one per character. Its size must hence be the same as what displaysize provides."""
+		* dots : points on an array of dot information, one per character. Its size must hence be the same as what displaysize provides. It may be any object supporting the buffer protocol (bytes, bytearray, memoryview, array...), which is used in place."""
 		cdef int retval
-		cdef char *c_dots
-		cdef unsigned char *c_udots
+		cdef Py_buffer view
+		cdef unsigned char *c_dots
+		cdef int dispSize
 		(x, y) = self.displaySize
 		dispSize = x * y
 		if (type(dots) == unicode):
 			dots = dots.encode('latin1')
-		if (len(dots) < dispSize):
-			dots = dots + b"".center(dispSize - len(dots), '\0')
-		c_dots = dots
-		c_udots = <unsigned char *>c_dots
-		c_brlapi.Py_BEGIN_ALLOW_THREADS
-		retval = c_brlapi.brlapi__writeDots(self.h, c_udots)
-		c_brlapi.Py_END_ALLOW_THREADS
+		PyObject_GetBuffer(dots, &view, PyBUF_SIMPLE)
+		try:
+			if (view.len < dispSize):
+				# Only short arrays are copied, to be padded with blank cells
+				c_dots = <unsigned char*>c_brlapi.malloc(dispSize)
+				if (not c_dots):
+					raise MemoryError()
+				c_brlapi.memcpy(<void*>c_dots, view.buf, view.len)
+				c_brlapi.memset(<void*>(c_dots + view.len), 0, dispSize - view.len)
+			else:
+				c_dots = <unsigned char*>view.buf
+			with nogil:
+				retval = c_brlapi.brlapi__writeDots(self.h, c_dots)
+			if (<void*>c_dots != view.buf):
+				c_brlapi.free(c_dots)
+		finally:
+			PyBuffer_Release(&view)
 		if retval == -1:
 			raise OperationError()
 		else:
@@ -544,9 +538,8 @@ cdef class Connection:
 		cdef int retval
 		cdef int c_wait
 		c_wait = wait
-		c_brlapi.Py_BEGIN_ALLOW_THREADS
-		retval = c_brlapi.brlapi__readKey(self.h, c_wait, <c_brlapi.brlapi_keyCode_t*>&code)
-		c_brlapi.Py_END_ALLOW_THREADS
+		with nogil:
+			retval = c_brlapi.brlapi__readKey(self.h, c_wait, <c_brlapi.brlapi_keyCode_t*>&code)
 		if retval == -1:
 			raise OperationError()
 		elif retval <= 0 and wait == False:
@@ -581,9 +574,8 @@ cdef class Connection:
 		c_set = <c_brlapi.brlapi_keyCode_t*>c_brlapi.malloc(c_n * sizeof(c_set[0]))
 		for i from 0 <= i < c_n:
 			c_set[i] = set[i]
-		c_brlapi.Py_BEGIN_ALLOW_THREADS
-		retval = c_brlapi.brlapi__ignoreKeys(self.h, c_type, c_set, c_n)
-		c_brlapi.Py_END_ALLOW_THREADS
+		with nogil:
+			retval = c_brlapi.brlapi__ignoreKeys(self.h, c_type, c_set, c_n)
 		c_brlapi.free(c_set)
 		if retval == -1:
 			raise OperationError()
@@ -606,9 +598,8 @@ cdef class Connection:
 		c_set = <c_brlapi.brlapi_keyCode_t*>c_brlapi.malloc(c_n * sizeof(c_set[0]))
 		for i from 0 <= i < c_n:
 			c_set[i] = set[i]
-		c_brlapi.Py_BEGIN_ALLOW_THREADS
-		retval = c_brlapi.brlapi__acceptKeys(self.h, c_type, c_set, c_n)
-		c_brlapi.Py_END_ALLOW_THREADS
+		with nogil:
+			retval = c_brlapi.brlapi__acceptKeys(self.h, c_type, c_set, c_n)
 		c_brlapi.free(c_set)
 		if retval == -1:
 			raise OperationError()
@@ -621,9 +612,8 @@ cdef class Connection:
 		
 		This function asks the server to give all keys to brltty, rather than returning them to the application via brlapi_readKey()."""
 		cdef int retval
-		c_brlapi.Py_BEGIN_ALLOW_THREADS
-		retval = c_brlapi.brlapi__ignoreAllKeys(self.h)
-		c_brlapi.Py_END_ALLOW_THREADS
+		with nogil:
+			retval = c_brlapi.brlapi__ignoreAllKeys(self.h)
 		if retval == -1:
 			raise OperationError()
 		else:
@@ -637,9 +627,8 @@ cdef class Connection:
 
 		Warning: after calling this function, make sure to call brlapi_ignoreKeys() for ignoring important keys like BRL_CMD_SWITCHVT_PREV/NEXT and such."""
 		cdef int retval
-		c_brlapi.Py_BEGIN_ALLOW_THREADS
-		retval = c_brlapi.brlapi__acceptAllKeys(self.h)
-		c_brlapi.Py_END_ALLOW_THREADS
+		with nogil:
+			retval = c_brlapi.brlapi__acceptAllKeys(self.h)
 		if retval == -1:
 			raise OperationError()
 		else:
@@ -660,9 +649,8 @@ cdef class Connection:
 		for i from 0 <= i < c_n:
 			c_keys[i].first = keys[i][0]
 			c_keys[i].last = keys[i][1]
-		c_brlapi.Py_BEGIN_ALLOW_THREADS
-		retval = c_brlapi.brlapi__ignoreKeyRanges(self.h, c_keys, c_n)
-		c_brlapi.Py_END_ALLOW_THREADS
+		with nogil:
+			retval = c_brlapi.brlapi__ignoreKeyRanges(self.h, c_keys, c_n)
 		c_brlapi.free(c_keys)
 		if retval == -1:
 			raise OperationError()
@@ -684,9 +672,8 @@ cdef class Connection:
 		for i from 0 <= i < c_n:
 			c_keys[i].first = keys[i][0]
 			c_keys[i].last = keys[i][1]
-		c_brlapi.Py_BEGIN_ALLOW_THREADS
-		retval = c_brlapi.brlapi__acceptKeyRanges(self.h, c_keys, c_n)
-		c_brlapi.Py_END_ALLOW_THREADS
+		with nogil:
+			retval = c_brlapi.brlapi__acceptKeyRanges(self.h, c_keys, c_n)
 		c_brlapi.free(c_keys)
 		if retval == -1:
 			raise OperationError()
@@ -703,9 +690,8 @@ cdef class Connection:
 		if (type(driver) == unicode):
 			driver = driver.encode('ASCII')
 		c_driver = driver
-		c_brlapi.Py_BEGIN_ALLOW_THREADS
-		retval = c_brlapi.brlapi__enterRawMode(self.h, c_driver)
-		c_brlapi.Py_END_ALLOW_THREADS
+		with nogil:
+			retval = c_brlapi.brlapi__enterRawMode(self.h, c_driver)
 		if retval == -1:
 			raise OperationError()
 		else:
@@ -715,9 +701,8 @@ cdef class Connection:
 		"""leave Raw mode
 		See brlapi_leaveRawMode(3)."""
 		cdef int retval
-		c_brlapi.Py_BEGIN_ALLOW_THREADS
-		retval = c_brlapi.brlapi__leaveRawMode(self.h)
-		c_brlapi.Py_END_ALLOW_THREADS
+		with nogil:
+			retval = c_brlapi.brlapi__leaveRawMode(self.h)
 		if retval == -1:
 			raise OperationError()
 		else:
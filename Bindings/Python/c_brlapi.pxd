@@ -22,7 +22,7 @@
 cdef extern from "sys/types.h":
 	ctypedef int size_t
 
-cdef extern from "Programs/brlapi.h":
+cdef extern from "Programs/brlapi.h" nogil:
 	ctypedef struct brlapi_connectionSettings_t:
 		char *auth
 		char *host
@@ -114,8 +114,4 @@ cdef extern from "stdlib.h":
 
 cdef extern from "string.h":
 	void *memcpy(void *, void *, size_t)
-
-cdef extern from "Python.h":
-	# these are macros, we just need to make Cython aware of them
-	int Py_BEGIN_ALLOW_THREADS
-	int Py_END_ALLOW_THREADS
+	void *memset(void *, int, size_t)
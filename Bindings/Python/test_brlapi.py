@@ -0,0 +1,243 @@
+###############################################################################
+# libbrlapi - A library providing access to braille terminals for applications.
+#
+# Copyright (C) 2005-2014 by
+#   Alexis Robert <alexissoft@free.fr>
+#   Samuel Thibault <Samuel.Thibault@ens-lyon.org>
+#
+# libbrlapi comes with ABSOLUTELY NO WARRANTY.
+#
+# This is free software, placed under the terms of the
+# GNU Lesser General Public License, as published by the Free Software
+# Foundation; either version 2.1 of the License, or (at your option) any
+# later version. Please see the file LICENSE-LGPL for details.
+#
+# Web Page: http://mielke.cc/brltty/
+#
+# This software is maintained by Dave Mielke <dave@mielke.cc>.
+###############################################################################
+
+# Check what writeDots, which releases the GIL and takes any object which
+# supports the buffer protocol, gets to the display. brltty is run with the
+# Virtual braille driver, which connects back to a socket here, is told how
+# many cells there are, and then reports each change of them as a line like:
+#
+#    Braille "1|12| |..."
+#
+# "make check" runs it from the build tree. To run it by hand:
+#
+#    BRLTTY_BUILD=/path/to/build/tree python -m pytest test_brlapi.py
+#
+# with the brlapi module and libbrlapi on PYTHONPATH and LD_LIBRARY_PATH, and
+# BRLTTY_TABLES set too if the tables aren't in the build tree.
+
+import os
+import queue
+import shutil
+import socket
+import subprocess
+import tempfile
+import threading
+import time
+import pytest
+import brlapi
+
+TTY = 1
+CELLS = 40
+WRITERS = 6
+WRITES = 200
+
+def findFreePort(start):
+    for port in range(start, start + 1000):
+        listener = socket.socket()
+        try:
+            listener.bind(("127.0.0.1", port))
+            return port
+        except OSError:
+            pass
+        finally:
+            listener.close()
+    raise RuntimeError("no free port from %d" % start)
+
+def formatDots(cells):
+    return "|".join("".join(str(dot + 1) for dot in range(8) if cell & (1 << dot)) or " "
+                    for cell in cells)
+
+class Display:
+    def __init__(self, build):
+        # brltty changes to its working directory before loading anything
+        build = os.path.abspath(build)
+        tables = os.path.abspath(os.environ.get("BRLTTY_TABLES", os.path.join(build, "Tables")))
+        self.lines = queue.Queue()
+        self.directory = tempfile.mkdtemp(prefix = "brlapi-test.")
+
+        self.listener = socket.socket()
+        self.listener.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        self.listener.bind(("127.0.0.1", 0))
+        self.listener.listen(1)
+
+        # BrlAPI listens on 4101 plus the port number it's given
+        self.host = "127.0.0.1:%d" % (findFreePort(4200) - 4101)
+        self.server = subprocess.Popen(
+            [os.path.join(build, "Programs", "brltty"), "-n", "-e", "-q",
+             "-D", os.path.join(build, "lib"),
+             "-T", tables,
+             "-W", self.directory,
+             "-P", os.path.join(self.directory, "pid"),
+             "-f", "/dev/null", "-F", "/dev/null", "-x", "no", "-s", "no",
+             "-b", "vr", "-d", "client:127.0.0.1:%d" % self.listener.getsockname()[1],
+             "-A", "auth=none,host=%s" % self.host],
+            stdout = subprocess.DEVNULL,
+            stderr = open(os.path.join(self.directory, "log"), "w"))
+
+        self.listener.settimeout(20)
+        (self.connection, address) = self.listener.accept()
+        self.connection.sendall(b"cells %d\n" % CELLS)
+        self.reader = threading.Thread(target = self.read, daemon = True)
+        self.reader.start()
+
+    def read(self):
+        data = b""
+        while True:
+            chunk = self.connection.recv(0X10000)
+            if not chunk:
+                break
+            data += chunk
+            while b"\n" in data:
+                (line, data) = data.split(b"\n", 1)
+                line = line.decode("utf-8", "replace").rstrip("\r")
+                if line.startswith('Braille "') and line.endswith('"'):
+                    self.lines.put(line[9:-1])
+
+    def connect(self):
+        deadline = time.time() + 20
+        while True:
+            try:
+                connection = brlapi.Connection(self.host.encode(), b"none")
+                (x, y) = connection.displaySize
+                if x * y:
+                    connection.enterTtyMode(TTY)
+                    return connection
+            except brlapi.OperationError:
+                pass
+            if time.time() > deadline:
+                raise RuntimeError("the server didn't start")
+            time.sleep(0.1)
+
+    def settle(self, quiet = 0.5, timeout = 10):
+        # Returns each change of the cells until they stop changing
+        lines = []
+        deadline = time.time() + timeout
+        while time.time() < deadline:
+            try:
+                lines.append(self.lines.get(timeout = quiet))
+            except queue.Empty:
+                return lines
+        raise RuntimeError("the display didn't settle")
+
+    def shown(self):
+        lines = self.settle()
+        return lines[-1] if lines else None
+
+    def close(self):
+        self.server.terminate()
+        self.server.wait()
+        self.connection.close()
+        self.listener.close()
+        shutil.rmtree(self.directory, ignore_errors = True)
+
+@pytest.fixture(scope = "module")
+def display():
+    build = os.environ.get("BRLTTY_BUILD")
+    if not build or not os.path.exists(os.path.join(build, "Programs", "brltty")):
+        pytest.skip("BRLTTY_BUILD doesn't name a build tree")
+    display = Display(build)
+    yield display
+    display.close()
+
+ARGUMENT_TYPES = [bytes, bytearray, lambda cells: memoryview(bytearray(cells))]
+
+def frame(writer, write, size):
+    # The first two cells tell every frame apart
+    return bytes([writer + 1, write & 0XFF] +
+                 [(writer + write + cell) & 0XFF for cell in range(2, size)])
+
+def writeFrames(connection, writer, convert, size, start, failures):
+    try:
+        start.wait()
+        for write in range(WRITES):
+            connection.writeDots(convert(frame(writer, write, size)))
+    except Exception as exception:
+        failures.append(exception)
+
+def test_threaded_writes(display):
+    connections = [display.connect() for writer in range(WRITERS)]
+    (x, y) = connections[0].displaySize
+    size = x * y
+    written = set(formatDots(frame(writer, write, size))
+                  for writer in range(WRITERS) for write in range(WRITES))
+    last = dict((formatDots(frame(writer, WRITES-1, size)), writer)
+                for writer in range(WRITERS))
+    start = threading.Event()
+    failures = []
+    writers = [threading.Thread(target = writeFrames,
+                                args = (connections[writer], writer,
+                                        ARGUMENT_TYPES[writer % len(ARGUMENT_TYPES)],
+                                        size, start, failures))
+               for writer in range(WRITERS)]
+
+    display.settle()
+    for writer in writers:
+        writer.start()
+    start.set()
+    for writer in writers:
+        writer.join()
+    assert not failures
+
+    # Only the connection which the server shows reaches the display, and it
+    # must end up showing that connection's last frame. Once it leaves, the
+    # last frame of the next one must appear, and so on.
+    lines = display.settle()
+    for line in lines:
+        assert line in written
+    shown = lines[-1]
+
+    remaining = set(range(WRITERS))
+    while remaining:
+        assert shown in last
+        writer = last[shown]
+        assert writer in remaining
+        remaining.remove(writer)
+        connections[writer].leaveTtyMode()
+        if remaining:
+            shown = display.shown()
+
+@pytest.mark.parametrize("convert", [
+    bytes,
+    bytearray,
+    memoryview,
+    lambda cells: memoryview(bytearray(b"\0" * 3 + cells))[3:],
+], ids = ["bytes", "bytearray", "memoryview", "memoryview-slice"])
+def test_short_writes(display, convert):
+    connection = display.connect()
+    (x, y) = connection.displaySize
+    size = x * y
+    full = bytes(0XFF for cell in range(size))
+
+    try:
+        # Start from a known state, whatever was shown before
+        connection.writeDots(bytes(size))
+        display.settle()
+        connection.writeDots(full)
+        assert display.shown() == formatDots(full)
+
+        # Short buffers are padded with blank cells
+        short = bytes(range(1, (size // 2) + 1))
+        connection.writeDots(convert(short))
+        assert display.shown() == formatDots(short + bytes(size - len(short)))
+
+        # Nothing is written beyond the display
+        connection.writeDots(convert(full + b"\x01" * 10))
+        assert display.shown() == formatDots(full)
+    finally:
+        connection.leaveTtyMode()
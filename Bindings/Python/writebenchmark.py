@@ -0,0 +1,168 @@
+###############################################################################
+# libbrlapi - A library providing access to braille terminals for applications.
+#
+# Copyright (C) 2005-2014 by
+#   Alexis Robert <alexissoft@free.fr>
+#   Samuel Thibault <Samuel.Thibault@ens-lyon.org>
+#
+# libbrlapi comes with ABSOLUTELY NO WARRANTY.
+#
+# This is free software, placed under the terms of the
+# GNU Lesser General Public License, as published by the Free Software
+# Foundation; either version 2.1 of the License, or (at your option) any
+# later version. Please see the file LICENSE-LGPL for details.
+#
+# Web Page: http://mielke.cc/brltty/
+#
+# This software is maintained by Dave Mielke <dave@mielke.cc>.
+###############################################################################
+
+# Time writeDots from several threads, each with its own connection, while
+# another thread runs pure Python code. Since the writes release the GIL, the
+# writers should overlap one another, and the Python thread should keep most
+# of the pace it has when running alone.
+#
+#    python writebenchmark.py [--host host] [--tty tty] [--count n] [--threads n]
+#                             [--pid server-pid]
+#
+# A write only takes a few microseconds, though, so the Python code around it
+# weighs heavily in these figures. When the server's process id is given, the
+# server is also stopped for a second so that the writers block (on a full
+# socket or shared memory ring), and the pace of the Python thread is measured
+# meanwhile: were the GIL held while blocked, it wouldn't get to run at all.
+
+import argparse
+import os
+import signal
+import threading
+import time
+import brlapi
+
+def spin(stop, result):
+    count = 0
+    while not stop.is_set():
+        count += 1
+    result.append(count)
+
+def spinRate(seconds):
+    stop = threading.Event()
+    result = []
+    thread = threading.Thread(target = spin, args = (stop, result))
+    start = time.time()
+    thread.start()
+    time.sleep(seconds)
+    stop.set()
+    thread.join()
+    return result[0] / (time.time() - start)
+
+def write(connection, count):
+    (x, y) = connection.displaySize
+    cells = bytearray(x * y)
+
+    for i in range(count):
+        cells[i % len(cells)] = i & 0XFF
+        connection.writeDots(cells)
+
+def connect(arguments, threads):
+    connections = []
+
+    for i in range(threads):
+        connection = brlapi.Connection(arguments.host and arguments.host.encode())
+        connection.enterTtyMode(arguments.tty)
+        write(connection, arguments.count // 10)
+        connections.append(connection)
+
+    return connections
+
+def disconnect(connections):
+    for connection in connections:
+        connection.leaveTtyMode()
+    del connections[:]
+
+def run(arguments, threads, spinning):
+    connections = connect(arguments, threads)
+    stop = threading.Event()
+    result = []
+    spinner = threading.Thread(target = spin, args = (stop, result))
+    writers = [threading.Thread(target = write, args = (connection, arguments.count))
+               for connection in connections]
+
+    start = time.time()
+    if spinning:
+        spinner.start()
+    for writer in writers:
+        writer.start()
+    for writer in writers:
+        writer.join()
+    elapsed = time.time() - start
+    stop.set()
+    if spinning:
+        spinner.join()
+
+    disconnect(connections)
+    return (elapsed, result[0] / elapsed if spinning else None)
+
+def stall(arguments, threads):
+    connections = connect(arguments, threads)
+    stop = threading.Event()
+    result = []
+    spinner = threading.Thread(target = spin, args = (stop, result))
+    writers = [threading.Thread(target = write, args = (connection, arguments.count * 10))
+               for connection in connections]
+
+    # The server is resumed by another process: a thread mightn't get the GIL.
+    os.kill(arguments.pid, signal.SIGSTOP)
+    child = os.fork()
+    if child == 0:
+        time.sleep(1)
+        os.kill(arguments.pid, signal.SIGCONT)
+        os._exit(0)
+
+    for writer in writers:
+        writer.start()
+    start = time.time()
+    spinner.start()
+    os.waitpid(child, 0)
+    stop.set()
+    spinner.join()
+    elapsed = time.time() - start
+
+    for writer in writers:
+        writer.join()
+    disconnect(connections)
+    return result[0] / elapsed
+
+def report(label, threads, count, elapsed):
+    writes = threads * count
+    print("%s: %d writes in %dms (%dus per write)"
+          % (label, writes, elapsed * 1000, elapsed * 1000000 / writes))
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description = "BrlAPI threaded write benchmark")
+    parser.add_argument("--host", default = None)
+    parser.add_argument("--tty", type = int, default = brlapi.TTY_DEFAULT)
+    parser.add_argument("--count", type = int, default = 10000)
+    parser.add_argument("--threads", type = int, default = 4)
+    parser.add_argument("--pid", type = int, default = None)
+    arguments = parser.parse_args()
+
+    (single, rate) = run(arguments, 1, False)
+    report("1 thread", 1, arguments.count, single)
+
+    (elapsed, rate) = run(arguments, arguments.threads, False)
+    report("%d threads" % arguments.threads, arguments.threads, arguments.count, elapsed)
+    print("concurrency: %.1fx (%d threads took %.1f times as long as one)"
+          % (single * arguments.threads / elapsed, arguments.threads, elapsed / single))
+
+    alone = spinRate(elapsed)
+    (elapsed, rate) = run(arguments, arguments.threads, True)
+    report("%d threads with Python running" % arguments.threads,
+           arguments.threads, arguments.count, elapsed)
+    print("Python thread: %d loops/s alone, %d loops/s while writing (%d%%)"
+          % (alone, rate, rate * 100 / alone))
+
+    if arguments.pid:
+        alone = spinRate(1)
+        rate = stall(arguments, arguments.threads)
+        print("Python thread: %d loops/s alone, %d loops/s while %d writers were blocked (%d%%)"
+              % (alone, rate, arguments.threads, rate * 100 / alone))
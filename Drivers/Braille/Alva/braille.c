@@ -494,6 +494,7 @@ typedef struct {
   int (*detectModel) (BrailleDisplay *brl);
   int (*readCommand) (BrailleDisplay *brl);
   int (*writeBraille) (BrailleDisplay *brl, const unsigned char *cells, int start, int count);
+  unsigned char writeOverhead; /* bytes added to each writeBraille */
 } ProtocolOperations;
 static const ProtocolOperations *protocol;
 
@@ -914,7 +915,8 @@ writeBraille1 (BrailleDisplay *brl, const unsigned char *cells, int start, int c
 static const ProtocolOperations protocol1Operations = {
   initializeVariables1,
   readPacket1, updateConfiguration1, detectModel1,
-  readCommand1, writeBraille1
+  readCommand1, writeBraille1,
+  6
 };
 
 static uint32_t hardwareVersion2;
@@ -1316,7 +1318,8 @@ writeBraille2s (BrailleDisplay *brl, const unsigned char *cells, int start, int
 static const ProtocolOperations protocol2sOperations = {
   initializeVariables2,
   readPacket2s, updateConfiguration2s, detectModel2s,
-  readCommand2s, writeBraille2s
+  readCommand2s, writeBraille2s,
+  4
 };
 
 static int
@@ -1498,7 +1501,8 @@ writeData2u (
 static const ProtocolOperations protocol2uOperations = {
   initializeVariables2,
   readPacket2u, updateConfiguration2u, detectModel2u,
-  readCommand2u, writeBraille2u
+  readCommand2u, writeBraille2u,
+  3 + 8 /* each write is also a control transfer's setup packet */
 };
 
 int
@@ -1628,14 +1632,23 @@ brl_destruct (BrailleDisplay *brl) {
 
 static int
 brl_writeWindow (BrailleDisplay *brl, const wchar_t *text) {
-  unsigned int from;
-  unsigned int to;
+  CellSegment segments[4];
+  unsigned int total = cellSegmentsHaveChanged(previousText, brl->buffer, brl->textColumns,
+                                               segments, ARRAY_COUNT(segments),
+                                               protocol->writeOverhead, &textRewriteRequired);
+
+  if (total && (model->flags & MOD_FLAG_FORCE_FROM_0)) {
+    segments[0].from = 0;
+    segments[0].to = segments[total-1].to;
+    total = 1;
+  }
 
-  if (cellsHaveChanged(previousText, brl->buffer, brl->textColumns, &from, &to, &textRewriteRequired)) {
-    if (model->flags & MOD_FLAG_FORCE_FROM_0) from = 0;
+  {
+    unsigned int index;
 
-    {
-      size_t count = to - from;
+    for (index=0; index<total; index+=1) {
+      unsigned int from = segments[index].from;
+      size_t count = segments[index].to - from;
       unsigned char cells[count];
 
       translateOutputCells(cells, &brl->buffer[from], count);
@@ -225,6 +225,13 @@ static const int probeTimeout = 200;
 
 #define KEY_GROUP_SIZE(count) (((count) + 7) / 8)
 #define MAXIMUM_CELL_COUNT 84
+#define CELL_SEGMENT_LIMIT 4
+
+/* A cell range write costs the escape, the data registers header, and the
+ * module's identifier and serial number - so resending up to that many
+ * unchanged cells is cheaper than starting another write.
+ */
+#define CELL_SEGMENT_GAP 10
 #define VERTICAL_SENSOR_COUNT 27
 
 static int cellCount;
@@ -377,11 +384,16 @@ clearCellRange (BrailleDisplay *brl, unsigned int start, unsigned int count) {
 
 static int
 putCells (BrailleDisplay *brl, const unsigned char *cells, unsigned int start, unsigned int count) {
-  unsigned int from;
-  unsigned int to;
+  CellSegment segments[CELL_SEGMENT_LIMIT];
+  unsigned int total = cellSegmentsHaveChanged(&internalCells[start], cells, count,
+                                               segments, ARRAY_COUNT(segments),
+                                               CELL_SEGMENT_GAP, NULL);
+  unsigned int index;
+
+  for (index=0; index<total; index+=1) {
+    const CellSegment *segment = &segments[index];
 
-  if (cellsHaveChanged(&internalCells[start], cells, count, &from, &to, NULL)) {
-    if (!updateCellRange(brl, start+from, to-from)) return 0;
+    if (!updateCellRange(brl, start+segment->from, segment->to-segment->from)) return 0;
   }
 
   return 1;
@@ -1061,9 +1073,8 @@ getBaumPacket (BrailleDisplay *brl, BaumResponsePacket *packet) {
   return readBaumPacket(brl, packet->bytes, sizeof(*packet));
 }
 
-static int
-writeBaumPacket (BrailleDisplay *brl, const unsigned char *packet, int length) {
-  unsigned char buffer[1 + (length * 2)];
+static size_t
+escapeBaumPacket (unsigned char *buffer, const unsigned char *packet, int length) {
   unsigned char *byte = buffer;
   *byte++ = ESC;
 
@@ -1074,7 +1085,22 @@ writeBaumPacket (BrailleDisplay *brl, const unsigned char *packet, int length) {
         *byte++ = ESC;
   }
 
-  return writeBraillePacket(brl, NULL, buffer, (byte - buffer));
+  return byte - buffer;
+}
+
+static int
+writeBaumPacket (BrailleDisplay *brl, const unsigned char *packet, int length) {
+  unsigned char buffer[1 + (length * 2)];
+
+  return writeBraillePacket(brl, NULL, buffer, escapeBaumPacket(buffer, packet, length));
+}
+
+static int
+queueBaumCells (BrailleDisplay *brl, const unsigned char *packet, int length) {
+  unsigned char buffer[1 + (length * 2)];
+
+  return queueBraillePacket(brl, NULL, buffer, escapeBaumPacket(buffer, packet, length),
+                            BRL_REGION_TEXT);
 }
 
 static int
@@ -1104,7 +1130,8 @@ writeBaumDataRegisters (
   const BaumModuleDescription *bmd = bmr->description;
 
   if (bmd) {
-    if (count < bmd->cellCount) count = bmd->cellCount;
+    if (start >= bmd->cellCount) return 1;
+    if (count > (bmd->cellCount - start)) count = bmd->cellCount - start;
 
     if (count) {
       unsigned char packet[2 + 7 + count];
@@ -1145,7 +1172,7 @@ writeBaumCells_all (BrailleDisplay *brl) {
   *byte++ = BAUM_REQ_DisplayData;
   byte = mempcpy(byte, externalCells, cellCount);
 
-  return writeBaumPacket(brl, packet, byte-packet);
+  return queueBaumCells(brl, packet, byte-packet);
 }
 
 static int
@@ -1157,7 +1184,7 @@ writeBaumCells_start (BrailleDisplay *brl) {
   *byte++ = 0;
   byte = mempcpy(byte, externalCells, cellCount);
 
-  return writeBaumPacket(brl, packet, byte-packet);
+  return queueBaumCells(brl, packet, byte-packet);
 }
 
 static int
@@ -1957,7 +1984,7 @@ writeHandyTechCells (BrailleDisplay *brl) {
 
   byte = mempcpy(byte, externalCells, ht->textCount);
 
-  return writeHandyTechPacket(brl, packet, byte-packet);
+  return queueBraillePacket(brl, NULL, packet, byte-packet, BRL_REGION_TEXT);
 }
 
 static int
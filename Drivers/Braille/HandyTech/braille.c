@@ -419,6 +419,12 @@ static const ModelEntry modelTable[] = {
 #define MAXIMUM_TEXT_CELLS   160
 #define MAXIMUM_STATUS_CELLS 4
 
+/* The protocol has no partial write - every write carries the whole display -
+ * so the changed segments only limit which cells need to be retranslated.
+ */
+#define CELL_SEGMENT_LIMIT 4
+#define CELL_SEGMENT_GAP 0
+
 typedef enum {
   BDS_OFF,
   BDS_READY,
@@ -1281,11 +1287,30 @@ updateCells (BrailleDisplay *brl) {
 }
 
 static int
-brl_writeWindow (BrailleDisplay *brl, const wchar_t *text) {
-  const size_t cellCount = brl->data->model->textCells;
+translateChangedCells (
+  unsigned char *raw, unsigned char *previous,
+  const unsigned char *cells, unsigned int count
+) {
+  CellSegment segments[CELL_SEGMENT_LIMIT];
+  unsigned int total = cellSegmentsHaveChanged(previous, cells, count,
+                                               segments, ARRAY_COUNT(segments),
+                                               CELL_SEGMENT_GAP, NULL);
+  unsigned int index;
+
+  for (index=0; index<total; index+=1) {
+    const CellSegment *segment = &segments[index];
+
+    translateOutputCells(&raw[segment->from], &previous[segment->from],
+                         segment->to - segment->from);
+  }
+
+  return total > 0;
+}
 
-  if (cellsHaveChanged(brl->data->prevData, brl->buffer, cellCount, NULL, NULL, NULL)) {
-    translateOutputCells(brl->data->rawData, brl->data->prevData, cellCount);
+static int
+brl_writeWindow (BrailleDisplay *brl, const wchar_t *text) {
+  if (translateChangedCells(brl->data->rawData, brl->data->prevData,
+                            brl->buffer, brl->data->model->textCells)) {
     brl->data->updateRequired = 1;
   }
 
@@ -1295,10 +1320,8 @@ brl_writeWindow (BrailleDisplay *brl, const wchar_t *text) {
 
 static int
 brl_writeStatus (BrailleDisplay *brl, const unsigned char *st) {
-  const size_t cellCount = brl->data->model->statusCells;
-
-  if (cellsHaveChanged(brl->data->prevStatus, st, cellCount, NULL, NULL, NULL)) {
-    translateOutputCells(brl->data->rawStatus, brl->data->prevStatus, cellCount);
+  if (translateChangedCells(brl->data->rawStatus, brl->data->prevStatus,
+                            st, brl->data->model->statusCells)) {
     brl->data->updateRequired = 1;
   }
 
@@ -62,6 +62,7 @@
 #include "async_wait.h"
 #include "charset.h"
 #include "cmd.h"
+#include "timing.h"
 
 #define BRL_STATUS_FIELDS sfGeneric
 #define BRL_HAVE_STATUS_CELLS
@@ -1213,6 +1214,15 @@ brl_readCommand (BrailleDisplay *brl, KeyTableCommandContext context) {
         if (dimensionsChanged(brl)) brl->resizeRequired = 1;
       } else if (testWord(word, "quit")) {
         command = BRL_CMD_RESTARTBRL;
+      } else if (testWord(word, "stall")) {
+        int milliseconds;
+
+        if ((word = nextWord()) && isInteger(&milliseconds, word) && (milliseconds > 0)) {
+          logMessage(LOG_DEBUG, "stalling for %d milliseconds", milliseconds);
+          approximateDelay(milliseconds);
+        } else {
+          logMessage(LOG_WARNING, "Stall duration not specified.");
+        }
       } else {
         const CommandDescriptor *descriptor = findCommand(word);
         if (descriptor) {
@@ -76,6 +76,7 @@ static char *curPath;
 static long curNumRows, curNumCols;
 static wchar_t **curRows;
 static long *curRowLengths;
+static long curTextLength;
 static long curCaret,curPosX,curPosY;
 static pthread_mutex_t updateMutex = PTHREAD_MUTEX_INITIALIZER;
 
@@ -297,54 +298,94 @@ static void caretPosition(long caret) {
   curCaret = caret;
 }
 
+static void freeRows(void) {
+  long i;
+  if (curRows) {
+    for (i=0;i<curNumRows;i++)
+      free(curRows[i]);
+    free(curRows);
+    curRows = NULL;
+  }
+  free(curRowLengths);
+  curRowLengths = NULL;
+  curNumCols = curNumRows = 0;
+  curTextLength = 0;
+}
+
 static void finiTerm(void) {
   logMessage(LOG_DEBUG,"end of term %s:%s",curSender,curPath);
+  pthread_mutex_lock(&updateMutex);
   free(curSender);
   curSender = NULL;
   free(curPath);
   curPath = NULL;
   curPosX = curPosY = 0;
-  free(curRows);
-  curRows = NULL;
-  curNumCols = curNumRows = 0;
+  freeRows();
+  pthread_mutex_unlock(&updateMutex);
 }
 
-/* Get the role of an AT-SPI2 object */
-static char *getRole(const char *sender, const char *path) {
-  const char *text;
-  char *res = NULL;
-  DBusError error;
-  DBusMessage *msg, *reply;
-  DBusMessageIter iter;
+static int isCurrentTerm(const char *sender, const char *path) {
+  return curSender && !strcmp(sender, curSender) && !strcmp(path, curPath);
+}
 
-  dbus_error_init(&error);
-  msg = dbus_message_new_method_call(sender, path, SPI2_DBUS_INTERFACE_ACCESSIBLE, "GetRoleName");
-  if (dbus_error_is_set(&error)) {
-    logMessage(LOG_DEBUG, "error while making getrole message: %s %s", error.name, error.message);
-    dbus_error_free(&error);
-    return NULL;
-  }
-  if (!msg) {
-    logMessage(LOG_DEBUG, "no memory while getting role");
-    return NULL;
-  }
+/* Send a method call without waiting, the callback gets the reply later on */
+static int sendMethodCall(DBusMessage *msg, DBusPendingCallNotifyFunction callback, void *data, DBusFreeFunction freeData) {
+  DBusPendingCall *pending = NULL;
+  int ok = 0;
 
-  dbus_error_init(&error);
   /* 1s max delay */
-  reply = dbus_connection_send_with_reply_and_block(bus, msg, 1000, &error);
-  if (dbus_error_is_set(&error)) {
-    logMessage(LOG_DEBUG, "error while getting role for %s:%s: %s %s", sender, path, error.name, error.message);
-    dbus_error_free(&error);
-    goto outMsg;
+  if (!dbus_connection_send_with_reply(bus, msg, &pending, 1000)) {
+    logMessage(LOG_DEBUG, "no memory while sending %s", dbus_message_get_member(msg));
+  } else if (!pending) {
+    logMessage(LOG_DEBUG, "disconnected while sending %s", dbus_message_get_member(msg));
+  } else if (!dbus_pending_call_set_notify(pending, callback, data, freeData)) {
+    logMessage(LOG_DEBUG, "no memory while sending %s", dbus_message_get_member(msg));
+    dbus_pending_call_cancel(pending);
+    dbus_pending_call_unref(pending);
+  } else {
+    ok = 1;
   }
+
+  dbus_message_unref(msg);
+  return ok;
+}
+
+/* Take the reply of a completed method call, NULL if it failed or timed out */
+static DBusMessage *getMethodReply(DBusPendingCall *pending, const char *what) {
+  DBusMessage *reply = dbus_pending_call_steal_reply(pending);
+
+  dbus_pending_call_unref(pending);
   if (!reply) {
-    logMessage(LOG_DEBUG, "timeout while getting role");
-    goto outMsg;
+    logMessage(LOG_DEBUG, "no reply while getting %s", what);
+    return NULL;
   }
   if (dbus_message_get_type (reply) == DBUS_MESSAGE_TYPE_ERROR) {
-    logMessage(LOG_DEBUG, "error while getting role");
-    goto out;
+    logMessage(LOG_DEBUG, "error while getting %s: %s", what, dbus_message_get_error_name(reply));
+    dbus_message_unref(reply);
+    return NULL;
   }
+  return reply;
+}
+
+/* Ask for the role of an AT-SPI2 object */
+static int requestRole(const char *sender, const char *path, DBusPendingCallNotifyFunction callback, void *data, DBusFreeFunction freeData) {
+  DBusMessage *msg = dbus_message_new_method_call(sender, path, SPI2_DBUS_INTERFACE_ACCESSIBLE, "GetRoleName");
+
+  if (!msg) {
+    logMessage(LOG_DEBUG, "no memory while getting role");
+    return 0;
+  }
+  return sendMethodCall(msg, callback, data, freeData);
+}
+
+static char *getRoleReply(DBusPendingCall *pending) {
+  const char *text;
+  char *res = NULL;
+  DBusMessage *reply;
+  DBusMessageIter iter;
+
+  if (!(reply = getMethodReply(pending, "role")))
+    return NULL;
   dbus_message_iter_init(reply, &iter);
   if (dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_STRING) {
     logMessage(LOG_DEBUG, "GetRoleName didn't return a string but '%c'", dbus_message_iter_get_arg_type(&iter));
@@ -355,50 +396,32 @@ static char *getRole(const char *sender, const char *path) {
 
 out:
   dbus_message_unref(reply);
-outMsg:
-  dbus_message_unref(msg);
   return res;
 }
 
-/* Get the text of an AT-SPI2 object */
-static char *getText(const char *sender, const char *path) {
-  const char *text;
-  char *res = NULL;
-  DBusError error;
-  DBusMessage *msg, *reply;
+/* Ask for the text of an AT-SPI2 object */
+static int requestText(const char *sender, const char *path, DBusPendingCallNotifyFunction callback, void *data, DBusFreeFunction freeData) {
+  DBusMessage *msg;
   dbus_int32_t begin = 0;
   dbus_int32_t end = -1;
-  DBusMessageIter iter;
 
-  dbus_error_init(&error);
   msg = dbus_message_new_method_call(sender, path, SPI2_DBUS_INTERFACE_TEXT, "GetText");
-  if (dbus_error_is_set(&error)) {
-    logMessage(LOG_DEBUG, "error while making gettext message: %s %s", error.name, error.message);
-    dbus_error_free(&error);
-    return NULL;
-  }
   if (!msg) {
     logMessage(LOG_DEBUG, "no memory while getting text");
-    return NULL;
+    return 0;
   }
   dbus_message_append_args(msg, DBUS_TYPE_INT32, &begin, DBUS_TYPE_INT32, &end, DBUS_TYPE_INVALID);
+  return sendMethodCall(msg, callback, data, freeData);
+}
 
-  dbus_error_init(&error);
-  /* 1s max delay */
-  reply = dbus_connection_send_with_reply_and_block(bus, msg, 1000, &error);
-  if (dbus_error_is_set(&error)) {
-    logMessage(LOG_DEBUG, "error while getting text for %s:%s: %s %s", sender, path, error.name, error.message);
-    dbus_error_free(&error);
-    goto outMsg;
-  }
-  if (!reply) {
-    logMessage(LOG_DEBUG, "timeout while getting text");
-    goto outMsg;
-  }
-  if (dbus_message_get_type (reply) == DBUS_MESSAGE_TYPE_ERROR) {
-    logMessage(LOG_DEBUG, "error while getting text");
-    goto out;
-  }
+static char *getTextReply(DBusPendingCall *pending) {
+  const char *text;
+  char *res = NULL;
+  DBusMessage *reply;
+  DBusMessageIter iter;
+
+  if (!(reply = getMethodReply(pending, "text")))
+    return NULL;
   dbus_message_iter_init(reply, &iter);
   if (dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_STRING) {
     logMessage(LOG_DEBUG, "GetText didn't return a string but '%c'", dbus_message_iter_get_arg_type(&iter));
@@ -409,49 +432,31 @@ static char *getText(const char *sender, const char *path) {
 
 out:
   dbus_message_unref(reply);
-outMsg:
-  dbus_message_unref(msg);
   return res;
 }
 
-/* Get the caret of an AT-SPI2 object */
-static dbus_int32_t getCaret(const char *sender, const char *path) {
-  dbus_int32_t res = -1;
-  DBusError error;
-  DBusMessage *msg, *reply = NULL;
+/* Ask for the caret of an AT-SPI2 object */
+static int requestCaret(const char *sender, const char *path, DBusPendingCallNotifyFunction callback, void *data, DBusFreeFunction freeData) {
+  DBusMessage *msg;
   const char *interface = SPI2_DBUS_INTERFACE_TEXT;
   const char *property = "CaretOffset";
-  DBusMessageIter iter, iter_variant;
 
-  dbus_error_init(&error);
   msg = dbus_message_new_method_call(sender, path, SPI2_DBUS_INTERFACE_PROP, "Get");
-  if (dbus_error_is_set(&error)) {
-    logMessage(LOG_DEBUG, "error while making caret message: %s %s", error.name, error.message);
-    dbus_error_free(&error);
-    return -1;
-  }
   if (!msg) {
     logMessage(LOG_DEBUG, "no memory while making caret message");
-    return -1;
+    return 0;
   }
   dbus_message_append_args(msg, DBUS_TYPE_STRING, &interface, DBUS_TYPE_STRING, &property, DBUS_TYPE_INVALID);
+  return sendMethodCall(msg, callback, data, freeData);
+}
 
-  dbus_error_init(&error);
-  /* 1s max delay */
-  reply = dbus_connection_send_with_reply_and_block(bus, msg, 1000, &error);
-  if (dbus_error_is_set(&error)) {
-    logMessage(LOG_DEBUG, "error while getting caret: %s %s", error.name, error.message);
-    dbus_error_free(&error);
-    goto outMsg;
-  }
-  if (!reply) {
-    logMessage(LOG_DEBUG, "timeout while getting caret");
-    goto outMsg;
-  }
-  if (dbus_message_get_type (reply) == DBUS_MESSAGE_TYPE_ERROR) {
-    logMessage(LOG_DEBUG, "error while getting caret");
-    goto out;
-  }
+static dbus_int32_t getCaretReply(DBusPendingCall *pending) {
+  dbus_int32_t res = -1;
+  DBusMessage *reply;
+  DBusMessageIter iter, iter_variant;
+
+  if (!(reply = getMethodReply(pending, "caret")))
+    return -1;
   dbus_message_iter_init(reply, &iter);
   if (dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_VARIANT) {
     logMessage(LOG_DEBUG, "getText didn't return a variant but '%c'", dbus_message_iter_get_arg_type(&iter));
@@ -467,36 +472,16 @@ static dbus_int32_t getCaret(const char *sender, const char *path) {
 
 out:
   dbus_message_unref(reply);
-outMsg:
-  dbus_message_unref(msg);
   return res;
 }
 
-/* Switched to a new terminal, restart from scratch */
-static void restartTerm(const char *sender, const char *path) {
+/* Split the full text of the widget into rows */
+static void setTermText(char *text) {
   char *c,*d;
   const char *e;
   long i,len;
-  char *text;
-
-  if (curPath)
-    finiTerm();
 
-  text = getText(sender, path);
-  if (!text)
-    return;
-
-  curSender = strdup(sender);
-  curPath = strdup(path);
-  logMessage(LOG_DEBUG,"new term %s:%s with text %s",curSender,curPath, text);
-
-  if (curRows) {
-    for (i=0;i<curNumRows;i++)
-      free(curRows[i]);
-    free(curRows);
-  }
-  curNumRows = 0;
-  free(curRowLengths);
+  freeRows();
   c = text;
   while (*c) {
     curNumRows++;
@@ -508,7 +493,6 @@ static void restartTerm(const char *sender, const char *path) {
   curRows = malloc(curNumRows * sizeof(*curRows));
   curRowLengths = malloc(curNumRows * sizeof(*curRowLengths));
   i = 0;
-  curNumCols = 0;
   for (c = text; *c; c = d+1) {
     d = strchr(c,'\n');
     if (d)
@@ -524,6 +508,7 @@ static void restartTerm(const char *sender, const char *path) {
 	logSystemError("mbrlen");
       curRowLengths[i] = (len = -1) + (d != NULL);
     }
+    curTextLength += curRowLengths[i];
     curRows[i] = malloc((len + (d!=NULL)) * sizeof(*curRows[i]));
     e = c;
     my_mbsrtowcs(curRows[i],&e,len,NULL);
@@ -534,10 +519,298 @@ static void restartTerm(const char *sender, const char *path) {
     i++;
   }
   logMessage(LOG_DEBUG,"%ld cols",curNumCols);
-  caretPosition(getCaret(sender, path));
+}
+
+/* Lookups for the focused object, all of them can be in flight at once.
+ * Replies belonging to an older focus generation are discarded. */
+typedef struct {
+  unsigned int references;
+  unsigned int generation;
+  char *sender;
+  char *path;
+  dbus_int32_t caret;
+  unsigned textPending:1;
+} TermRequest;
+
+static unsigned int focusGeneration;
+static TermRequest *focusRequest;
+
+static void releaseTermRequest(void *data) {
+  TermRequest *req = data;
+  if (!--req->references) {
+    free(req->sender);
+    free(req->path);
+    free(req);
+  }
+}
+
+static TermRequest *claimTermRequest(TermRequest *req) {
+  req->references++;
+  return req;
+}
+
+static int isStaleRequest(const TermRequest *req) {
+  return req->generation != focusGeneration;
+}
+
+static void dropFocusRequest(void) {
+  focusGeneration++;
+  if (focusRequest) {
+    releaseTermRequest(focusRequest);
+    focusRequest = NULL;
+  }
+}
+
+/* While the text is being refetched, text events are already part of it */
+static int isFetchingText(void) {
+  return focusRequest && focusRequest->textPending;
+}
+
+static TermRequest *newFocusRequest(const char *sender, const char *path) {
+  TermRequest *req;
+
+  dropFocusRequest();
+  if (!(req = malloc(sizeof(*req)))) {
+    logMallocError();
+    return NULL;
+  }
+  memset(req, 0, sizeof(*req));
+  req->references = 1;
+  req->generation = focusGeneration;
+  req->caret = -1;
+  if (!(req->sender = strdup(sender)) || !(req->path = strdup(path))) {
+    logMallocError();
+    releaseTermRequest(req);
+    return NULL;
+  }
+  return focusRequest = req;
+}
+
+static void textReceived(DBusPendingCall *pending, void *data) {
+  TermRequest *req = data;
+  char *text;
+
+  if (isStaleRequest(req)) {
+    dbus_pending_call_unref(pending);
+    return;
+  }
+  req->textPending = 0;
+  text = getTextReply(pending);
+
+  if (curPath)
+    finiTerm();
+  if (!text)
+    return;
+
+  pthread_mutex_lock(&updateMutex);
+  curSender = strdup(req->sender);
+  curPath = strdup(req->path);
+  logMessage(LOG_DEBUG,"new term %s:%s with %zu bytes of text",curSender,curPath,strlen(text));
+  setTermText(text);
+  caretPosition(MAX(req->caret, 0));
+  pthread_mutex_unlock(&updateMutex);
   free(text);
 }
 
+static void caretReceived(DBusPendingCall *pending, void *data) {
+  TermRequest *req = data;
+
+  if (isStaleRequest(req)) {
+    dbus_pending_call_unref(pending);
+    return;
+  }
+  req->caret = getCaretReply(pending);
+
+  if (!req->textPending && isCurrentTerm(req->sender, req->path) && (req->caret >= 0)) {
+    pthread_mutex_lock(&updateMutex);
+    caretPosition(req->caret);
+    pthread_mutex_unlock(&updateMutex);
+  }
+}
+
+static void fetchTerm(TermRequest *req) {
+  if (requestText(req->sender, req->path, textReceived, claimTermRequest(req), releaseTermRequest)) {
+    req->textPending = 1;
+  } else {
+    releaseTermRequest(req);
+    if (curPath)
+      finiTerm();
+    return;
+  }
+
+  if (!requestCaret(req->sender, req->path, caretReceived, claimTermRequest(req), releaseTermRequest))
+    releaseTermRequest(req);
+}
+
+static void roleReceived(DBusPendingCall *pending, void *data) {
+  TermRequest *req = data;
+  char *role;
+
+  if (isStaleRequest(req)) {
+    dbus_pending_call_unref(pending);
+    return;
+  }
+  role = getRoleReply(pending);
+  logMessage(LOG_DEBUG, "state changed focused to role %s", role);
+
+  if (role && (typeAll || (typeText && !strcmp(role, "text")) || (typeTerminal && !strcmp(role, "terminal")))) {
+    fetchTerm(req);
+  } else {
+    if (curPath)
+      finiTerm();
+  }
+  free(role);
+}
+
+/* Focus moved to a new object, find out whether it's a terminal */
+static void focusTerm(const char *sender, const char *path) {
+  TermRequest *req = newFocusRequest(sender, path);
+
+  if (!req)
+    return;
+  if (!requestRole(sender, path, roleReceived, claimTermRequest(req), releaseTermRequest))
+    releaseTermRequest(req);
+}
+
+/* Lost track of the current terminal, fetch it again from scratch.
+ * If the focus is already moving to another object then its lookup will
+ * replace the terminal anyway, and mustn't be cancelled. */
+static void restartTerm(const char *sender, const char *path) {
+  TermRequest *req;
+
+  if (focusRequest && (strcmp(sender, focusRequest->sender) || strcmp(path, focusRequest->path))) {
+    logMessage(LOG_DEBUG, "focus change to %s:%s pending, not refetching", focusRequest->sender, focusRequest->path);
+    return;
+  }
+
+  req = newFocusRequest(sender, path);
+  if (!req) {
+    finiTerm();
+    return;
+  }
+  fetchTerm(req);
+}
+
+/* Apply a text-changed:delete event to the row model, return 0 if it doesn't fit */
+static int deleteText(long position, long toDelete) {
+  long x,y;
+  long length = 0, toCopy;
+  long downTo; /* line that will provide what will follow x */
+
+  if (position < 0 || toDelete < 0 || position > curTextLength)
+    return 0;
+  findPosition(position,&x,&y);
+  downTo = y;
+  if (downTo < curNumRows)
+    length = curRowLengths[downTo];
+  while (x+toDelete >= length) {
+    downTo++;
+    if (downTo <= curNumRows - 1)
+      length += curRowLengths[downTo];
+    else {
+      /* imaginary extra line doesn't provide more length, and shouldn't need to ! */
+      if (x+toDelete > length)
+	/* deleting past end of text */
+	return 0;
+      break; /* deleting up to end */
+    }
+  }
+  if (length-toDelete>0) {
+    /* still something on line y */
+    if (y!=downTo) {
+      curRowLengths[y] = length-toDelete;
+      curRows[y]=realloc(curRows[y],curRowLengths[y]*sizeof(*curRows[y]));
+    }
+    if ((toCopy = length-toDelete-x))
+      memmove(curRows[y]+x,curRows[downTo]+curRowLengths[downTo]-toCopy,toCopy*sizeof(*curRows[downTo]));
+    if (y==downTo) {
+      curRowLengths[y] = length-toDelete;
+      curRows[y]=realloc(curRows[y],curRowLengths[y]*sizeof(*curRows[y]));
+    }
+  } else {
+    /* kills this line as well ! */
+    y--;
+  }
+  if (downTo>=curNumRows)
+    /* imaginary extra lines don't need to be deleted */
+    downTo=curNumRows-1;
+  delRows(y+1,downTo-y);
+  curTextLength -= toDelete;
+  caretPosition(curCaret);
+  return 1;
+}
+
+/* Apply a text-changed:insert event to the row model, return 0 if it doesn't fit */
+static int insertText(long position, long len, const char *added) {
+  long semilen,x,y;
+  const char *adding,*c;
+
+  if (position < 0 || len < 0 || position > curTextLength)
+    return 0;
+  {
+    my_mbstate_t ps;
+    memset(&ps,0,sizeof(ps));
+    adding = added;
+    if (my_mbsrtowcs(NULL,&adding,0,&ps) != len)
+      /* the announced length doesn't match the text */
+      return 0;
+  }
+  curTextLength += len;
+  findPosition(position,&x,&y);
+  adding = c = added;
+  if (x && (c = strchr(adding,'\n'))) {
+    /* splitting line */
+    addRows(y,1);
+    semilen=my_mbslen(adding,c+1-adding);
+    curRowLengths[y]=x+semilen;
+    if (x+semilen-1>curNumCols)
+      curNumCols=x+semilen-1;
+
+    /* copy beginning */
+    curRows[y]=malloc(curRowLengths[y]*sizeof(*curRows[y]));
+    memcpy(curRows[y],curRows[y+1],x*sizeof(*curRows[y]));
+    /* add */
+    my_mbsrtowcs(curRows[y]+x,&adding,semilen,NULL);
+    len-=semilen;
+    adding=c+1;
+    /* shift end */
+    curRowLengths[y+1]-=x;
+    memmove(curRows[y+1],curRows[y+1]+x,curRowLengths[y+1]*sizeof(*curRows[y+1]));
+    x=0;
+    y++;
+  }
+  while ((c = strchr(adding,'\n'))) {
+    /* adding lines */
+    addRows(y,1);
+    semilen=my_mbslen(adding,c+1-adding);
+    curRowLengths[y]=semilen;
+    if (semilen-1>curNumCols)
+      curNumCols=semilen-1;
+    curRows[y]=malloc(semilen*sizeof(*curRows[y]));
+    my_mbsrtowcs(curRows[y],&adding,semilen,NULL);
+    len-=semilen;
+    adding=c+1;
+    y++;
+  }
+  if (len) {
+    /* still length to add on the line following it */
+    if (y==curNumRows) {
+      /* It won't insert ending \n yet */
+      addRows(y,1);
+      curRows[y]=NULL;
+      curRowLengths[y]=0;
+    }
+    curRowLengths[y] += len;
+    curRows[y]=realloc(curRows[y],curRowLengths[y]*sizeof(*curRows[y]));
+    memmove(curRows[y]+x+len,curRows[y]+x,(curRowLengths[y]-(x+len))*sizeof(*curRows[y]));
+    my_mbsrtowcs(curRows[y]+x,&adding,len,NULL);
+    if (curRowLengths[y]-(curRows[y][curRowLengths[y]-1]=='\n')>curNumCols)
+      curNumCols=curRowLengths[y]-(curRows[y][curRowLengths[y]-1]=='\n');
+  }
+  caretPosition(curCaret);
+  return 1;
+}
+
 /* Handle incoming events */
 static void AtSpi2HandleEvent(const char *interface, DBusMessage *message)
 {
@@ -590,130 +863,46 @@ static void AtSpi2HandleEvent(const char *interface, DBusMessage *message)
     && !strcmp(detail, "focused");
 
   if (StateChanged_focused && !detail1) {
-    if (curSender && !strcmp(sender, curSender) && !strcmp(path, curPath))
+    if (focusRequest && !strcmp(sender, focusRequest->sender) && !strcmp(path, focusRequest->path))
+      dropFocusRequest();
+    if (isCurrentTerm(sender, path))
       finiTerm();
   } else if (!strcmp(interface,"Focus") || (StateChanged_focused && detail1)) {
-    char *role = getRole(sender, path);
-    logMessage(LOG_DEBUG, "state changed focused to role %s", role);
-    if (typeAll || (typeText && !strcmp(role, "text")) || (typeTerminal && !strcmp(role, "terminal"))) {
-      restartTerm(sender, path);
-    } else {
-      if (curPath)
-	finiTerm();
-    }
-    free(role);
+    focusTerm(sender, path);
   } else if (!strcmp(interface, "Object") && !strcmp(member, "TextCaretMoved")) {
-    if (!curSender || strcmp(sender, curSender) || strcmp(path, curPath)) return;
+    if (!isCurrentTerm(sender, path) || isFetchingText()) return;
     logMessage(LOG_DEBUG, "caret move to %d", detail1);
+    pthread_mutex_lock(&updateMutex);
     caretPosition(detail1);
+    pthread_mutex_unlock(&updateMutex);
   } else if (!strcmp(interface, "Object") && !strcmp(member, "TextChanged") && !strcmp(detail, "delete")) {
-    long x,y,toDelete = detail2;
-    long length = 0, toCopy;
-    long downTo; /* line that will provide what will follow x */
+    int ok;
     logMessage(LOG_DEBUG,"delete %d from %d",detail2,detail1);
-    if (!curSender || strcmp(sender, curSender) || strcmp(path, curPath)) return;
-    findPosition(detail1,&x,&y);
-    downTo = y;
-    if (downTo < curNumRows)
-      length = curRowLengths[downTo];
-    while (x+toDelete >= length) {
-      downTo++;
-      if (downTo <= curNumRows - 1)
-	length += curRowLengths[downTo];
-      else {
-	/* imaginary extra line doesn't provide more length, and shouldn't need to ! */
-	if (x+toDelete > length) {
-	  logMessage(LOG_ERR,"deleting past end of text !");
-	  /* discarding */
-	  toDelete = length - x;
-	}
-	break; /* deleting up to end */
-      }
-    }
-    if (length-toDelete>0) {
-      /* still something on line y */
-      if (y!=downTo) {
-	curRowLengths[y] = length-toDelete;
-	curRows[y]=realloc(curRows[y],curRowLengths[y]*sizeof(*curRows[y]));
-      }
-      if ((toCopy = length-toDelete-x))
-	memmove(curRows[y]+x,curRows[downTo]+curRowLengths[downTo]-toCopy,toCopy*sizeof(*curRows[downTo]));
-      if (y==downTo) {
-	curRowLengths[y] = length-toDelete;
-	curRows[y]=realloc(curRows[y],curRowLengths[y]*sizeof(*curRows[y]));
-      }
-    } else {
-      /* kills this line as well ! */
-      y--;
+    if (!isCurrentTerm(sender, path) || isFetchingText()) return;
+    pthread_mutex_lock(&updateMutex);
+    ok = deleteText(detail1, detail2);
+    pthread_mutex_unlock(&updateMutex);
+    if (!ok) {
+      logMessage(LOG_DEBUG, "text model out of sync on delete, refetching");
+      restartTerm(sender, path);
     }
-    if (downTo>=curNumRows)
-      /* imaginary extra lines don't need to be deleted */
-      downTo=curNumRows-1;
-    delRows(y+1,downTo-y);
-    caretPosition(curCaret);
   } else if (!strcmp(interface, "Object") && !strcmp(member, "TextChanged") && !strcmp(detail, "insert")) {
-    long len=detail2,semilen,x,y;
     const char *added;
-    const char *adding,*c;
+    int ok;
     logMessage(LOG_DEBUG,"insert %d from %d",detail2,detail1);
-    if (!curSender || strcmp(sender, curSender) || strcmp(path, curPath)) return;
-    findPosition(detail1,&x,&y);
+    if (!isCurrentTerm(sender, path) || isFetchingText()) return;
     if (dbus_message_iter_get_arg_type(&iter_variant) != DBUS_TYPE_STRING) {
       logMessage(LOG_DEBUG, "ergl, not string but '%c'", dbus_message_iter_get_arg_type(&iter_variant));
       return;
     }
     dbus_message_iter_get_basic(&iter_variant, &added);
-    adding = c = added;
-    if (x && (c = strchr(adding,'\n'))) {
-      /* splitting line */
-      addRows(y,1);
-      semilen=my_mbslen(adding,c+1-adding);
-      curRowLengths[y]=x+semilen;
-      if (x+semilen-1>curNumCols)
-	curNumCols=x+semilen-1;
-
-      /* copy beginning */
-      curRows[y]=malloc(curRowLengths[y]*sizeof(*curRows[y]));
-      memcpy(curRows[y],curRows[y+1],x*sizeof(*curRows[y]));
-      /* add */
-      my_mbsrtowcs(curRows[y]+x,&adding,semilen,NULL);
-      len-=semilen;
-      adding=c+1;
-      /* shift end */
-      curRowLengths[y+1]-=x;
-      memmove(curRows[y+1],curRows[y+1]+x,curRowLengths[y+1]*sizeof(*curRows[y+1]));
-      x=0;
-      y++;
-    }
-    while ((c = strchr(adding,'\n'))) {
-      /* adding lines */
-      addRows(y,1);
-      semilen=my_mbslen(adding,c+1-adding);
-      curRowLengths[y]=semilen;
-      if (semilen-1>curNumCols)
-	curNumCols=semilen-1;
-      curRows[y]=malloc(semilen*sizeof(*curRows[y]));
-      my_mbsrtowcs(curRows[y],&adding,semilen,NULL);
-      len-=semilen;
-      adding=c+1;
-      y++;
-    }
-    if (len) {
-      /* still length to add on the line following it */
-      if (y==curNumRows) {
-	/* It won't insert ending \n yet */
-	addRows(y,1);
-	curRows[y]=NULL;
-	curRowLengths[y]=0;
-      }
-      curRowLengths[y] += len;
-      curRows[y]=realloc(curRows[y],curRowLengths[y]*sizeof(*curRows[y]));
-      memmove(curRows[y]+x+len,curRows[y]+x,(curRowLengths[y]-(x+len))*sizeof(*curRows[y]));
-      my_mbsrtowcs(curRows[y]+x,&adding,len,NULL);
-      if (curRowLengths[y]-(curRows[y][curRowLengths[y]-1]=='\n')>curNumCols)
-	curNumCols=curRowLengths[y]-(curRows[y][curRowLengths[y]-1]=='\n');
+    pthread_mutex_lock(&updateMutex);
+    ok = insertText(detail1, detail2, added);
+    pthread_mutex_unlock(&updateMutex);
+    if (!ok) {
+      logMessage(LOG_DEBUG, "text model out of sync on insert, refetching");
+      restartTerm(sender, path);
     }
-    caretPosition(curCaret);
   } else {
       //logMessage(LOG_DEBUG,"interface %s, member %s, detail %s, detail1 %d detail2 %d",interface, member, detail, detail1, detail2);
   }
@@ -823,10 +1012,12 @@ ASYNC_THREAD_FUNCTION(a2OpenScreenThread) {
   WATCH("type='signal',interface='"SPI2_DBUS_INTERFACE_EVENT".Object',member='StateChanged'", "object:statechanged");
 
   /* TODO: use dbus_watch_get_unix_fd() or dbus_watch_get_socket() instead */
+  /* replies to our lookups are dispatched from here too, see sendMethodCall */
   sem_post(SPI2_init_sem);
   while (!finished && dbus_connection_read_write_dispatch (bus, 1000))
     ;
 
+  dropFocusRequest();
   if (curPath)
     finiTerm();
 
@@ -911,9 +1102,11 @@ readCharacters_AtSpi2Screen (const ScreenBox *box, ScreenCharacter *buffer) {
     setScreenMessage(box, buffer, nonatspi);
     return 1;
   }
-  if (!curNumCols || !curNumRows) return 0;
-  if (!validateScreenBox(box, curNumCols, curNumRows)) return 0;
   pthread_mutex_lock(&updateMutex);
+  if (!curNumCols || !curNumRows || !validateScreenBox(box, curNumCols, curNumRows)) {
+    pthread_mutex_unlock(&updateMutex);
+    return 0;
+  }
   for (y=0; y<box->height; y++) {
     if (curRowLengths[box->top+y]) {
       for (x=0; x<box->width; x++) {
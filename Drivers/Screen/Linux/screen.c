@@ -43,14 +43,18 @@ typedef enum {
   PARM_CHARSET,
   PARM_HFB,
   PARM_DEBUGSFM,
+  PARM_HISTORY,
+  PARM_MONITOR,
 } ScreenParameters;
-#define SCRPARMS "charset", "hfb", "debugsfm"
+#define SCRPARMS "charset", "hfb", "debugsfm", "history", "monitor"
 
 #include "scr_driver.h"
 #include "screen.h"
 
 static const char *problemText;
 static unsigned int debugScreenFontMap = 0;
+static unsigned int historyLimit = 0;
+static unsigned int monitorLimit = 0;
 
 #define UNICODE_ROW_DIRECT 0XF000
 
@@ -391,6 +395,298 @@ typedef struct {
   unsigned char row;
 } ScreenLocation;
 
+/* Rows which scroll off the top of the screen are kept in a bounded history
+ * for each console. Identical lines are only stored once, and each carries a
+ * signature of its lowercased trigrams so that a search can skip most lines
+ * without having to compare them.
+ */
+#define HISTORY_SIGNATURE_BITS 0X100
+#define HISTORY_SIGNATURE_WORDS (HISTORY_SIGNATURE_BITS / 32)
+#define HISTORY_TABLE_MINIMUM 0X100
+
+/* A scroll is only recognized if enough rows still match after it - at least
+ * this fraction of the screen, and at least this many which aren't blank -
+ * so that a redrawn screen isn't mistaken for one which has scrolled a lot.
+ */
+#define HISTORY_SCROLL_FRACTION 4
+#define HISTORY_SCROLL_MINIMUM 3
+
+typedef uint32_t HistorySignature[HISTORY_SIGNATURE_WORDS];
+
+typedef struct HistoryLineStruct HistoryLine;
+
+struct HistoryLineStruct {
+  HistoryLine *next;
+  uint32_t hash;
+  unsigned int references;
+  HistorySignature signature;
+  unsigned short length;
+  wchar_t characters[0];
+};
+
+typedef struct {
+  HistoryLine **lines;
+  unsigned int first;
+  unsigned int count;
+} ScreenHistory;
+
+static HistoryLine **historyTable = NULL;
+static unsigned int historyTableSize = 0;
+static unsigned int historyLineCount = 0;
+
+static ScreenHistory *screenHistories[MAX_NR_CONSOLES + 1];
+static unsigned int historyOffset;
+
+static unsigned char *previousBuffer;
+static size_t previousSize;
+static int previousConsole;
+
+static uint32_t
+hashHistoryCharacters (const wchar_t *characters, size_t length) {
+  uint32_t hash = 2166136261U;
+
+  while (length) {
+    hash ^= *characters++;
+    hash *= 16777619U;
+    length -= 1;
+  }
+
+  return hash;
+}
+
+static void
+setHistorySignature (HistorySignature signature, const wchar_t *characters, size_t length) {
+  memset(signature, 0, sizeof(HistorySignature));
+
+  if (length >= 3) {
+    wchar_t first = towlower(characters[0]);
+    wchar_t second = towlower(characters[1]);
+    size_t index;
+
+    for (index=2; index<length; index+=1) {
+      wchar_t third = towlower(characters[index]);
+      uint32_t hash = ((first * 0X9E3779B1U) ^ (second * 0X85EBCA77U) ^ (third * 0XC2B2AE3DU));
+      unsigned int bit = (hash >> 16) % HISTORY_SIGNATURE_BITS;
+
+      signature[bit / 32] |= UINT32_C(1) << (bit % 32);
+      first = second;
+      second = third;
+    }
+  }
+}
+
+static int
+testHistorySignature (const HistoryLine *line, const HistorySignature signature) {
+  unsigned int index;
+
+  for (index=0; index<HISTORY_SIGNATURE_WORDS; index+=1) {
+    if ((line->signature[index] & signature[index]) != signature[index]) return 0;
+  }
+
+  return 1;
+}
+
+static int
+findHistoryCharacters (const wchar_t *line, size_t length, const wchar_t *characters, size_t count, int last) {
+  int column = -1;
+
+  if (count <= length) {
+    size_t start;
+
+    for (start=0; start<=(length-count); start+=1) {
+      size_t index = 0;
+
+      while (towlower(line[start+index]) == characters[index]) {
+        if (++index == count) break;
+      }
+
+      if (index == count) {
+        column = start;
+        if (!last) break;
+      }
+    }
+  }
+
+  return column;
+}
+
+static int
+resizeHistoryTable (unsigned int size) {
+  HistoryLine **table = calloc(size, sizeof(*table));
+
+  if (table) {
+    unsigned int index;
+
+    for (index=0; index<historyTableSize; index+=1) {
+      HistoryLine *line = historyTable[index];
+
+      while (line) {
+        HistoryLine *next = line->next;
+        HistoryLine **bucket = &table[line->hash % size];
+
+        line->next = *bucket;
+        *bucket = line;
+        line = next;
+      }
+    }
+
+    if (historyTable) free(historyTable);
+    historyTable = table;
+    historyTableSize = size;
+    return 1;
+  } else {
+    logMallocError();
+  }
+
+  return 0;
+}
+
+static HistoryLine *
+getHistoryLine (const wchar_t *characters, size_t length) {
+  uint32_t hash = hashHistoryCharacters(characters, length);
+  HistoryLine *line;
+
+  if (historyLineCount >= (historyTableSize * 2)) {
+    resizeHistoryTable(historyTableSize? (historyTableSize * 2): HISTORY_TABLE_MINIMUM);
+    if (!historyTable) return NULL;
+  }
+
+  {
+    HistoryLine **bucket = &historyTable[hash % historyTableSize];
+
+    for (line=*bucket; line; line=line->next) {
+      if (line->hash == hash) {
+        if (line->length == length) {
+          if (wmemcmp(line->characters, characters, length) == 0) {
+            line->references += 1;
+            return line;
+          }
+        }
+      }
+    }
+
+    if ((line = malloc(sizeof(*line) + (length * sizeof(line->characters[0]))))) {
+      line->hash = hash;
+      line->references = 1;
+      line->length = length;
+      wmemcpy(line->characters, characters, length);
+      setHistorySignature(line->signature, characters, length);
+
+      line->next = *bucket;
+      *bucket = line;
+      historyLineCount += 1;
+    } else {
+      logMallocError();
+    }
+  }
+
+  return line;
+}
+
+static void
+releaseHistoryLine (HistoryLine *line) {
+  if (!--line->references) {
+    HistoryLine **bucket = &historyTable[line->hash % historyTableSize];
+
+    while (*bucket != line) bucket = &(*bucket)->next;
+    *bucket = line->next;
+
+    free(line);
+    historyLineCount -= 1;
+  }
+}
+
+static ScreenHistory *
+getScreenHistory (int console, int create) {
+  ScreenHistory *history;
+
+  if ((console < 0) || (console >= ARRAY_COUNT(screenHistories))) return NULL;
+  if ((history = screenHistories[console])) return history;
+  if (!create || !historyLimit) return NULL;
+
+  if ((history = malloc(sizeof(*history)))) {
+    if ((history->lines = malloc(historyLimit * sizeof(*history->lines)))) {
+      history->first = 0;
+      history->count = 0;
+
+      screenHistories[console] = history;
+      return history;
+    }
+
+    free(history);
+  }
+
+  logMallocError();
+  return NULL;
+}
+
+static inline HistoryLine *
+getScreenHistoryLine (const ScreenHistory *history, unsigned int index) {
+  return history->lines[(history->first + index) % historyLimit];
+}
+
+static int
+addScreenHistoryLine (ScreenHistory *history, const ScreenCharacter *characters, size_t count) {
+  wchar_t text[count];
+  HistoryLine *line;
+
+  {
+    size_t index;
+
+    for (index=0; index<count; index+=1) text[index] = characters[index].text;
+    while (count && iswspace(text[count-1])) count -= 1;
+  }
+
+  if (!(line = getHistoryLine(text, count))) return 0;
+
+  if (history->count == historyLimit) {
+    releaseHistoryLine(history->lines[history->first]);
+    history->first = (history->first + 1) % historyLimit;
+    history->count -= 1;
+  }
+
+  history->lines[(history->first + history->count++) % historyLimit] = line;
+  return 1;
+}
+
+static void
+destroyScreenHistories (void) {
+  unsigned int console;
+
+  for (console=0; console<ARRAY_COUNT(screenHistories); console+=1) {
+    ScreenHistory *history = screenHistories[console];
+
+    if (history) {
+      while (history->count) {
+        releaseHistoryLine(history->lines[history->first]);
+        history->first = (history->first + 1) % historyLimit;
+        history->count -= 1;
+      }
+
+      free(history->lines);
+      free(history);
+      screenHistories[console] = NULL;
+    }
+  }
+
+  if (historyTable) {
+    free(historyTable);
+    historyTable = NULL;
+  }
+
+  historyTableSize = 0;
+  historyLineCount = 0;
+  historyOffset = 0;
+
+  if (previousBuffer) {
+    free(previousBuffer);
+    previousBuffer = NULL;
+  }
+
+  previousSize = 0;
+  previousConsole = -1;
+}
+
 #ifdef HAVE_SYS_POLL_H
 #include <poll.h>
 
@@ -404,16 +700,35 @@ canMonitorScreen (void) {
   return poll(&pollDescriptor, 1, 0) == 1;
 }
 
+static int
+testScreenDevice (int descriptor, int *closed) {
+  struct pollfd pollDescriptor = {
+    .fd = descriptor,
+    .events = POLLPRI
+  };
+
+  *closed = 0;
+  if (poll(&pollDescriptor, 1, 0) != 1) return 0;
+  if (pollDescriptor.revents & (POLLHUP | POLLERR | POLLNVAL)) *closed = 1;
+  return (pollDescriptor.revents & POLLPRI) != 0;
+}
+
 #else /* can poll */
 static int
 canMonitorScreen (void) {
   return 0;
 }
+
+static int
+testScreenDevice (int descriptor, int *closed) {
+  *closed = 1;
+  return 0;
+}
 #endif /* can poll */
 
 static size_t
-readScreenDevice (off_t offset, void *buffer, size_t size) {
-  const ssize_t count = pread(screenDescriptor, buffer, size, offset);
+readConsoleDevice (int descriptor, off_t offset, void *buffer, size_t size) {
+  const ssize_t count = pread(descriptor, buffer, size, offset);
 
   if (count != -1) {
     return count;
@@ -424,6 +739,65 @@ readScreenDevice (off_t offset, void *buffer, size_t size) {
   return 0;
 }
 
+static size_t
+readScreenDevice (off_t offset, void *buffer, size_t size) {
+  return readConsoleDevice(screenDescriptor, offset, buffer, size);
+}
+
+static size_t
+toScreenCacheSize (const ScreenSize *screenSize) {
+  return (screenSize->columns * screenSize->rows * 2) + 4;
+}
+
+static int
+readScreenImage (int descriptor, unsigned char **buffer, size_t *size) {
+  if (!*buffer) {
+    ScreenSize screenSize;
+    if (!readConsoleDevice(descriptor, 0, &screenSize, sizeof(screenSize))) return 0;
+
+    {
+      size_t newSize = toScreenCacheSize(&screenSize);
+      unsigned char *newBuffer = malloc(newSize);
+
+      if (!newBuffer) {
+        logMallocError();
+        return 0;
+      }
+
+      *buffer = newBuffer;
+      *size = newSize;
+    }
+  }
+
+  while (1) {
+    size_t count = readConsoleDevice(descriptor, 0, *buffer, *size);
+
+    if (count < 4) {
+      logMessage(LOG_ERR, "truncated screen header");
+      return 0;
+    }
+
+    {
+      ScreenSize *screenSize = (void *)*buffer;
+      size_t newSize = toScreenCacheSize(screenSize);
+
+      if (count >= newSize) return 1;
+
+      {
+        unsigned char *newBuffer = realloc(*buffer, newSize);
+
+        if (!newBuffer) {
+          logMallocError();
+          return 0;
+        }
+
+        *buffer = newBuffer;
+        *size = newSize;
+      }
+    }
+  }
+}
+
 ASYNC_MONITOR_CALLBACK(lxScreenUpdated) {
   asyncDiscardHandle(screenMonitor);
   screenMonitor = NULL;
@@ -765,6 +1139,34 @@ processParameters_LinuxScreen (char **parameters) {
     }
   }
 
+  historyLimit = 0;
+  if (parameters[PARM_HISTORY] && *parameters[PARM_HISTORY]) {
+    int limit = 0;
+
+    static const int minimum = 0;
+    static const int maximum = 100000;
+
+    if (validateInteger(&limit, parameters[PARM_HISTORY], &minimum, &maximum)) {
+      historyLimit = limit;
+    } else {
+      logMessage(LOG_WARNING, "%s: %s", "invalid history line limit", parameters[PARM_HISTORY]);
+    }
+  }
+
+  monitorLimit = 0;
+  if (parameters[PARM_MONITOR] && *parameters[PARM_MONITOR]) {
+    int limit = 0;
+
+    static const int minimum = 0;
+    static const int maximum = MAX_NR_CONSOLES;
+
+    if (validateInteger(&limit, parameters[PARM_MONITOR], &minimum, &maximum)) {
+      monitorLimit = limit;
+    } else {
+      logMessage(LOG_WARNING, "%s: %s", "invalid console monitor limit", parameters[PARM_MONITOR]);
+    }
+  }
+
   return 1;
 }
 
@@ -992,12 +1394,225 @@ static int at2Pressed;
 #endif /* HAVE_LINUX_INPUT_H */
 
 static int currentConsoleNumber;
+
+typedef struct {
+  int descriptor;
+  AsyncHandle monitor;
+  unsigned char *buffer;
+  size_t size;
+  unsigned primed:1;
+  unsigned stale:1;
+  unsigned activity:1;
+} ConsoleMonitor;
+
+static ConsoleMonitor consoleMonitors[MAX_NR_CONSOLES + 1];
+static unsigned int consoleMonitorCount;
+static int cachedConsole;
+
+static void
+initializeConsoleMonitors (void) {
+  unsigned int vt;
+
+  for (vt=0; vt<ARRAY_COUNT(consoleMonitors); vt+=1) {
+    ConsoleMonitor *cm = &consoleMonitors[vt];
+
+    cm->descriptor = -1;
+    cm->monitor = NULL;
+    cm->buffer = NULL;
+    cm->size = 0;
+    cm->primed = 0;
+    cm->stale = 0;
+    cm->activity = 0;
+  }
+
+  consoleMonitorCount = 0;
+  cachedConsole = -1;
+}
+
+static void
+closeConsoleMonitor (ConsoleMonitor *cm) {
+  if (cm->monitor) {
+    asyncCancelRequest(cm->monitor);
+    cm->monitor = NULL;
+  }
+
+  if (cm->descriptor != -1) {
+    close(cm->descriptor);
+    logMessage(LOG_DEBUG, "console monitor closed: vt=%d fd=%d",
+               (int)(cm - consoleMonitors), cm->descriptor);
+    cm->descriptor = -1;
+    consoleMonitorCount -= 1;
+  }
+
+  if (cm->buffer) {
+    free(cm->buffer);
+    cm->buffer = NULL;
+  }
+
+  cm->size = 0;
+  cm->primed = 0;
+  cm->stale = 0;
+  cm->activity = 0;
+}
+
+ASYNC_MONITOR_CALLBACK(lxConsoleUpdated) {
+  ConsoleMonitor *cm = parameters->data;
+  int vt = cm - consoleMonitors;
+  int closed;
+  int ok;
+
+  testScreenDevice(cm->descriptor, &closed);
+
+  if (closed) {
+    ok = 0;
+  } else if (vt == currentConsoleNumber) {
+    /* The foreground console is read by refresh anyway - just rearm the alert. */
+    ScreenSize size;
+
+    ok = readConsoleDevice(cm->descriptor, 0, &size, sizeof(size)) == sizeof(size);
+    cm->stale = 1;
+  } else {
+    ok = readScreenImage(cm->descriptor, &cm->buffer, &cm->size);
+    cm->stale = 0;
+  }
+
+  if (!ok) {
+    asyncDiscardHandle(cm->monitor);
+    cm->monitor = NULL;
+    return 0;
+  }
+
+  if (!cm->primed) {
+    cm->primed = 1;
+  } else if ((vt != currentConsoleNumber) && !cm->activity) {
+    cm->activity = 1;
+    mainScreenActivity(vt);
+  }
+
+  return 1;
+}
+
+static int
+openConsoleMonitor (int vt) {
+  ConsoleMonitor *cm = &consoleMonitors[vt];
+  char *name = vtName(screenName, vt);
+
+  if (name) {
+    int descriptor = openCharacterDevice(name, O_RDONLY, 7, 0X80|vt);
+
+    free(name);
+    name = NULL;
+
+    if (descriptor != -1) {
+      cm->descriptor = descriptor;
+      consoleMonitorCount += 1;
+
+      if (readScreenImage(descriptor, &cm->buffer, &cm->size)) {
+        if (asyncMonitorFileAlert(&cm->monitor, descriptor, lxConsoleUpdated, cm)) {
+          logMessage(LOG_DEBUG, "console monitor opened: vt=%d fd=%d", vt, descriptor);
+          return 1;
+        }
+      }
+
+      closeConsoleMonitor(cm);
+    }
+  }
+
+  return 0;
+}
+
+static void
+updateConsoleMonitors (void) {
+  struct vt_stat state;
+
+  if (!monitorLimit) return;
+  if (!isMonitorable) return;
+  if (controlConsole(VT_GETSTATE, &state) == -1) return;
+
+  {
+    unsigned int vt;
+
+    for (vt=1; vt<ARRAY_COUNT(consoleMonitors); vt+=1) {
+      ConsoleMonitor *cm = &consoleMonitors[vt];
+      int allocated = (vt < (sizeof(state.v_state) * 8)) && (state.v_state & (1 << vt));
+
+      if (cm->descriptor != -1) {
+        if (!allocated || !cm->monitor) closeConsoleMonitor(cm);
+      }
+
+      if (allocated && (cm->descriptor == -1)) {
+        if (consoleMonitorCount < monitorLimit) openConsoleMonitor(vt);
+      }
+    }
+  }
+}
+
+static void
+closeConsoleMonitors (void) {
+  unsigned int vt;
+
+  for (vt=0; vt<ARRAY_COUNT(consoleMonitors); vt+=1) {
+    closeConsoleMonitor(&consoleMonitors[vt]);
+  }
+}
+
+static int
+getActiveConsole (void) {
+  struct vt_stat state;
+
+  if (virtualTerminal) return virtualTerminal;
+  if (controlConsole(VT_GETSTATE, &state) != -1) return state.v_active;
+  return -1;
+}
+
+static int
+readConsoleSnapshot (void) {
+  int console = getActiveConsole();
+
+  if (console == cachedConsole) return 0;
+  cachedConsole = console;
+
+  if ((console > 0) && (console < ARRAY_COUNT(consoleMonitors))) {
+    ConsoleMonitor *cm = &consoleMonitors[console];
+    int closed;
+
+    cm->activity = 0;
+
+    if (cm->monitor && !cm->stale && !testScreenDevice(cm->descriptor, &closed) && !closed) {
+      if (cm->size > cacheSize) {
+        unsigned char *buffer = realloc(cacheBuffer, cm->size);
+
+        if (!buffer) {
+          logMallocError();
+          return 0;
+        }
+
+        cacheBuffer = buffer;
+        cacheSize = cm->size;
+      }
+
+      memcpy(cacheBuffer, cm->buffer, cm->size);
+      logMessage(LOG_DEBUG, "console snapshot used: vt=%d", console);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
 static int
 construct_LinuxScreen (void) {
   screenUpdated = 0;
   cacheBuffer = NULL;
   cacheSize = 0;
 
+  historyOffset = 0;
+  previousBuffer = NULL;
+  previousSize = 0;
+  previousConsole = -1;
+
+  initializeConsoleMonitors();
+
 #ifdef HAVE_LINUX_INPUT_H
   at2Keys = at2KeysOriginal;
   at2Pressed = 1;
@@ -1011,6 +1626,7 @@ construct_LinuxScreen (void) {
 
       if (openScreen(currentConsoleNumber=0)) {
         if (setTranslationTable(1)) {
+          updateConsoleMonitors();
           return 1;
         }
       }
@@ -1021,6 +1637,7 @@ construct_LinuxScreen (void) {
 
 static void
 destruct_LinuxScreen (void) {
+  closeConsoleMonitors();
   closeConsole();
   consoleName = NULL;
 
@@ -1039,6 +1656,8 @@ destruct_LinuxScreen (void) {
     cacheBuffer = NULL;
   }
   cacheSize = 0;
+
+  destroyScreenHistories();
 }
 
 static int
@@ -1046,48 +1665,52 @@ userVirtualTerminal_LinuxScreen (int number) {
   return MAX_NR_CONSOLES + 1 + number;
 }
 
-static int
-readScreenRow (int row, size_t size, ScreenCharacter *characters, int *offsets) {
-  uint16_t line[size];
+static void
+translateScreenCells (const uint16_t *line, size_t size, ScreenCharacter *characters, int *offsets) {
+  const uint16_t *source = line;
+  const uint16_t *end = source + size;
+  ScreenCharacter *character = characters;
   int column = 0;
 
-  if (readScreenContent((row * size), line, size)) {
-    const uint16_t *source = line;
-    const uint16_t *end = source + size;
-    ScreenCharacter *character = characters;
-
-    while (source != end) {
-      uint16_t position = *source & 0XFF;
-      wint_t wc;
-
-      if (*source & fontAttributesMask) position |= 0X100;
-      if ((wc = convertCharacter(&translationTable[position])) != WEOF) {
-        if (character) {
-          character->text = wc;
-          character->attributes = ((*source & unshiftedAttributesMask) |
-                                   ((*source & shiftedAttributesMask) >> 1)) >> 8;
-          character += 1;
-        }
-
-        if (offsets) offsets[column++] = source - line;
+  while (source != end) {
+    uint16_t position = *source & 0XFF;
+    wint_t wc;
+
+    if (*source & fontAttributesMask) position |= 0X100;
+    if ((wc = convertCharacter(&translationTable[position])) != WEOF) {
+      if (character) {
+        character->text = wc;
+        character->attributes = ((*source & unshiftedAttributesMask) |
+                                 ((*source & shiftedAttributesMask) >> 1)) >> 8;
+        character += 1;
       }
 
-      source += 1;
+      if (offsets) offsets[column++] = source - line;
     }
 
-    {
-      wint_t wc;
-      while ((wc = convertCharacter(NULL)) != WEOF) {
-        if (character) {
-          character->text = wc;
-          character->attributes = 0X07;
-          character += 1;
-        }
+    source += 1;
+  }
 
-        if (offsets) offsets[column++] = size - 1;
+  {
+    wint_t wc;
+    while ((wc = convertCharacter(NULL)) != WEOF) {
+      if (character) {
+        character->text = wc;
+        character->attributes = 0X07;
+        character += 1;
       }
+
+      if (offsets) offsets[column++] = size - 1;
     }
+  }
+}
 
+static int
+readScreenRow (int row, size_t size, ScreenCharacter *characters, int *offsets) {
+  uint16_t line[size];
+
+  if (readScreenContent((row * size), line, size)) {
+    translateScreenCells(line, size, characters, offsets);
     return 1;
   }
 
@@ -1105,63 +1728,252 @@ poll_LinuxScreen (void) {
   return poll;
 }
 
-static size_t
-toScreenCacheSize (const ScreenSize *screenSize) {
-  return (screenSize->columns * screenSize->rows * 2) + 4;
+static uint32_t
+hashScreenCells (const uint16_t *cells, size_t count) {
+  uint32_t hash = 2166136261U;
+
+  while (count) {
+    hash ^= *cells++;
+    hash *= 16777619U;
+    count -= 1;
+  }
+
+  return hash;
 }
 
 static int
-refresh_LinuxScreen (void) {
-  if (!screenUpdated) return 1;
+isBlankScreenCells (const uint16_t *cells, size_t count) {
+  while (count) {
+    if ((*cells++ & 0XFF) != ' ') return 0;
+    count -= 1;
+  }
 
-  if (!cacheBuffer) {
-    ScreenSize screenSize;
-    if (!readScreenDevice(0, &screenSize, sizeof(screenSize))) return 0;
+  return 1;
+}
 
-    {
-      size_t size = toScreenCacheSize(&screenSize);
-      unsigned char *buffer = malloc(size);
+static unsigned int
+findScrolledRows (const uint16_t *from, const uint16_t *to, unsigned int rows, unsigned int columns) {
+  /* The bottom row isn't compared because it's usually the one being
+   * written to, i.e. it may have changed without the screen scrolling.
+   */
+  unsigned int last = rows - 1;
+  unsigned int least = MAX(last/HISTORY_SCROLL_FRACTION, 1);
+  uint32_t fromHashes[rows];
+  uint32_t toHashes[rows];
+  unsigned int contentRows[rows];
 
-      if (!buffer) {
-        logMallocError();
-        return 0;
+  if (rows < 3) return 0;
+
+  {
+    unsigned int row;
+
+    contentRows[0] = 0;
+
+    for (row=0; row<last; row+=1) {
+      const uint16_t *cells = &to[row * columns];
+
+      fromHashes[row] = hashScreenCells(&from[row * columns], columns);
+      toHashes[row] = hashScreenCells(cells, columns);
+      contentRows[row+1] = contentRows[row] + !isBlankScreenCells(cells, columns);
+    }
+  }
+
+  {
+    unsigned int shift;
+
+    for (shift=0; shift<last; shift+=1) {
+      unsigned int count = last - shift;
+
+      if (count < least) break;
+      if (contentRows[count] < HISTORY_SCROLL_MINIMUM) break;
+
+      if (memcmp(&fromHashes[shift], toHashes, (count * sizeof(toHashes[0]))) == 0) {
+        if (memcmp(&from[shift * columns], to, (count * columns * sizeof(*to))) == 0) {
+          if (!shift) break;
+          return shift;
+        }
       }
+    }
+  }
 
-      cacheBuffer = buffer;
-      cacheSize = size;
+  return 0;
+}
+
+static void
+updateScreenHistory (void) {
+  const ScreenSize *size = (const void *)cacheBuffer;
+  size_t count = toScreenCacheSize(size);
+  int console = getActiveConsole();
+
+  if ((console != -1) && (console == previousConsole)) {
+    if (memcmp(previousBuffer, cacheBuffer, sizeof(*size)) == 0) {
+      const uint16_t *from = (const void *)&previousBuffer[4];
+      const uint16_t *to = (const void *)&cacheBuffer[4];
+      unsigned int shift = findScrolledRows(from, to, size->rows, size->columns);
+
+      if (shift) {
+        ScreenHistory *history = getScreenHistory(console, 1);
+
+        if (history) {
+          unsigned int row;
+
+          for (row=0; row<shift; row+=1) {
+            ScreenCharacter characters[size->columns];
+
+            translateScreenCells(&from[row * size->columns], size->columns, characters, NULL);
+            if (!addScreenHistoryLine(history, characters, size->columns)) break;
+          }
+
+          if (historyOffset && (console == currentConsoleNumber)) {
+            historyOffset = MIN(historyOffset+shift, history->count);
+          }
+        }
+      }
     }
   }
 
-  while (1) {
-    size_t count = readScreenDevice(0, cacheBuffer, cacheSize);
+  if (count != previousSize) {
+    unsigned char *buffer = realloc(previousBuffer, count);
 
-    if (count < 4) {
-      logMessage(LOG_ERR, "truncated screen header");
-      return 0;
+    if (!buffer) {
+      logMallocError();
+      previousConsole = -1;
+      return;
     }
 
-    {
-      ScreenSize *screenSize = (void *)cacheBuffer;
-      size_t size = toScreenCacheSize(screenSize);
+    previousBuffer = buffer;
+    previousSize = count;
+  }
 
-      if (count >= size) {
-        screenUpdated = 0;
-        return 1;
+  memcpy(previousBuffer, cacheBuffer, count);
+  previousConsole = console;
+}
+
+static int
+readHistoryRow (int row, size_t size, ScreenCharacter *characters) {
+  if (row < historyOffset) {
+    const ScreenHistory *history = getScreenHistory(currentConsoleNumber, 0);
+
+    if (history) {
+      const HistoryLine *line = getScreenHistoryLine(history, (history->count - historyOffset + row));
+      size_t count = MIN(line->length, size);
+      size_t index;
+
+      clearScreenCharacters(characters, size);
+      for (index=0; index<count; index+=1) characters[index].text = line->characters[index];
+      return 1;
+    }
+
+    historyOffset = 0;
+  }
+
+  return readScreenRow((row - historyOffset), size, characters, NULL);
+}
+
+static int
+setHistoryOffset (int offset) {
+  const ScreenHistory *history = getScreenHistory(currentConsoleNumber, 0);
+  unsigned int count = history? history->count: 0;
+
+  if (offset < 0) offset = 0;
+  if (offset > count) offset = count;
+  if (offset == historyOffset) return 0;
+
+  historyOffset = offset;
+  return 1;
+}
+
+static int
+searchHistory_LinuxScreen (const wchar_t *characters, size_t count, int backward, int *column, int *row) {
+  const ScreenHistory *history = getScreenHistory(currentConsoleNumber, 0);
+  ScreenSize size;
+
+  if (!count) return 0;
+  if (!readScreenSize(&size)) return 0;
+
+  if (history) {
+    HistorySignature signature;
+    setHistorySignature(signature, characters, count);
+
+    if (backward) {
+      unsigned int index = history->count - historyOffset;
+
+      while (index > 0) {
+        const HistoryLine *line = getScreenHistoryLine(history, --index);
+
+        if (testHistorySignature(line, signature)) {
+          int found = findHistoryCharacters(line->characters, line->length, characters, count, 1);
+
+          if (found >= 0) {
+            historyOffset = history->count - index;
+            *column = found;
+            *row = 0;
+            return 1;
+          }
+        }
       }
+    } else if (historyOffset) {
+      unsigned int index = history->count - historyOffset + size.rows;
 
-      {
-        unsigned char *buffer = realloc(cacheBuffer, size);
+      while (index < history->count) {
+        const HistoryLine *line = getScreenHistoryLine(history, index);
 
-        if (!buffer) {
-          logMallocError();
-          return 0;
+        if (testHistorySignature(line, signature)) {
+          int found = findHistoryCharacters(line->characters, line->length, characters, count, 0);
+
+          if (found >= 0) {
+            historyOffset = history->count - index;
+            *column = found;
+            *row = 0;
+            return 1;
+          }
         }
 
-        cacheBuffer = buffer;
-        cacheSize = size;
+        index += 1;
+      }
+
+      {
+        int live = (historyOffset < size.rows)? (size.rows - historyOffset): 0;
+
+        while (live < size.rows) {
+          ScreenCharacter buffer[size.columns];
+          wchar_t text[size.columns];
+          int found;
+
+          if (!readScreenRow(live, size.columns, buffer, NULL)) break;
+
+          {
+            unsigned int index;
+            for (index=0; index<size.columns; index+=1) text[index] = buffer[index].text;
+          }
+
+          if ((found = findHistoryCharacters(text, size.columns, characters, count, 0)) >= 0) {
+            historyOffset = 0;
+            *column = found;
+            *row = live;
+            return 1;
+          }
+
+          live += 1;
+        }
       }
     }
   }
+
+  return 0;
+}
+
+static int
+refresh_LinuxScreen (void) {
+  if (!screenUpdated) return 1;
+
+  if (!(consoleMonitorCount && readConsoleSnapshot())) {
+    if (!readScreenImage(screenDescriptor, &cacheBuffer, &cacheSize)) return 0;
+  }
+
+  if (historyLimit) updateScreenHistory();
+  screenUpdated = 0;
+  return 1;
 }
 
 static int
@@ -1251,6 +2063,7 @@ getConsoleDescription (ScreenDescription *description) {
 
   if (currentConsoleNumber != description->number) {
     currentConsoleNumber = description->number;
+    historyOffset = 0;
     setTranslationTable(1);
   }
 
@@ -1273,6 +2086,12 @@ describe_LinuxScreen (ScreenDescription *description) {
   getScreenDescription(description);
   description->unreadable = problemText;
 
+  if (historyOffset && !problemText) {
+    description->posy += historyOffset;
+    if (description->posy >= description->rows) description->posy = description->rows - 1;
+    description->cursor = 0;
+  }
+
   /* Periodically recalculate font mapping. I don't know any way to be
    * notified when it changes, and the recalculation is not too
    * long/difficult.
@@ -1281,6 +2100,7 @@ describe_LinuxScreen (ScreenDescription *description) {
     static int timer = 0;
     if (++timer > 100) {
       setTranslationTable(0);
+      updateConsoleMonitors();
       timer = 0;
     }
   }
@@ -1302,7 +2122,7 @@ readCharacters_LinuxScreen (const ScreenBox *box, ScreenCharacter *buffer) {
 
         for (row=0; row<box->height; ++row) {
           ScreenCharacter characters[size.columns];
-          if (!readScreenRow(box->top+row, size.columns, characters, NULL)) return 0;
+          if (!readHistoryRow(box->top+row, size.columns, characters)) return 0;
 
           memcpy(buffer, &characters[box->left],
                  box->width * sizeof(characters[0]));
@@ -1994,6 +2814,24 @@ handleCommand_LinuxScreen (int command) {
 #endif /* HAVE_LINUX_INPUT_H */
       break;
 
+    {
+      ScreenSize size;
+
+    case BRL_CMD_HIST_PREV:
+      if (!readScreenSize(&size)) break;
+      return setHistoryOffset(historyOffset + size.rows);
+
+    case BRL_CMD_HIST_NEXT:
+      if (!readScreenSize(&size)) break;
+      return setHistoryOffset((int)historyOffset - size.rows);
+    }
+
+    case BRL_CMD_HIST_TOP:
+      return setHistoryOffset(INT_MAX);
+
+    case BRL_CMD_HIST_BOT:
+      return setHistoryOffset(0);
+
     default:
 #ifdef HAVE_LINUX_INPUT_H
       switch (blk) {
@@ -2079,6 +2917,7 @@ scr_initialize (MainScreen *main) {
   main->base.selectVirtualTerminal = selectVirtualTerminal_LinuxScreen;
   main->base.switchVirtualTerminal = switchVirtualTerminal_LinuxScreen;
   main->base.currentVirtualTerminal = currentVirtualTerminal_LinuxScreen;
+  main->base.searchHistory = searchHistory_LinuxScreen;
   main->base.handleCommand = handleCommand_LinuxScreen;
 
   main->processParameters = processParameters_LinuxScreen;
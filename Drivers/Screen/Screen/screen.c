@@ -39,6 +39,7 @@ static int shmFileDescriptor = -1;
 #endif /* HAVE_SHM_OPEN */
 
 #include "log.h"
+#include "timing.h"
 #include "hostcmd.h"
 #include "charset.h"
 
@@ -47,7 +48,18 @@ static int shmFileDescriptor = -1;
 
 static unsigned char *shmAddress = NULL;
 static const mode_t shmMode = S_IRWXU;
-static const int shmSize = 4 + ((66 * 132) * 2);
+static size_t shmSize;
+
+#ifdef HAVE_SHMGET
+static size_t
+getSegmentSize (int identifier) {
+  struct shmid_ds status;
+
+  if (shmctl(identifier, IPC_STAT, &status) != -1) return status.shm_segsz;
+  logSystemError("shmctl[IPC_STAT]");
+  return 0;
+}
+#endif /* HAVE_SHMGET */
 
 static int
 construct_ScreenScreen (void) {
@@ -76,8 +88,9 @@ construct_ScreenScreen (void) {
     while (keyCount > 0) {
       shmKey = keys[--keyCount];
       logMessage(LOG_DEBUG, "Trying shared memory key: 0X%" PRIX_KEY_T, shmKey);
-      if ((shmIdentifier = shmget(shmKey, shmSize, shmMode)) != -1) {
+      if ((shmIdentifier = shmget(shmKey, 0, shmMode)) != -1) {
         if ((shmAddress = shmat(shmIdentifier, NULL, 0)) != (unsigned char *)-1) {
+          shmSize = getSegmentSize(shmIdentifier);
           logMessage(LOG_INFO, "Screen image shared memory key: 0X%" PRIX_KEY_T, shmKey);
           return 1;
         } else {
@@ -96,10 +109,18 @@ construct_ScreenScreen (void) {
 #ifdef HAVE_SHM_OPEN
   {
     if ((shmFileDescriptor = shm_open(shmPath, O_RDONLY, shmMode)) != -1) {
-      if ((shmAddress = mmap(0, shmSize, PROT_READ, MAP_SHARED, shmFileDescriptor, 0)) != MAP_FAILED) {
-        return 1;
+      struct stat status;
+
+      if (fstat(shmFileDescriptor, &status) != -1) {
+        shmSize = status.st_size;
+
+        if ((shmAddress = mmap(0, shmSize, PROT_READ, MAP_SHARED, shmFileDescriptor, 0)) != MAP_FAILED) {
+          return 1;
+        } else {
+          logSystemError("mmap");
+        }
       } else {
-        logSystemError("mmap");
+        logSystemError("fstat");
       }
 
       close(shmFileDescriptor);
@@ -113,13 +134,214 @@ construct_ScreenScreen (void) {
   return 0;
 }
 
+/* The writer may have grown the segment to accommodate a larger screen. */
+static int
+remapSegment (void) {
+#ifdef HAVE_SHMGET
+  if (shmIdentifier != -1) {
+    int identifier;
+
+    if ((identifier = shmget(shmKey, 0, shmMode)) != -1) {
+      size_t size = getSegmentSize(identifier);
+
+      if (size > shmSize) {
+        unsigned char *address;
+
+        if ((address = shmat(identifier, NULL, 0)) != (unsigned char *)-1) {
+          shmdt(shmAddress);
+          shmAddress = address;
+          shmIdentifier = identifier;
+          shmSize = size;
+          return 1;
+        } else {
+          logSystemError("shmat");
+        }
+      }
+    } else {
+      logSystemError("shmget");
+    }
+
+    return 0;
+  }
+#endif /* HAVE_SHMGET */
+
+#ifdef HAVE_SHM_OPEN
+  if (shmFileDescriptor != -1) {
+    struct stat status;
+
+    if (fstat(shmFileDescriptor, &status) != -1) {
+      if ((size_t)status.st_size > shmSize) {
+        unsigned char *address;
+
+        if ((address = mmap(0, status.st_size, PROT_READ, MAP_SHARED, shmFileDescriptor, 0)) != MAP_FAILED) {
+          munmap(shmAddress, shmSize);
+          shmAddress = address;
+          shmSize = status.st_size;
+          return 1;
+        } else {
+          logSystemError("mmap");
+        }
+      }
+    } else {
+      logSystemError("fstat");
+    }
+  }
+#endif /* HAVE_SHM_OPEN */
+
+  return 0;
+}
+
+static const ScreenSegmentHeader *
+getSegmentHeader (void) {
+  const ScreenSegmentHeader *header = (const ScreenSegmentHeader *)shmAddress;
+
+  if (shmSize < sizeof(*header)) return NULL;
+  if (header->zero[0] || header->zero[1]) return NULL;
+  if (header->magic != SCREEN_SEGMENT_MAGIC) return NULL;
+  if (header->version < SCREEN_SEGMENT_VERSION) return NULL;
+  return header;
+}
+
+#if defined(__GNUC__)
+#define readBarrier() __sync_synchronize()
+#else /* memory barrier */
+#define readBarrier()
+#endif /* memory barrier */
+
+static struct {
+  ScreenSegmentCharacter *characters;
+  size_t size;
+
+  uint32_t sequence;
+  unsigned consistent:1;
+
+  unsigned char flags;
+  unsigned int columns;
+  unsigned int rows;
+  unsigned int cursorColumn;
+  unsigned int cursorRow;
+  unsigned int number;
+} segmentImage;
+
+static int
+copySegmentImage (const ScreenSegmentHeader *header, uint32_t sequence) {
+  unsigned int columns = header->columns;
+  unsigned int rows = header->rows;
+  size_t count = columns * rows;
+  size_t dirtyOffset = header->dirtyOffset;
+  size_t cellsOffset = header->cellsOffset;
+  int all = !segmentImage.consistent ||
+            (sequence != (segmentImage.sequence + 2)) ||
+            (columns != segmentImage.columns) ||
+            (rows != segmentImage.rows);
+
+  if ((dirtyOffset + ((rows + 7) / 8) > shmSize) ||
+      (cellsOffset + (count * sizeof(*segmentImage.characters)) > shmSize)) {
+    return 0;
+  }
+
+  if (count > segmentImage.size) {
+    ScreenSegmentCharacter *characters = realloc(segmentImage.characters, ARRAY_SIZE(characters, count));
+
+    if (!characters) {
+      logMallocError();
+      return 0;
+    }
+
+    segmentImage.characters = characters;
+    segmentImage.size = count;
+  }
+
+  segmentImage.consistent = 0;
+  segmentImage.columns = columns;
+  segmentImage.rows = rows;
+
+  {
+    const unsigned char *dirty = shmAddress + dirtyOffset;
+    const ScreenSegmentCharacter *from = (const ScreenSegmentCharacter *)(shmAddress + cellsOffset);
+    ScreenSegmentCharacter *to = segmentImage.characters;
+    size_t size = columns * sizeof(*to);
+    unsigned int row;
+
+    for (row=0; row<rows; row+=1) {
+      if (all || (dirty[row / 8] & (1 << (row % 8)))) memcpy(to, from, size);
+      from += columns;
+      to += columns;
+    }
+  }
+
+  segmentImage.cursorColumn = header->cursorColumn;
+  segmentImage.cursorRow = header->cursorRow;
+  segmentImage.number = header->number;
+  segmentImage.flags = header->flags;
+  return 1;
+}
+
+static int
+refreshSegmentImage (const ScreenSegmentHeader *header) {
+  int attempts = 0;
+
+  while (1) {
+    uint32_t sequence = header->sequence;
+    readBarrier();
+
+    if (!(sequence & 1)) {
+      if (segmentImage.consistent && (sequence == segmentImage.sequence)) return 1;
+
+      if (header->size > shmSize) {
+        if (!remapSegment()) return 0;
+
+        /* The image has moved to a bigger segment which has its own sequence. */
+        if (!(header = getSegmentHeader())) return 0;
+        segmentImage.consistent = 0;
+        continue;
+      }
+
+      if (!copySegmentImage(header, sequence)) return 0;
+      readBarrier();
+
+      if (header->sequence == sequence) {
+        segmentImage.sequence = sequence;
+        segmentImage.consistent = 1;
+        return 1;
+      }
+    }
+
+    if (++attempts == 10) {
+      logMessage(LOG_DEBUG, "screen image not stable");
+      return 0;
+    }
+
+    approximateDelay(1);
+  }
+}
+
+static int
+refresh_ScreenScreen (void) {
+  const ScreenSegmentHeader *header = getSegmentHeader();
+
+  if (header) refreshSegmentImage(header);
+  return 1;
+}
+
 static const unsigned char *
 getAuxiliaryData (void) {
-  return &shmAddress[4 + (shmAddress[0] * shmAddress[1] * 2)];
+  static const unsigned char none[2] = {0, 0};
+  size_t offset = 4 + (shmAddress[0] * shmAddress[1] * 2);
+
+  if (offset + 2 > shmSize) return none;
+  return &shmAddress[offset];
+}
+
+static unsigned char
+getScreenFlags (void) {
+  if (getSegmentHeader()) return segmentImage.flags;
+  return getAuxiliaryData()[1];
 }
 
 static int
 currentVirtualTerminal_ScreenScreen (void) {
+  if (getSegmentHeader()) return segmentImage.number;
   return getAuxiliaryData()[0];
 }
 
@@ -168,10 +390,18 @@ userVirtualTerminal_ScreenScreen (int number) {
 
 static void
 describe_ScreenScreen (ScreenDescription *description) {
-  description->cols = shmAddress[0];
-  description->rows = shmAddress[1];
-  description->posx = shmAddress[2];
-  description->posy = shmAddress[3];
+  if (getSegmentHeader()) {
+    description->cols = segmentImage.columns;
+    description->rows = segmentImage.rows;
+    description->posx = segmentImage.cursorColumn;
+    description->posy = segmentImage.cursorRow;
+  } else {
+    description->cols = shmAddress[0];
+    description->rows = shmAddress[1];
+    description->posx = shmAddress[2];
+    description->posy = shmAddress[3];
+  }
+
   description->number = currentVirtualTerminal_ScreenScreen();
 }
 
@@ -181,22 +411,42 @@ readCharacters_ScreenScreen (const ScreenBox *box, ScreenCharacter *buffer) {
   describe_ScreenScreen(&description);
   if (validateScreenBox(box, description.cols, description.rows)) {
     ScreenCharacter *character = buffer;
-    unsigned char *text = shmAddress + 4 + (box->top * description.cols) + box->left;
-    unsigned char *attributes = text + (description.cols * description.rows);
     size_t increment = description.cols - box->width;
     int row;
-    for (row=0; row<box->height; row++) {
-      int column;
-      for (column=0; column<box->width; column++) {
-        wint_t wc = convertCharToWchar(*text++);
-        if (wc == WEOF) wc = L'?';
-        character->text = wc;
-        character->attributes = *attributes++;
-        character++;
+
+    if (getSegmentHeader()) {
+      const ScreenSegmentCharacter *from = segmentImage.characters + (box->top * description.cols) + box->left;
+
+      for (row=0; row<box->height; row++) {
+        int column;
+        for (column=0; column<box->width; column++) {
+          character->text = from->text;
+          character->attributes = from->attributes;
+          character++;
+          from++;
+        }
+        from += increment;
+      }
+    } else {
+      unsigned char *text = shmAddress + 4 + (box->top * description.cols) + box->left;
+      unsigned char *attributes = text + (description.cols * description.rows);
+
+      if (4 + (description.cols * description.rows * 2) > shmSize) return 0;
+
+      for (row=0; row<box->height; row++) {
+        int column;
+        for (column=0; column<box->width; column++) {
+          wint_t wc = convertCharToWchar(*text++);
+          if (wc == WEOF) wc = L'?';
+          character->text = wc;
+          character->attributes = *attributes++;
+          character++;
+        }
+        text += increment;
+        attributes += increment;
       }
-      text += increment;
-      attributes += increment;
     }
+
     return 1;
   }
   return 0;
@@ -204,7 +454,7 @@ readCharacters_ScreenScreen (const ScreenBox *box, ScreenCharacter *buffer) {
 
 static int
 insertKey_ScreenScreen (ScreenKey key) {
-  const unsigned char flags = getAuxiliaryData()[1];
+  const unsigned char flags = getScreenFlags();
   wchar_t character = key & SCR_KEY_CHAR_MASK;
   char buffer[3];
   char *sequence;
@@ -214,7 +464,7 @@ insertKey_ScreenScreen (ScreenKey key) {
 
   if (isSpecialKey(key)) {
 #define KEY(key,string) case (key): sequence = (string); break
-#define CURSOR_KEY(key,string1,string2) KEY((key), ((flags & 0X01)? (string1): (string2)))
+#define CURSOR_KEY(key,string1,string2) KEY((key), ((flags & SCREEN_FLAG_CURSOR_KEYS)? (string1): (string2)))
     switch (character) {
       KEY(SCR_KEY_ENTER, "\r");
       KEY(SCR_KEY_TAB, "\t");
@@ -292,12 +542,22 @@ destruct_ScreenScreen (void) {
 #endif /* HAVE_SHM_OPEN */
 
   shmAddress = NULL;
+  shmSize = 0;
+
+  if (segmentImage.characters) {
+    free(segmentImage.characters);
+    segmentImage.characters = NULL;
+  }
+
+  segmentImage.size = 0;
+  segmentImage.consistent = 0;
 }
 
 static void
 scr_initialize (MainScreen *main) {
   initializeRealScreen(main);
   main->base.currentVirtualTerminal = currentVirtualTerminal_ScreenScreen;
+  main->base.refresh = refresh_ScreenScreen;
   main->base.describe = describe_ScreenScreen;
   main->base.readCharacters = readCharacters_ScreenScreen;
   main->base.insertKey = insertKey_ScreenScreen;
@@ -19,10 +19,57 @@
 #ifndef BRLTTY_INCLUDED_SCR_SHM
 #define BRLTTY_INCLUDED_SCR_SHM
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif /* __cplusplus */
 
+/* Version 1 of the shared screen image (still supported) is:
+ *   width, height, cursor column, cursor row (one byte each)
+ *   the characters (one byte each, in the local character set)
+ *   the attributes (one byte each)
+ *   the window number and the flags (one byte each)
+ *
+ * Version 2 starts with the header below. Its first two bytes are zero so
+ * that a version 1 reader sees an empty screen rather than garbage. The
+ * writer increments the sequence number both before and after changing the
+ * image, i.e. it's odd while an update is in progress. Bit n (least
+ * significant first) of byte n/8 of the dirty bitmap is set if row n has
+ * changed since the previous update (sequence number minus 2).
+ */
+
+#define SCREEN_SEGMENT_MAGIC 0X42525453
+#define SCREEN_SEGMENT_VERSION 2
+
+#define SCREEN_FLAG_CURSOR_KEYS 0X01 /* cursor keys are in application mode */
+#define SCREEN_FLAG_KEYPAD      0X02 /* keypad is in application mode */
+
+typedef struct {
+  unsigned char zero[2];
+  unsigned char version;
+  unsigned char flags;
+  uint32_t magic;
+  volatile uint32_t sequence;
+  uint32_t size; /* of the whole segment */
+
+  uint32_t dirtyOffset;
+  uint32_t cellsOffset;
+
+  uint16_t columns;
+  uint16_t rows;
+  uint16_t cursorColumn;
+  uint16_t cursorRow;
+
+  uint16_t number;
+  uint16_t reserved;
+} ScreenSegmentHeader;
+
+typedef struct {
+  uint32_t text; /* UTF-32 */
+  uint32_t attributes;
+} ScreenSegmentCharacter;
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -0,0 +1,916 @@
+/*
+ * BRLTTY - A background process providing access to the console screen (when in
+ *          text mode) for a blind person using a refreshable braille display.
+ *
+ * Copyright (C) 1995-2014 by The BRLTTY Developers.
+ *
+ * BRLTTY comes with ABSOLUTELY NO WARRANTY.
+ *
+ * This is free software, placed under the terms of the
+ * GNU General Public License, as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any
+ * later version. Please see the file LICENSE-GPL for details.
+ *
+ * Web Page: http://mielke.cc/brltty/
+ *
+ * This software is maintained by Dave Mielke <dave@mielke.cc>.
+ */
+
+/* apiload puts load on BRLTTY's API and measures how it copes
+ *
+ * It plays the part of the display behind BRLTTY's Virtual braille driver,
+ * so that it sees what gets written to the driver and can inject commands.
+ * BRLTTY is to be started with -b vr -d client:127.0.0.1:port once apiload
+ * listens.  Clients are then connected, spread over the windows of one or
+ * more ttys, and write frames which identify them at a steady rate while the
+ * focus moves between the windows of each tty.  Only the tty which the
+ * screen shows reaches the display, so the clients of the others load the
+ * server without having their frames shown.  ROUTE commands are injected through the
+ * driver, and the driver can be told to stall now and then so as to see
+ * whether screen updates and clients keep up with a slow device.  The
+ * latency from a write to the driver showing it, of the write call itself,
+ * and from a command to a client getting it, is reported.
+ */
+
+#include "prologue.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#ifdef HAVE_SYS_SELECT_H
+#include <sys/select.h>
+#else /* HAVE_SYS_SELECT_H */
+#include <sys/time.h>
+#endif /* HAVE_SYS_SELECT_H */
+
+#include "options.h"
+#include "log.h"
+#include "parse.h"
+#include "timing.h"
+#include "async_thread.h"
+
+#define BRLAPI_NO_DEPRECATED
+#include "brlapi.h"
+
+static brlapi_connectionSettings_t settings;
+
+static char *opt_clientCount;
+static char *opt_windowCount;
+static char *opt_writeRate;
+static char *opt_keyRate;
+static char *opt_focusInterval;
+static char *opt_duration;
+static char *opt_driverPort;
+static char *opt_cellCount;
+static char *opt_ttyNumber;
+static char *opt_ttyCount;
+static char *opt_stallInterval;
+static char *opt_stallDuration;
+
+BEGIN_OPTION_TABLE(programOptions)
+  { .letter = 'c',
+    .word = "clients",
+    .argument = "count",
+    .setting.string = &opt_clientCount,
+    .defaultSetting = "4",
+    .description = "Number of clients to connect."
+  },
+
+  { .letter = 'w',
+    .word = "windows",
+    .argument = "count",
+    .setting.string = &opt_windowCount,
+    .defaultSetting = "2",
+    .description = "Number of windows to spread the clients over."
+  },
+
+  { .letter = 'r',
+    .word = "write-rate",
+    .argument = "writes",
+    .setting.string = &opt_writeRate,
+    .defaultSetting = "20",
+    .description = "Writes per second by each client."
+  },
+
+  { .letter = 'k',
+    .word = "key-rate",
+    .argument = "keys",
+    .setting.string = &opt_keyRate,
+    .defaultSetting = "10",
+    .description = "Commands per second injected through the driver."
+  },
+
+  { .letter = 'f',
+    .word = "focus-interval",
+    .argument = "milliseconds",
+    .setting.string = &opt_focusInterval,
+    .defaultSetting = "1000",
+    .description = "Time between focus changes (0 for none)."
+  },
+
+  { .letter = 'd',
+    .word = "duration",
+    .argument = "seconds",
+    .setting.string = &opt_duration,
+    .defaultSetting = "10",
+    .description = "How long to put load on the server."
+  },
+
+  { .letter = 'p',
+    .word = "driver-port",
+    .argument = "port",
+    .setting.string = &opt_driverPort,
+    .defaultSetting = "35752",
+    .description = "Local TCP port which the Virtual braille driver connects to."
+  },
+
+  { .letter = 'n',
+    .word = "cells",
+    .argument = "count",
+    .setting.string = &opt_cellCount,
+    .defaultSetting = "40",
+    .description = "Number of cells the display pretends to have."
+  },
+
+  { .letter = 't',
+    .word = "tty",
+    .argument = "number",
+    .setting.string = &opt_ttyNumber,
+    .defaultSetting = "1",
+    .description = "First tty which holds the windows."
+  },
+
+  { .letter = 'y',
+    .word = "ttys",
+    .argument = "count",
+    .setting.string = &opt_ttyCount,
+    .defaultSetting = "1",
+    .description = "Number of ttys to spread the windows over."
+  },
+
+  { .letter = 's',
+    .word = "stall-interval",
+    .argument = "milliseconds",
+    .setting.string = &opt_stallInterval,
+    .defaultSetting = "0",
+    .description = "Time between driver stalls (0 for none)."
+  },
+
+  { .letter = 'l',
+    .word = "stall-duration",
+    .argument = "milliseconds",
+    .setting.string = &opt_stallDuration,
+    .defaultSetting = "500",
+    .description = "How long each driver stall lasts."
+  },
+
+  { .letter = 'b',
+    .word = "brlapi",
+    .argument = "[host][:port]",
+    .setting.string = &settings.host,
+    .description = "BrlAPIa host and/or port to connect to."
+  },
+
+  { .letter = 'a',
+    .word = "auth",
+    .argument = "file",
+    .setting.string = &settings.auth,
+    .description = "BrlAPI authorization/authentication string."
+  },
+END_OPTION_TABLE
+
+#ifdef ASYNC_CAN_HANDLE_THREADS
+#define FRAME_PREFIX "apiload"
+#define WRITE_HISTORY 0X400
+
+typedef struct {
+  pthread_mutex_t mutex;
+  long int *samples; /* microseconds */
+  size_t count;
+  size_t size;
+} LatencySamples;
+
+typedef struct {
+  unsigned int number;
+  int tty;
+  int window;
+  brlapi_handle_t *handle;
+  pthread_t thread;
+
+  /* shared with the driver thread */
+  pthread_mutex_t mutex;
+  unsigned int writes;
+  TimeValue writeTimes[WRITE_HISTORY]; /* indexed by sequence number */
+} LoadClient;
+
+static int clientCount;
+static int windowCount;
+static int writeRate;
+static int keyRate;
+static int focusInterval;
+static int duration;
+static int driverPort;
+static int cellCount;
+static int ttyNumber;
+static int ttyCount;
+static int stallInterval;
+static int stallDuration;
+
+static LoadClient *clients;
+static volatile int stopping;
+static pthread_mutex_t statisticsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static LatencySamples writeLatencies = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+static LatencySamples callLatencies = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+static LatencySamples keyLatencies = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+static unsigned int framesShown;
+static unsigned int keysInjected;
+static unsigned int keysLost;
+static unsigned int stallsInjected;
+static unsigned int focusChanges;
+static unsigned int clientFailures;
+
+/* When each injected ROUTE command was sent, indexed by its column */
+static struct {
+  TimeValue time;
+  int pending;
+} keyTimes[BRLAPI_KEY_CMD_ARG_MASK];
+
+static long int
+microsecondsBetween (const TimeValue *from, const TimeValue *to) {
+  return ((long int)(to->seconds - from->seconds) * 1000000)
+       + ((to->nanoseconds - from->nanoseconds) / 1000);
+}
+
+static void
+addLatency (LatencySamples *latencies, long int microseconds) {
+  pthread_mutex_lock(&latencies->mutex);
+
+  if (latencies->count == latencies->size) {
+    size_t newSize = latencies->size? latencies->size << 1: 0X100;
+    long int *newSamples = realloc(latencies->samples, ARRAY_SIZE(newSamples, newSize));
+
+    if (!newSamples) {
+      logMallocError();
+      goto done;
+    }
+
+    latencies->samples = newSamples;
+    latencies->size = newSize;
+  }
+
+  latencies->samples[latencies->count++] = microseconds;
+
+done:
+  pthread_mutex_unlock(&latencies->mutex);
+}
+
+static int
+compareLatencies (const void *item1, const void *item2) {
+  const long int *latency1 = item1;
+  const long int *latency2 = item2;
+
+  if (*latency1 < *latency2) return -1;
+  if (*latency1 > *latency2) return 1;
+  return 0;
+}
+
+static void
+reportLatencies (const char *label, LatencySamples *latencies) {
+  size_t count = latencies->count;
+
+  if (!count) {
+    printf("%s: no samples\n", label);
+    return;
+  }
+
+  qsort(latencies->samples, count, sizeof(*latencies->samples), compareLatencies);
+  printf("%s: %lu samples, p50 %.3fms, p99 %.3fms, max %.3fms\n",
+         label, (unsigned long)count,
+         latencies->samples[count / 2] / 1000.0,
+         latencies->samples[(count * 99) / 100] / 1000.0,
+         latencies->samples[count - 1] / 1000.0);
+}
+
+static void
+handleKey (brlapi_keyCode_t code) {
+  if ((code & BRLAPI_KEY_TYPE_MASK) != BRLAPI_KEY_TYPE_CMD) return;
+  if ((code & BRLAPI_KEY_CMD_BLK_MASK) != BRLAPI_KEY_CMD_ROUTE) return;
+
+  {
+    unsigned int column = code & BRLAPI_KEY_CMD_ARG_MASK;
+    TimeValue now;
+
+    /* The driver takes columns from 1 */
+    if (!column--) return;
+
+    getMonotonicTime(&now);
+    pthread_mutex_lock(&statisticsMutex);
+
+    if (keyTimes[column].pending) {
+      keyTimes[column].pending = 0;
+      pthread_mutex_unlock(&statisticsMutex);
+      addLatency(&keyLatencies, microsecondsBetween(&keyTimes[column].time, &now));
+    } else {
+      pthread_mutex_unlock(&statisticsMutex);
+    }
+  }
+}
+
+/* Connects, and takes the tty at path unless count is negative */
+static brlapi_handle_t *
+openHandle (int *path, int count) {
+  brlapi_handle_t *handle;
+
+  if (!(handle = malloc(brlapi_getHandleSize()))) {
+    logMallocError();
+    return NULL;
+  }
+
+  if (brlapi__openConnection(handle, &settings, NULL) == (brlapi_fileDescriptor)(-1)) {
+    logMessage(LOG_ERR, "openConnection: %s", brlapi_strerror(&brlapi_error));
+    free(handle);
+    return NULL;
+  }
+
+  if ((count >= 0) && (brlapi__enterTtyModeWithPath(handle, path, count, NULL) < 0)) {
+    logMessage(LOG_ERR, "enterTtyMode: %s", brlapi_strerror(&brlapi_error));
+    brlapi__closeConnection(handle);
+    free(handle);
+    return NULL;
+  }
+
+  return handle;
+}
+
+static void
+closeHandle (brlapi_handle_t *handle) {
+  brlapi__closeConnection(handle);
+  free(handle);
+}
+
+static void
+handleClientError (LoadClient *client, const char *action) {
+  logMessage(LOG_ERR, "client %u: %s: %s", client->number, action, brlapi_strerror(&brlapi_error));
+
+  pthread_mutex_lock(&statisticsMutex);
+  clientFailures += 1;
+  pthread_mutex_unlock(&statisticsMutex);
+}
+
+static ASYNC_THREAD_FUNCTION(runClient) {
+  LoadClient *client = argument;
+  brlapi_handle_t *handle = client->handle;
+  long int period = 1000000 / writeRate;
+  TimeValue next;
+
+  getMonotonicTime(&next);
+
+  while (!stopping) {
+    char text[0X40];
+    TimeValue written;
+    TimeValue now;
+    long int timeout;
+
+    snprintf(text, sizeof(text), FRAME_PREFIX " %u %u", client->number, client->writes);
+    getMonotonicTime(&written);
+
+    /* The frame can be shown before the write call returns */
+    pthread_mutex_lock(&client->mutex);
+    client->writeTimes[client->writes % WRITE_HISTORY] = written;
+    pthread_mutex_unlock(&client->mutex);
+
+    if (brlapi__writeText(handle, BRLAPI_CURSOR_OFF, text) < 0) {
+      handleClientError(client, "writeText");
+      break;
+    }
+
+    getMonotonicTime(&now);
+    addLatency(&callLatencies, microsecondsBetween(&written, &now));
+
+    pthread_mutex_lock(&client->mutex);
+    client->writes += 1;
+    pthread_mutex_unlock(&client->mutex);
+    next.nanoseconds += (period % 1000000) * 1000;
+    next.seconds += period / 1000000;
+    normalizeTimeValue(&next);
+
+    /* Take the keys which arrive until the next write is due */
+    while (1) {
+      brlapi_keyCode_t codes[0X40];
+      int count;
+
+      getMonotonicTime(&now);
+      if ((timeout = microsecondsBetween(&now, &next)) <= 0) break;
+
+      if ((count = brlapi__readKeys(handle, codes, ARRAY_COUNT(codes), (timeout + 999) / 1000)) < 0) {
+        if ((brlapi_errno == BRLAPI_ERROR_LIBCERR) && (brlapi_libcerrno == EINTR)) continue;
+        handleClientError(client, "readKeys");
+        return NULL;
+      }
+
+      {
+        int index;
+
+        for (index=0; index<count; index+=1) handleKey(codes[index]);
+      }
+    }
+  }
+
+  return NULL;
+}
+
+static void
+handleDriverLine (char *line) {
+  static const char visual[] = "Visual \"" FRAME_PREFIX " ";
+  unsigned int number;
+  unsigned int sequence;
+
+  if (strncmp(line, visual, sizeof(visual)-1) != 0) return;
+  if (sscanf(line+sizeof(visual)-1, "%u %u", &number, &sequence) != 2) return;
+  if (number >= clientCount) return;
+
+  {
+    LoadClient *client = &clients[number];
+    TimeValue written;
+    TimeValue now;
+
+    getMonotonicTime(&now);
+    pthread_mutex_lock(&client->mutex);
+
+    /* The slot of a sequence number is reused once it's that far behind */
+    if (client->writes - sequence >= WRITE_HISTORY) {
+      pthread_mutex_unlock(&client->mutex);
+      return;
+    }
+
+    written = client->writeTimes[sequence % WRITE_HISTORY];
+    pthread_mutex_unlock(&client->mutex);
+    addLatency(&writeLatencies, microsecondsBetween(&written, &now));
+
+    pthread_mutex_lock(&statisticsMutex);
+    framesShown += 1;
+    pthread_mutex_unlock(&statisticsMutex);
+  }
+}
+
+static int
+injectKey (int descriptor) {
+  unsigned int column = keysInjected % cellCount;
+  char command[0X20];
+  int length = snprintf(command, sizeof(command), "ROUTE %u\n", column+1);
+
+  pthread_mutex_lock(&statisticsMutex);
+  if (keyTimes[column].pending) keysLost += 1;
+  keyTimes[column].pending = 1;
+  getMonotonicTime(&keyTimes[column].time);
+  keysInjected += 1;
+  pthread_mutex_unlock(&statisticsMutex);
+
+  if (send(descriptor, command, length, 0) != length) {
+    logSystemError("send");
+    return 0;
+  }
+
+  return 1;
+}
+
+static int
+injectStall (int descriptor) {
+  char command[0X20];
+  int length = snprintf(command, sizeof(command), "stall %d\n", stallDuration);
+
+  if (send(descriptor, command, length, 0) != length) {
+    logSystemError("send");
+    return 0;
+  }
+
+  stallsInjected += 1;
+  return 1;
+}
+
+/* Plays the display, until told to stop */
+static ASYNC_THREAD_FUNCTION(runDriver) {
+  int descriptor = *(int *)argument;
+  char buffer[0X1000];
+  size_t length = 0;
+  long int period = keyRate? 1000000 / keyRate: 0;
+  TimeValue next;
+  TimeValue nextStall;
+
+  getMonotonicTime(&next);
+  nextStall = next;
+  nextStall.seconds += stallInterval / 1000;
+  nextStall.nanoseconds += (stallInterval % 1000) * 1000000;
+  normalizeTimeValue(&nextStall);
+
+  while (!stopping) {
+    fd_set set;
+    struct timeval timeout;
+    TimeValue now;
+    long int wait = 100000;
+
+    if (period) {
+      getMonotonicTime(&now);
+
+      if ((wait = microsecondsBetween(&now, &next)) <= 0) {
+        if (!injectKey(descriptor)) break;
+        next.nanoseconds += (period % 1000000) * 1000;
+        next.seconds += period / 1000000;
+        normalizeTimeValue(&next);
+        continue;
+      }
+    }
+
+    if (stallInterval) {
+      long int stallWait;
+
+      getMonotonicTime(&now);
+
+      if ((stallWait = microsecondsBetween(&now, &nextStall)) <= 0) {
+        if (!injectStall(descriptor)) break;
+        nextStall.seconds += stallInterval / 1000;
+        nextStall.nanoseconds += (stallInterval % 1000) * 1000000;
+        normalizeTimeValue(&nextStall);
+        continue;
+      }
+
+      if (stallWait < wait) wait = stallWait;
+    }
+
+    FD_ZERO(&set);
+    FD_SET(descriptor, &set);
+    timeout.tv_sec = wait / 1000000;
+    timeout.tv_usec = wait % 1000000;
+
+    switch (select(descriptor+1, &set, NULL, NULL, &timeout)) {
+      case -1:
+        if (errno == EINTR) continue;
+        logSystemError("select");
+        return NULL;
+
+      case 0:
+        continue;
+
+      default:
+        break;
+    }
+
+    {
+      ssize_t count = recv(descriptor, &buffer[length], sizeof(buffer)-1-length, 0);
+      char *line = buffer;
+      char *end;
+
+      if (count <= 0) {
+        if (count == -1) logSystemError("recv");
+        else logMessage(LOG_ERR, "driver disconnected");
+        break;
+      }
+
+      length += count;
+      buffer[length] = 0;
+
+      while ((end = strchr(line, '\n'))) {
+        *end = 0;
+        handleDriverLine(line);
+        line = end + 1;
+      }
+
+      length -= line - buffer;
+      memmove(buffer, line, length);
+      if (length == sizeof(buffer)-1) length = 0;
+    }
+  }
+
+  return NULL;
+}
+
+static int
+acceptDriver (void) {
+  int server;
+  int descriptor = -1;
+  struct sockaddr_in address;
+  char cells[0X20];
+  int on = 1;
+
+  if ((server = socket(PF_INET, SOCK_STREAM, 0)) == -1) {
+    logSystemError("socket");
+    return -1;
+  }
+
+  setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(driverPort);
+
+  if (bind(server, (struct sockaddr *)&address, sizeof(address)) == -1) {
+    logSystemError("bind");
+    goto done;
+  }
+
+  if (listen(server, 1) == -1) {
+    logSystemError("listen");
+    goto done;
+  }
+
+  fprintf(stderr, "Waiting for the Virtual braille driver on port %d\n", driverPort);
+
+  if ((descriptor = accept(server, NULL, NULL)) == -1) {
+    logSystemError("accept");
+    goto done;
+  }
+
+  snprintf(cells, sizeof(cells), "cells %d\n", cellCount);
+  if (send(descriptor, cells, strlen(cells), 0) == -1) {
+    logSystemError("send");
+    close(descriptor);
+    descriptor = -1;
+  }
+
+done:
+  close(server);
+  return descriptor;
+}
+
+/* The server only knows the size of the display once the driver is started */
+static int
+awaitDisplay (void) {
+  brlapi_handle_t *handle;
+  int ok = 0;
+  TimePeriod period;
+
+  startTimePeriod(&period, 10000);
+
+  /* the driver can connect before the server is listening */
+  while (!(handle = openHandle(NULL, -1))) {
+    if (afterTimePeriod(&period, NULL)) return 0;
+    approximateDelay(100);
+  }
+
+  do {
+    unsigned int width, height;
+
+    if (brlapi__getDisplaySize(handle, &width, &height) < 0) {
+      logMessage(LOG_ERR, "getDisplaySize: %s", brlapi_strerror(&brlapi_error));
+      break;
+    }
+
+    if (width && height) {
+      ok = 1;
+      break;
+    }
+
+    approximateDelay(100);
+  } while (!afterTimePeriod(&period, NULL));
+
+  if (!ok) logMessage(LOG_ERR, "the braille driver didn't start");
+  closeHandle(handle);
+  return ok;
+}
+
+/* The server accepts connections one at a time, so they are all made
+ * before the load is started */
+static int
+connectClients (void) {
+  int index;
+
+  for (index=0; index<clientCount; index+=1) {
+    LoadClient *client = &clients[index];
+    int path[] = {ttyNumber + (index % ttyCount), ((index / ttyCount) % windowCount) + 1};
+
+    client->number = index;
+    client->tty = path[0];
+    client->window = path[1];
+    pthread_mutex_init(&client->mutex, NULL);
+    if (!(client->handle = openHandle(path, ARRAY_COUNT(path)))) return 0;
+  }
+
+  return 1;
+}
+
+static void
+disconnectClients (void) {
+  int index;
+
+  for (index=0; index<clientCount; index+=1) {
+    LoadClient *client = &clients[index];
+
+    if (client->handle) {
+      closeHandle(client->handle);
+      client->handle = NULL;
+    }
+  }
+}
+
+/* Takes each tty, so as to be able to move the focus between its windows */
+static brlapi_handle_t **
+openFocusHandles (void) {
+  brlapi_handle_t **handles;
+  int index;
+
+  if (!(handles = calloc(ttyCount, sizeof(*handles)))) {
+    logMallocError();
+    return NULL;
+  }
+
+  for (index=0; index<ttyCount; index+=1) {
+    int path[] = {ttyNumber + index};
+
+    if (!(handles[index] = openHandle(path, ARRAY_COUNT(path)))) goto error;
+
+    if (brlapi__ignoreAllKeys(handles[index]) < 0) {
+      logMessage(LOG_ERR, "ignoreAllKeys: %s", brlapi_strerror(&brlapi_error));
+      goto error;
+    }
+  }
+
+  return handles;
+
+error:
+  while (index >= 0) {
+    if (handles[index]) closeHandle(handles[index]);
+    index -= 1;
+  }
+
+  free(handles);
+  return NULL;
+}
+
+static void
+closeFocusHandles (brlapi_handle_t **handles) {
+  int index;
+
+  for (index=0; index<ttyCount; index+=1) closeHandle(handles[index]);
+  free(handles);
+}
+
+/* Moves the focus between the windows, until the duration is over */
+static void
+moveFocus (brlapi_handle_t **handles) {
+  int window = 0;
+  TimePeriod period;
+
+  startTimePeriod(&period, duration * 1000);
+
+  while (!afterTimePeriod(&period, NULL)) {
+    if (handles) {
+      int index;
+
+      approximateDelay(focusInterval);
+      window = (window + 1) % windowCount;
+
+      for (index=0; index<ttyCount; index+=1) {
+        if (brlapi__setFocus(handles[index], window+1) < 0) {
+          logMessage(LOG_ERR, "setFocus: %s", brlapi_strerror(&brlapi_error));
+        } else {
+          focusChanges += 1;
+        }
+      }
+    } else {
+      approximateDelay(100);
+    }
+  }
+}
+
+static int
+validateOption (int *value, const char *name, const char *string, int minimum, int maximum) {
+  if (!validateInteger(value, string, &minimum, &maximum)) {
+    logMessage(LOG_ERR, "invalid %s: %s", name, string);
+    return 0;
+  }
+
+  return 1;
+}
+#endif /* ASYNC_CAN_HANDLE_THREADS */
+
+int
+main (int argc, char *argv[]) {
+  settings.host = NULL; settings.auth = NULL;
+
+  {
+    static const OptionsDescriptor descriptor = {
+      OPTION_TABLE(programOptions),
+      .applicationName = "apiload"
+    };
+    PROCESS_OPTIONS(descriptor, argc, argv);
+  }
+
+#ifdef ASYNC_CAN_HANDLE_THREADS
+  if (!validateOption(&clientCount, "client count", opt_clientCount, 1, 1000)) return PROG_EXIT_SYNTAX;
+  if (!validateOption(&windowCount, "window count", opt_windowCount, 1, 1000)) return PROG_EXIT_SYNTAX;
+  if (!validateOption(&writeRate, "write rate", opt_writeRate, 1, 100000)) return PROG_EXIT_SYNTAX;
+  if (!validateOption(&keyRate, "key rate", opt_keyRate, 0, 100000)) return PROG_EXIT_SYNTAX;
+  if (!validateOption(&focusInterval, "focus interval", opt_focusInterval, 0, 3600000)) return PROG_EXIT_SYNTAX;
+  if (!validateOption(&duration, "duration", opt_duration, 1, 86400)) return PROG_EXIT_SYNTAX;
+  if (!validateOption(&driverPort, "driver port", opt_driverPort, 1, 0XFFFF)) return PROG_EXIT_SYNTAX;
+  if (!validateOption(&cellCount, "cell count", opt_cellCount, 20, 1000)) return PROG_EXIT_SYNTAX;
+  if (!validateOption(&ttyNumber, "tty number", opt_ttyNumber, 0, 0X7FFFFFFF)) return PROG_EXIT_SYNTAX;
+  if (!validateOption(&ttyCount, "tty count", opt_ttyCount, 1, 0X7FFFFFFF - ttyNumber)) return PROG_EXIT_SYNTAX;
+  if (!validateOption(&stallInterval, "stall interval", opt_stallInterval, 0, 3600000)) return PROG_EXIT_SYNTAX;
+  if (!validateOption(&stallDuration, "stall duration", opt_stallDuration, 1, 60000)) return PROG_EXIT_SYNTAX;
+
+  {
+    ProgramExitStatus exitStatus = PROG_EXIT_SUCCESS;
+    int driver;
+    pthread_t driverThread;
+    TimeValue start;
+    long int elapsed;
+    unsigned int writes = 0;
+    brlapi_handle_t **focus = NULL;
+    int started = clientCount;
+    int index;
+
+    if ((driver = acceptDriver()) == -1) return PROG_EXIT_FATAL;
+
+    if (!(clients = calloc(clientCount, sizeof(*clients)))) {
+      logMallocError();
+      return PROG_EXIT_FATAL;
+    }
+
+    if (asyncCreateThread("apiload-driver", &driverThread, NULL, runDriver, &driver) != 0) {
+      logMessage(LOG_ERR, "cannot create driver thread");
+      return PROG_EXIT_FATAL;
+    }
+
+    if (!awaitDisplay() || !connectClients()) {
+      disconnectClients();
+      stopping = 1;
+      pthread_join(driverThread, NULL);
+      return PROG_EXIT_FATAL;
+    }
+
+    if (focusInterval && (windowCount > 1)) {
+      if (!(focus = openFocusHandles())) {
+        disconnectClients();
+        stopping = 1;
+        pthread_join(driverThread, NULL);
+        return PROG_EXIT_FATAL;
+      }
+    }
+
+    fprintf(stderr, "Running %d clients over %d windows of %d ttys for %d seconds\n",
+            clientCount, windowCount, ttyCount, duration);
+    getMonotonicTime(&start);
+
+    for (index=0; index<clientCount; index+=1) {
+      LoadClient *client = &clients[index];
+
+      if (asyncCreateThread("apiload-client", &client->thread, NULL, runClient, client) != 0) {
+        logMessage(LOG_ERR, "cannot create client thread");
+        stopping = 1;
+        started = index;
+        exitStatus = PROG_EXIT_FATAL;
+        break;
+      }
+    }
+
+    if (!stopping) moveFocus(focus);
+    stopping = 1;
+
+    for (index=0; index<started; index+=1) {
+      pthread_join(clients[index].thread, NULL);
+      writes += clients[index].writes;
+    }
+
+    elapsed = getMonotonicElapsed(&start);
+    pthread_join(driverThread, NULL);
+    close(driver);
+    if (focus) closeFocusHandles(focus);
+    disconnectClients();
+
+    printf("%u writes (%.1f/s), %u frames shown (%.1f/s), %u focus changes\n",
+           writes, writes * 1000.0 / elapsed,
+           framesShown, framesShown * 1000.0 / elapsed,
+           focusChanges);
+    reportLatencies("write to driver", &writeLatencies);
+    reportLatencies("write call", &callLatencies);
+
+    printf("%u keys injected (%.1f/s), %u delivered, %u lost\n",
+           keysInjected, keysInjected * 1000.0 / elapsed,
+           (unsigned int)keyLatencies.count, keysLost);
+    reportLatencies("key to client", &keyLatencies);
+
+    if (stallsInjected) {
+      printf("%u driver stalls of %dms injected\n", stallsInjected, stallDuration);
+    }
+
+    if (clientFailures) {
+      printf("%u clients failed\n", clientFailures);
+      exitStatus = PROG_EXIT_FATAL;
+    }
+
+    return exitStatus;
+  }
+#else /* ASYNC_CAN_HANDLE_THREADS */
+  logMessage(LOG_ERR, "threads are not supported by this build");
+  return PROG_EXIT_FATAL;
+#endif /* ASYNC_CAN_HANDLE_THREADS */
+}
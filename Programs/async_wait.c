@@ -143,12 +143,19 @@ awaitAction (long int timeout) {
 int
 asyncAwaitCondition (int timeout, AsyncConditionTester *testCondition, void *data) {
   TimePeriod period;
+  int first = 1;
   startTimePeriod(&period, timeout);
 
   while (!(testCondition && testCondition(data))) {
     long int elapsed;
 
-    if (afterTimePeriod(&period, &elapsed)) return 0;
+    if (afterTimePeriod(&period, &elapsed)) {
+      /* a zero timeout still handles what's already pending */
+      if (!first) return 0;
+      elapsed = timeout;
+    }
+
+    first = 0;
     awaitAction(timeout - elapsed);
   }
 
@@ -128,6 +128,19 @@ extern int writeBraillePacket (
   const void *packet, size_t size
 );
 
+typedef enum {
+  BRL_REGION_UNTAGGED,
+  BRL_REGION_TEXT,
+  BRL_REGION_STATUS
+} BrailleRegion;
+
+extern int queueBraillePacket (
+  BrailleDisplay *brl,
+  GioEndpoint *endpoint,
+  const void *packet, size_t size,
+  BrailleRegion region
+);
+
 typedef int BrailleRequestWriter (BrailleDisplay *brl);
 
 typedef size_t BraillePacketReader (
@@ -196,6 +209,16 @@ extern int cellsHaveChanged (
   unsigned int *from, unsigned int *to, int *force
 );
 
+typedef struct {
+  unsigned int from;
+  unsigned int to;
+} CellSegment;
+
+extern unsigned int cellSegmentsHaveChanged (
+  unsigned char *cells, const unsigned char *new, unsigned int count,
+  CellSegment *segments, unsigned int limit, unsigned int gap, int *force
+);
+
 extern int textHasChanged (
   wchar_t *text, const wchar_t *new, unsigned int count,
   unsigned int *from, unsigned int *to, int *force
@@ -0,0 +1,187 @@
+/*
+ * BRLTTY - A background process providing access to the console screen (when in
+ *          text mode) for a blind person using a refreshable braille display.
+ *
+ * Copyright (C) 1995-2014 by The BRLTTY Developers.
+ *
+ * BRLTTY comes with ABSOLUTELY NO WARRANTY.
+ *
+ * This is free software, placed under the terms of the
+ * GNU General Public License, as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any
+ * later version. Please see the file LICENSE-GPL for details.
+ *
+ * Web Page: http://mielke.cc/brltty/
+ *
+ * This software is maintained by Dave Mielke <dave@mielke.cc>.
+ */
+
+#include "prologue.h"
+
+#include <string.h>
+
+#include "brl.h"
+
+int
+cellsHaveChanged (
+  unsigned char *cells, const unsigned char *new, unsigned int count,
+  unsigned int *from, unsigned int *to, int *force
+) {
+  unsigned int first = 0;
+
+  if (force && *force) {
+    *force = 0;
+  } else if (memcmp(cells, new, count) != 0) {
+    if (to) {
+      while (count) {
+        unsigned int last = count - 1;
+        if (cells[last] != new[last]) break;
+        count = last;
+      }
+    }
+
+    if (from) {
+      while (first < count) {
+        if (cells[first] != new[first]) break;
+        first += 1;
+      }
+    }
+  } else {
+    return 0;
+  }
+
+  if (from) *from = first;
+  if (to) *to = count;
+
+  memcpy(cells+first, new+first, count-first);
+  return 1;
+}
+
+/* Like cellsHaveChanged, but reports up to limit separate [from,to) segments.
+ * Changed cells separated by no more than gap unchanged ones share a segment,
+ * so a driver can set gap to its per-write overhead. When there'd be more
+ * than limit segments, the ones separated by the shortest gaps are merged.
+ */
+unsigned int
+cellSegmentsHaveChanged (
+  unsigned char *cells, const unsigned char *new, unsigned int count,
+  CellSegment *segments, unsigned int limit, unsigned int gap, int *force
+) {
+  unsigned int total = 0;
+
+  if (!count || !limit) return 0;
+
+  if (force && *force) {
+    *force = 0;
+
+    segments[0].from = 0;
+    segments[0].to = count;
+    total = 1;
+  } else {
+    unsigned int index = 0;
+
+    while (index < count) {
+      unsigned int from;
+      unsigned int to;
+
+      if (cells[index] == new[index]) {
+        index += 1;
+        continue;
+      }
+
+      from = index;
+      to = ++index;
+
+      while (index < count) {
+        if (cells[index] != new[index]) {
+          to = index + 1;
+        } else if ((index - to) >= gap) {
+          break;
+        }
+
+        index += 1;
+      }
+
+      if (total == limit) {
+        unsigned int nearest = total - 1;
+        unsigned int shortest = from - segments[nearest].to;
+        unsigned int current;
+
+        for (current=0; current<(total-1); current+=1) {
+          unsigned int distance = segments[current+1].from - segments[current].to;
+
+          if (distance < shortest) {
+            shortest = distance;
+            nearest = current;
+          }
+        }
+
+        if (nearest == (total - 1)) {
+          segments[nearest].to = to;
+          continue;
+        }
+
+        segments[nearest].to = segments[nearest+1].to;
+        memmove(&segments[nearest+1], &segments[nearest+2],
+                (total - nearest - 2) * sizeof(*segments));
+        total -= 1;
+      }
+
+      segments[total].from = from;
+      segments[total].to = to;
+      total += 1;
+    }
+
+    if (!total) return 0;
+  }
+
+  memcpy(cells, new, count);
+  return total;
+}
+
+int
+textHasChanged (
+  wchar_t *text, const wchar_t *new, unsigned int count,
+  unsigned int *from, unsigned int *to, int *force
+) {
+  unsigned int first = 0;
+
+  if (force && *force) {
+    *force = 0;
+  } else if (wmemcmp(text, new, count) != 0) {
+    if (to) {
+      while (count) {
+        unsigned int last = count - 1;
+        if (text[last] != new[last]) break;
+        count = last;
+      }
+    }
+
+    if (from) {
+      while (first < count) {
+        if (text[first] != new[first]) break;
+        first += 1;
+      }
+    }
+  } else {
+    return 0;
+  }
+
+  if (from) *from = first;
+  if (to) *to = count;
+
+  wmemcpy(text+first, new+first, count-first);
+  return 1;
+}
+
+int
+cursorHasChanged (int *cursor, int new, int *force) {
+  if (force && *force) {
+    *force = 0;
+  } else if (new == *cursor) {
+    return 0;
+  }
+
+  *cursor = new;
+  return 1;
+}
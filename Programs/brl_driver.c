@@ -29,6 +29,7 @@
 #include "drivers.h"
 #include "driver.h"
 #include "brl.h"
+#include "brl_thread.h"
 #include "brl.auto.h"
 
 #define BRLSYMBOL noBraille
@@ -159,53 +160,65 @@ readBraillePacket (
   if (!endpoint) endpoint = brl->gioEndpoint;
 
   while (1) {
-    unsigned char byte;
+    const unsigned char *input;
+    ssize_t available;
+    ssize_t consumed = 0;
 
     {
       int started = count > 0;
 
-      if (!gioReadByte(endpoint, &byte, started)) {
+      if ((available = gioPeekInput(endpoint, &input, started)) < 1) {
         if (started) logPartialPacket(bytes, count);
         return 0;
       }
     }
 
-  gotByte:
-    if (count < size) {
-      bytes[count++] = byte;
-
-      {
-        BraillePacketVerifierResult result = verifyPacket(brl, bytes, count, &length, data);
-
-        switch (result) {
-          case BRL_PVR_EXCLUDE:
-            count -= 1;
-          case BRL_PVR_INCLUDE:
-            break;
-
-          default:
-            logMessage(LOG_WARNING, "unimplemented braille packet verifier result: %u", result);
-          case BRL_PVR_INVALID:
-            if (--count) {
-              logShortPacket(bytes, count);
-              count = 0;
-              length = 1;
-              goto gotByte;
-            }
-
-            logIgnoredByte(byte);
-            continue;
+    /* Work directly on what the endpoint has already buffered, taking only
+     * the bytes which belong to this packet.
+     */
+    while (consumed < available) {
+      unsigned char byte = input[consumed++];
+
+    gotByte:
+      if (count < size) {
+        bytes[count++] = byte;
+
+        {
+          BraillePacketVerifierResult result = verifyPacket(brl, bytes, count, &length, data);
+
+          switch (result) {
+            case BRL_PVR_EXCLUDE:
+              count -= 1;
+            case BRL_PVR_INCLUDE:
+              break;
+
+            default:
+              logMessage(LOG_WARNING, "unimplemented braille packet verifier result: %u", result);
+            case BRL_PVR_INVALID:
+              if (--count) {
+                logShortPacket(bytes, count);
+                count = 0;
+                length = 1;
+                goto gotByte;
+              }
+
+              logIgnoredByte(byte);
+              continue;
+          }
         }
-      }
 
-      if (count == length) {
-        logInputPacket(bytes, length);
-        return length;
+        if (count == length) {
+          gioSkipInput(endpoint, consumed);
+          logInputPacket(bytes, length);
+          return length;
+        }
+      } else {
+        if (count++ == size) logTruncatedPacket(bytes, size);
+        logDiscardedByte(byte);
       }
-    } else {
-      if (count++ == size) logTruncatedPacket(bytes, size);
-      logDiscardedByte(byte);
     }
+
+    gioSkipInput(endpoint, consumed);
   }
 }
 
@@ -226,6 +239,34 @@ writeBraillePacket (
   return 1;
 }
 
+/* Cell updates are queued while the device is still busy with earlier output,
+ * a newer update for a region replacing an older one which hasn't gone out
+ * yet. Anything written with writeBraillePacket first flushes the queue,
+ * so commands and acknowledgements keep their order.
+ */
+int
+queueBraillePacket (
+  BrailleDisplay *brl,
+  GioEndpoint *endpoint,
+  const void *packet, size_t size,
+  BrailleRegion region
+) {
+  ssize_t result;
+
+  if (!endpoint) endpoint = brl->gioEndpoint;
+  logOutputPacket(packet, size);
+  if ((result = gioQueueData(endpoint, packet, size, region)) == -1) return 0;
+
+  /* queued data is paced by the endpoint itself - only a packet which has
+   * already gone out adds to the delay before the next write
+   */
+  if (result && (endpoint == brl->gioEndpoint)) {
+    brl->writeDelay += gioGetMillisecondsToTransfer(endpoint, size);
+  }
+
+  return 1;
+}
+
 int
 probeBrailleDisplay (
   BrailleDisplay *brl, unsigned int retryLimit,
@@ -278,88 +319,6 @@ probeBrailleDisplay (
   return 0;
 }
 
-int
-cellsHaveChanged (
-  unsigned char *cells, const unsigned char *new, unsigned int count,
-  unsigned int *from, unsigned int *to, int *force
-) {
-  unsigned int first = 0;
-
-  if (force && *force) {
-    *force = 0;
-  } else if (memcmp(cells, new, count) != 0) {
-    if (to) {
-      while (count) {
-        unsigned int last = count - 1;
-        if (cells[last] != new[last]) break;
-        count = last;
-      }
-    }
-
-    if (from) {
-      while (first < count) {
-        if (cells[first] != new[first]) break;
-        first += 1;
-      }
-    }
-  } else {
-    return 0;
-  }
-
-  if (from) *from = first;
-  if (to) *to = count;
-
-  memcpy(cells+first, new+first, count-first);
-  return 1;
-}
-
-int
-textHasChanged (
-  wchar_t *text, const wchar_t *new, unsigned int count,
-  unsigned int *from, unsigned int *to, int *force
-) {
-  unsigned int first = 0;
-
-  if (force && *force) {
-    *force = 0;
-  } else if (wmemcmp(text, new, count) != 0) {
-    if (to) {
-      while (count) {
-        unsigned int last = count - 1;
-        if (text[last] != new[last]) break;
-        count = last;
-      }
-    }
-
-    if (from) {
-      while (first < count) {
-        if (text[first] != new[first]) break;
-        first += 1;
-      }
-    }
-  } else {
-    return 0;
-  }
-
-  if (from) *from = first;
-  if (to) *to = count;
-
-  wmemcpy(text+first, new+first, count-first);
-  return 1;
-}
-
-int
-cursorHasChanged (int *cursor, int new, int *force) {
-  if (force && *force) {
-    *force = 0;
-  } else if (new == *cursor) {
-    return 0;
-  }
-
-  *cursor = new;
-  return 1;
-}
-
 void
 makeTranslationTable (const DotsTable dots, TranslationTable table) {
   int byte;
@@ -460,6 +419,10 @@ enqueueKeyEvent (
   BrailleDisplay *brl,
   unsigned char set, unsigned char key, int press
 ) {
+  if (isBrailleDriverThread()) {
+    return brailleMessage_keyEvent(set, key, press);
+  }
+
 #ifdef ENABLE_API
   if (apiStarted) {
     if (api_handleKeyEvent(set, key, press)) {
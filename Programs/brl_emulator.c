@@ -0,0 +1,587 @@
+/*
+ * BRLTTY - A background process providing access to the console screen (when in
+ *          text mode) for a blind person using a refreshable braille display.
+ *
+ * Copyright (C) 1995-2014 by The BRLTTY Developers.
+ *
+ * BRLTTY comes with ABSOLUTELY NO WARRANTY.
+ *
+ * This is free software, placed under the terms of the
+ * GNU General Public License, as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any
+ * later version. Please see the file LICENSE-GPL for details.
+ *
+ * Web Page: http://mielke.cc/brltty/
+ *
+ * This software is maintained by Dave Mielke <dave@mielke.cc>.
+ */
+
+#include "prologue.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "log.h"
+#include "ascii.h"
+#include "brl_emulator.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#ifdef HAVE_POSIX_OPENPT
+#include <fcntl.h>
+#include <poll.h>
+#endif /* HAVE_POSIX_OPENPT */
+
+static long int
+microsecondsBetween (const TimeValue *from, const TimeValue *to) {
+  return ((to->seconds - from->seconds) * USECS_PER_SEC)
+       + ((to->nanoseconds - from->nanoseconds) / NSECS_PER_USEC);
+}
+
+static void
+addStatistic (EmulatorStatistic *statistic, long int value) {
+  if (!statistic->count || (value < statistic->minimum)) statistic->minimum = value;
+  if (!statistic->count || (value > statistic->maximum)) statistic->maximum = value;
+  statistic->total += value;
+  statistic->count += 1;
+}
+
+void
+showEmulatorStatistic (const char *label, const EmulatorStatistic *statistic) {
+  if (statistic->count) {
+    printf("%s: %lu samples, min %.3fms, avg %.3fms, max %.3fms\n",
+           label, statistic->count,
+           (double)statistic->minimum / USECS_PER_MSEC,
+           (double)statistic->total / statistic->count / USECS_PER_MSEC,
+           (double)statistic->maximum / USECS_PER_MSEC);
+  } else {
+    printf("%s: no samples\n", label);
+  }
+}
+
+static int
+writeBytes (Emulator *emu, const unsigned char *bytes, size_t count) {
+  while (count) {
+    ssize_t result = write(emu->masterDescriptor, bytes, count);
+
+    if (result == -1) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN) continue;
+      logSystemError("pty write");
+      return 0;
+    }
+
+    emu->statistics.bytesSent += result;
+    bytes += result;
+    count -= result;
+  }
+
+  return 1;
+}
+
+static void
+resetPacket (Emulator *emu) {
+  emu->packet.length = 0;
+  emu->packet.expected = 0;
+  emu->packet.raw = 0;
+  emu->packet.escape = 0;
+  emu->packet.started = 0;
+}
+
+static void
+noteRefresh (Emulator *emu, const unsigned char *cells, size_t count) {
+  int changed = (count != emu->display.count) ||
+                (memcmp(cells, emu->display.cells, count) != 0);
+  TimeValue now;
+  getMonotonicTime(&now);
+
+  if (changed) {
+    memcpy(emu->display.cells, cells, count);
+    emu->display.count = count;
+  }
+
+  emu->statistics.refreshBytes += emu->packet.raw;
+
+  if (emu->statistics.haveRefresh) {
+    addStatistic(&emu->statistics.refreshInterval,
+                 microsecondsBetween(&emu->statistics.lastRefresh, &now));
+  }
+
+  emu->statistics.lastRefresh = now;
+  emu->statistics.haveRefresh = 1;
+
+  /* A refresh which doesn't change the cells (e.g. one which was already on
+   * its way when the key was pressed) doesn't show what the key did.
+   */
+  if (emu->key.pending && changed) {
+    addStatistic(&emu->statistics.keyRoundTrip,
+                 microsecondsBetween(&emu->key.time, &now));
+    emu->key.pending = 0;
+  }
+}
+
+static int
+noteKey (Emulator *emu) {
+  if (emu->key.pending) emu->statistics.keysMissed += 1;
+  emu->key.pending = 1;
+  getMonotonicTime(&emu->key.time);
+  return 1;
+}
+
+static int
+writeBaumPacket (Emulator *emu, const unsigned char *packet, size_t length) {
+  unsigned char buffer[1 + (length * 2)];
+  unsigned char *byte = buffer;
+
+  *byte++ = ESC;
+
+  while (length) {
+    if ((*byte++ = *packet++) == ESC) *byte++ = ESC;
+    length -= 1;
+  }
+
+  return writeBytes(emu, buffer, byte-buffer);
+}
+
+static int
+prepareBaum (Emulator *emu) {
+  return 1;
+}
+
+static int
+handleBaumPacket (Emulator *emu) {
+  const unsigned char *bytes = emu->packet.bytes;
+  size_t length = emu->packet.length;
+
+  if (!length) return 1;
+
+  switch (bytes[0]) {
+    case 0X01: /* DisplayData */
+      if (length == (1 + emu->textCells)) {
+        noteRefresh(emu, &bytes[1], length-1);
+      } else {
+        /* a short write is a request for the cell count */
+        const unsigned char response[] = {0X01, emu->textCells};
+        if (!writeBaumPacket(emu, response, sizeof(response))) return 0;
+        emu->identified = 1;
+      }
+      break;
+
+    case 0X84: { /* GetDeviceIdentity */
+      unsigned char response[1 + 16];
+      char identity[sizeof(response)];
+
+      snprintf(identity, sizeof(identity), "Baum Vario %-5u", emu->textCells);
+      response[0] = bytes[0];
+      memcpy(&response[1], identity, sizeof(response)-1);
+      if (!writeBaumPacket(emu, response, sizeof(response))) return 0;
+      break;
+    }
+
+    case 0X8A: { /* GetSerialNumber */
+      static const unsigned char response[] = {
+        0X8A, '0', '0', '0', '0', '0', '0', '0', '1'
+      };
+
+      if (!writeBaumPacket(emu, response, sizeof(response))) return 0;
+      break;
+    }
+
+    default:
+      break;
+  }
+
+  return 1;
+}
+
+static int
+handleBaumByte (Emulator *emu, unsigned char byte) {
+  emu->packet.raw += 1;
+
+  if (emu->packet.escape) {
+    emu->packet.escape = 0;
+
+    if (byte != ESC) {
+      /* an unescaped ESC starts the next packet */
+      if (emu->packet.started && !handleBaumPacket(emu)) return 0;
+      resetPacket(emu);
+      emu->packet.raw = 2;
+      emu->packet.started = 1;
+      if (byte == 0X01) emu->packet.expected = 1 + emu->textCells;
+      goto addByte;
+    }
+  } else if (byte == ESC) {
+    emu->packet.escape = 1;
+    return 1;
+  }
+
+  if (!emu->packet.started) return 1;
+
+addByte:
+  if (emu->packet.length < sizeof(emu->packet.bytes)) {
+    emu->packet.bytes[emu->packet.length++] = byte;
+  }
+
+  if (emu->packet.length == emu->packet.expected) {
+    /* cell data is complete - don't wait for the next packet */
+    if (!handleBaumPacket(emu)) return 0;
+    resetPacket(emu);
+  }
+
+  return 1;
+}
+
+static int
+injectBaumKey (Emulator *emu) {
+  /* Dot5+Press on the joystick toggles the information mode */
+  static const unsigned char dot5Press[]  = {0X33, 0X00, 0X10};
+  static const unsigned char dot5Release[]  = {0X33, 0X00, 0X00};
+  static const unsigned char joystickPress[] = {0X34, 0X10};
+  static const unsigned char joystickRelease[] = {0X34, 0X00};
+
+  if (!writeBaumPacket(emu, dot5Press, sizeof(dot5Press))) return 0;
+  if (!writeBaumPacket(emu, joystickPress, sizeof(joystickPress))) return 0;
+  if (!writeBaumPacket(emu, joystickRelease, sizeof(joystickRelease))) return 0;
+  if (!writeBaumPacket(emu, dot5Release, sizeof(dot5Release))) return 0;
+  return noteKey(emu);
+}
+
+static int
+prepareHandyTech (Emulator *emu) {
+  switch (emu->textCells) {
+    case 40:
+      emu->modelIdentifier = 0X89; /* Modular 40+4 */
+      break;
+
+    case 80:
+      emu->modelIdentifier = 0X88; /* Modular 80+4 */
+      break;
+
+    default:
+      logMessage(LOG_ERR, "unsupported HandyTech cell count: %u", emu->textCells);
+      return 0;
+  }
+
+  emu->statusCells = 4;
+  return 1;
+}
+
+static int
+handleHandyTechByte (Emulator *emu, unsigned char byte) {
+  emu->packet.raw += 1;
+
+  if (!emu->packet.length) {
+    switch (byte) {
+      case 0XFF: { /* Reset */
+        const unsigned char response[] = {0XFE, emu->modelIdentifier};
+
+        resetPacket(emu);
+        emu->identified = 1;
+        return writeBytes(emu, response, sizeof(response));
+      }
+
+      case 0X01: /* status and text cells */
+        emu->packet.expected = 1 + emu->statusCells + emu->textCells;
+        break;
+
+      case 0X79: /* extended packet - the length is in the third byte */
+        emu->packet.expected = 3;
+        break;
+
+      default:
+        resetPacket(emu);
+        return 1;
+    }
+  }
+
+  if (emu->packet.length < sizeof(emu->packet.bytes)) {
+    emu->packet.bytes[emu->packet.length] = byte;
+  }
+  emu->packet.length += 1;
+
+  if (emu->packet.length == emu->packet.expected) {
+    if (emu->packet.bytes[0] == 0X79) {
+      if (emu->packet.length == 3) {
+        /* type and data, then SYN */
+        emu->packet.expected += byte + 1;
+        return 1;
+      }
+    } else {
+      static const unsigned char acknowledgement[] = {0X7E};
+
+      noteRefresh(emu, &emu->packet.bytes[1], emu->packet.length-1);
+      if (!writeBytes(emu, acknowledgement, sizeof(acknowledgement))) return 0;
+    }
+
+    resetPacket(emu);
+  }
+
+  return 1;
+}
+
+static int
+injectHandyTechKey (Emulator *emu) {
+  /* Status2 toggles the preferences menu on the modular models */
+  static const unsigned char keys[] = {0X71, 0X71|0X80};
+
+  if (!writeBytes(emu, keys, sizeof(keys))) return 0;
+  return noteKey(emu);
+}
+
+const EmulatorProtocol emulatorProtocolTable[] = {
+  { .name = "baum",
+    .prepare = prepareBaum,
+    .handleByte = handleBaumByte,
+    .injectKey = injectBaumKey
+  },
+
+  { .name = "handytech",
+    .prepare = prepareHandyTech,
+    .handleByte = handleHandyTechByte,
+    .injectKey = injectHandyTechKey
+  },
+
+  { .name = NULL }
+};
+
+const EmulatorProtocol *
+getEmulatorProtocol (const char *name) {
+  const EmulatorProtocol *protocol;
+
+  for (protocol=emulatorProtocolTable; protocol->name; protocol+=1) {
+    if (strcmp(name, protocol->name) == 0) return protocol;
+  }
+
+  logMessage(LOG_ERR, "unknown emulator protocol: %s", name);
+  return NULL;
+}
+
+#ifdef HAVE_POSIX_OPENPT
+static int
+openPseudoTerminal (Emulator *emu) {
+  if ((emu->masterDescriptor = posix_openpt(O_RDWR | O_NOCTTY)) != -1) {
+    if (grantpt(emu->masterDescriptor) != -1) {
+      if (unlockpt(emu->masterDescriptor) != -1) {
+        const char *slave = ptsname(emu->masterDescriptor);
+
+        if (slave) {
+          if ((emu->slavePath = strdup(slave))) {
+            /* Keep the slave open so that the master doesn't see a hangup
+             * whenever the driver closes and reopens the device.
+             */
+            if ((emu->slaveDescriptor = open(slave, O_RDWR | O_NOCTTY)) != -1) {
+              if (!emu->linkPath) return 1;
+              unlink(emu->linkPath);
+
+              if (symlink(slave, emu->linkPath) != -1) return 1;
+              logMessage(LOG_ERR, "symlink error: %s -> %s: %s",
+                         emu->linkPath, slave, strerror(errno));
+
+              close(emu->slaveDescriptor);
+              emu->slaveDescriptor = -1;
+            } else {
+              logSystemError("pty slave open");
+            }
+
+            free(emu->slavePath);
+            emu->slavePath = NULL;
+          } else {
+            logMallocError();
+          }
+        } else {
+          logSystemError("ptsname");
+        }
+      } else {
+        logSystemError("unlockpt");
+      }
+    } else {
+      logSystemError("grantpt");
+    }
+
+    close(emu->masterDescriptor);
+    emu->masterDescriptor = -1;
+  } else {
+    logSystemError("posix_openpt");
+  }
+
+  return 0;
+}
+
+int
+openEmulator (
+  Emulator *emu, const EmulatorProtocol *protocol,
+  unsigned int textCells, const char *linkPath
+) {
+  memset(emu, 0, sizeof(*emu));
+  emu->protocol = protocol;
+  emu->textCells = textCells;
+  emu->masterDescriptor = -1;
+  emu->slaveDescriptor = -1;
+
+  if (emu->protocol->prepare(emu)) {
+    resetPacket(emu);
+
+    if (!linkPath || !*linkPath || (emu->linkPath = strdup(linkPath))) {
+      if (openPseudoTerminal(emu)) return 1;
+
+      if (emu->linkPath) {
+        free(emu->linkPath);
+        emu->linkPath = NULL;
+      }
+    } else {
+      logMallocError();
+    }
+  }
+
+  return 0;
+}
+
+void
+closeEmulator (Emulator *emu) {
+  if (emu->linkPath) {
+    if (unlink(emu->linkPath) == -1) logSystemError("unlink");
+    free(emu->linkPath);
+    emu->linkPath = NULL;
+  }
+
+  if (emu->slavePath) {
+    free(emu->slavePath);
+    emu->slavePath = NULL;
+  }
+
+  if (emu->slaveDescriptor != -1) {
+    close(emu->slaveDescriptor);
+    emu->slaveDescriptor = -1;
+  }
+
+  if (emu->masterDescriptor != -1) {
+    close(emu->masterDescriptor);
+    emu->masterDescriptor = -1;
+  }
+}
+
+/* Handles what the driver has written, waiting up to timeout milliseconds */
+int
+processEmulatorInput (Emulator *emu, int timeout) {
+  struct pollfd pfd = {
+    .fd = emu->masterDescriptor,
+    .events = POLLIN
+  };
+
+  switch (poll(&pfd, 1, timeout)) {
+    case -1:
+      if (errno == EINTR) return 1;
+      logSystemError("poll");
+      return 0;
+
+    case 0:
+      return 1;
+
+    default:
+      break;
+  }
+
+  {
+    unsigned char buffer[0X100];
+    ssize_t count = read(emu->masterDescriptor, buffer, sizeof(buffer));
+
+    if (count == -1) {
+      if (errno == EINTR) return 1;
+      if (errno == EAGAIN) return 1;
+      logSystemError("pty read");
+      return 0;
+    }
+
+    emu->statistics.bytesReceived += count;
+
+    {
+      const unsigned char *byte = buffer;
+
+      while (count) {
+        if (!emu->protocol->handleByte(emu, *byte++)) return 0;
+        count -= 1;
+      }
+    }
+  }
+
+  return 1;
+}
+#else /* HAVE_POSIX_OPENPT */
+int
+openEmulator (
+  Emulator *emu, const EmulatorProtocol *protocol,
+  unsigned int textCells, const char *linkPath
+) {
+  logMessage(LOG_ERR, "pseudo-terminals not supported");
+  return 0;
+}
+
+void
+closeEmulator (Emulator *emu) {
+}
+
+int
+processEmulatorInput (Emulator *emu, int timeout) {
+  return 0;
+}
+#endif /* HAVE_POSIX_OPENPT */
+
+int
+injectEmulatorKey (Emulator *emu) {
+  return emu->protocol->injectKey(emu);
+}
+
+int
+runEmulator (Emulator *emu, int keyInterval, int duration) {
+  TimePeriod benchmarkPeriod;
+  TimePeriod keyPeriod;
+
+  startTimePeriod(&benchmarkPeriod, duration * MSECS_PER_SEC);
+  startTimePeriod(&keyPeriod, keyInterval);
+
+  while (!duration || !afterTimePeriod(&benchmarkPeriod, NULL)) {
+    int timeout = 100;
+
+    if (keyInterval && emu->identified) {
+      long int elapsed;
+
+      if (afterTimePeriod(&keyPeriod, &elapsed)) {
+        if (!injectEmulatorKey(emu)) return 0;
+        restartTimePeriod(&keyPeriod);
+        continue;
+      }
+
+      if ((keyInterval - elapsed) < timeout) timeout = keyInterval - elapsed;
+    }
+
+    if (!processEmulatorInput(emu, timeout)) return 0;
+  }
+
+  return 1;
+}
+
+unsigned long int
+getEmulatorRefreshCount (const Emulator *emu) {
+  return emu->statistics.haveRefresh? emu->statistics.refreshInterval.count + 1: 0;
+}
+
+void
+showEmulatorResults (const Emulator *emu) {
+  unsigned long int refreshes = getEmulatorRefreshCount(emu);
+
+  printf("refreshes: %lu\n", refreshes);
+  printf("bytes received: %lu\n", emu->statistics.bytesReceived);
+  printf("bytes sent: %lu\n", emu->statistics.bytesSent);
+
+  if (refreshes) {
+    printf("bytes per refresh: %.1f\n",
+           (double)emu->statistics.refreshBytes / refreshes);
+  }
+
+  showEmulatorStatistic("refresh interval", &emu->statistics.refreshInterval);
+  showEmulatorStatistic("key round trip", &emu->statistics.keyRoundTrip);
+  printf("keys without refresh: %lu\n",
+         emu->statistics.keysMissed + (emu->key.pending? 1: 0));
+}
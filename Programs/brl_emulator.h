@@ -0,0 +1,114 @@
+/*
+ * BRLTTY - A background process providing access to the console screen (when in
+ *          text mode) for a blind person using a refreshable braille display.
+ *
+ * Copyright (C) 1995-2014 by The BRLTTY Developers.
+ *
+ * BRLTTY comes with ABSOLUTELY NO WARRANTY.
+ *
+ * This is free software, placed under the terms of the
+ * GNU General Public License, as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any
+ * later version. Please see the file LICENSE-GPL for details.
+ *
+ * Web Page: http://mielke.cc/brltty/
+ *
+ * This software is maintained by Dave Mielke <dave@mielke.cc>.
+ */
+
+#ifndef BRLTTY_INCLUDED_BRL_EMULATOR
+#define BRLTTY_INCLUDED_BRL_EMULATOR
+
+#include "timing.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/* The device side of a braille display protocol, emulated on the master
+ * side of a pty so that an unmodified driver can be run against the slave.
+ */
+
+typedef struct {
+  unsigned long int count;
+  unsigned long long int total;
+  long int minimum;
+  long int maximum;
+} EmulatorStatistic;
+
+typedef struct EmulatorProtocolStruct EmulatorProtocol;
+
+typedef struct {
+  const EmulatorProtocol *protocol;
+  int masterDescriptor;
+  int slaveDescriptor;
+  char *slavePath;
+  char *linkPath;
+
+  unsigned int textCells;
+  unsigned char modelIdentifier;
+  unsigned char statusCells;
+  unsigned identified:1;
+
+  struct {
+    unsigned char bytes[0X200];
+    size_t length;
+    size_t expected;
+    size_t raw;
+    unsigned escape:1;
+    unsigned started:1;
+  } packet;
+
+  struct {
+    unsigned char cells[0X200];
+    size_t count;
+  } display;
+
+  struct {
+    unsigned pending:1;
+    TimeValue time;
+  } key;
+
+  struct {
+    unsigned long int bytesReceived;
+    unsigned long int bytesSent;
+    unsigned long int refreshBytes;
+    unsigned long int keysMissed;
+
+    EmulatorStatistic refreshInterval;
+    EmulatorStatistic keyRoundTrip;
+
+    unsigned haveRefresh:1;
+    TimeValue lastRefresh;
+  } statistics;
+} Emulator;
+
+struct EmulatorProtocolStruct {
+  const char *name;
+  int (*prepare) (Emulator *emu);
+  int (*handleByte) (Emulator *emu, unsigned char byte);
+  int (*injectKey) (Emulator *emu);
+};
+
+extern const EmulatorProtocol emulatorProtocolTable[];
+extern const EmulatorProtocol *getEmulatorProtocol (const char *name);
+
+extern int openEmulator (
+  Emulator *emu, const EmulatorProtocol *protocol,
+  unsigned int textCells, const char *linkPath
+);
+extern void closeEmulator (Emulator *emu);
+
+extern int processEmulatorInput (Emulator *emu, int timeout);
+extern int injectEmulatorKey (Emulator *emu);
+extern int runEmulator (Emulator *emu, int keyInterval, int duration);
+
+extern unsigned long int getEmulatorRefreshCount (const Emulator *emu);
+extern void showEmulatorStatistic (const char *label, const EmulatorStatistic *statistic);
+extern void showEmulatorResults (const Emulator *emu);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* BRLTTY_INCLUDED_BRL_EMULATOR */
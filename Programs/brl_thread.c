@@ -0,0 +1,990 @@
+/*
+ * BRLTTY - A background process providing access to the console screen (when in
+ *          text mode) for a blind person using a refreshable braille display.
+ *
+ * Copyright (C) 1995-2014 by The BRLTTY Developers.
+ *
+ * BRLTTY comes with ABSOLUTELY NO WARRANTY.
+ *
+ * This is free software, placed under the terms of the
+ * GNU General Public License, as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any
+ * later version. Please see the file LICENSE-GPL for details.
+ *
+ * Web Page: http://mielke.cc/brltty/
+ *
+ * This software is maintained by Dave Mielke <dave@mielke.cc>.
+ */
+
+
+#include "prologue.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "log.h"
+#include "parameters.h"
+#include "brl_thread.h"
+#include "cmd_queue.h"
+#include "message.h"
+#include "queue.h"
+#include "ktbdefs.h"
+#include "status.h"
+#include "prefs.h"
+#include "async_wait.h"
+#include "async_event.h"
+#include "async_thread.h"
+#include "io_generic.h"
+
+#ifdef ASYNC_CAN_HANDLE_THREADS
+typedef enum {
+  THD_CONSTRUCTING,
+  THD_STARTING,
+  THD_READY,
+  THD_STOPPING,
+  THD_FINISHED
+} ThreadState;
+
+typedef struct {
+  const char *name;
+} ThreadStateEntry;
+
+static const ThreadStateEntry threadStateTable[] = {
+  [THD_CONSTRUCTING] = {
+    .name = "constructing"
+  },
+
+  [THD_STARTING] = {
+    .name = "starting"
+  },
+
+  [THD_READY] = {
+    .name = "ready"
+  },
+
+  [THD_STOPPING] = {
+    .name = "stopping"
+  },
+
+  [THD_FINISHED] = {
+    .name = "finished"
+  },
+};
+
+static inline const ThreadStateEntry *
+getThreadStateEntry (ThreadState state) {
+  if (state >= ARRAY_COUNT(threadStateTable)) return NULL;
+  return &threadStateTable[state];
+}
+
+typedef enum {
+  RSP_PENDING,
+  RSP_INTEGER
+} BrailleResponseType;
+
+typedef struct {
+  unsigned char *cells;
+  wchar_t *text;
+  unsigned int textCount;
+
+  unsigned char *status;
+  unsigned int statusCount;
+
+  int cursor;
+  unsigned hasText:1;
+  unsigned statusChanged:1;
+} BrailleFrame;
+
+typedef struct {
+  volatile ThreadState threadState;
+
+  const BrailleDriver *driver;
+  char **driverParameters;
+  const char *driverDevice;
+
+  BrailleDisplay *coreDisplay;
+  BrailleDisplay driverDisplay;
+
+  pthread_t threadIdentifier;
+  AsyncEvent *requestEvent;
+  AsyncEvent *messageEvent;
+  unsigned int pendingMessages;
+  unsigned char discardMessages;
+
+  pthread_mutex_t frameMutex;
+  BrailleFrame nextFrame;
+  BrailleFrame currentFrame;
+
+  Queue *commandQueue;
+  volatile KeyTableCommandContext commandContext;
+
+  BrailleFirmness firmness;
+  BrailleSensitivity sensitivity;
+
+  unsigned int resizedColumns;
+  unsigned int resizedRows;
+
+  volatile unsigned char stopRequested;
+  volatile unsigned char writeRequested;
+  volatile unsigned char firmnessChanged;
+  volatile unsigned char sensitivityChanged;
+  volatile unsigned char resizePending;
+  volatile unsigned char displayOffline;
+  volatile unsigned char driverFailed;
+
+  struct {
+    volatile BrailleResponseType type;
+
+    union {
+      int INTEGER;
+    } value;
+  } response;
+} BrailleDriverThread;
+
+typedef enum {
+  MSG_KEY_EVENT,
+  MSG_COMMAND,
+  MSG_READ_COMMAND,
+  MSG_MESSAGE
+} BrailleMessageType;
+
+typedef struct {
+  BrailleMessageType type;
+
+  union {
+    struct {
+      unsigned char set;
+      unsigned char key;
+      unsigned press:1;
+    } keyEvent;
+
+    struct {
+      int command;
+    } command;
+
+    struct {
+      const char *mode;
+      const char *text;
+      MessageOptions options;
+    } message;
+  } arguments;
+
+  char strings[0];
+} BrailleMessage;
+
+static BrailleDriver threadBraille;
+static const BrailleDriver *threadDriver = NULL;
+static BrailleDriverThread *volatile brailleDriverThread = NULL;
+
+static void
+setThreadState (BrailleDriverThread *bdt, ThreadState state) {
+  const ThreadStateEntry *entry = getThreadStateEntry(state);
+  const char *name = entry? entry->name: NULL;
+
+  if (!name) name = "?";
+  logMessage(LOG_DEBUG, "braille driver thread %s", name);
+  bdt->threadState = state;
+}
+
+static void
+deallocateBrailleFrame (BrailleFrame *frame) {
+  if (frame->cells) {
+    free(frame->cells);
+    frame->cells = NULL;
+  }
+
+  if (frame->text) {
+    free(frame->text);
+    frame->text = NULL;
+  }
+
+  if (frame->status) {
+    free(frame->status);
+    frame->status = NULL;
+  }
+
+  frame->textCount = 0;
+  frame->statusCount = 0;
+}
+
+static int
+allocateBrailleFrame (BrailleFrame *frame, const BrailleDisplay *brl) {
+  unsigned int textCount = brl->textColumns * brl->textRows;
+  unsigned int statusCount = MAX(brl->statusColumns*brl->statusRows, GSC_COUNT);
+
+  deallocateBrailleFrame(frame);
+  frame->cursor = -1;
+  frame->hasText = 0;
+  frame->statusChanged = 0;
+
+  if ((frame->cells = calloc(MAX(textCount, 1), sizeof(*frame->cells)))) {
+    if ((frame->text = calloc(MAX(textCount, 1), sizeof(*frame->text)))) {
+      if ((frame->status = calloc(statusCount, sizeof(*frame->status)))) {
+        frame->textCount = textCount;
+        frame->statusCount = statusCount;
+        return 1;
+      }
+    }
+  }
+
+  logMallocError();
+  deallocateBrailleFrame(frame);
+  return 0;
+}
+
+static void
+copyBrailleFrame (BrailleFrame *to, BrailleFrame *from) {
+  unsigned int textCount = MIN(to->textCount, from->textCount);
+
+  memcpy(to->cells, from->cells, textCount);
+  if ((to->hasText = from->hasText)) memcpy(to->text, from->text, textCount*sizeof(*to->text));
+  to->cursor = from->cursor;
+
+  if ((to->statusChanged = from->statusChanged)) {
+    memcpy(to->status, from->status, MIN(to->statusCount, from->statusCount));
+    from->statusChanged = 0;
+  }
+}
+
+static void
+handleBrailleMessage (BrailleDriverThread *bdt, BrailleMessage *msg) {
+  if (msg) {
+    switch (msg->type) {
+      case MSG_KEY_EVENT:
+        enqueueKeyEvent(bdt->coreDisplay,
+                        msg->arguments.keyEvent.set,
+                        msg->arguments.keyEvent.key,
+                        msg->arguments.keyEvent.press);
+        break;
+
+      case MSG_COMMAND:
+        enqueueCommand(msg->arguments.command.command);
+        break;
+
+      case MSG_MESSAGE:
+        message(msg->arguments.message.mode,
+                msg->arguments.message.text,
+                msg->arguments.message.options);
+        break;
+
+      case MSG_READ_COMMAND:
+        if (getQueueSize(bdt->commandQueue) < BRAILLE_DRIVER_THREAD_COMMAND_LIMIT) {
+          if (enqueueItem(bdt->commandQueue, msg)) return;
+        } else {
+          logMessage(LOG_WARNING, "braille command queue full: %04X",
+                     msg->arguments.command.command);
+        }
+        break;
+
+      default:
+        logMessage(LOG_DEBUG, "unimplemented braille message type: %u", msg->type);
+        break;
+    }
+
+    free(msg);
+  }
+}
+
+static int
+sendBrailleMessage (BrailleDriverThread *bdt, BrailleMessage *msg) {
+  int sent;
+
+  /* counted before it's sent because the main thread may handle it at once */
+  asyncLockMutex(&bdt->frameMutex);
+  bdt->pendingMessages += 1;
+  asyncUnlockMutex(&bdt->frameMutex);
+
+  if (!(sent = asyncSignalEvent(bdt->messageEvent, msg))) {
+    asyncLockMutex(&bdt->frameMutex);
+    bdt->pendingMessages -= 1;
+    asyncUnlockMutex(&bdt->frameMutex);
+  }
+
+  return sent;
+}
+
+static BrailleMessage *
+newBrailleMessage (BrailleMessageType type, size_t extra) {
+  BrailleMessage *msg;
+  size_t size = sizeof(*msg) + extra;
+
+  if ((msg = malloc(size))) {
+    memset(msg, 0, size);
+    msg->type = type;
+    return msg;
+  } else {
+    logMallocError();
+  }
+
+  return NULL;
+}
+
+int
+isBrailleDriverThread (void) {
+  BrailleDriverThread *bdt = brailleDriverThread;
+
+  if (!bdt) return 0;
+  return pthread_equal(pthread_self(), bdt->threadIdentifier);
+}
+
+int
+brailleMessage_keyEvent (
+  unsigned char set, unsigned char key, int press
+) {
+  BrailleDriverThread *bdt = brailleDriverThread;
+  BrailleMessage *msg;
+
+  if ((msg = newBrailleMessage(MSG_KEY_EVENT, 0))) {
+    msg->arguments.keyEvent.set = set;
+    msg->arguments.keyEvent.key = key;
+    msg->arguments.keyEvent.press = !!press;
+    if (sendBrailleMessage(bdt, msg)) return 1;
+
+    free(msg);
+  }
+
+  return 0;
+}
+
+static int
+sendCommandMessage (BrailleMessageType type, int command) {
+  BrailleDriverThread *bdt = brailleDriverThread;
+  BrailleMessage *msg;
+
+  if ((msg = newBrailleMessage(type, 0))) {
+    msg->arguments.command.command = command;
+    if (sendBrailleMessage(bdt, msg)) return 1;
+
+    free(msg);
+  }
+
+  return 0;
+}
+
+int
+brailleMessage_command (
+  int command
+) {
+  return sendCommandMessage(MSG_COMMAND, command);
+}
+
+int
+brailleMessage_message (
+  const char *mode, const char *text, MessageOptions options
+) {
+  BrailleDriverThread *bdt = brailleDriverThread;
+  BrailleMessage *msg;
+  size_t modeSize;
+  size_t textSize;
+
+  if (!mode) mode = "";
+  modeSize = strlen(mode) + 1;
+  textSize = strlen(text) + 1;
+
+  if ((msg = newBrailleMessage(MSG_MESSAGE, (modeSize + textSize)))) {
+    char *strings = msg->strings;
+
+    msg->arguments.message.mode = memcpy(strings, mode, modeSize);
+    msg->arguments.message.text = memcpy(&strings[modeSize], text, textSize);
+
+    /* the message waits for keys which only this thread can read */
+    msg->arguments.message.options = options & ~MSG_SYNC;
+
+    if (sendBrailleMessage(bdt, msg)) return 1;
+    free(msg);
+  }
+
+  return 0;
+}
+
+static inline void
+setResponsePending (BrailleDriverThread *bdt) {
+  bdt->response.type = RSP_PENDING;
+}
+
+static int
+sendIntegerResponse (BrailleDriverThread *bdt, int value) {
+  bdt->response.value.INTEGER = value;
+  bdt->response.type = RSP_INTEGER;
+  return sendBrailleMessage(bdt, NULL);
+}
+
+ASYNC_CONDITION_TESTER(testBrailleResponseReceived) {
+  BrailleDriverThread *bdt = data;
+
+  return bdt->response.type != RSP_PENDING;
+}
+
+ASYNC_CONDITION_TESTER(testBrailleDriverThreadFinished) {
+  BrailleDriverThread *bdt = data;
+
+  return bdt->threadState == THD_FINISHED;
+}
+
+ASYNC_CONDITION_TESTER(testBrailleMessagesHandled) {
+  BrailleDriverThread *bdt = data;
+  unsigned int count;
+
+  asyncLockMutex(&bdt->frameMutex);
+  count = bdt->pendingMessages;
+  asyncUnlockMutex(&bdt->frameMutex);
+
+  return !count;
+}
+
+ASYNC_CONDITION_TESTER(testBrailleDriverThreadWork) {
+  BrailleDriverThread *bdt = data;
+
+  return bdt->stopRequested
+      || bdt->writeRequested
+      || bdt->firmnessChanged
+      || bdt->sensitivityChanged;
+}
+
+static void
+signalBrailleDriverThread (BrailleDriverThread *bdt) {
+  asyncLockMutex(&bdt->frameMutex);
+  if (bdt->requestEvent) asyncSignalEvent(bdt->requestEvent, NULL);
+  asyncUnlockMutex(&bdt->frameMutex);
+}
+
+static int
+writeBrailleFrame (BrailleDriverThread *bdt) {
+  BrailleDisplay *brl = &bdt->driverDisplay;
+  BrailleFrame *frame = &bdt->currentFrame;
+
+  asyncLockMutex(&bdt->frameMutex);
+  copyBrailleFrame(frame, &bdt->nextFrame);
+  bdt->writeRequested = 0;
+  asyncUnlockMutex(&bdt->frameMutex);
+
+  if (frame->statusChanged && bdt->driver->writeStatus) {
+    if (!bdt->driver->writeStatus(brl, frame->status)) return 0;
+  }
+
+  memcpy(brl->buffer, frame->cells, MIN(frame->textCount, brl->textColumns*brl->textRows));
+  brl->cursor = frame->cursor;
+  if (!bdt->driver->writeWindow(brl, (frame->hasText? frame->text: NULL))) return 0;
+
+  drainBrailleOutput(brl, 0);
+  return 1;
+}
+
+static void
+applyBrailleSettings (BrailleDriverThread *bdt) {
+  BrailleDisplay *brl = &bdt->driverDisplay;
+
+  if (bdt->firmnessChanged) {
+    bdt->firmnessChanged = 0;
+    if (brl->setFirmness) brl->setFirmness(brl, bdt->firmness);
+  }
+
+  if (bdt->sensitivityChanged) {
+    bdt->sensitivityChanged = 0;
+    if (brl->setSensitivity) brl->setSensitivity(brl, bdt->sensitivity);
+  }
+}
+
+static int
+resizeDriverDisplay (BrailleDriverThread *bdt) {
+  BrailleDisplay *brl = &bdt->driverDisplay;
+
+  if (brl->isCoreBuffer) {
+    free(brl->buffer);
+    brl->buffer = NULL;
+  }
+
+  if (ensureBrailleBuffer(brl, LOG_DEBUG)) {
+    if (allocateBrailleFrame(&bdt->currentFrame, brl)) {
+      asyncLockMutex(&bdt->frameMutex);
+      bdt->resizedColumns = brl->textColumns;
+      bdt->resizedRows = brl->textRows;
+      bdt->resizePending = 1;
+      asyncUnlockMutex(&bdt->frameMutex);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static void
+handleDriverInput (BrailleDriverThread *bdt) {
+  BrailleDisplay *brl = &bdt->driverDisplay;
+
+  while (!bdt->driverFailed) {
+    int command = bdt->driver->readCommand(brl, bdt->commandContext);
+
+    if (brl->resizeRequired) {
+      if (!resizeDriverDisplay(bdt)) bdt->driverFailed = 1;
+    }
+
+    if (command == EOF) {
+      bdt->displayOffline = 0;
+      break;
+    }
+
+    if ((command & BRL_MSK_CMD) == BRL_CMD_OFFLINE) {
+      bdt->displayOffline = 1;
+      break;
+    }
+
+    bdt->displayOffline = 0;
+    if (command == BRL_CMD_RESTARTBRL) bdt->driverFailed = 1;
+    sendCommandMessage(MSG_READ_COMMAND, command);
+  }
+}
+
+ASYNC_MONITOR_CALLBACK(monitorDriverInput) {
+  BrailleDriverThread *bdt = parameters->data;
+
+  handleDriverInput(bdt);
+  return !bdt->stopRequested;
+}
+
+static int
+startBrailleDriver (BrailleDriverThread *bdt) {
+  BrailleDisplay *brl = &bdt->driverDisplay;
+
+  logMessage(LOG_DEBUG, "starting braille driver");
+  initializeBrailleDisplay(brl);
+
+  if (bdt->driver->construct(brl, bdt->driverParameters, bdt->driverDevice)) {
+    if (ensureBrailleBuffer(brl, LOG_DEBUG)) {
+      if (allocateBrailleFrame(&bdt->currentFrame, brl)) {
+        if (brl->gioEndpoint) {
+          if (!gioMonitorInput(brl->gioEndpoint, monitorDriverInput, bdt)) {
+            logMessage(LOG_DEBUG, "braille input will be polled");
+          }
+        }
+
+        return 1;
+      }
+
+      if (brl->isCoreBuffer) free(brl->buffer);
+      brl->buffer = NULL;
+    }
+
+    bdt->driver->destruct(brl);
+  }
+
+  return 0;
+}
+
+static void
+stopBrailleDriver (BrailleDriverThread *bdt) {
+  BrailleDisplay *brl = &bdt->driverDisplay;
+
+  logMessage(LOG_DEBUG, "stopping braille driver");
+  drainBrailleOutput(brl, 0);
+  bdt->driver->destruct(brl);
+
+  if (brl->buffer) {
+    if (brl->isCoreBuffer) free(brl->buffer);
+    brl->buffer = NULL;
+  }
+
+  deallocateBrailleFrame(&bdt->currentFrame);
+}
+
+ASYNC_EVENT_CALLBACK(handleBrailleMessageEvent) {
+  BrailleDriverThread *bdt = parameters->eventData;
+  BrailleMessage *msg = parameters->signalData;
+
+  asyncLockMutex(&bdt->frameMutex);
+  bdt->pendingMessages -= 1;
+  asyncUnlockMutex(&bdt->frameMutex);
+
+  if (bdt->discardMessages) {
+    if (msg) free(msg);
+  } else {
+    handleBrailleMessage(bdt, msg);
+  }
+}
+
+ASYNC_EVENT_CALLBACK(handleBrailleRequestEvent) {
+}
+
+ASYNC_THREAD_FUNCTION(runBrailleDriverThread) {
+  BrailleDriverThread *bdt = argument;
+  int started = 0;
+
+  bdt->threadIdentifier = pthread_self();
+  setThreadState(bdt, THD_STARTING);
+
+  if ((bdt->requestEvent = asyncNewEvent(handleBrailleRequestEvent, bdt))) {
+    if (startBrailleDriver(bdt)) {
+      started = 1;
+      setThreadState(bdt, THD_READY);
+      sendIntegerResponse(bdt, 1);
+
+      while (1) {
+        if (bdt->writeRequested && !bdt->driverFailed) {
+          if (!writeBrailleFrame(bdt)) {
+            logMessage(LOG_WARNING, "braille driver write failed");
+            bdt->driverFailed = 1;
+          }
+        }
+
+        if (bdt->stopRequested) break;
+        applyBrailleSettings(bdt);
+        handleDriverInput(bdt);
+
+        asyncAwaitCondition(BRAILLE_INPUT_POLL_INTERVAL,
+                            testBrailleDriverThreadWork, bdt);
+      }
+
+      setThreadState(bdt, THD_STOPPING);
+      stopBrailleDriver(bdt);
+    } else {
+      logMessage(LOG_DEBUG, "braille driver construction failure");
+    }
+
+    asyncLockMutex(&bdt->frameMutex);
+    asyncDiscardEvent(bdt->requestEvent);
+    bdt->requestEvent = NULL;
+    asyncUnlockMutex(&bdt->frameMutex);
+  } else {
+    logMessage(LOG_DEBUG, "braille request event construction failure");
+  }
+
+  setThreadState(bdt, THD_FINISHED);
+  sendIntegerResponse(bdt, started);
+  return NULL;
+}
+
+static void
+stopBrailleDriverThread (BrailleDriverThread *bdt) {
+  void *result;
+
+  bdt->stopRequested = 1;
+  signalBrailleDriverThread(bdt);
+
+  asyncAwaitCondition(BRAILLE_DRIVER_THREAD_STOP_TIMEOUT,
+                      testBrailleDriverThreadFinished, bdt);
+  pthread_join(bdt->threadIdentifier, &result);
+}
+
+static void
+destroyBrailleDriverThread (BrailleDriverThread *bdt) {
+  if (brailleDriverThread == bdt) brailleDriverThread = NULL;
+
+  /* The thread has finished, so nothing more can be sent, but what it sent
+   * last may still be in the event's pipe - only the messages own it.
+   */
+  bdt->discardMessages = 1;
+
+  if (!asyncAwaitCondition(BRAILLE_DRIVER_THREAD_STOP_TIMEOUT,
+                           testBrailleMessagesHandled, bdt)) {
+    logMessage(LOG_WARNING, "braille messages not discarded: %u", bdt->pendingMessages);
+  }
+
+  asyncDiscardEvent(bdt->messageEvent);
+  deallocateQueue(bdt->commandQueue);
+  pthread_mutex_destroy(&bdt->frameMutex);
+
+  deallocateBrailleFrame(&bdt->nextFrame);
+  free(bdt);
+}
+
+static void
+deallocateBrailleMessage (void *item, void *data) {
+  free(item);
+}
+
+static int
+thread_setFirmness (BrailleDisplay *brl, BrailleFirmness setting) {
+  BrailleDriverThread *bdt = brailleDriverThread;
+
+  if (!bdt) return 0;
+  bdt->firmness = setting;
+  bdt->firmnessChanged = 1;
+  signalBrailleDriverThread(bdt);
+  return 1;
+}
+
+static int
+thread_setSensitivity (BrailleDisplay *brl, BrailleSensitivity setting) {
+  BrailleDriverThread *bdt = brailleDriverThread;
+
+  if (!bdt) return 0;
+  bdt->sensitivity = setting;
+  bdt->sensitivityChanged = 1;
+  signalBrailleDriverThread(bdt);
+  return 1;
+}
+
+static int
+linkCoreDisplay (BrailleDriverThread *bdt) {
+  BrailleDisplay *brl = bdt->coreDisplay;
+  const BrailleDisplay *display = &bdt->driverDisplay;
+
+  if (!allocateBrailleFrame(&bdt->nextFrame, display)) return 0;
+
+  brl->textColumns = display->textColumns;
+  brl->textRows = display->textRows;
+  brl->statusColumns = display->statusColumns;
+  brl->statusRows = display->statusRows;
+
+  brl->keyBindings = display->keyBindings;
+  brl->keyNameTables = display->keyNameTables;
+  brl->rotateKey = display->rotateKey;
+  brl->data = display->data;
+
+  brl->touchEnabled = display->touchEnabled;
+  brl->highlightWindow = display->highlightWindow;
+
+  brl->setFirmness = display->setFirmness? thread_setFirmness: NULL;
+  brl->setSensitivity = display->setSensitivity? thread_setSensitivity: NULL;
+
+  brl->gioEndpoint = NULL;
+  return 1;
+}
+
+static int
+thread_construct (BrailleDisplay *brl, char **parameters, const char *device) {
+  BrailleDriverThread *bdt;
+
+  if ((bdt = malloc(sizeof(*bdt)))) {
+    memset(bdt, 0, sizeof(*bdt));
+    setThreadState(bdt, THD_CONSTRUCTING);
+    setResponsePending(bdt);
+
+    bdt->driver = threadDriver;
+    bdt->driverParameters = parameters;
+    bdt->driverDevice = device;
+    bdt->coreDisplay = brl;
+    bdt->commandContext = KTB_CTX_DEFAULT;
+
+    if ((bdt->commandQueue = newQueue(deallocateBrailleMessage, NULL))) {
+      int mutexError = pthread_mutex_init(&bdt->frameMutex, NULL);
+
+      if (!mutexError) {
+        if ((bdt->messageEvent = asyncNewEvent(handleBrailleMessageEvent, bdt))) {
+          pthread_t threadIdentifier;
+          int createError;
+
+          brailleDriverThread = bdt;
+          createError = asyncCreateThread("braille-driver",
+                                          &threadIdentifier, NULL,
+                                          runBrailleDriverThread, bdt);
+
+          if (!createError) {
+            bdt->threadIdentifier = threadIdentifier;
+
+            if (asyncAwaitCondition(BRAILLE_DRIVER_THREAD_START_TIMEOUT,
+                                    testBrailleResponseReceived, bdt)) {
+              if (bdt->response.value.INTEGER) {
+                if (linkCoreDisplay(bdt)) return 1;
+              } else {
+                logMessage(LOG_DEBUG, "braille driver thread initialization failure");
+              }
+            } else {
+              logMessage(LOG_WARNING, "braille driver thread initialization timeout");
+            }
+
+            stopBrailleDriverThread(bdt);
+          } else {
+            logMessage(LOG_ERR, "braille driver thread creation failure: %s", strerror(createError));
+          }
+
+          destroyBrailleDriverThread(bdt);
+          return 0;
+        } else {
+          logMessage(LOG_DEBUG, "braille message event construction failure");
+        }
+
+        pthread_mutex_destroy(&bdt->frameMutex);
+      } else {
+        logMessage(LOG_ERR, "braille frame mutex initialization failure: %s", strerror(mutexError));
+      }
+
+      deallocateQueue(bdt->commandQueue);
+    }
+
+    free(bdt);
+  } else {
+    logMallocError();
+  }
+
+  return 0;
+}
+
+static void
+thread_destruct (BrailleDisplay *brl) {
+  BrailleDriverThread *bdt = brailleDriverThread;
+
+  if (bdt) {
+    stopBrailleDriverThread(bdt);
+    destroyBrailleDriverThread(bdt);
+  }
+
+  brl->data = NULL;
+  brl->rotateKey = NULL;
+  brl->setFirmness = NULL;
+  brl->setSensitivity = NULL;
+}
+
+static int
+thread_readCommand (BrailleDisplay *brl, KeyTableCommandContext context) {
+  BrailleDriverThread *bdt = brailleDriverThread;
+
+  if (!bdt) return EOF;
+  bdt->commandContext = context;
+
+  if (bdt->resizePending) {
+    int ok;
+
+    asyncLockMutex(&bdt->frameMutex);
+    brl->textColumns = bdt->resizedColumns;
+    brl->textRows = bdt->resizedRows;
+    bdt->resizePending = 0;
+    bdt->writeRequested = 0;
+    ok = allocateBrailleFrame(&bdt->nextFrame, brl);
+    asyncUnlockMutex(&bdt->frameMutex);
+
+    if (!ok) return BRL_CMD_RESTARTBRL;
+    brl->resizeRequired = 1;
+  }
+
+  {
+    BrailleMessage *msg = dequeueItem(bdt->commandQueue);
+
+    if (msg) {
+      int command = msg->arguments.command.command;
+
+      free(msg);
+      return command;
+    }
+  }
+
+  if (bdt->driverFailed) return BRL_CMD_RESTARTBRL;
+  if (bdt->displayOffline) return BRL_CMD_OFFLINE;
+  return EOF;
+}
+
+static void
+requestBrailleFrameWrite (BrailleDriverThread *bdt) {
+  /* the frame mutex must be held */
+  if (!bdt->writeRequested) {
+    bdt->writeRequested = 1;
+    if (bdt->requestEvent) asyncSignalEvent(bdt->requestEvent, NULL);
+  }
+}
+
+static int
+thread_writeWindow (BrailleDisplay *brl, const wchar_t *text) {
+  BrailleDriverThread *bdt = brailleDriverThread;
+
+  if (!bdt) return 1;
+  if (bdt->driverFailed) return 0;
+
+  asyncLockMutex(&bdt->frameMutex);
+
+  {
+    BrailleFrame *frame = &bdt->nextFrame;
+    unsigned int count = MIN(frame->textCount, brl->textColumns*brl->textRows);
+
+    memcpy(frame->cells, brl->buffer, count);
+    if ((frame->hasText = !!text)) memcpy(frame->text, text, count*sizeof(*text));
+    frame->cursor = brl->cursor;
+  }
+
+  requestBrailleFrameWrite(bdt);
+  asyncUnlockMutex(&bdt->frameMutex);
+  return 1;
+}
+
+static int
+thread_writeStatus (BrailleDisplay *brl, const unsigned char *cells) {
+  BrailleDriverThread *bdt = brailleDriverThread;
+
+  if (!bdt) return 1;
+  if (bdt->driverFailed) return 0;
+
+  asyncLockMutex(&bdt->frameMutex);
+
+  {
+    BrailleFrame *frame = &bdt->nextFrame;
+    unsigned int count = brl->statusColumns * brl->statusRows;
+
+    if (!count) count = getStatusFieldsLength(prefs.statusFields);
+    memcpy(frame->status, cells, MIN(count, frame->statusCount));
+    frame->statusChanged = 1;
+  }
+
+  requestBrailleFrameWrite(bdt);
+  asyncUnlockMutex(&bdt->frameMutex);
+  return 1;
+}
+
+void
+linkBrailleDriverThread (void) {
+  if (threadDriver) return;
+
+  threadDriver = braille;
+  memcpy(&threadBraille, braille, sizeof(threadBraille));
+
+  threadBraille.construct = thread_construct;
+  threadBraille.destruct = thread_destruct;
+
+  threadBraille.readCommand = thread_readCommand;
+  threadBraille.writeWindow = thread_writeWindow;
+  threadBraille.writeStatus = threadDriver->writeStatus? thread_writeStatus: NULL;
+
+  threadBraille.readPacket = NULL;
+  threadBraille.writePacket = NULL;
+  threadBraille.reset = NULL;
+
+  threadBraille.readKey = NULL;
+  threadBraille.keyToCommand = NULL;
+
+  braille = &threadBraille;
+  logMessage(LOG_DEBUG, "braille driver thread linked: %s", threadDriver->definition.code);
+}
+
+void
+unlinkBrailleDriverThread (void) {
+  if (braille == &threadBraille) {
+    braille = threadDriver;
+    threadDriver = NULL;
+    logMessage(LOG_DEBUG, "braille driver thread unlinked");
+  }
+}
+
+#else /* ASYNC_CAN_HANDLE_THREADS */
+void
+linkBrailleDriverThread (void) {
+  logMessage(LOG_WARNING, "braille driver thread not supported");
+}
+
+void
+unlinkBrailleDriverThread (void) {
+}
+
+int
+isBrailleDriverThread (void) {
+  return 0;
+}
+
+int
+brailleMessage_keyEvent (
+  unsigned char set, unsigned char key, int press
+) {
+  return 0;
+}
+
+int
+brailleMessage_command (
+  int command
+) {
+  return 0;
+}
+
+int
+brailleMessage_message (
+  const char *mode, const char *text, MessageOptions options
+) {
+  return 0;
+}
+#endif /* ASYNC_CAN_HANDLE_THREADS */
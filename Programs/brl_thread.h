@@ -0,0 +1,62 @@
+/*
+ * BRLTTY - A background process providing access to the console screen (when in
+ *          text mode) for a blind person using a refreshable braille display.
+ *
+ * Copyright (C) 1995-2014 by The BRLTTY Developers.
+ *
+ * BRLTTY comes with ABSOLUTELY NO WARRANTY.
+ *
+ * This is free software, placed under the terms of the
+ * GNU General Public License, as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any
+ * later version. Please see the file LICENSE-GPL for details.
+ *
+ * Web Page: http://mielke.cc/brltty/
+ *
+ * This software is maintained by Dave Mielke <dave@mielke.cc>.
+ */
+
+#ifndef BRLTTY_INCLUDED_BRL_THREAD
+#define BRLTTY_INCLUDED_BRL_THREAD
+
+#include "brl.h"
+#include "message.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/* When the braille driver runs on its own thread, the only core functions
+ * which it may call are those which notice that they've been called on that
+ * thread and forward the call to the main thread:
+ *   enqueueKeyEvent (and so enqueueKey, enqueueKeys, etc), enqueueCommand,
+ *   and message (which is then always asynchronous).
+ * The driver's own I/O, including its alarms and input monitors, is on that
+ * thread's async queue and may be used as usual. Logging may be done, but
+ * not pushLogPrefix/popLogPrefix. Anything else which the main thread
+ * owns - tunes, preferences, the screen, BrlAPI, the core's alarms - mustn't
+ * be touched.
+ */
+
+extern void linkBrailleDriverThread (void);
+extern void unlinkBrailleDriverThread (void);
+
+extern int isBrailleDriverThread (void);
+
+extern int brailleMessage_keyEvent (
+  unsigned char set, unsigned char key, int press
+);
+
+extern int brailleMessage_command (
+  int command
+);
+
+extern int brailleMessage_message (
+  const char *mode, const char *text, MessageOptions options
+);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* BRLTTY_INCLUDED_BRL_THREAD */
@@ -24,6 +24,7 @@
 
 #include <stdio.h>
 #include <stddef.h>
+#include <limits.h>
 #include <string.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -62,6 +63,16 @@
 #include <sys/time.h>
 #endif /* HAVE_SYS_SELECT_H */
 
+#if defined(HAVE_MEMFD_CREATE) && defined(HAVE_SYS_EVENTFD_H)
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+
+#if defined(SCM_RIGHTS) && defined(F_SEAL_SHRINK)
+#define SHARED_MEMORY_TRANSPORT
+#endif /* SCM_RIGHTS && F_SEAL_SHRINK */
+#endif /* HAVE_MEMFD_CREATE && HAVE_SYS_EVENTFD_H */
+
 #endif /* __MINGW32__ */
 
 #ifdef HAVE_ALLOCA_H
@@ -163,11 +174,46 @@ static WIN_PROC_STUB(freeaddrinfo);
 */
 #define BRL_KEYBUF_SIZE 256
 
+/** size of the ring through which writes are passed to local servers */
+#define SHARED_MEMORY_SIZE 0X10000
+
+/* A write queued by brlapi_writeAsync() */
+typedef struct AsyncWrite {
+  struct AsyncWrite *next;
+  int status;
+  int withHandle;
+  union {
+    brlapi_writeCallback_t withoutHandle;
+    brlapi__writeCallback_t withHandle;
+  } callback;
+  void *data;
+  unsigned char *packets; /* with their headers, as sent on the socket */
+  size_t size; /* of the packets */
+  size_t sent; /* how much of them has been sent */
+} AsyncWrite;
+
 struct brlapi_handle_t { /* Connection-specific information */
   unsigned int brlx;
   unsigned int brly;
   brlapi_fileDescriptor fileDescriptor; /* Descriptor of the socket connected to BrlApi */
   int addrfamily; /* Address family of the socket */
+  uint32_t serverFeatures; /* Optional features which the server supports */
+#ifdef SHARED_MEMORY_TRANSPORT
+  /* ring shared with the server, also protected by fileDescriptor_mutex */
+  struct {
+    brlapi_sharedMemoryHeader_t *header; /* NULL if the socket is used */
+    unsigned char *ring;
+    uint32_t size;
+    uint32_t head; /* our own copy */
+    int event;
+    int space;
+  } shared;
+#endif /* SHARED_MEMORY_TRANSPORT */
+  /* writes not sent yet, and sent ones whose callback hasn't been called yet,
+   * also protected by fileDescriptor_mutex */
+  struct {
+    AsyncWrite *first, *last;
+  } queuedWrites, completedWrites;
   /* to protect concurrent fd write operations */
   pthread_mutex_t fileDescriptor_mutex;
   /* to protect concurrent fd requests */
@@ -220,6 +266,12 @@ static void brlapi_initializeHandle(brlapi_handle_t *handle)
   handle->brly = 0;
   handle->fileDescriptor = INVALID_FILE_DESCRIPTOR;
   handle->addrfamily = 0;
+  handle->serverFeatures = 0;
+#ifdef SHARED_MEMORY_TRANSPORT
+  handle->shared.header = NULL;
+#endif /* SHARED_MEMORY_TRANSPORT */
+  handle->queuedWrites.first = handle->queuedWrites.last = NULL;
+  handle->completedWrites.first = handle->completedWrites.last = NULL;
   pthread_mutex_init(&handle->fileDescriptor_mutex, NULL);
   pthread_mutex_init(&handle->req_mutex, NULL);
   pthread_mutex_init(&handle->key_mutex, NULL);
@@ -242,6 +294,21 @@ static void brlapi_initializeHandle(brlapi_handle_t *handle)
   pthread_mutex_init(&handle->exceptionHandler_mutex, NULL);
 }
 
+/* brlapi_bufferKeys */
+/* Appends the keys of a KEY or KEYS packet to the key buffer */
+/* Must be called with read_mutex locked */
+static void brlapi__bufferKeys(brlapi_handle_t *handle, const uint32_t *codes, size_t size)
+{
+  const uint32_t *end = codes + size/sizeof(brlapi_keyCode_t)*2;
+  for (; codes<end; codes+=2) {
+    if (handle->keybuf_nb>=BRL_KEYBUF_SIZE) {
+      syslog(LOG_WARNING,"lost key: 0X%8lx%8lx\n",(unsigned long)ntohl(codes[0]),(unsigned long)ntohl(codes[1]));
+    } else {
+      handle->keybuf[(handle->keybuf_next+handle->keybuf_nb++)%BRL_KEYBUF_SIZE]=((brlapi_keyCode_t)ntohl(codes[0]) << 32) | ntohl(codes[1]);
+    }
+  }
+}
+
 /* brlapi_doWaitForPacket */
 /* Waits for the specified type of packet: must be called with brlapi_req_mutex locked */
 /* If the right packet type arrives, returns its size */
@@ -282,13 +349,11 @@ static ssize_t brlapi__doWaitForPacket(brlapi_handle_t *handle, brlapi_packetTyp
     pthread_mutex_unlock(&handle->read_mutex);
     return res;
   }
-  if ((type==BRLAPI_PACKET_KEY) && (handle->state & STCONTROLLINGTTY) && (res==sizeof(brlapi_keyCode_t))) {
-    /* keypress, buffer it */
-    if (handle->keybuf_nb>=BRL_KEYBUF_SIZE) {
-      syslog(LOG_WARNING,"lost key: 0X%8lx%8lx\n",(unsigned long)ntohl(uint32Packet[0]),(unsigned long)ntohl(uint32Packet[1]));
-    } else {
-      handle->keybuf[(handle->keybuf_next+handle->keybuf_nb++)%BRL_KEYBUF_SIZE]=ntohl(*uint32Packet);
-    }
+  if ((handle->state & STCONTROLLINGTTY) && (
+	((type==BRLAPI_PACKET_KEY) && (res==sizeof(brlapi_keyCode_t))) ||
+	((type==BRLAPI_PACKET_KEYS) && !(res%sizeof(brlapi_keyCode_t))))) {
+    /* keypresses, buffer them */
+    brlapi__bufferKeys(handle, uint32Packet, res);
     pthread_mutex_unlock(&handle->read_mutex);
     return -3;
   }
@@ -397,13 +462,306 @@ static int brlapi__waitForAck(brlapi_handle_t *handle)
   return brlapi__waitForPacket(handle, BRLAPI_PACKET_ACK, NULL, 0, 1);
 }
 
+#ifdef SHARED_MEMORY_TRANSPORT
+/* brlapi_openSharedMemory */
+/* Sets up a ring in memory shared with the server through which writes */
+/* are then passed. Failing to is not an error, the socket just keeps being used */
+static void brlapi__openSharedMemory(brlapi_handle_t *handle)
+{
+  brlapi_error_t error = brlapi_error;
+  size_t mapSize = sizeof(*handle->shared.header) + SHARED_MEMORY_SIZE;
+  uint32_t packet[3] = {
+    htonl(sizeof(brlapi_sharedMemoryPacket_t)), htonl(BRLAPI_PACKET_SHAREDMEMORY),
+    htonl(SHARED_MEMORY_SIZE)
+  };
+  union {
+    struct cmsghdr header;
+    char buffer[CMSG_SPACE(3*sizeof(int))];
+  } control;
+  struct iovec iov = {
+    .iov_base = packet,
+    .iov_len = sizeof(packet)
+  };
+  struct msghdr msg = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = &control,
+    .msg_controllen = sizeof(control)
+  };
+  struct cmsghdr *cmsg;
+  int descriptors[3];
+  ssize_t res;
+  void *address;
+
+  if ((descriptors[0] = memfd_create("brlapi", MFD_CLOEXEC|MFD_ALLOW_SEALING)) == -1) return;
+
+  /* The server only maps memory which can't shrink under its feet. */
+  if ((ftruncate(descriptors[0], mapSize) == -1) ||
+      (fcntl(descriptors[0], F_ADD_SEALS, F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_SEAL) == -1))
+    goto outmemory;
+  if ((address = mmap(NULL, mapSize, PROT_READ|PROT_WRITE, MAP_SHARED, descriptors[0], 0)) == MAP_FAILED)
+    goto outmemory;
+  ((brlapi_sharedMemoryHeader_t *) address)->magic = BRLAPI_SHAREDMEMORY_MAGIC;
+
+  if ((descriptors[1] = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC)) == -1)
+    goto outmap;
+  if ((descriptors[2] = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC)) == -1)
+    goto outevent;
+
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(descriptors));
+  memcpy(CMSG_DATA(cmsg), descriptors, sizeof(descriptors));
+
+  if ((res = sendmsg(handle->fileDescriptor, &msg, 0)) == -1)
+    goto outspace;
+  if ((res < sizeof(packet)) &&
+      (brlapi_writeFile(handle->fileDescriptor, (unsigned char *) packet + res, sizeof(packet) - res) < 0))
+    goto outspace;
+  if (brlapi__waitForAck(handle))
+    goto outspace;
+
+  close(descriptors[0]);
+  handle->shared.header = address;
+  handle->shared.ring = (unsigned char *) (handle->shared.header + 1);
+  handle->shared.size = SHARED_MEMORY_SIZE;
+  handle->shared.head = 0;
+  handle->shared.event = descriptors[1];
+  handle->shared.space = descriptors[2];
+  return;
+
+outspace:
+  close(descriptors[2]);
+outevent:
+  close(descriptors[1]);
+outmap:
+  munmap(address, mapSize);
+outmemory:
+  close(descriptors[0]);
+  brlapi_error = error;
+}
+
+/* brlapi_closeSharedMemory */
+/* Must be called with fileDescriptor_mutex locked */
+static void brlapi__closeSharedMemory(brlapi_handle_t *handle)
+{
+  if (handle->shared.header) {
+    munmap(handle->shared.header, sizeof(*handle->shared.header) + handle->shared.size);
+    close(handle->shared.event);
+    close(handle->shared.space);
+    handle->shared.header = NULL;
+  }
+}
+
+/* brlapi_copyToRing */
+/* Copies data into the shared memory ring */
+static void brlapi__copyToRing(brlapi_handle_t *handle, uint32_t position, const void *buffer, size_t size)
+{
+  uint32_t offset = position & (handle->shared.size - 1);
+  size_t count = MIN(size, handle->shared.size - offset);
+
+  memcpy(handle->shared.ring + offset, buffer, count);
+  memcpy(handle->shared.ring, (const unsigned char *) buffer + count, size - count);
+}
+
+/* brlapi_hasSharedSpace */
+/* Tells whether length more bytes fit into the shared memory ring */
+static int brlapi__hasSharedSpace(brlapi_handle_t *handle, uint32_t length)
+{
+  return (uint32_t) (handle->shared.head - handle->shared.header->tail) <= (handle->shared.size - length);
+}
+
+/* brlapi_writeSharedPacket */
+/* Puts a packet into the shared memory ring, and wakes the server up if needed */
+/* Returns 1 if there's no room for it and wait is 0 */
+/* Must be called with fileDescriptor_mutex locked */
+static ssize_t brlapi__writeSharedPacket(brlapi_handle_t *handle, brlapi_packetType_t type, const void *buf, size_t size, int wait)
+{
+  brlapi_sharedMemoryHeader_t *header = handle->shared.header;
+  brlapi_header_t packetHeader = { size, type };
+  uint32_t length = sizeof(packetHeader) + ((size + 3) & ~3);
+
+  if (size > BRLAPI_MAXPACKETSIZE) {
+    brlapi_errno = BRLAPI_ERROR_INVALID_PACKET;
+    return -1;
+  }
+
+  while (!brlapi__hasSharedSpace(handle, length)) {
+    /* The server hasn't caught up yet: wait for it, unless it has gone away. */
+    struct pollfd pollDescriptors[] = {
+      { .fd = handle->shared.space, .events = POLLIN },
+      { .fd = handle->fileDescriptor, .events = 0 }
+    };
+    uint64_t count;
+
+    /* Forget about an earlier wakeup before asking for a new one. */
+    if ((read(handle->shared.space, &count, sizeof(count)) == -1) && (errno != EAGAIN)) {
+      LibcError("read in writeSharedPacket");
+      return -1;
+    }
+
+    /* It only writes to the event after having advanced tail and seen this. */
+    header->full = 1;
+    __sync_synchronize();
+    if (brlapi__hasSharedSpace(handle, length)) break;
+    if (!wait) return 1;
+
+    if (poll(pollDescriptors, 2, -1) == -1) {
+      if (errno == EINTR) continue;
+      LibcError("poll in writeSharedPacket");
+      return -1;
+    }
+
+    if (pollDescriptors[1].revents) {
+      brlapi_errno = BRLAPI_ERROR_EOF;
+      return -1;
+    }
+  }
+
+  /* Don't overwrite the space before the server has seen it's free. */
+  __sync_synchronize();
+
+  brlapi__copyToRing(handle, handle->shared.head, &packetHeader, sizeof(packetHeader));
+  if (size && buf) brlapi__copyToRing(handle, handle->shared.head + sizeof(packetHeader), buf, size);
+  handle->shared.head += length;
+
+  /* The server mustn't see the new head before the packet itself. */
+  __sync_synchronize();
+  header->head = handle->shared.head;
+
+  /* It only waits for the event after having said so and checked the head again. */
+  __sync_synchronize();
+  if (header->waiting) {
+    uint64_t count = 1;
+
+    if ((write(handle->shared.event, &count, sizeof(count)) == -1) && (errno != EAGAIN)) {
+      LibcError("write in writeSharedPacket");
+      return -1;
+    }
+  }
+
+  return 0;
+}
+#endif /* SHARED_MEMORY_TRANSPORT */
+
+/* brlapi_completeAsyncWrite */
+/* Moves the first queued write to the completed ones */
+/* Must be called with fileDescriptor_mutex locked */
+static void brlapi__completeAsyncWrite(brlapi_handle_t *handle, int status)
+{
+  AsyncWrite *w = handle->queuedWrites.first;
+
+  if (!(handle->queuedWrites.first = w->next)) handle->queuedWrites.last = NULL;
+  w->next = NULL;
+  w->status = status;
+  if (handle->completedWrites.last) handle->completedWrites.last->next = w;
+  else handle->completedWrites.first = w;
+  handle->completedWrites.last = w;
+}
+
+/* brlapi_sendAsyncWrites */
+/* Sends queued writes, only as much as can be without blocking if wait is 0 */
+/* Must be called with fileDescriptor_mutex locked */
+static int brlapi__sendAsyncWrites(brlapi_handle_t *handle, int wait)
+{
+  AsyncWrite *w;
+
+  while ((w = handle->queuedWrites.first)) {
+    while (w->sent < w->size) {
+      ssize_t res;
+
+#ifdef SHARED_MEMORY_TRANSPORT
+      if (handle->shared.header) {
+        uint32_t header[2];
+        size_t size;
+
+        memcpy(header, w->packets + w->sent, sizeof(header));
+        size = ntohl(header[0]);
+        res = brlapi__writeSharedPacket(handle, ntohl(header[1]), w->packets + w->sent + sizeof(header), size, wait);
+        if (res < 0) goto error;
+        if (res > 0) return 0;
+        w->sent += sizeof(header) + size;
+        continue;
+      }
+#endif /* SHARED_MEMORY_TRANSPORT */
+
+#if defined(MSG_DONTWAIT) && !defined(__MINGW32__)
+      if (!wait) {
+        res = send(handle->fileDescriptor, w->packets + w->sent, w->size - w->sent, MSG_DONTWAIT);
+        if (res < 0) {
+          if ((errno == EINTR) ||
+#ifdef EWOULDBLOCK
+              (errno == EWOULDBLOCK) ||
+#endif /* EWOULDBLOCK */
+              (errno == EAGAIN)) return 0;
+          LibcError("send in sendAsyncWrites");
+          goto error;
+        }
+      } else
+#endif /* MSG_DONTWAIT */
+      if ((res = brlapi_writeFile(handle->fileDescriptor, w->packets + w->sent, w->size - w->sent)) < 0) {
+        LibcError("write in sendAsyncWrites");
+        goto error;
+      }
+      w->sent += res;
+    }
+
+    brlapi__completeAsyncWrite(handle, BRLAPI_WRITE_SENT);
+  }
+  return 0;
+
+error:
+  while (handle->queuedWrites.first) brlapi__completeAsyncWrite(handle, BRLAPI_WRITE_FAILED);
+  return -1;
+}
+
+/* brlapi_writeRequest */
+/* Writes a request which gets no answer, through shared memory if it's set up */
+/* Must be called with fileDescriptor_mutex locked */
+static ssize_t brlapi__writeRequest(brlapi_handle_t *handle, brlapi_packetType_t type, const void *buf, size_t size)
+{
+  if (brlapi__sendAsyncWrites(handle, 1) < 0) return -1;
+#ifdef SHARED_MEMORY_TRANSPORT
+  if (handle->shared.header) return brlapi__writeSharedPacket(handle, type, buf, size, 1);
+#endif /* SHARED_MEMORY_TRANSPORT */
+  return brlapi_writePacket(handle->fileDescriptor, type, buf, size);
+}
+
+/* brlapi_writePacket */
+/* Writes a request to the socket, after the queued writes */
+/* Must be called with fileDescriptor_mutex locked */
+static ssize_t brlapi__writePacket(brlapi_handle_t *handle, brlapi_packetType_t type, const void *buf, size_t size)
+{
+  if (brlapi__sendAsyncWrites(handle, 1) < 0) return -1;
+  return brlapi_writePacket(handle->fileDescriptor, type, buf, size);
+}
+
+/* brlapi_freeAsyncWrites */
+/* Must be called with fileDescriptor_mutex locked */
+static void brlapi__freeAsyncWrites(brlapi_handle_t *handle)
+{
+  while (handle->queuedWrites.first) brlapi__completeAsyncWrite(handle, BRLAPI_WRITE_FAILED);
+
+  while (handle->completedWrites.first) {
+    AsyncWrite *w = handle->completedWrites.first;
+    handle->completedWrites.first = w->next;
+    free(w->packets);
+    free(w);
+  }
+  handle->completedWrites.last = NULL;
+}
+
 /* brlapi_writePacketWaitForAck */
 /* write a packet and wait for an acknowledgement */
 static int brlapi__writePacketWaitForAck(brlapi_handle_t *handle, brlapi_packetType_t type, const void *buf, size_t size)
 {
   ssize_t res;
   pthread_mutex_lock(&handle->req_mutex);
-  if ((res=brlapi_writePacket(handle->fileDescriptor, type,buf,size))<0) {
+  pthread_mutex_lock(&handle->fileDescriptor_mutex);
+  res=brlapi__writePacket(handle, type,buf,size);
+  pthread_mutex_unlock(&handle->fileDescriptor_mutex);
+  if (res<0) {
     pthread_mutex_unlock(&handle->req_mutex);
     return res;
   }
@@ -674,8 +1032,15 @@ brlapi_fileDescriptor BRLAPI_STDCALL brlapi__openConnection(brlapi_handle_t *han
     brlapi_errno = BRLAPI_ERROR_PROTOCOL_VERSION;
     goto outfd;
   }
-
-  if (brlapi_writePacket(handle->fileDescriptor, BRLAPI_PACKET_VERSION, version, sizeof(*version)) < 0)
+  if (len >= sizeof(serverPacket.serverVersion))
+    handle->serverFeatures = ntohl(serverPacket.serverVersion.features);
+
+  if (handle->serverFeatures & BRLAPI_FEATURE_KEYS) {
+    /* Echo the version, with the features we want */
+    serverPacket.serverVersion.features = htonl(BRLAPI_FEATURE_KEYS);
+    if (brlapi_writePacket(handle->fileDescriptor, BRLAPI_PACKET_VERSION, &serverPacket, sizeof(serverPacket.serverVersion)) < 0)
+      goto outfd;
+  } else if (brlapi_writePacket(handle->fileDescriptor, BRLAPI_PACKET_VERSION, version, sizeof(*version)) < 0)
     goto outfd;
 
   if ((len = brlapi__waitForPacket(handle, BRLAPI_PACKET_AUTH, &serverPacket, sizeof(serverPacket), 1)) < 0)
@@ -716,6 +1081,10 @@ out:
   return INVALID_FILE_DESCRIPTOR;
 
 done:
+#ifdef SHARED_MEMORY_TRANSPORT
+  if ((handle->addrfamily == PF_LOCAL) && (handle->serverFeatures & BRLAPI_FEATURE_SHAREDMEMORY))
+    brlapi__openSharedMemory(handle);
+#endif /* SHARED_MEMORY_TRANSPORT */
   pthread_mutex_lock(&handle->state_mutex);
   handle->state = STCONNECTED;
   pthread_mutex_unlock(&handle->state_mutex);
@@ -735,6 +1104,10 @@ void BRLAPI_STDCALL brlapi__closeConnection(brlapi_handle_t *handle)
   handle->state = 0;
   pthread_mutex_unlock(&handle->state_mutex);
   pthread_mutex_lock(&handle->fileDescriptor_mutex);
+  brlapi__freeAsyncWrites(handle);
+#ifdef SHARED_MEMORY_TRANSPORT
+  brlapi__closeSharedMemory(handle);
+#endif /* SHARED_MEMORY_TRANSPORT */
   closeFileDescriptor(handle->fileDescriptor);
   handle->fileDescriptor = INVALID_FILE_DESCRIPTOR;
   pthread_mutex_unlock(&handle->fileDescriptor_mutex);
@@ -826,7 +1199,7 @@ ssize_t BRLAPI_STDCALL brlapi__sendRaw(brlapi_handle_t *handle, const void *buf,
 {
   ssize_t res;
   pthread_mutex_lock(&handle->fileDescriptor_mutex);
-  res=brlapi_writePacket(handle->fileDescriptor, BRLAPI_PACKET_PACKET, buf, size);
+  res=brlapi__writePacket(handle, BRLAPI_PACKET_PACKET, buf, size);
   pthread_mutex_unlock(&handle->fileDescriptor_mutex);
   return res;
 }
@@ -889,7 +1262,9 @@ static ssize_t brlapi__request(brlapi_handle_t *handle, brlapi_packetType_t requ
 {
   ssize_t res;
   pthread_mutex_lock(&handle->req_mutex);
-  res = brlapi_writePacket(handle->fileDescriptor, request, NULL, 0);
+  pthread_mutex_lock(&handle->fileDescriptor_mutex);
+  res = brlapi__writePacket(handle, request, NULL, 0);
+  pthread_mutex_unlock(&handle->fileDescriptor_mutex);
   if (res==-1) {
     pthread_mutex_unlock(&handle->req_mutex);
     return -1;
@@ -1098,7 +1473,7 @@ int BRLAPI_STDCALL brlapi__setFocus(brlapi_handle_t *handle, int tty)
   int res;
   utty = htonl(tty);
   pthread_mutex_lock(&handle->fileDescriptor_mutex);
-  res = brlapi_writePacket(handle->fileDescriptor, BRLAPI_PACKET_SETFOCUS, &utty, sizeof(utty));
+  res = brlapi__writeRequest(handle, BRLAPI_PACKET_SETFOCUS, &utty, sizeof(utty));
   pthread_mutex_unlock(&handle->fileDescriptor_mutex);
   return res;
 }
@@ -1144,27 +1519,221 @@ static size_t getCharset(void *buffer, int wide) {
   return p-start;
 }
 
+/* How the text of a write is divided into cells, so that it can be fragmented */
+typedef enum {
+  TEXT_CELLS_UNKNOWN,
+  TEXT_CELLS_FIXED,
+  TEXT_CELLS_UTF8,
+  TEXT_CELLS_LOCALE
+} TextCells;
+
+/* A write, before it is put into one or more packets */
+typedef struct {
+  uint32_t flags; /* besides the ones telling which fields are present */
+  int region;
+  unsigned int regionBegin, regionSize;
+  const unsigned char *text;
+  size_t textSize;
+  TextCells textCells;
+  size_t cellSize; /* for TEXT_CELLS_FIXED */
+  const unsigned char *andMask, *orMask;
+  int cursor;
+  const unsigned char *charset; /* length-prefixed */
+  size_t charsetSize;
+} WriteRequest;
+
+static void setTextCells(WriteRequest *w, int locale)
+{
+  const char *charset = (const char *) w->charset + 1;
+  size_t length = w->charsetSize? w->charsetSize - 1: 0;
+
+  if ((length == strlen(WCHAR_CHARSET)) && !strncmp(charset, WCHAR_CHARSET, length)) {
+    w->textCells = TEXT_CELLS_FIXED;
+    w->cellSize = sizeof(wchar_t);
+  } else if (((length == 5) && !strncasecmp(charset, "UTF-8", length)) ||
+             ((length == 4) && !strncasecmp(charset, "UTF8", length))) {
+    w->textCells = TEXT_CELLS_UTF8;
+  } else if (length && locale) {
+    w->textCells = TEXT_CELLS_LOCALE;
+  } else if (w->regionSize && !(w->textSize % w->regionSize)) {
+    w->textCells = TEXT_CELLS_FIXED;
+    w->cellSize = w->textSize / w->regionSize;
+  } else {
+    w->textCells = TEXT_CELLS_UNKNOWN;
+  }
+}
+
+/* Returns how many bytes of text make up the next cell, 0 if unknown */
+static size_t getCellTextSize(const WriteRequest *w, const unsigned char *text, size_t size, mbstate_t *ps)
+{
+  size_t length;
+
+  switch (w->textCells) {
+    case TEXT_CELLS_FIXED:
+      length = w->cellSize;
+      break;
+
+    case TEXT_CELLS_UTF8:
+      if (!size) return 0;
+      if (!(*text & 0X80)) length = 1;
+      else if ((*text & 0XE0) == 0XC0) length = 2;
+      else if ((*text & 0XF0) == 0XE0) length = 3;
+      else if ((*text & 0XF8) == 0XF0) length = 4;
+      else return 0;
+      break;
+
+    case TEXT_CELLS_LOCALE:
+      length = mbrlen((const char *) text, size, ps);
+      if ((length == (size_t) -1) || (length == (size_t) -2)) return 0;
+      if (!length) length = 1;
+      break;
+
+    default:
+      return 0;
+  }
+
+  return (length <= size)? length: 0;
+}
+
+/* Puts the fields of a write for cells [begin, begin+count) into a packet */
+static size_t putWriteArguments(brlapi_packet_t *packet, const WriteRequest *w, unsigned int begin, unsigned int count, const unsigned char *text, size_t textSize, int region, int last)
+{
+  brlapi_writeArgumentsPacket_t *wa = &packet->writeArguments;
+  unsigned char *p = &wa->data;
+  unsigned int offset = begin - w->regionBegin;
+  uint32_t flags = w->flags;
+
+  if (region) {
+    flags |= BRLAPI_WF_REGION;
+    *((uint32_t *) p) = htonl(begin); p += sizeof(uint32_t);
+    *((uint32_t *) p) = htonl(count); p += sizeof(uint32_t);
+  }
+  if (w->text) {
+    flags |= BRLAPI_WF_TEXT;
+    *((uint32_t *) p) = htonl(textSize); p += sizeof(uint32_t);
+    memcpy(p, text, textSize);
+    p += textSize;
+  }
+  if (w->andMask) {
+    flags |= BRLAPI_WF_ATTR_AND;
+    memcpy(p, w->andMask+offset, count);
+    p += count;
+  }
+  if (w->orMask) {
+    flags |= BRLAPI_WF_ATTR_OR;
+    memcpy(p, w->orMask+offset, count);
+    p += count;
+  }
+  if ((w->cursor >= 0) && last) {
+    flags |= BRLAPI_WF_CURSOR;
+    *((uint32_t *) p) = htonl(w->cursor);
+    p += sizeof(uint32_t);
+  }
+  if (w->text && w->charsetSize) {
+    flags |= BRLAPI_WF_CHARSET;
+    memcpy(p, w->charset, w->charsetSize);
+    p += w->charsetSize;
+  }
+  if (!last) flags |= BRLAPI_WF_CONTINUED;
+  wa->flags = htonl(flags);
+  return p - packet->data;
+}
+
+/* Where the packets of a write go */
+typedef int WritePacketHandler(brlapi_handle_t *handle, const brlapi_packet_t *packet, size_t size, void *data);
+
+/* Puts a write into a packet, or into a sequence of continued fragments if it
+ * doesn't fit into one, so that the server still displays it all at once */
+static int putWriteRequest(brlapi_handle_t *handle, const WriteRequest *w, WritePacketHandler *handlePacket, void *data)
+{
+  brlapi_packet_t packet;
+  size_t overhead = sizeof(uint32_t) + (w->text? sizeof(uint32_t) + w->charsetSize: 0) + ((w->cursor >= 0)? sizeof(uint32_t): 0);
+  size_t cellOverhead = (w->andMask? 1: 0) + (w->orMask? 1: 0);
+  unsigned int begin = w->regionBegin, end = w->regionBegin + w->regionSize;
+  const unsigned char *text = w->text;
+  size_t textLeft = w->textSize;
+  mbstate_t ps;
+  int res = 0;
+
+  if (overhead + (w->region? 2*sizeof(uint32_t): 0) + w->textSize + w->regionSize*cellOverhead <= sizeof(packet)) {
+    size_t size = putWriteArguments(&packet, w, begin, w->regionSize, text, textLeft, w->region, 1);
+    return handlePacket(handle, &packet, size, data);
+  }
+
+  overhead += 2*sizeof(uint32_t);
+  memset(&ps, 0, sizeof(ps));
+  while (begin < end) {
+    unsigned int count = 0;
+    size_t textSize = 0, size = overhead;
+    int last;
+
+    while (begin + count < end) {
+      mbstate_t state = ps;
+      size_t cell = 0;
+
+      if (text && !(cell = getCellTextSize(w, text+textSize, textLeft-textSize, &ps))) goto invalid;
+      if (size + cell + cellOverhead > sizeof(packet)) {
+        ps = state;
+        break;
+      }
+      size += cell + cellOverhead;
+      textSize += cell;
+      count++;
+    }
+    if (!count) goto invalid;
+
+    last = (begin + count) == end;
+    if (last && (textSize != textLeft)) goto invalid;
+    size = putWriteArguments(&packet, w, begin, count, text, textSize, 1, last);
+    if ((res = handlePacket(handle, &packet, size, data)) < 0) return res;
+
+    begin += count;
+    if (text) text += textSize;
+    textLeft -= textSize;
+  }
+  return res;
+
+invalid:
+  brlapi_errno = BRLAPI_ERROR_INVALID_PARAMETER;
+  return -1;
+}
+
+static int writeWritePacket(brlapi_handle_t *handle, const brlapi_packet_t *packet, size_t size, void *data)
+{
+  return brlapi__writeRequest(handle, BRLAPI_PACKET_WRITE, packet, size);
+}
+
+/* Sends a write right away */
+static int sendWriteRequest(brlapi_handle_t *handle, const WriteRequest *w)
+{
+  int res;
+  pthread_mutex_lock(&handle->fileDescriptor_mutex);
+  res = putWriteRequest(handle, w, writeWritePacket, NULL);
+  pthread_mutex_unlock(&handle->fileDescriptor_mutex);
+  return res;
+}
+
 /* Function : brlapi_writeText */
 /* Writes a string to the braille display */
 static int brlapi___writeText(brlapi_handle_t *handle, int cursor, const void *str, int wide)
 {
   int dispSize = handle->brlx * handle->brly;
   unsigned int min;
-  brlapi_packet_t packet;
-  brlapi_writeArgumentsPacket_t *wa = &packet.writeArguments;
-  unsigned char *p = &wa->data;
+  unsigned char textBuf[dispSize * MAX(MB_LEN_MAX, sizeof(wchar_t))];
+  unsigned char *p = textBuf;
+  unsigned char charset[1+0XFF];
+  WriteRequest w;
   char *locale;
-  int res;
   size_t len;
   locale = setlocale(LC_CTYPE,NULL);
-  wa->flags = BRLAPI_WF_REGION;
-  *((uint32_t *) p) = htonl(1); p += sizeof(uint32_t);
-  *((uint32_t *) p) = htonl(dispSize); p += sizeof(uint32_t);
+  w.flags = 0;
+  w.region = 1;
+  w.regionBegin = 1;
+  w.regionSize = dispSize;
+  w.text = NULL;
+  w.textSize = 0;
+  w.andMask = w.orMask = NULL;
   if (str) {
-    uint32_t *size;
-    wa->flags |= BRLAPI_WF_TEXT;
-    size = (uint32_t *) p;
-    p += sizeof(*size);
 #if defined(__MINGW32__)
     if (CHECKGETPROC("ntdll.dll", wcslen) && wide)
       len = sizeof(wchar_t) * wcslenProc(str);
@@ -1216,24 +1785,15 @@ endcount:
       memset(p, ' ', dispSize-min);
       p += dispSize-min;
     }
-    *size = htonl((p-(unsigned char *)(size+1)));
-  }
-  if (cursor!=BRLAPI_CURSOR_LEAVE) {
-    wa->flags |= BRLAPI_WF_CURSOR;
-    *((uint32_t *) p) = htonl(cursor);
-    p += sizeof(uint32_t);
-  }
-
-  if ((len = getCharset(p , wide))) {
-    wa->flags |= BRLAPI_WF_CHARSET;
-    p += len;
+    w.text = textBuf;
+    w.textSize = p - textBuf;
   }
+  w.cursor = (cursor!=BRLAPI_CURSOR_LEAVE)? cursor: -1;
 
-  wa->flags = htonl(wa->flags);
-  pthread_mutex_lock(&handle->fileDescriptor_mutex);
-  res = brlapi_writePacket(handle->fileDescriptor,BRLAPI_PACKET_WRITE,&packet,sizeof(wa->flags)+(p-&wa->data));
-  pthread_mutex_unlock(&handle->fileDescriptor_mutex);
-  return res;
+  w.charset = charset;
+  w.charsetSize = getCharset(charset, wide);
+  setTextCells(&w, 1);
+  return sendWriteRequest(handle, &w);
 }
 
 #ifdef WINDOWS
@@ -1268,6 +1828,41 @@ int BRLAPI_STDCALL brlapi_writeWText(int cursor, const wchar_t *str)
 }
 #endif /* WINDOWS */
 
+/* Function : brlapi_writeContractedText */
+/* Writes a string to the braille display, contracted by the server */
+int BRLAPI_STDCALL brlapi__writeContractedText(brlapi_handle_t *handle, int cursor, const char *str)
+{
+  unsigned char charset[1+0XFF];
+  WriteRequest w;
+
+  if (!(handle->serverFeatures & BRLAPI_FEATURE_CONTRACTION)) {
+    brlapi_errno = BRLAPI_ERROR_OPNOTSUPP;
+    return -1;
+  }
+  if (cursor < BRLAPI_CURSOR_LEAVE) {
+    brlapi_errno = BRLAPI_ERROR_INVALID_PARAMETER;
+    return -1;
+  }
+  w.flags = BRLAPI_WF_CONTRACT;
+  w.region = 1;
+  w.regionBegin = 1;
+  w.regionSize = handle->brlx * handle->brly;
+  w.text = (const unsigned char *) (str? str: "");
+  w.textSize = strlen((const char *) w.text);
+  w.andMask = w.orMask = NULL;
+  w.cursor = (cursor!=BRLAPI_CURSOR_LEAVE)? cursor: -1;
+  w.charset = charset;
+  w.charsetSize = getCharset(charset, 0);
+  /* the text can't be split into cells, so it must fit into one packet */
+  w.textCells = TEXT_CELLS_UNKNOWN;
+  return sendWriteRequest(handle, &w);
+}
+
+int BRLAPI_STDCALL brlapi_writeContractedText(int cursor, const char *str)
+{
+  return brlapi__writeContractedText(&defaultHandle, cursor, str);
+}
+
 /* Function : brlapi_writeDots */
 /* Writes dot-matrix to the braille display */
 int BRLAPI_STDCALL brlapi__writeDots(brlapi_handle_t *handle, const unsigned char *dots)
@@ -1304,35 +1899,34 @@ int BRLAPI_STDCALL brlapi_writeDots(const unsigned char *dots)
 
 /* Function : brlapi_write */
 /* Extended writes on braille displays */
-#ifdef WINDOWS
-int BRLAPI_STDCALL brlapi__writeWin(brlapi_handle_t *handle, const brlapi_writeArguments_t *s, int wide)
-#else /* WINDOWS */
-int brlapi__write(brlapi_handle_t *handle, const brlapi_writeArguments_t *s)
-#endif /* WINDOWS */
+/* Checks the arguments of a write, and tells what to put into packets */
+/* charset must have room for a length-prefixed charset name */
+/* Returns -1 on error, 0 if there's nothing to write, 1 otherwise */
+static int prepareWriteRequest(brlapi_handle_t *handle, const brlapi_writeArguments_t *s, int wide, WriteRequest *request, unsigned char *charset)
 {
+  WriteRequest w;
   int dispSize = handle->brlx * handle->brly;
-  unsigned int rbeg, rsiz, strLen;
-  brlapi_packet_t packet;
-  brlapi_writeArgumentsPacket_t *wa = &packet.writeArguments;
-  unsigned char *p = &wa->data;
-  unsigned char *end = (unsigned char*) &packet.data[sizeof(packet)];
-  int res;
-#ifndef WINDOWS
-  int wide = 0;
-#endif /* WINDOWS */
-  wa->flags = 0;
-  if (s==NULL) goto send;
-  rbeg = s->regionBegin;
-  rsiz = s->regionSize;
-  if (rbeg || rsiz) {
-    if (rsiz == 0) return 0;
-    wa->flags |= BRLAPI_WF_REGION;
-    *((uint32_t *) p) = htonl(rbeg); p += sizeof(uint32_t);
-    *((uint32_t *) p) = htonl(rsiz); p += sizeof(uint32_t);
+  unsigned int strLen;
+  int locale = 0;
+  if (s==NULL) {
+    /* just clear the client's display */
+    memset(request, 0, sizeof(*request));
+    request->cursor = -1;
+    return 1;
+  }
+  w.flags = 0;
+  w.regionBegin = s->regionBegin;
+  w.regionSize = s->regionSize;
+  if (w.regionBegin || w.regionSize) {
+    if (w.regionSize == 0) return 0;
+    w.region = 1;
   } else {
     /* DEPRECATED */
-    rbeg = 1; rsiz = dispSize;
+    w.region = 0;
+    w.regionBegin = 1; w.regionSize = dispSize;
   }
+  w.text = NULL;
+  w.textSize = 0;
   if (s->text) {
     if (s->textSize != -1)
       strLen = s->textSize;
@@ -1347,69 +1941,54 @@ int brlapi__write(brlapi_handle_t *handle, const brlapi_writeArguments_t *s)
       else
 #endif /* windows wide string length */
 	strLen = strlen(s->text);
-    *((uint32_t *) p) = htonl(strLen); p += sizeof(uint32_t);
-    wa->flags |= BRLAPI_WF_TEXT;
-    if (p + strLen > end) {
-      brlapi_errno = BRLAPI_ERROR_INVALID_PARAMETER;
-      return -1;
-    }
-    memcpy(p, s->text, strLen);
-    p += strLen;
-  }
-  if (s->andMask) {
-    wa->flags |= BRLAPI_WF_ATTR_AND;
-    if (p + rsiz > end) {
-      brlapi_errno = BRLAPI_ERROR_INVALID_PARAMETER;
-      return -1;
-    }
-    memcpy(p, s->andMask, rsiz);
-    p += rsiz;
-  }
-  if (s->orMask) {
-    wa->flags |= BRLAPI_WF_ATTR_OR;
-    if (p + rsiz > end) {
-      brlapi_errno = BRLAPI_ERROR_INVALID_PARAMETER;
-      return -1;
-    }
-    memcpy(p, s->orMask, rsiz);
-    p += rsiz;
+    w.text = (const unsigned char *) s->text;
+    w.textSize = strLen;
   }
+  w.andMask = s->andMask;
+  w.orMask = s->orMask;
   if ((s->cursor>=0) && (s->cursor<=dispSize)) {
-    wa->flags |= BRLAPI_WF_CURSOR;
-    if (p + sizeof(uint32_t) > end) {
-      brlapi_errno = BRLAPI_ERROR_INVALID_PARAMETER;
-      return -1;
-    }
-    *((uint32_t *) p) = htonl(s->cursor);
-    p += sizeof(uint32_t);
+    w.cursor = s->cursor;
   } else if (s->cursor!=-1) {
     brlapi_errno = BRLAPI_ERROR_INVALID_PARAMETER;
     return -1;    
-  }
+  } else w.cursor = -1;
+  w.charset = charset;
+  w.charsetSize = 0;
   if (s->charset) {
     if (!*s->charset) {
-      if ((strLen = getCharset(p, wide))) {
-	wa->flags |= BRLAPI_WF_CHARSET;
-	p += strLen;
-      }
+      w.charsetSize = getCharset(charset, wide);
+      locale = 1;
     } else {
       strLen = strlen(s->charset);
-      *p++ = strLen;
-      wa->flags |= BRLAPI_WF_CHARSET;
-      if (p + strLen > end) {
+      if (strLen > 0XFF) {
 	brlapi_errno = BRLAPI_ERROR_INVALID_PARAMETER;
 	return -1;
       }
-      memcpy(p, s->charset, strLen);
-      p += strLen;
+      charset[0] = strLen;
+      memcpy(charset+1, s->charset, strLen);
+      w.charsetSize = 1 + strLen;
     }
   }
-send:
-  wa->flags = htonl(wa->flags);
-  pthread_mutex_lock(&handle->fileDescriptor_mutex);
-  res = brlapi_writePacket(handle->fileDescriptor,BRLAPI_PACKET_WRITE,&packet,sizeof(wa->flags)+(p-&wa->data));
-  pthread_mutex_unlock(&handle->fileDescriptor_mutex);
-  return res;
+  setTextCells(&w, locale);
+  *request = w;
+  return 1;
+}
+
+#ifdef WINDOWS
+int BRLAPI_STDCALL brlapi__writeWin(brlapi_handle_t *handle, const brlapi_writeArguments_t *s, int wide)
+#else /* WINDOWS */
+int brlapi__write(brlapi_handle_t *handle, const brlapi_writeArguments_t *s)
+#endif /* WINDOWS */
+{
+  unsigned char charset[1+0XFF];
+  WriteRequest w;
+  int res;
+#ifndef WINDOWS
+  int wide = 0;
+#endif /* WINDOWS */
+
+  if ((res = prepareWriteRequest(handle, s, wide, &w, charset)) <= 0) return res;
+  return sendWriteRequest(handle, &w);
 }
 
 #ifdef WINDOWS
@@ -1425,43 +2004,51 @@ int brlapi_write(const brlapi_writeArguments_t *s)
 #endif /* WINDOWS */
 
 /* Function : packetReady */
-/* Tests wether a packet is ready on file descriptor fd */
+/* Tests wether a packet is ready on file descriptor fd, waiting for at most */
+/* timeout milliseconds */
 /* Returns -1 if an error occurs, 0 if no packet is ready, 1 if there is a */
 /* packet ready to be read */
-static int packetReady(brlapi_handle_t *handle)
+static int packetReady(brlapi_handle_t *handle, int timeout)
 {
 #ifdef __MINGW32__
   if (handle->addrfamily == PF_LOCAL) {
     DWORD avail;
-    if (!PeekNamedPipe(handle->fileDescriptor, NULL, 0, NULL, &avail, NULL)) {
-      brlapi_errfun = "packetReady";
-      brlapi_errno = BRLAPI_ERROR_LIBCERR;
-      brlapi_libcerrno = errno;
-      return -1;
+    while (1) {
+      if (!PeekNamedPipe(handle->fileDescriptor, NULL, 0, NULL, &avail, NULL)) {
+	brlapi_errfun = "packetReady";
+	brlapi_errno = BRLAPI_ERROR_LIBCERR;
+	brlapi_libcerrno = errno;
+	return -1;
+      }
+      if (avail || timeout <= 0) return avail!=0;
+      /* Named pipes can't be waited for, poll them */
+      Sleep(MIN(timeout, 10));
+      timeout -= MIN(timeout, 10);
     }
-    return avail!=0;
   } else {
     SOCKET fd = (SOCKET) handle->fileDescriptor;
 #else /* __MINGW32__ */
   int fd = handle->fileDescriptor;
 #endif /* __MINGW32__ */
   fd_set set;
-  struct timeval timeout;
-  memset(&timeout, 0, sizeof(timeout));
+  struct timeval tv;
+  tv.tv_sec = timeout / 1000;
+  tv.tv_usec = timeout % 1000 * 1000;
   FD_ZERO(&set);
   FD_SET(fd, &set);
-  return select(fd+1, &set, NULL, NULL, &timeout);
+  return select(fd+1, &set, NULL, NULL, &tv);
 #ifdef __MINGW32__
   }
 #endif /* __MINGW32__ */
 }
 
-/* Function : brlapi_readKey */
-/* Reads a key from the braille keyboard */
-int BRLAPI_STDCALL brlapi__readKey(brlapi_handle_t *handle, int block, brlapi_keyCode_t *code)
+/* Function : brlapi_readKeys */
+/* Reads the pending key presses from the braille keyboard */
+int BRLAPI_STDCALL brlapi__readKeys(brlapi_handle_t *handle, brlapi_keyCode_t *codes, size_t max, int timeout)
 {
   ssize_t res;
-  uint32_t buf[2];
+  size_t count = 0;
+  uint32_t buf[2*BRLAPI_MAXKEYS];
 
   pthread_mutex_lock(&handle->state_mutex);
   if (!(handle->state & STCONTROLLINGTTY)) {
@@ -1471,43 +2058,266 @@ int BRLAPI_STDCALL brlapi__readKey(brlapi_handle_t *handle, int block, brlapi_ke
   }
   pthread_mutex_unlock(&handle->state_mutex);
 
-  pthread_mutex_lock(&handle->read_mutex);
-  if (handle->keybuf_nb>0) {
-    *code=handle->keybuf[handle->keybuf_next];
-    handle->keybuf_next=(handle->keybuf_next+1)%BRL_KEYBUF_SIZE;
-    handle->keybuf_nb--;
+  pthread_mutex_lock(&handle->key_mutex);
+  while (1) {
+    pthread_mutex_lock(&handle->read_mutex);
+    while ((count<max) && (handle->keybuf_nb>0)) {
+      codes[count++]=handle->keybuf[handle->keybuf_next];
+      handle->keybuf_next=(handle->keybuf_next+1)%BRL_KEYBUF_SIZE;
+      handle->keybuf_nb--;
+    }
     pthread_mutex_unlock(&handle->read_mutex);
-    return 1;
-  }
-  pthread_mutex_unlock(&handle->read_mutex);
+    if (count==max) break;
+
+    /* Once we have some keys, only take those which are already there */
+    if (count) timeout = 0;
+    if (timeout >= 0) {
+      res = packetReady(handle, timeout);
+      if (res<=0) {
+	if (res<0 && !count) {
+	  brlapi_errno = BRLAPI_ERROR_LIBCERR;
+	  pthread_mutex_unlock(&handle->key_mutex);
+	  return -1;
+	}
+	break;
+      }
+      timeout = 0;
+    }
 
-  pthread_mutex_lock(&handle->key_mutex);
-  if (!block) {
-    res = packetReady(handle);
-    if (res<=0) {
-      if (res<0)
-	brlapi_errno = BRLAPI_ERROR_LIBCERR;
+    /* Keys are put in the buffer whatever the packet they come in */
+    res=brlapi__waitForPacket(handle,BRLAPI_PACKET_KEYS, buf, sizeof(buf), 0);
+    if (res == -3) continue;
+    if (res < 0) {
+      if (count) break;
       pthread_mutex_unlock(&handle->key_mutex);
-      return res;
+      return -1;
     }
+    pthread_mutex_lock(&handle->read_mutex);
+    brlapi__bufferKeys(handle, buf, res);
+    pthread_mutex_unlock(&handle->read_mutex);
   }
-  res=brlapi__waitForPacket(handle,BRLAPI_PACKET_KEY, buf, sizeof(buf), 0);
   pthread_mutex_unlock(&handle->key_mutex);
-  if (res == -3) {
-    if (!block) return 0;
-    brlapi_libcerrno = block?EINTR:EAGAIN;
-    brlapi_errno = BRLAPI_ERROR_LIBCERR;
-    brlapi_errfun = "waitForPacket";
+  return count;
+}
+
+int BRLAPI_STDCALL brlapi_readKeys(brlapi_keyCode_t *codes, size_t max, int timeout)
+{
+  return brlapi__readKeys(&defaultHandle, codes, max, timeout);
+}
+
+/* Function : brlapi_readKey */
+/* Reads a key from the braille keyboard */
+int BRLAPI_STDCALL brlapi__readKey(brlapi_handle_t *handle, int block, brlapi_keyCode_t *code)
+{
+  return brlapi__readKeys(handle, code, 1, block? -1: 0);
+}
+
+int BRLAPI_STDCALL brlapi_readKey(int block, brlapi_keyCode_t *code)
+{
+  return brlapi__readKey(&defaultHandle, block, code) ;
+}
+
+/* Function : appendAsyncPacket */
+/* Appends a packet of a write to those to send */
+static int appendAsyncPacket(brlapi_handle_t *handle, const brlapi_packet_t *packet, size_t size, void *data)
+{
+  AsyncWrite *w = data;
+  uint32_t header[2] = { htonl(size), htonl(BRLAPI_PACKET_WRITE) };
+  unsigned char *packets = realloc(w->packets, w->size + sizeof(header) + size);
+
+  if (!packets) {
+    brlapi_errno = BRLAPI_ERROR_NOMEM;
     return -1;
   }
+  memcpy(packets + w->size, header, sizeof(header));
+  memcpy(packets + w->size + sizeof(header), packet, size);
+  w->packets = packets;
+  w->size += sizeof(header) + size;
+  return 0;
+}
+
+/* Function : brlapi_writeAsync */
+/* Queues a write, and sends what can be without blocking */
+static int brlapi___writeAsync(brlapi_handle_t *handle, const brlapi_writeArguments_t *s, int flags, AsyncWrite *w)
+{
+  unsigned char charset[1+0XFF];
+  WriteRequest request;
+  AsyncWrite *last;
+  int res;
+
+  w->next = NULL;
+  w->packets = NULL;
+  w->size = w->sent = 0;
+  if ((res = prepareWriteRequest(handle, s, 0, &request, charset)) > 0)
+    res = putWriteRequest(handle, &request, appendAsyncPacket, w);
+  if (res < 0) {
+    free(w->packets);
+    free(w);
+    return res;
+  }
+
+  pthread_mutex_lock(&handle->fileDescriptor_mutex);
+  last = handle->queuedWrites.last;
+  if ((flags & BRLAPI_WRITE_REPLACE) && last && !last->sent) {
+    /* Send the new packets in place of the last ones, and report these as
+     * replaced in their own place. */
+    AsyncWrite replaced = *last;
+
+    last->packets = w->packets;
+    last->size = w->size;
+    last->withHandle = w->withHandle;
+    last->callback = w->callback;
+    last->data = w->data;
+    *w = replaced;
+    w->next = NULL;
+    w->status = BRLAPI_WRITE_REPLACED;
+    if (handle->completedWrites.last) handle->completedWrites.last->next = w;
+    else handle->completedWrites.first = w;
+    handle->completedWrites.last = w;
+  } else {
+    if (last) last->next = w;
+    else handle->queuedWrites.first = w;
+    handle->queuedWrites.last = w;
+  }
+  res = brlapi__sendAsyncWrites(handle, 0);
+  pthread_mutex_unlock(&handle->fileDescriptor_mutex);
+  return res;
+}
+
+int BRLAPI_STDCALL brlapi__writeAsync(brlapi_handle_t *handle, const brlapi_writeArguments_t *s, int flags, brlapi__writeCallback_t callback, void *data)
+{
+  AsyncWrite *w = malloc(sizeof(*w));
+  if (!w) {
+    brlapi_errno = BRLAPI_ERROR_NOMEM;
+    return -1;
+  }
+  w->withHandle = 1;
+  w->callback.withHandle = callback;
+  w->data = data;
+  return brlapi___writeAsync(handle, s, flags, w);
+}
+
+int BRLAPI_STDCALL brlapi_writeAsync(const brlapi_writeArguments_t *s, int flags, brlapi_writeCallback_t callback, void *data)
+{
+  AsyncWrite *w = malloc(sizeof(*w));
+  if (!w) {
+    brlapi_errno = BRLAPI_ERROR_NOMEM;
+    return -1;
+  }
+  w->withHandle = 0;
+  w->callback.withoutHandle = callback;
+  w->data = data;
+  return brlapi___writeAsync(&defaultHandle, s, flags, w);
+}
+
+/* Function : brlapi_getAsyncEvents */
+/* Tells what to wait for before calling brlapi_processEvents() */
+int BRLAPI_STDCALL brlapi__getAsyncEvents(brlapi_handle_t *handle)
+{
+  int events = BRLAPI_ASYNC_READ;
+
+  pthread_mutex_lock(&handle->fileDescriptor_mutex);
+  if (handle->queuedWrites.first) {
+#ifdef SHARED_MEMORY_TRANSPORT
+    /* They're only left queued when the ring is full. */
+    if (handle->shared.header) events |= BRLAPI_ASYNC_SPACE;
+    else
+#endif /* SHARED_MEMORY_TRANSPORT */
+    events |= BRLAPI_ASYNC_WRITE;
+  }
+  if (handle->completedWrites.first) events |= BRLAPI_ASYNC_PENDING;
+  pthread_mutex_unlock(&handle->fileDescriptor_mutex);
+
+  pthread_mutex_lock(&handle->read_mutex);
+  if (handle->keybuf_nb) events |= BRLAPI_ASYNC_PENDING;
+  pthread_mutex_unlock(&handle->read_mutex);
+  return events;
+}
+
+int BRLAPI_STDCALL brlapi_getAsyncEvents(void)
+{
+  return brlapi__getAsyncEvents(&defaultHandle);
+}
+
+/* Function : brlapi_getSpaceDescriptor */
+/* Tells which descriptor to wait for when BRLAPI_ASYNC_SPACE is returned */
+int BRLAPI_STDCALL brlapi__getSpaceDescriptor(brlapi_handle_t *handle)
+{
+  int descriptor = -1;
+
+#ifdef SHARED_MEMORY_TRANSPORT
+  pthread_mutex_lock(&handle->fileDescriptor_mutex);
+  if (handle->shared.header) descriptor = handle->shared.space;
+  pthread_mutex_unlock(&handle->fileDescriptor_mutex);
+#endif /* SHARED_MEMORY_TRANSPORT */
+  return descriptor;
+}
+
+int BRLAPI_STDCALL brlapi_getSpaceDescriptor(void)
+{
+  return brlapi__getSpaceDescriptor(&defaultHandle);
+}
+
+/* Function : brlapi_processEvents */
+/* Sends what can be without blocking, and calls the callbacks */
+static int brlapi___processEvents(brlapi_handle_t *handle, int withHandle, brlapi__keyCallback_t keyCallbackWithHandle, brlapi_keyCallback_t keyCallback, void *data)
+{
+  AsyncWrite *w;
+  int count = 0;
+  int res;
+  int tty;
+
+  pthread_mutex_lock(&handle->fileDescriptor_mutex);
+  res = brlapi__sendAsyncWrites(handle, 0);
+  w = handle->completedWrites.first;
+  handle->completedWrites.first = handle->completedWrites.last = NULL;
+  pthread_mutex_unlock(&handle->fileDescriptor_mutex);
+
+  /* The callbacks may well queue more writes. */
+  while (w) {
+    AsyncWrite *next = w->next;
+
+    if (w->withHandle) {
+      if (w->callback.withHandle) w->callback.withHandle(handle, w->status, w->data);
+    } else {
+      if (w->callback.withoutHandle) w->callback.withoutHandle(w->status, w->data);
+    }
+    free(w->packets);
+    free(w);
+    count++;
+    w = next;
+  }
   if (res < 0) return -1;
-  *code = ((brlapi_keyCode_t)ntohl(buf[0]) << 32) | ntohl(buf[1]);
-  return 1;
+
+  pthread_mutex_lock(&handle->state_mutex);
+  tty = handle->state & STCONTROLLINGTTY;
+  pthread_mutex_unlock(&handle->state_mutex);
+
+  if (tty && (keyCallbackWithHandle || keyCallback)) {
+    brlapi_keyCode_t codes[BRLAPI_MAXKEYS];
+    int i;
+
+    while ((res = brlapi__readKeys(handle, codes, sizeof(codes)/sizeof(codes[0]), 0)) > 0) {
+      for (i=0; i<res; i++) {
+	if (withHandle) keyCallbackWithHandle(handle, codes[i], data);
+	else keyCallback(codes[i], data);
+      }
+      count += res;
+    }
+    if (res < 0) return -1;
+  }
+
+  return count;
 }
 
-int BRLAPI_STDCALL brlapi_readKey(int block, brlapi_keyCode_t *code)
+int BRLAPI_STDCALL brlapi__processEvents(brlapi_handle_t *handle, brlapi__keyCallback_t callback, void *data)
 {
-  return brlapi__readKey(&defaultHandle, block, code) ;
+  return brlapi___processEvents(handle, 1, callback, NULL, data);
+}
+
+int BRLAPI_STDCALL brlapi_processEvents(brlapi_keyCallback_t callback, void *data)
+{
+  return brlapi___processEvents(&defaultHandle, 0, NULL, callback, data);
 }
 
 typedef struct {
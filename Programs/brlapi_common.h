@@ -331,6 +331,7 @@ static const brlapi_packetTypeEntry_t brlapi_packetTypeTable[] = {
   { BRLAPI_PACKET_ENTERTTYMODE, "EnterTtyMode" },
   { BRLAPI_PACKET_LEAVETTYMODE, "LeaveTtyMode" },
   { BRLAPI_PACKET_KEY, "Key" },
+  { BRLAPI_PACKET_KEYS, "Keys" },
   { BRLAPI_PACKET_IGNOREKEYRANGES, "IgnoreKeyRanges" },
   { BRLAPI_PACKET_ACCEPTKEYRANGES, "AcceptKeyRanges" },
   { BRLAPI_PACKET_WRITE, "Write" },
@@ -339,6 +340,7 @@ static const brlapi_packetTypeEntry_t brlapi_packetTypeTable[] = {
   { BRLAPI_PACKET_PACKET, "Packet" },
   { BRLAPI_PACKET_SUSPENDDRIVER, "SuspendDriver" },
   { BRLAPI_PACKET_RESUMEDRIVER, "ResumeDriver" },
+  { BRLAPI_PACKET_SHAREDMEMORY, "SharedMemory" },
   { BRLAPI_PACKET_ACK, "Ack" },
   { BRLAPI_PACKET_ERROR, "Error" },
   { BRLAPI_PACKET_EXCEPTION, "Exception" },
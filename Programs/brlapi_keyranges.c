@@ -78,6 +78,95 @@ KeyrangeList *inKeyrangeList(KeyrangeList *l, KeyrangeElem n)
   return NULL;
 }
 
+/* Function : initializeKeyrangeIndex */
+void initializeKeyrangeIndex(KeyrangeIndex *index)
+{
+  index->entries = NULL;
+  index->count = index->size = 0;
+  index->valid = 0;
+}
+
+/* Function : invalidateKeyrangeIndex */
+void invalidateKeyrangeIndex(KeyrangeIndex *index)
+{
+  index->valid = 0;
+}
+
+/* Function : freeKeyrangeIndex */
+void freeKeyrangeIndex(KeyrangeIndex *index)
+{
+  free(index->entries);
+  initializeKeyrangeIndex(index);
+}
+
+static int compareKeyrangeIndexEntries(const void *element1, const void *element2)
+{
+  const KeyrangeIndexEntry *entry1 = element1;
+  const KeyrangeIndexEntry *entry2 = element2;
+
+  if (entry1->minVal < entry2->minVal) return -1;
+  if (entry1->minVal > entry2->minVal) return 1;
+  return 0;
+}
+
+/* Function : buildKeyrangeIndex */
+static int buildKeyrangeIndex(KeyrangeIndex *index, KeyrangeList *l)
+{
+  KeyrangeList *c;
+  unsigned int count = 0;
+  unsigned int i;
+
+  for (c=l; c!=NULL; c=c->next) count++;
+
+  if (count > index->size) {
+    KeyrangeIndexEntry *entries = realloc(index->entries, count*sizeof(*entries));
+    if (entries==NULL) return 0;
+    index->entries = entries;
+    index->size = count;
+  }
+
+  for (c=l, i=0; c!=NULL; c=c->next, i++) {
+    index->entries[i].minVal = c->minVal;
+    index->entries[i].range = c;
+  }
+  qsort(index->entries, count, sizeof(*index->entries), compareKeyrangeIndexEntries);
+
+  for (i=0; i<count; i++) {
+    uint32_t maxVal = index->entries[i].range->maxVal;
+    index->entries[i].reach = (i && (index->entries[i-1].reach > maxVal))? index->entries[i-1].reach: maxVal;
+  }
+
+  index->count = count;
+  index->valid = 1;
+  return 1;
+}
+
+/* Function : inKeyrangeIndex */
+KeyrangeList *inKeyrangeIndex(KeyrangeIndex *index, KeyrangeList *l, KeyrangeElem n)
+{
+  uint32_t val = KeyrangeVal(n);
+  unsigned int first = 0, last;
+
+  if (!index->valid && !buildKeyrangeIndex(index, l)) return inKeyrangeList(l, n);
+
+  /* find the first range which starts after val */
+  last = index->count;
+  while (first < last) {
+    unsigned int middle = (first + last) / 2;
+    if (index->entries[middle].minVal <= val) first = middle + 1;
+    else last = middle;
+  }
+
+  /* only ranges before it can contain val, and only while they reach it */
+  while (first > 0) {
+    const KeyrangeIndexEntry *entry = &index->entries[--first];
+    if (entry->reach < val) break;
+    if (inKeyrange(entry->range, n)) return entry->range;
+  }
+
+  return NULL;
+}
+
 /* Function : DisplayKeyrangeList */
 void DisplayKeyrangeList(KeyrangeList *l)
 {
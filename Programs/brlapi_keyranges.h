@@ -54,6 +54,36 @@ extern void freeKeyrangeList(KeyrangeList **l);
 /* If no, returns NULL */
 extern KeyrangeList *inKeyrangeList(KeyrangeList *l, KeyrangeElem n);
 
+/* Sorted view of a range list, for looking keys up by binary search */
+typedef struct {
+  uint32_t minVal;
+  uint32_t reach; /* highest maxVal of this and all previous entries */
+  KeyrangeList *range;
+} KeyrangeIndexEntry;
+
+typedef struct {
+  KeyrangeIndexEntry *entries;
+  unsigned int count, size;
+  int valid;
+} KeyrangeIndex;
+
+/* Function : initializeKeyrangeIndex */
+/* Initializes an empty index */
+extern void initializeKeyrangeIndex(KeyrangeIndex *index);
+
+/* Function : invalidateKeyrangeIndex */
+/* Must be called whenever the indexed list changes */
+extern void invalidateKeyrangeIndex(KeyrangeIndex *index);
+
+/* Function : freeKeyrangeIndex */
+/* Frees the memory used by an index */
+extern void freeKeyrangeIndex(KeyrangeIndex *index);
+
+/* Function : inKeyrangeIndex */
+/* Same as inKeyrangeList, but through an index of l, which is rebuilt first */
+/* if it is invalid */
+extern KeyrangeList *inKeyrangeIndex(KeyrangeIndex *index, KeyrangeList *l, KeyrangeElem n);
+
 /* Function : displayKeyrangeList */
 /* Prints a range list on stdout */
 /* This is for debugging only */
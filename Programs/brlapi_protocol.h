@@ -63,6 +63,7 @@ extern "C" {
 #define BRLAPI_PACKET_SETFOCUS        'F'   /**< Set current tty focus       */
 #define BRLAPI_PACKET_LEAVETTYMODE    'L'   /**< Release the tty             */
 #define BRLAPI_PACKET_KEY             'k'   /**< Braille key                 */
+#define BRLAPI_PACKET_KEYS            'K'   /**< Several braille keys        */
 #define BRLAPI_PACKET_IGNOREKEYRANGES 'm'   /**< Mask key ranges             */
 #define BRLAPI_PACKET_ACCEPTKEYRANGES 'u'   /**< Unmask key ranges           */
 #define BRLAPI_PACKET_WRITE           'w'   /**< Write                       */
@@ -74,6 +75,7 @@ extern "C" {
 #define BRLAPI_PACKET_EXCEPTION       'E'   /**< Exception                   */
 #define BRLAPI_PACKET_SUSPENDDRIVER   'S'   /**< Suspend driver              */
 #define BRLAPI_PACKET_RESUMEDRIVER    'R'   /**< Resume driver               */
+#define BRLAPI_PACKET_SHAREDMEMORY    'M'   /**< Shared memory transport     */
 
 /** Magic number to give when sending a BRLPACKET_ENTERRAWMODE or BRLPACKET_SUSPEND packet */
 #define BRLAPI_DEVICE_MAGIC (0xdeadbeefL)
@@ -92,6 +94,19 @@ typedef struct {
   uint32_t protocolVersion;
 } brlapi_versionPacket_t;
 
+/** Structure of version packets sent by servers which advertise optional
+ * features.  Older clients only look at the protocol version.  Clients which
+ * want some of the advertised features reply with the same structure, and
+ * the features they want. */
+typedef struct {
+  uint32_t protocolVersion;
+  uint32_t features;
+} brlapi_serverVersionPacket_t;
+
+#define BRLAPI_FEATURE_SHAREDMEMORY 0X01 /**< Shared memory transport */
+#define BRLAPI_FEATURE_KEYS         0X02 /**< Keys batched into KEYS packets */
+#define BRLAPI_FEATURE_CONTRACTION  0X04 /**< Writes may ask for contraction */
+
 /** Structure of authorization packets */
 typedef struct {
   uint32_t type;
@@ -128,6 +143,15 @@ typedef struct {
 #define BRLAPI_WF_ATTR_OR       0X10    /**< Or attributes                  */
 #define BRLAPI_WF_CURSOR        0X20    /**< Cursor position                */
 #define BRLAPI_WF_CHARSET       0X40    /**< Charset                        */
+#define BRLAPI_WF_CONTINUED     0X80    /**< More fragments of this update follow */
+#define BRLAPI_WF_CONTRACT      0X100   /**< Text is to be contracted by the server */
+
+/* With BRLAPI_WF_CONTRACT, the text may hold any number of characters,
+ * which the server contracts into the region with its contraction table, if
+ * it has one.  The cursor is then a position in the text, 1 being its first
+ * character.  Routing keys on the region give the offset in the text of the
+ * character which the cell stands for, added to the start of the region.
+ * Such writes can't be continued. */
 
 /** Structure of extended write packets */
 typedef struct {
@@ -135,16 +159,59 @@ typedef struct {
   unsigned char data; /** Fields in the same order as flag weight */
 } brlapi_writeArgumentsPacket_t;
 
+/** Structure of shared memory packets
+ *
+ * The client passes three descriptors along with this packet as SCM_RIGHTS
+ * ancillary data: a sealed memory file holding a
+ * brlapi_sharedMemoryHeader_t immediately followed by the ring, an eventfd
+ * which it writes to when the server has to be woken up, and an eventfd
+ * which the server writes to when the client waits for space in the ring. */
+typedef struct {
+  uint32_t size; /** Size of the ring, a power of two */
+} brlapi_sharedMemoryPacket_t;
+
+/** Magic number at the start of the shared memory */
+#define BRLAPI_SHAREDMEMORY_MAGIC 0X42524C52
+
+/** Minimum and maximum sizes of the shared memory ring */
+#define BRLAPI_SHAREDMEMORY_MINIMUM 0X1000
+#define BRLAPI_SHAREDMEMORY_MAXIMUM 0X100000
+
+/** Structure of the shared memory header
+ *
+ * Packets are put into the ring with the same header as on the socket, but
+ * in host byte order, and their content is padded to a multiple of 4 bytes.
+ * head and tail are free running byte counts: the client advances head once
+ * a packet is complete, the server advances tail once it has taken a packet
+ * out.  The server sets waiting before sleeping, and the client then writes
+ * to the first eventfd after advancing head.  Likewise, the client sets full
+ * before waiting for space, and the server then writes to the second eventfd
+ * after advancing tail. */
+typedef struct {
+  uint32_t magic;
+  volatile uint32_t head;
+  volatile uint32_t tail;
+  volatile uint32_t waiting;
+  volatile uint32_t full;
+} brlapi_sharedMemoryHeader_t;
+
+/** KEYS packets hold several key codes, each as in KEY packets: the high then
+ * the low 32 bits, in network byte order.  Servers only send them to clients
+ * which asked for ::BRLAPI_FEATURE_KEYS. */
+#define BRLAPI_MAXKEYS (BRLAPI_MAXPACKETSIZE / (2*sizeof(uint32_t)))
+
 /** Type for packets.  Should be used instead of a mere char[], since it has
  * correct alignment requirements. */
 typedef union {
 	unsigned char data[BRLAPI_MAXPACKETSIZE];
 	brlapi_versionPacket_t version;
+	brlapi_serverVersionPacket_t serverVersion;
 	brlapi_authClientPacket_t authClient;
 	brlapi_authServerPacket_t authServer;
 	brlapi_errorPacket_t error;
 	brlapi_getDriverSpecificModePacket_t getDriverSpecificMode;
 	brlapi_writeArgumentsPacket_t writeArguments;
+	brlapi_sharedMemoryPacket_t sharedMemory;
 	uint32_t uint32;
 } brlapi_packet_t;
 
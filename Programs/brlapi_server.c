@@ -52,13 +52,30 @@
 
 #include <pthread.h>
 
-#ifdef HAVE_SYS_SELECT_H
+#if defined(HAVE_SYS_EPOLL_H)
+#include <sys/epoll.h>
+#elif defined(HAVE_SYS_SELECT_H)
 #include <sys/select.h>
 #else /* HAVE_SYS_SELECT_H */
 #include <sys/time.h>
 #endif /* HAVE_SYS_SELECT_H */
+
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_EVENTFD_H)
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+
+#if defined(SCM_RIGHTS) && defined(F_SEAL_SHRINK)
+#define SHARED_MEMORY_TRANSPORT
+#endif /* SCM_RIGHTS && F_SEAL_SHRINK */
+#endif /* HAVE_SYS_EPOLL_H && HAVE_SYS_EVENTFD_H */
 #endif /* __MINGW32__ */
 
+#ifdef SHARED_MEMORY_TRANSPORT
+#define SERVER_FEATURES (BRLAPI_FEATURE_SHAREDMEMORY | BRLAPI_FEATURE_KEYS | BRLAPI_FEATURE_CONTRACTION)
+#else /* SHARED_MEMORY_TRANSPORT */
+#define SERVER_FEATURES (BRLAPI_FEATURE_KEYS | BRLAPI_FEATURE_CONTRACTION)
+#endif /* SHARED_MEMORY_TRANSPORT */
+
 #define BRLAPI_NO_DEPRECATED
 #include "brlapi.h"
 #include "brlapi_protocol.h"
@@ -79,6 +96,8 @@
 #include "scr.h"
 #include "tunes.h"
 #include "charset.h"
+#include "unicode.h"
+#include "async_alarm.h"
 #include "async_event.h"
 #include "async_signal.h"
 #include "async_thread.h"
@@ -96,6 +115,9 @@
 #define UNAUTH_MAX 5
 #define UNAUTH_DELAY 30
 
+#define CONVERTERS_MAX 4
+#define CONTRACTED_LINES_MAX 8
+
 #define OUR_STACK_MIN 0X10000
 #ifndef PTHREAD_STACK_MIN
 #define PTHREAD_STACK_MIN OUR_STACK_MIN
@@ -112,6 +134,10 @@ const char *const api_parameters[] = { "auth", "host", "retaindots", "stacksize"
 
 static size_t stackSize;
 static AsyncEvent *flushEvent;
+static int flushRequested; /* protected by apiFlushMutex */
+static AsyncHandle flushAlarm;
+static TimeValue flushTime; /* when the device can take the next frame */
+static AsyncHandle keysAlarm; /* sends the keys batched so far */
 
 #define RELEASE "BrlAPI Server: release " BRLAPI_RELEASE
 #define COPYRIGHT "   Copyright (C) 2002-2014 by Sébastien Hinderer <Sebastien.Hinderer@ens-lyon.org>, \
@@ -172,6 +198,17 @@ typedef struct {
 
 typedef enum { TODISPLAY, EMPTY } BrlBufState;
 
+/* A text which a client asked to be contracted, and the cells it became */
+typedef struct {
+  int *offsets; /* offset in the text of each cell, NULL if unused */
+  wchar_t *text; /* allocated along with offsets */
+  unsigned char *cells; /* likewise */
+  unsigned int length, size;
+  int cursor; /* offset in the text, -1 if none */
+  int cursorCell; /* -1 if the cursor isn't shown */
+  const ContractionTable *table; /* what it was contracted with */
+} ContractedLine;
+
 typedef enum {
 #ifdef __MINGW32__
   READY, /* but no pending ReadFile */
@@ -201,14 +238,59 @@ typedef struct Connection {
   int raw, suspend;
   unsigned int how; /* how keys must be delivered to clients */
   BrailleWindow brailleWindow;
+  BrailleWindow fragmentWindow; /* where continued writes are assembled */
+  int fragmenting; /* whether a continued write is in progress */
   BrlBufState brlbufstate;
+  int framePending; /* written but not yet sent to the device */
+  unsigned int framesWritten, framesCoalesced, framesDropped;
   pthread_mutex_t brailleWindowMutex;
   KeyrangeList *acceptedKeys;
+  KeyrangeIndex acceptedKeysIndex;
   pthread_mutex_t acceptedKeysMutex;
   time_t upTime;
   Packet packet;
+  uint32_t features; /* the optional features the client asked for */
+  struct {
+    uint32_t codes[2*BRLAPI_MAXKEYS];
+    unsigned int count;
+  } keys; /* batched but not yet sent, protected by apiConnectionsMutex */
+#ifdef HAVE_ICONV_H
+  struct {
+    char *charset;
+    iconv_t handle;
+  } converters[CONVERTERS_MAX]; /* most recently used first */
+#endif /* HAVE_ICONV_H */
+  struct {
+    wchar_t *text; /* what is to be contracted, NULL if nothing */
+    unsigned int length;
+    int cursor; /* offset in the text, -1 if none */
+    unsigned int begin, size; /* region of the window it goes to */
+    int shown; /* whether the window holds the cells of lines[0] */
+    ContractedLine lines[CONTRACTED_LINES_MAX]; /* most recently used first */
+  } contraction; /* protected by brailleWindowMutex */
+#ifdef SHARED_MEMORY_TRANSPORT
+  int receivedDescriptors[3]; /* passed along with the packet being read */
+  unsigned int receivedCount;
+  struct {
+    brlapi_sharedMemoryHeader_t *header; /* NULL until the client sets it up */
+    unsigned char *ring;
+    uint32_t size;
+    uint32_t tail; /* our own copy, which the client can't tamper with */
+    int event;
+    int space;
+  } shared;
+#endif /* SHARED_MEMORY_TRANSPORT */
 } Connection;
 
+#define KEY_ROUTES_SIZE 0X20
+
+typedef struct {
+  unsigned int generation;
+  unsigned int how;
+  brlapi_keyCode_t code;
+  struct Connection *connection;
+} KeyRoute;
+
 typedef struct Tty {
   int focus;
   int number;
@@ -216,13 +298,12 @@ typedef struct Tty {
   struct Tty *father; /* father */
   struct Tty **prevnext,*next; /* siblings */
   struct Tty *subttys; /* children */
+  KeyRoute keyRoutes[KEY_ROUTES_SIZE]; /* recent answers of whoGetsKey() */
 } Tty;
 
-#define MAXSOCKETS 4 /* who knows what users want to do... */
-
 /* Pointer to the connection accepter thread */
 static pthread_t serverThread; /* server */
-static pthread_t socketThreads[MAXSOCKETS]; /* socket binding threads */
+static pthread_t *socketThreads; /* socket binding threads */
 static int running; /* should threads be running? */
 static char **socketHosts = NULL; /* socket local hosts */
 static struct socketInfo {
@@ -233,15 +314,44 @@ static struct socketInfo {
 #ifdef __MINGW32__
   OVERLAPPED overl;
 #endif /* __MINGW32__ */
-} socketInfo[MAXSOCKETS]; /* information for cleaning sockets */
+} *socketInfo; /* information for cleaning sockets */
 static int numSockets; /* number of sockets */
 
+#if !defined(__MINGW32__) && defined(HAVE_SYS_EPOLL_H)
+/* Listening sockets and connections stay registered for as long as they're open */
+static int epollDescriptor = -1;
+
+static int watchDescriptor(FileDescriptor fd, void *data)
+{
+  struct epoll_event event = {
+    .events = EPOLLIN,
+    .data.ptr = data
+  };
+
+  if (epoll_ctl(epollDescriptor, EPOLL_CTL_ADD, fd, &event) != -1) return 1;
+  logSystemError("epoll_ctl[EPOLL_CTL_ADD]");
+  return 0;
+}
+
+static void unwatchDescriptor(FileDescriptor fd)
+{
+  if (epollDescriptor != -1) {
+    if (epoll_ctl(epollDescriptor, EPOLL_CTL_DEL, fd, NULL) == -1) {
+      if (errno != ENOENT) logSystemError("epoll_ctl[EPOLL_CTL_DEL]");
+    }
+  }
+}
+#endif /* HAVE_SYS_EPOLL_H */
+
 /* Protects from connection addition / remove from the server thread */
 pthread_mutex_t apiConnectionsMutex;
 
 /* Protects the real driver's functions */
 pthread_mutex_t apiDriverMutex;
 
+/* Protects flushRequested */
+pthread_mutex_t apiFlushMutex;
+
 /* Which connection currently has raw mode */
 pthread_mutex_t apiRawMutex;
 static Connection *rawConnection = NULL;
@@ -253,6 +363,10 @@ static Connection *suspendConnection = NULL;
 static Tty notty;
 static Tty ttys;
 
+/* Cached key routes are only valid for the current generation, which is
+ * protected by apiConnectionsMutex */
+static unsigned int keyRoutesGeneration = 1;
+
 static unsigned int unauthConnections;
 static unsigned int unauthConnLog = 0;
 
@@ -321,6 +435,7 @@ static unsigned int retainDots;
 
 extern void processParameters(char ***values, const char *const *names, const char *description, char *optionParameters, char *configuredParameters, const char *environmentVariable);
 static int initializeAcceptedKeys(Connection *c, int how);
+static void requestFlush(void);
 static void brlResize(BrailleDisplay *brl);
 
 /****************************************************************************/
@@ -414,6 +529,53 @@ static void writeKey(FileDescriptor fd, brlapi_keyCode_t key) {
   brlapiserver_writePacket(fd,BRLAPI_PACKET_KEY,&buf,sizeof(buf));
 }
 
+/* Function : flushKeys */
+/* Sends the keys batched for a connection in one packet */
+/* Must be called with apiConnectionsMutex locked */
+static void flushKeys(Connection *c)
+{
+  if (!c->keys.count) return;
+  logMessage(LOG_CATEGORY(SERVER_EVENTS), "writing %u keys on fd %"PRIfd, c->keys.count, c->fd);
+  brlapiserver_writePacket(c->fd,BRLAPI_PACKET_KEYS,c->keys.codes,c->keys.count*2*sizeof(c->keys.codes[0]));
+  c->keys.count = 0;
+}
+
+static void flushTtyKeys(Tty *tty)
+{
+  Connection *c;
+  Tty *t;
+  for (c=tty->connections->next; c!=tty->connections; c = c->next)
+    flushKeys(c);
+  for (t = tty->subttys; t; t = t->next)
+    flushTtyKeys(t);
+}
+
+/* Keys produced while the core handles the same input are sent together */
+ASYNC_ALARM_CALLBACK(handleKeysAlarm) {
+  asyncDiscardHandle(keysAlarm);
+  keysAlarm = NULL;
+  asyncLockMutex(&apiConnectionsMutex);
+  flushTtyKeys(&ttys);
+  asyncUnlockMutex(&apiConnectionsMutex);
+}
+
+/* Function : sendKey */
+/* Sends a key, batching it if the client asked for KEYS packets */
+/* Must be called with apiConnectionsMutex locked */
+static void sendKey(Connection *c, brlapi_keyCode_t key)
+{
+  if (!(c->features & BRLAPI_FEATURE_KEYS)) {
+    writeKey(c->fd,key);
+    return;
+  }
+  if (c->keys.count == BRLAPI_MAXKEYS) flushKeys(c);
+  c->keys.codes[2*c->keys.count] = htonl(key >> 32);
+  c->keys.codes[2*c->keys.count+1] = htonl(key & 0xffffffff);
+  c->keys.count++;
+  if (!keysAlarm && !asyncSetAlarmIn(&keysAlarm, 0, handleKeysAlarm, NULL))
+    flushKeys(c);
+}
+
 /* Function: resetPacket */
 /* Resets a Packet structure */
 void resetPacket(Packet *packet)
@@ -447,6 +609,58 @@ int initializePacket(Packet *packet)
   return 0;
 }
 
+#ifdef SHARED_MEMORY_TRANSPORT
+/* Function : readConnection */
+/* Reads from the socket of a connection, keeping any descriptors passed along */
+static ssize_t readConnection(Connection *c, void *buffer, size_t size)
+{
+  struct iovec iov = {
+    .iov_base = buffer,
+    .iov_len = size
+  };
+  union {
+    struct cmsghdr header;
+    char buffer[CMSG_SPACE(sizeof(c->receivedDescriptors))];
+  } control;
+  struct msghdr msg = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = &control,
+    .msg_controllen = sizeof(control)
+  };
+  ssize_t res = recvmsg(c->fd, &msg, MSG_CMSG_CLOEXEC);
+
+  if (res > 0) {
+    struct cmsghdr *cmsg;
+
+    for (cmsg=CMSG_FIRSTHDR(&msg); cmsg; cmsg=CMSG_NXTHDR(&msg, cmsg)) {
+      if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS)) {
+        const int *descriptors = (const int *) CMSG_DATA(cmsg);
+        unsigned int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(*descriptors);
+        unsigned int i;
+
+        for (i=0; i<count; i++) {
+          if (c->receivedCount < ARRAY_COUNT(c->receivedDescriptors)) {
+            c->receivedDescriptors[c->receivedCount++] = descriptors[i];
+          } else {
+            close(descriptors[i]);
+          }
+        }
+      }
+    }
+  }
+
+  return res;
+}
+
+/* Function : closeReceivedDescriptors */
+/* Closes the descriptors which the handled packet didn't make use of */
+static void closeReceivedDescriptors(Connection *c)
+{
+  while (c->receivedCount) close(c->receivedDescriptors[--c->receivedCount]);
+}
+#endif /* SHARED_MEMORY_TRANSPORT */
+
 /* Function : readPacket */
 /* Reads a packet for the given connection */
 /* Returns -2 on EOF, -1 on error, 0 if the reading is not complete, */
@@ -470,7 +684,11 @@ read:
 #else /* __MINGW32__ */
   int res;
 read:
+#ifdef SHARED_MEMORY_TRANSPORT
+  res = readConnection(c, packet->p, packet->n);
+#else /* SHARED_MEMORY_TRANSPORT */
   res = read(c->fd, packet->p, packet->n);
+#endif /* SHARED_MEMORY_TRANSPORT */
   if (res==-1) {
     switch (errno) {
       case EINTR: goto read;
@@ -538,6 +756,7 @@ typedef struct { /* packet handlers */
   PacketHandler packet;
   PacketHandler suspendDriver;
   PacketHandler resumeDriver;
+  PacketHandler sharedMemory;
 } PacketHandlers;
 
 /****************************************************************************/
@@ -604,6 +823,170 @@ void getDots(const BrailleWindow *brailleWindow, unsigned char *buf)
   if (brailleWindow->cursor) buf[brailleWindow->cursor-1] |= cursorShape;
 }
 
+/* Function: clearContraction */
+/* Forgets the text which a connection asked to be contracted */
+static void clearContraction(Connection *c)
+{
+  free(c->contraction.text);
+  c->contraction.text = NULL;
+  c->contraction.cursor = -1;
+  c->contraction.shown = 0;
+}
+
+/* Function: freeContraction */
+/* Frees the contracted text of a connection, and the lines it remembers */
+static void freeContraction(Connection *c)
+{
+  int i;
+  clearContraction(c);
+  for (i=0; i<CONTRACTED_LINES_MAX; i++) {
+    free(c->contraction.lines[i].offsets);
+    c->contraction.lines[i].offsets = NULL;
+  }
+}
+
+/* Function: contractLine */
+/* Contracts the text of a line into its cells, and maps them to the text */
+static void contractLine(ContractedLine *line)
+{
+  int inputLength = line->length, outputLength = line->size;
+  unsigned int cell;
+
+  for (cell=0; cell<line->size; cell++) line->offsets[cell] = CTB_NO_OFFSET;
+#ifdef ENABLE_CONTRACTED_BRAILLE
+  if (line->table && inputLength) {
+    int inputOffsets[inputLength];
+    int i;
+
+    contractText((ContractionTable *) line->table,
+                 line->text, &inputLength,
+                 line->cells, &outputLength,
+                 inputOffsets, (line->cursor >= 0)? line->cursor: CTB_NO_CURSOR);
+
+    /* a cell stands for the first character which was contracted into it */
+    for (i=inputLength-1; i>=0; i--)
+      if ((inputOffsets[i] != CTB_NO_OFFSET) && (inputOffsets[i] < outputLength))
+        line->offsets[inputOffsets[i]] = i;
+  } else
+#endif /* ENABLE_CONTRACTED_BRAILLE */
+  {
+    if (outputLength > inputLength) outputLength = inputLength;
+    for (cell=0; cell<outputLength; cell++) {
+      line->cells[cell] = convertCharacterToDots(textTable, line->text[cell]);
+      line->offsets[cell] = cell;
+    }
+  }
+  memset(line->cells+outputLength, 0, line->size-outputLength);
+
+  /* the other cells of a character stand for it, the ones after the text for its end */
+  for (cell=0; cell<line->size; cell++)
+    if (line->offsets[cell] == CTB_NO_OFFSET)
+      line->offsets[cell] = (cell >= outputLength)? inputLength: cell? line->offsets[cell-1]: 0;
+
+  line->cursorCell = -1;
+  if ((line->cursor >= 0) && ((line->cursor < inputLength) || (inputLength == line->length))) {
+    for (cell=0; cell<line->size; cell++) {
+      if (line->offsets[cell] > line->cursor) break;
+      if (!cell || (line->offsets[cell] != line->offsets[cell-1])) line->cursorCell = cell;
+    }
+  }
+}
+
+/* Function: getContractedLine */
+/* Returns the cells of the text which a connection asked to be contracted */
+/* Only contracts it if it isn't one of the lines contracted recently */
+static const ContractedLine *getContractedLine(Connection *c)
+{
+  ContractedLine *lines = c->contraction.lines;
+  ContractedLine line;
+  const ContractionTable *table = NULL;
+  int i;
+
+#ifdef ENABLE_CONTRACTED_BRAILLE
+  table = contractionTable;
+#endif /* ENABLE_CONTRACTED_BRAILLE */
+
+  for (i=0; i<CONTRACTED_LINES_MAX; i++) {
+    line = lines[i];
+    if (!line.offsets) break;
+    if ((line.table == table) &&
+        (line.length == c->contraction.length) &&
+        (line.size == c->contraction.size) &&
+        (line.cursor == c->contraction.cursor) &&
+        !wmemcmp(line.text, c->contraction.text, line.length)) goto found;
+  }
+
+  line.length = c->contraction.length;
+  line.size = c->contraction.size;
+  if (!(line.offsets = malloc(line.size*sizeof(*line.offsets) + line.length*sizeof(*line.text) + line.size))) {
+    logMallocError();
+    return NULL;
+  }
+  line.text = (wchar_t *) (line.offsets + line.size);
+  line.cells = (unsigned char *) (line.text + line.length);
+  wmemcpy(line.text, c->contraction.text, line.length);
+  line.cursor = c->contraction.cursor;
+  line.table = table;
+  contractLine(&line);
+
+  if (i == CONTRACTED_LINES_MAX) {
+    i -= 1;
+    free(lines[i].offsets);
+  }
+
+found:
+  memmove(&lines[1], &lines[0], i*sizeof(lines[0]));
+  lines[0] = line;
+  return &lines[0];
+}
+
+/* Function: applyContraction */
+/* Puts the cells of a connection's contracted text into its window */
+/* Must be called with brailleWindowMutex locked */
+static void applyContraction(Connection *c)
+{
+  const ContractedLine *line = getContractedLine(c);
+  BrailleWindow *window = &c->brailleWindow;
+  unsigned int i;
+
+  if (!line) return;
+  for (i=0; i<line->size; i++)
+    window->text[c->contraction.begin-1+i] = UNICODE_BRAILLE_ROW | line->cells[i];
+  if (line->cursor >= 0)
+    window->cursor = (line->cursorCell >= 0)? c->contraction.begin+line->cursorCell: 0;
+  c->contraction.shown = 1;
+}
+
+/* Function: getContractedKey */
+/* Routing keys on contracted cells tell which character of the text they are on */
+static brlapi_keyCode_t getContractedKey(Connection *c, brlapi_keyCode_t code)
+{
+  if ((code & BRLAPI_KEY_TYPE_MASK) != BRLAPI_KEY_TYPE_CMD) return code;
+  switch (code & BRLAPI_KEY_CMD_BLK_MASK) {
+    case BRLAPI_KEY_CMD_ROUTE:
+    case BRLAPI_KEY_CMD_CLIP_NEW:
+    case BRLAPI_KEY_CMD_CLIP_ADD:
+    case BRLAPI_KEY_CMD_COPY_RECT:
+    case BRLAPI_KEY_CMD_COPY_LINE:
+    case BRLAPI_KEY_CMD_DESCCHAR:
+      break;
+    default:
+      return code;
+  }
+
+  asyncLockMutex(&c->brailleWindowMutex);
+  if (c->contraction.shown) {
+    const ContractedLine *line = &c->contraction.lines[0];
+    unsigned int begin = c->contraction.begin - 1;
+    unsigned int column = code & BRLAPI_KEY_CMD_ARG_MASK;
+
+    if ((column >= begin) && (column < begin+line->size))
+      code = (code & ~BRLAPI_KEY_CMD_ARG_MASK) | (begin + line->offsets[column-begin]);
+  }
+  asyncUnlockMutex(&c->brailleWindowMutex);
+  return code;
+}
+
 static void handleResize(BrailleDisplay *brl)
 {
   /* TODO: handle resize */
@@ -627,6 +1010,10 @@ static Connection *createConnection(FileDescriptor fd, time_t currentTime)
   c->raw = 0;
   c->suspend = 0;
   c->brlbufstate = EMPTY;
+  c->framePending = 0;
+  c->framesWritten = c->framesCoalesced = c->framesDropped = 0;
+  c->features = 0;
+  c->keys.count = 0;
 
   {
     pthread_mutexattr_t mattr;
@@ -643,10 +1030,30 @@ static Connection *createConnection(FileDescriptor fd, time_t currentTime)
 
   c->how = 0;
   c->acceptedKeys = NULL;
+  initializeKeyrangeIndex(&c->acceptedKeysIndex);
   c->upTime = currentTime;
   c->brailleWindow.text = NULL;
   c->brailleWindow.andAttr = NULL;
   c->brailleWindow.orAttr = NULL;
+  c->fragmentWindow.text = NULL;
+  c->fragmentWindow.andAttr = NULL;
+  c->fragmentWindow.orAttr = NULL;
+  c->fragmenting = 0;
+  memset(&c->contraction, 0, sizeof(c->contraction));
+  c->contraction.cursor = -1;
+#ifdef HAVE_ICONV_H
+  {
+    int i;
+    for (i=0; i<CONVERTERS_MAX; i++) {
+      c->converters[i].charset = NULL;
+      c->converters[i].handle = (iconv_t) -1;
+    }
+  }
+#endif /* HAVE_ICONV_H */
+#ifdef SHARED_MEMORY_TRANSPORT
+  c->receivedCount = 0;
+  c->shared.header = NULL;
+#endif /* SHARED_MEMORY_TRANSPORT */
   if (initializePacket(&c->packet))
     goto outmalloc;
   return c;
@@ -659,12 +1066,37 @@ out:
   return NULL;
 }
 
+#ifdef SHARED_MEMORY_TRANSPORT
+/* Function : closeSharedMemory */
+/* Stops using the shared memory ring of a connection */
+static void closeSharedMemory(Connection *c)
+{
+  if (c->shared.header) {
+    unwatchDescriptor(c->shared.event);
+    close(c->shared.event);
+    close(c->shared.space);
+    munmap(c->shared.header, sizeof(*c->shared.header) + c->shared.size);
+    c->shared.header = NULL;
+  }
+}
+#endif /* SHARED_MEMORY_TRANSPORT */
+
 /* Function : freeConnection */
 /* Frees all resources associated to a connection */
 static void freeConnection(Connection *c)
 {
+#ifdef SHARED_MEMORY_TRANSPORT
+  closeReceivedDescriptors(c);
+  closeSharedMemory(c);
+#endif /* SHARED_MEMORY_TRANSPORT */
   if (c->fd != INVALID_FILE_DESCRIPTOR) {
     if (c->auth != 1) unauthConnections--;
+    if (c->framesWritten)
+      logMessage(LOG_CATEGORY(SERVER_EVENTS), "fd %" PRIfd ": %u frames written, %u coalesced, %u dropped",
+                 c->fd, c->framesWritten, c->framesCoalesced, c->framesDropped);
+#if !defined(__MINGW32__) && defined(HAVE_SYS_EPOLL_H)
+    unwatchDescriptor(c->fd);
+#endif /* HAVE_SYS_EPOLL_H */
     closeFileDescriptor(c->fd);
   }
 
@@ -675,7 +1107,20 @@ static void freeConnection(Connection *c)
   unsetAddressName(&c->acceptedKeysMutex);
 
   freeBrailleWindow(&c->brailleWindow);
+  freeBrailleWindow(&c->fragmentWindow);
+  freeContraction(c);
   freeKeyrangeList(&c->acceptedKeys);
+  freeKeyrangeIndex(&c->acceptedKeysIndex);
+#ifdef HAVE_ICONV_H
+  {
+    int i;
+    for (i=0; i<CONVERTERS_MAX; i++) {
+      if (!c->converters[i].charset) break;
+      iconv_close(c->converters[i].handle);
+      free(c->converters[i].charset);
+    }
+  }
+#endif /* HAVE_ICONV_H */
   free(c);
 }
 
@@ -683,6 +1128,7 @@ static void freeConnection(Connection *c)
 /* Creates a connection and adds it to the connection list */
 static void __addConnection(Connection *c, Connection *connections)
 {
+  keyRoutesGeneration++;
   c->next = connections->next;
   c->prev = connections;
   connections->next->prev = c;
@@ -699,6 +1145,7 @@ static void addConnection(Connection *c, Connection *connections)
 /* Removes the connection from the list */
 static void __removeConnection(Connection *c)
 {
+  keyRoutesGeneration++;
   c->prev->next = c->next;
   c->next->prev = c->prev;
 }
@@ -822,15 +1269,20 @@ static int handleEnterTtyMode(Connection *c, brlapi_packetType_t type, brlapi_pa
     how = BRL_KEYCODES;
   }
   freeBrailleWindow(&c->brailleWindow); /* In case of multiple enterTtyMode requests */
+  freeBrailleWindow(&c->fragmentWindow);
+  freeContraction(c);
+  c->fragmenting = 0;
 
   if ((initializeAcceptedKeys(c, how)==-1) || (allocBrailleWindow(&c->brailleWindow)==-1)) {
     logMessage(LOG_WARNING,"Failed to allocate some ressources");
     freeKeyrangeList(&c->acceptedKeys);
+    invalidateKeyrangeIndex(&c->acceptedKeysIndex);
     WERR(c->fd,BRLAPI_ERROR_NOMEM, "no memory for accepted keys");
     return 0;
   }
 
   asyncLockMutex(&apiConnectionsMutex);
+  keyRoutesGeneration++; /* our accepted keys were just reset */
   tty = tty2 = &ttys;
 
   for (ptty=ints+1; ptty<=ints+nbTtys; ptty++) {
@@ -914,7 +1366,10 @@ static int handleSetFocus(Connection *c, brlapi_packetType_t type, brlapi_packet
   uint32_t * ints = &packet->uint32;
   CHECKEXC(!c->raw,BRLAPI_ERROR_ILLEGAL_INSTRUCTION,"not allowed in raw mode");
   CHECKEXC(c->tty,BRLAPI_ERROR_ILLEGAL_INSTRUCTION,"not allowed out of tty mode");
+  asyncLockMutex(&apiConnectionsMutex);
   c->tty->focus = ntohl(ints[0]);
+  keyRoutesGeneration++;
+  asyncUnlockMutex(&apiConnectionsMutex);
   logMessage(LOG_CATEGORY(SERVER_EVENTS), "focus on window %#010x",c->tty->focus);
   return 0;
 }
@@ -927,11 +1382,22 @@ static void doLeaveTty(Connection *c)
   logMessage(LOG_CATEGORY(SERVER_EVENTS), "releasing tty %#010x",tty->number);
   c->tty = NULL;
   asyncLockMutex(&apiConnectionsMutex);
+  flushKeys(c);
   __removeConnection(c);
   __addConnection(c,notty.connections);
   asyncUnlockMutex(&apiConnectionsMutex);
   freeKeyrangeList(&c->acceptedKeys);
+  invalidateKeyrangeIndex(&c->acceptedKeysIndex);
   freeBrailleWindow(&c->brailleWindow);
+  freeBrailleWindow(&c->fragmentWindow);
+  freeContraction(c);
+  c->fragmenting = 0;
+
+  /* another connection, or the core, may get the display */
+  if (c->brlbufstate != EMPTY) {
+    c->brlbufstate = EMPTY;
+    requestFlush();
+  }
 }
 
 static int handleLeaveTtyMode(Connection *c, brlapi_packetType_t type, brlapi_packet_t *packet, size_t size)
@@ -952,6 +1418,7 @@ static int handleKeyRanges(Connection *c, brlapi_packetType_t type, brlapi_packe
   CHECKERR(!c->raw,BRLAPI_ERROR_ILLEGAL_INSTRUCTION,"not allowed in raw mode");
   CHECKERR(c->tty,BRLAPI_ERROR_ILLEGAL_INSTRUCTION,"not allowed out of tty mode");
   CHECKERR(!(size%2*sizeof(brlapi_keyCode_t)),BRLAPI_ERROR_INVALID_PACKET,"wrong packet size");
+  asyncLockMutex(&apiConnectionsMutex);
   asyncLockMutex(&c->acceptedKeysMutex);
   for (i=0; i<size/(2*sizeof(brlapi_keyCode_t)); i++) {
     x = ((brlapi_keyCode_t)ntohl(ints[i][0]) << 32) | ntohl(ints[i][1]);
@@ -965,17 +1432,139 @@ static int handleKeyRanges(Connection *c, brlapi_packetType_t type, brlapi_packe
       break;
     }
   }
+  invalidateKeyrangeIndex(&c->acceptedKeysIndex);
   asyncUnlockMutex(&c->acceptedKeysMutex);
+  keyRoutesGeneration++;
+  asyncUnlockMutex(&apiConnectionsMutex);
   if (!res) writeAck(c->fd);
   return 0;
 }
 
+typedef enum {
+  TEXT_CHARSET_OTHER,
+  TEXT_CHARSET_UTF8,
+  TEXT_CHARSET_LATIN1
+} TextCharset;
+
+/* Charsets which are decoded directly rather than through iconv */
+static TextCharset getTextCharset(const char *charset)
+{
+  static const struct {
+    const char *name;
+    TextCharset charset;
+  } names[] = {
+    { "UTF-8", TEXT_CHARSET_UTF8 },
+    { "UTF8", TEXT_CHARSET_UTF8 },
+    { "ISO-8859-1", TEXT_CHARSET_LATIN1 },
+    { "ISO8859-1", TEXT_CHARSET_LATIN1 },
+    { "ISO_8859-1", TEXT_CHARSET_LATIN1 },
+    { "LATIN1", TEXT_CHARSET_LATIN1 },
+    { "L1", TEXT_CHARSET_LATIN1 },
+  };
+  int i;
+
+  for (i=0; i<ARRAY_COUNT(names); i++)
+    if (!strcasecmp(charset, names[i].name)) return names[i].charset;
+  return TEXT_CHARSET_OTHER;
+}
+
+/* The converters below consume input and fill output until either runs out,
+ * leaving *sin and *sout at what remains */
+static int convertUtf8Text(const char **in, size_t *sin, wchar_t *out, size_t *sout)
+{
+  while (*sin && *sout) {
+    wint_t wc = convertUtf8ToWchar(in, sin);
+    if (wc == WEOF) return 0;
+    *out++ = wc;
+    (*sout)--;
+  }
+  return 1;
+}
+
+static int convertLatin1Text(const char **in, size_t *sin, wchar_t *out, size_t *sout)
+{
+  while (*sin && *sout) {
+    *out++ = (unsigned char) *(*in)++;
+    (*sin)--;
+    (*sout)--;
+  }
+  return 1;
+}
+
+#ifdef HAVE_ICONV_H
+/* Returns the connection's converter from charset, opening it if needed */
+static iconv_t getConnectionConverter(Connection *c, const char *charset)
+{
+  int i;
+  char *name;
+  iconv_t handle;
+
+  for (i=0; i<CONVERTERS_MAX; i++) {
+    if (!c->converters[i].charset) break;
+    if (!strcmp(c->converters[i].charset, charset)) {
+      name = c->converters[i].charset;
+      handle = c->converters[i].handle;
+      goto found;
+    }
+  }
+
+  if ((handle = iconv_open(getWcharCharset(), charset)) == (iconv_t) -1) return handle;
+
+  if (!(name = strdup(charset))) {
+    logMallocError();
+    iconv_close(handle);
+    return (iconv_t) -1;
+  }
+
+  if (i == CONVERTERS_MAX) {
+    i -= 1;
+    iconv_close(c->converters[i].handle);
+    free(c->converters[i].charset);
+  }
+
+found:
+  memmove(&c->converters[1], &c->converters[0], i*sizeof(c->converters[0]));
+  c->converters[0].charset = name;
+  c->converters[0].handle = handle;
+
+  iconv(handle, NULL, NULL, NULL, NULL);
+  return handle;
+}
+
+static int convertIconvText(iconv_t conv, const char **in, size_t *sin, wchar_t *out, size_t *sout)
+{
+  char *inBuf = (char *) *in, *outBuf = (char *) out;
+  size_t outSize = *sout * sizeof(*out);
+  size_t res = iconv(conv, &inBuf, sin, &outBuf, &outSize);
+
+  *in = inBuf;
+  *sout = outSize / sizeof(*out);
+  return (res != (size_t) -1) || (errno == E2BIG);
+}
+#endif /* HAVE_ICONV_H */
+
+/* Returns the window which a write goes to, with brailleWindowMutex held */
+static BrailleWindow *lockWriteWindow(Connection *c, int continued)
+{
+  asyncLockMutex(&c->brailleWindowMutex);
+  if (continued && !c->fragmenting) {
+    if (!c->fragmentWindow.text && (allocBrailleWindow(&c->fragmentWindow) == -1)) {
+      asyncUnlockMutex(&c->brailleWindowMutex);
+      return NULL;
+    }
+    copyBrailleWindow(&c->fragmentWindow, &c->brailleWindow);
+    c->fragmenting = 1;
+  }
+  return c->fragmenting? &c->fragmentWindow: &c->brailleWindow;
+}
+
 static int handleWrite(Connection *c, brlapi_packetType_t type, brlapi_packet_t *packet, size_t size)
 {
   brlapi_writeArgumentsPacket_t *wa = &packet->writeArguments;
   unsigned char *text = NULL, *orAttr = NULL, *andAttr = NULL;
   unsigned int rbeg, rsiz, textLen = 0;
   int cursor = -1;
+  BrailleWindow *window;
   unsigned char *p = &wa->data;
   int remaining = size;
   char *charset = NULL;
@@ -989,6 +1578,11 @@ static int handleWrite(Connection *c, brlapi_packetType_t type, brlapi_packet_t
   wa->flags = ntohl(wa->flags);
   if ((remaining==sizeof(wa->flags))&&(wa->flags==0)) {
     c->brlbufstate = EMPTY;
+    c->fragmenting = 0;
+    asyncLockMutex(&c->brailleWindowMutex);
+    clearContraction(c);
+    asyncUnlockMutex(&c->brailleWindowMutex);
+    requestFlush();
     return 0;
   }
   remaining -= sizeof(wa->flags); /* flags */
@@ -1043,7 +1637,7 @@ static int handleWrite(Connection *c, brlapi_packetType_t type, brlapi_packet_t
     memcpy(&u32, p, sizeof(uint32_t));
     cursor = ntohl(u32);
     p += sizeof(uint32_t); remaining -= sizeof(uint32_t); /* cursor */
-    CHECKEXC(cursor<=displaySize, BRLAPI_ERROR_INVALID_PACKET, "wrong cursor");
+    CHECKEXC((wa->flags & BRLAPI_WF_CONTRACT) || (cursor<=displaySize), BRLAPI_ERROR_INVALID_PACKET, "wrong cursor");
   }
   if (wa->flags & BRLAPI_WF_CHARSET) {
     CHECKEXC(wa->flags & BRLAPI_WF_TEXT, BRLAPI_ERROR_INVALID_PACKET, "charset requires text");
@@ -1054,54 +1648,129 @@ static int handleWrite(Connection *c, brlapi_packetType_t type, brlapi_packet_t
     p += charsetLen; remaining -= charsetLen; /* charset name */
   }
   CHECKEXC(remaining==0, BRLAPI_ERROR_INVALID_PACKET, "packet too big");
+  if (wa->flags & BRLAPI_WF_CONTRACT) {
+    CHECKEXC(wa->flags & BRLAPI_WF_TEXT, BRLAPI_ERROR_INVALID_PACKET, "contraction requires text");
+    CHECKEXC(!(wa->flags & BRLAPI_WF_CONTINUED), BRLAPI_ERROR_INVALID_PACKET, "contracted text can't be continued");
+    CHECKERR(!c->fragmenting, BRLAPI_ERROR_ILLEGAL_INSTRUCTION, "continued write in progress");
+  }
   /* Here the whole packet has been checked */
   if (text) {
+    /* text to be contracted has no fixed size, but can't have more characters than bytes */
+    size_t textMax = (wa->flags & BRLAPI_WF_CONTRACT)? textLen: rsiz;
+    wchar_t textBuf[textMax+1];
+    const char *in = (const char *) text;
+    size_t sin = textLen, sout = textMax;
+    TextCharset textCharset = TEXT_CHARSET_LATIN1;
+    int validCharset = 1, converted;
     if (charset) {
       charset[charsetLen] = 0; /* we have room for this */
+      textCharset = getTextCharset(charset);
 #ifndef HAVE_ICONV_H
-      CHECKEXC(!strcasecmp(charset, "iso-8859-1"), BRLAPI_ERROR_OPNOTSUPP, "charset conversion not supported (enable iconv?)");
+      CHECKEXC(textCharset != TEXT_CHARSET_OTHER, BRLAPI_ERROR_OPNOTSUPP, "charset conversion not supported (enable iconv?)");
 #endif /* !HAVE_ICONV_H */
     }
 #ifdef HAVE_ICONV_H
     else {
       lockCharset(0);
       charset = coreCharset = (char *) getCharset();
-      if (!coreCharset)
+      if (coreCharset)
+        textCharset = getTextCharset(coreCharset);
+      else
         unlockCharset();
     }
-    if (charset) {
-      iconv_t conv;
-      wchar_t textBuf[rsiz];
-      char *in = (char *) text, *out = (char *) textBuf;
-      size_t sin = textLen, sout = sizeof(textBuf), res;
-      logMessage(LOG_CATEGORY(SERVER_EVENTS), "charset %s", charset);
-      CHECKEXC((conv = iconv_open(getWcharCharset(),charset)) != (iconv_t)(-1), BRLAPI_ERROR_INVALID_PACKET, "invalid charset");
-      res = iconv(conv,&in,&sin,&out,&sout);
-      iconv_close(conv);
-      CHECKEXC(res != (size_t) -1, BRLAPI_ERROR_INVALID_PACKET, "invalid charset conversion");
-      CHECKEXC(!sin, BRLAPI_ERROR_INVALID_PACKET, "text too big");
-      CHECKEXC(!sout, BRLAPI_ERROR_INVALID_PACKET, "text too small");
-      if (coreCharset) unlockCharset();
-      asyncLockMutex(&c->brailleWindowMutex);
-      memcpy(c->brailleWindow.text+rbeg-1,textBuf,rsiz*sizeof(wchar_t));
-    } else
 #endif /* HAVE_ICONV_H */
+    if (charset) logMessage(LOG_CATEGORY(SERVER_EVENTS), "charset %s", charset);
+    switch (textCharset) {
+      case TEXT_CHARSET_UTF8:
+        converted = convertUtf8Text(&in, &sin, textBuf, &sout);
+        break;
+      case TEXT_CHARSET_LATIN1:
+        /* also what is assumed when no charset is known */
+        converted = convertLatin1Text(&in, &sin, textBuf, &sout);
+        break;
+      default:
+#ifdef HAVE_ICONV_H
+      {
+        iconv_t conv = getConnectionConverter(c, charset);
+        if (conv != (iconv_t) -1) {
+          converted = convertIconvText(conv, &in, &sin, textBuf, &sout);
+          break;
+        }
+      }
+#endif /* HAVE_ICONV_H */
+        validCharset = converted = 0;
+        break;
+    }
+#ifdef HAVE_ICONV_H
+    if (coreCharset) unlockCharset();
+#endif /* HAVE_ICONV_H */
+    CHECKEXC(validCharset, BRLAPI_ERROR_INVALID_PACKET, "invalid charset");
+    CHECKEXC(converted, BRLAPI_ERROR_INVALID_PACKET, "invalid charset conversion");
+    CHECKEXC(!sin, BRLAPI_ERROR_INVALID_PACKET, "text too big");
+    if (wa->flags & BRLAPI_WF_CONTRACT) {
+      size_t length = textMax - sout;
+      wchar_t *contracted;
+      CHECKEXC(cursor<=(int)length+1, BRLAPI_ERROR_INVALID_PACKET, "wrong cursor");
+      CHECKERR((contracted = malloc((length+1)*sizeof(wchar_t))), BRLAPI_ERROR_NOMEM, "no memory for contracted text");
+      wmemcpy(contracted, textBuf, length);
+      window = lockWriteWindow(c, 0);
+      free(c->contraction.text);
+      c->contraction.text = contracted;
+      c->contraction.length = length;
+      c->contraction.begin = rbeg;
+      c->contraction.size = rsiz;
+      if (cursor>=0) {
+        c->contraction.cursor = cursor-1;
+        if (!cursor) window->cursor = 0;
+        cursor = -1; /* placed when the text is contracted */
+      } else {
+        /* a cell position within the previous text means nothing within this one */
+        c->contraction.cursor = -1;
+        if ((window->cursor >= rbeg) && (window->cursor < rbeg+rsiz)) window->cursor = 0;
+      }
+    } else {
+      CHECKEXC(!sout, BRLAPI_ERROR_INVALID_PACKET, "text too small");
+      CHECKERR((window = lockWriteWindow(c, wa->flags & BRLAPI_WF_CONTINUED)), BRLAPI_ERROR_NOMEM, "no memory for continued write");
+      /* the contracted text is only forgotten once its own cells are overwritten */
+      if (c->contraction.text &&
+          (rbeg < c->contraction.begin+c->contraction.size) &&
+          (rbeg+rsiz > c->contraction.begin))
+        clearContraction(c);
+      memcpy(window->text+rbeg-1,textBuf,rsiz*sizeof(wchar_t));
+    }
+    if (!andAttr) memset(window->andAttr+rbeg-1,0xFF,rsiz);
+    if (!orAttr)  memset(window->orAttr+rbeg-1,0x00,rsiz);
+  } else {
+    CHECKERR((window = lockWriteWindow(c, wa->flags & BRLAPI_WF_CONTINUED)), BRLAPI_ERROR_NOMEM, "no memory for continued write");
+  }
+  if (andAttr) memcpy(window->andAttr+rbeg-1,andAttr,rsiz);
+  if (orAttr) memcpy(window->orAttr+rbeg-1,orAttr,rsiz);
+  if (cursor>=0) {
+    window->cursor = cursor;
+    c->contraction.cursor = -1;
+  }
+  if (c->fragmenting) {
+    if (wa->flags & BRLAPI_WF_CONTINUED) {
+      /* not displayed until the last fragment */
+      asyncUnlockMutex(&c->brailleWindowMutex);
+      return 0;
+    }
     {
-      int i;
-      asyncLockMutex(&c->brailleWindowMutex);
-      for (i=0; i<rsiz; i++)
-	/* assume latin1 */
-        c->brailleWindow.text[rbeg-1+i] = text[i];
-    }
-    if (!andAttr) memset(c->brailleWindow.andAttr+rbeg-1,0xFF,rsiz);
-    if (!orAttr)  memset(c->brailleWindow.orAttr+rbeg-1,0x00,rsiz);
-  } else asyncLockMutex(&c->brailleWindowMutex);
-  if (andAttr) memcpy(c->brailleWindow.andAttr+rbeg-1,andAttr,rsiz);
-  if (orAttr) memcpy(c->brailleWindow.orAttr+rbeg-1,orAttr,rsiz);
-  if (cursor>=0) c->brailleWindow.cursor = cursor;
+      BrailleWindow assembled = c->fragmentWindow;
+      c->fragmentWindow = c->brailleWindow;
+      c->brailleWindow = assembled;
+    }
+    c->fragmenting = 0;
+  }
+  if (!c->framePending)
+    c->framePending = 1;
+  else if ((rbeg == 1) && (rsiz == displaySize))
+    c->framesDropped++; /* the pending frame was entirely replaced */
+  else
+    c->framesCoalesced++;
   c->brlbufstate = TODISPLAY;
   asyncUnlockMutex(&c->brailleWindowMutex);
-  asyncSignalEvent(flushEvent, NULL);
+  requestFlush();
   return 0;
 }
 
@@ -1200,19 +1869,88 @@ static int handleResumeDriver(Connection *c, brlapi_packetType_t type, brlapi_pa
   return 0;
 }
 
+#ifdef SHARED_MEMORY_TRANSPORT
+static int handleSharedMemory(Connection *c, brlapi_packetType_t type, brlapi_packet_t *packet, size_t size)
+{
+  brlapi_sharedMemoryPacket_t *sharedMemory = &packet->sharedMemory;
+  brlapi_sharedMemoryHeader_t *header;
+  uint32_t ringSize;
+  size_t mapSize;
+  int memory, event, space, seals;
+  struct stat status;
+  void *address;
+
+  CHECKERR(size == sizeof(*sharedMemory), BRLAPI_ERROR_INVALID_PACKET, "wrong packet size");
+  CHECKERR(c->receivedCount == 3, BRLAPI_ERROR_INVALID_PARAMETER, "memory and event descriptors expected");
+  CHECKERR(!c->shared.header, BRLAPI_ERROR_ILLEGAL_INSTRUCTION, "shared memory already set up");
+  ringSize = ntohl(sharedMemory->size);
+  CHECKERR((ringSize >= BRLAPI_SHAREDMEMORY_MINIMUM) && (ringSize <= BRLAPI_SHAREDMEMORY_MAXIMUM) && !(ringSize & (ringSize - 1)), BRLAPI_ERROR_INVALID_PARAMETER, "invalid ring size");
+
+  memory = c->receivedDescriptors[0];
+  event = c->receivedDescriptors[1];
+  space = c->receivedDescriptors[2];
+  mapSize = sizeof(*header) + ringSize;
+
+  /* The client mustn't be able to shrink the memory while we're using it. */
+  seals = fcntl(memory, F_GET_SEALS);
+  CHECKERR((seals != -1) && (seals & F_SEAL_SHRINK), BRLAPI_ERROR_INVALID_PARAMETER, "memory not sealed against shrinking");
+  CHECKERR((fstat(memory, &status) != -1) && (status.st_size >= (off_t) mapSize), BRLAPI_ERROR_INVALID_PARAMETER, "memory too small");
+
+  if ((address = mmap(NULL, mapSize, PROT_READ|PROT_WRITE, MAP_SHARED, memory, 0)) == MAP_FAILED) {
+    logSystemError("mmap");
+    WERR(c->fd, BRLAPI_ERROR_NOMEM, "couldn't map shared memory");
+    return 0;
+  }
+
+  header = address;
+  if (header->magic != BRLAPI_SHAREDMEMORY_MAGIC) {
+    munmap(address, mapSize);
+    WERR(c->fd, BRLAPI_ERROR_INVALID_PARAMETER, "wrong shared memory magic number");
+    return 0;
+  }
+
+  if (!setBlockingIo(event, 0) || !setBlockingIo(space, 0) || !watchDescriptor(event, c)) {
+    munmap(address, mapSize);
+    WERR(c->fd, BRLAPI_ERROR_INVALID_PARAMETER, "unusable event descriptor");
+    return 0;
+  }
+
+  c->shared.header = header;
+  c->shared.ring = (unsigned char *) (header + 1);
+  c->shared.size = ringSize;
+  c->shared.tail = header->tail;
+  c->shared.event = event;
+  c->shared.space = space;
+  c->receivedCount = 0;
+  close(memory);
+
+  /* The ring is still empty: have the client wake us up for its first packet. */
+  header->waiting = 1;
+  writeAck(c->fd);
+  logMessage(LOG_CATEGORY(SERVER_EVENTS), "fd %" PRIfd ": using a %u-byte shared memory ring", c->fd, ringSize);
+  return 0;
+}
+#endif /* SHARED_MEMORY_TRANSPORT */
+
 static PacketHandlers packetHandlers = {
   handleGetDriverName, handleGetDisplaySize,
   handleEnterTtyMode, handleSetFocus, handleLeaveTtyMode,
   handleKeyRanges, handleKeyRanges, handleWrite,
-  handleEnterRawMode, handleLeaveRawMode, handlePacket, handleSuspendDriver, handleResumeDriver
+  handleEnterRawMode, handleLeaveRawMode, handlePacket, handleSuspendDriver, handleResumeDriver,
+#ifdef SHARED_MEMORY_TRANSPORT
+  handleSharedMemory
+#else /* SHARED_MEMORY_TRANSPORT */
+  NULL
+#endif /* SHARED_MEMORY_TRANSPORT */
 };
 
 static void handleNewConnection(Connection *c)
 {
   brlapi_packet_t versionPacket;
-  versionPacket.version.protocolVersion = htonl(BRLAPI_PROTOCOL_VERSION);
+  versionPacket.serverVersion.protocolVersion = htonl(BRLAPI_PROTOCOL_VERSION);
+  versionPacket.serverVersion.features = htonl(SERVER_FEATURES);
 
-  brlapiserver_writePacket(c->fd,BRLAPI_PACKET_VERSION,&versionPacket.data,sizeof(versionPacket.version));
+  brlapiserver_writePacket(c->fd,BRLAPI_PACKET_VERSION,&versionPacket.data,sizeof(versionPacket.serverVersion));
 }
 
 /* Function : handleUnauthorizedConnection */
@@ -1235,6 +1973,8 @@ static int handleUnauthorizedConnection(Connection *c, brlapi_packetType_t type,
 	WERR(c->fd, BRLAPI_ERROR_PROTOCOL_VERSION, "wrong protocol version");
 	return 1;
       }
+      if (size>=sizeof(packet->serverVersion))
+	c->features = ntohl(packet->serverVersion.features) & SERVER_FEATURES;
 
       /* TODO: move this inside auth.c */
       if (authDescriptor && authPerform(authDescriptor, c->fd)) {
@@ -1308,13 +2048,44 @@ static int handleUnauthorizedConnection(Connection *c, brlapi_packetType_t type,
   }
 }
 
+/* Function : handleRequest */
+/* Passes a request of an authorized connection to its handler */
+static void handleRequest(Connection *c, PacketHandlers *handlers, brlapi_packetType_t type, brlapi_packet_t *packet, size_t size)
+{
+  PacketHandler p = NULL;
+
+  if (size>BRLAPI_MAXPACKETSIZE) {
+    logMessage(LOG_WARNING, "Discarding too large packet of type %s on fd %"PRIfd,brlapiserver_getPacketTypeName(type), c->fd);
+    return;
+  }
+  switch (type) {
+    case BRLAPI_PACKET_GETDRIVERNAME: p = handlers->getDriverName; break;
+    case BRLAPI_PACKET_GETDISPLAYSIZE: p = handlers->getDisplaySize; break;
+    case BRLAPI_PACKET_ENTERTTYMODE: p = handlers->enterTtyMode; break;
+    case BRLAPI_PACKET_SETFOCUS: p = handlers->setFocus; break;
+    case BRLAPI_PACKET_LEAVETTYMODE: p = handlers->leaveTtyMode; break;
+    case BRLAPI_PACKET_IGNOREKEYRANGES: p = handlers->ignoreKeyRanges; break;
+    case BRLAPI_PACKET_ACCEPTKEYRANGES: p = handlers->acceptKeyRanges; break;
+    case BRLAPI_PACKET_WRITE: p = handlers->write; break;
+    case BRLAPI_PACKET_ENTERRAWMODE: p = handlers->enterRawMode; break;
+    case BRLAPI_PACKET_LEAVERAWMODE: p = handlers->leaveRawMode; break;
+    case BRLAPI_PACKET_PACKET: p = handlers->packet; break;
+    case BRLAPI_PACKET_SUSPENDDRIVER: p = handlers->suspendDriver; break;
+    case BRLAPI_PACKET_RESUMEDRIVER: p = handlers->resumeDriver; break;
+    case BRLAPI_PACKET_SHAREDMEMORY: p = handlers->sharedMemory; break;
+  }
+  if (p!=NULL) {
+    logRequest(type, c->fd);
+    p(c, type, packet, size);
+  } else WEXC(c->fd,BRLAPI_ERROR_UNKNOWN_INSTRUCTION, type, packet, size, "unknown packet type");
+}
+
 /* Function : processRequest */
 /* Reads a packet fro c->fd and processes it */
 /* Returns 1 if connection has to be removed */
 /* If EOF is reached, closes fd and frees all associated ressources */
 static int processRequest(Connection *c, PacketHandlers *handlers)
 {
-  PacketHandler p = NULL;
   int res;
   ssize_t size;
   brlapi_packet_t *packet = (brlapi_packet_t *) c->packet.content;
@@ -1365,32 +2136,16 @@ static int processRequest(Connection *c, PacketHandlers *handlers)
   size = c->packet.header.size;
   type = c->packet.header.type;
   
-  if (c->auth!=1) return handleUnauthorizedConnection(c, type, packet, size);
-
-  if (size>BRLAPI_MAXPACKETSIZE) {
-    logMessage(LOG_WARNING, "Discarding too large packet of type %s on fd %"PRIfd,brlapiserver_getPacketTypeName(type), c->fd);
-    return 0;    
-  }
-  switch (type) {
-    case BRLAPI_PACKET_GETDRIVERNAME: p = handlers->getDriverName; break;
-    case BRLAPI_PACKET_GETDISPLAYSIZE: p = handlers->getDisplaySize; break;
-    case BRLAPI_PACKET_ENTERTTYMODE: p = handlers->enterTtyMode; break;
-    case BRLAPI_PACKET_SETFOCUS: p = handlers->setFocus; break;
-    case BRLAPI_PACKET_LEAVETTYMODE: p = handlers->leaveTtyMode; break;
-    case BRLAPI_PACKET_IGNOREKEYRANGES: p = handlers->ignoreKeyRanges; break;
-    case BRLAPI_PACKET_ACCEPTKEYRANGES: p = handlers->acceptKeyRanges; break;
-    case BRLAPI_PACKET_WRITE: p = handlers->write; break;
-    case BRLAPI_PACKET_ENTERRAWMODE: p = handlers->enterRawMode; break;
-    case BRLAPI_PACKET_LEAVERAWMODE: p = handlers->leaveRawMode; break;
-    case BRLAPI_PACKET_PACKET: p = handlers->packet; break;
-    case BRLAPI_PACKET_SUSPENDDRIVER: p = handlers->suspendDriver; break;
-    case BRLAPI_PACKET_RESUMEDRIVER: p = handlers->resumeDriver; break;
+  if (c->auth!=1) {
+    res = handleUnauthorizedConnection(c, type, packet, size);
+  } else {
+    handleRequest(c, handlers, type, packet, size);
+    res = 0;
   }
-  if (p!=NULL) {
-    logRequest(type, c->fd);
-    p(c, type, packet, size);
-  } else WEXC(c->fd,BRLAPI_ERROR_UNKNOWN_INSTRUCTION, type, packet, size, "unknown packet type");
-  return 0;
+#ifdef SHARED_MEMORY_TRANSPORT
+  closeReceivedDescriptors(c);
+#endif /* SHARED_MEMORY_TRANSPORT */
+  return res;
 }
 
 /****************************************************************************/
@@ -1950,6 +2705,9 @@ static void createSocket(int num)
     logMessage(LOG_WARNING, "error while creating socket %d", num);
   } else {
     logMessage(LOG_CATEGORY(SERVER_EVENTS), "socket %d created (fd %"PRIfd")", num, cinfo->fd);
+#if !defined(__MINGW32__) && defined(HAVE_SYS_EPOLL_H)
+    watchDescriptor(cinfo->fd, cinfo);
+#endif /* HAVE_SYS_EPOLL_H */
   }
 }
 
@@ -2015,6 +2773,7 @@ static void closeSockets(void *arg)
   }
 }
 
+#if defined(__MINGW32__) || !defined(HAVE_SYS_EPOLL_H)
 /* Function: addTtyFds */
 /* recursively add fds of ttys */
 #ifdef __MINGW32__
@@ -2087,6 +2846,174 @@ static void handleTtyFds(fd_set *fds, time_t currentTime, Tty *tty) {
     asyncUnlockMutex(&apiConnectionsMutex);
   }
 }
+#else /* HAVE_SYS_EPOLL_H */
+/* Function: cleanTty */
+/* frees a tty, and then its ancestors, once nobody uses it anymore */
+static void cleanTty(Tty *tty) {
+  asyncLockMutex(&apiConnectionsMutex);
+  while (tty!=&ttys && tty!=&notty
+         && tty->connections->next == tty->connections && !tty->subttys) {
+    Tty *father = tty->father;
+    logMessage(LOG_CATEGORY(SERVER_EVENTS), "freeing tty %#010x",tty->number);
+    removeTty(tty);
+    freeTty(tty);
+    tty = father;
+  }
+  asyncUnlockMutex(&apiConnectionsMutex);
+}
+
+#ifdef SHARED_MEMORY_TRANSPORT
+/* Function: copyFromRing */
+/* copies data out of the shared memory ring of a connection */
+static void copyFromRing(const Connection *c, uint32_t position, void *buffer, size_t size)
+{
+  uint32_t offset = position & (c->shared.size - 1);
+  size_t count = MIN(size, c->shared.size - offset);
+
+  memcpy(buffer, c->shared.ring + offset, count);
+  memcpy((unsigned char *) buffer + count, c->shared.ring, size - count);
+}
+
+/* Function: processSharedRequests */
+/* handles the requests which the client has put into its shared memory ring */
+/* Returns 0 if the ring is corrupted, else tells through drained whether */
+/* the ring has been emptied or this connection has had enough for now */
+static int processSharedRequests(Connection *c, int *drained)
+{
+  brlapi_sharedMemoryHeader_t *header = c->shared.header;
+  uint32_t content[BRLAPI_MAXPACKETSIZE/sizeof(uint32_t)+1]; /* +1 for additional \0 */
+  uint32_t limit = c->shared.tail + c->shared.size;
+  uint64_t count;
+
+  if (read(c->shared.event, &count, sizeof(count)) == -1) {
+    if (errno != EAGAIN) logSystemError("eventfd read");
+  }
+  header->waiting = 0;
+
+  while (1) {
+    uint32_t head = header->head;
+    uint32_t available = head - c->shared.tail;
+    brlapi_header_t packetHeader;
+    uint32_t length;
+
+    if (!available) {
+      /* The client only writes to the event descriptor if we say we're waiting. */
+      header->waiting = 1;
+      __sync_synchronize();
+      if (header->head == c->shared.tail) {
+        *drained = 1;
+        return 1;
+      }
+      header->waiting = 0;
+      continue;
+    }
+
+    if ((int32_t) (c->shared.tail - limit) >= 0) {
+      /* Let the other connections have their turn. */
+      count = 1;
+      if (write(c->shared.event, &count, sizeof(count)) == -1) logSystemError("eventfd write");
+      *drained = 0;
+      return 1;
+    }
+
+    /* Don't look at the packet before having seen that it's complete. */
+    __sync_synchronize();
+
+    if ((available > c->shared.size) || (available < sizeof(packetHeader))) return 0;
+    copyFromRing(c, c->shared.tail, &packetHeader, sizeof(packetHeader));
+    if (packetHeader.size > BRLAPI_MAXPACKETSIZE) return 0;
+    length = sizeof(packetHeader) + ((packetHeader.size + 3) & ~3);
+    if (length > available) return 0;
+    copyFromRing(c, c->shared.tail + sizeof(packetHeader), content, packetHeader.size);
+
+    /* The client can reuse that space as soon as we've copied the packet. */
+    c->shared.tail += length;
+    __sync_synchronize();
+    header->tail = c->shared.tail;
+
+    /* The client sets full before checking tail again, and then waits.
+     * Let it fill half of the ring at a time rather than packet by packet. */
+    __sync_synchronize();
+    if (header->full && ((uint32_t) (header->head - c->shared.tail) <= (c->shared.size / 2))) {
+      header->full = 0;
+      count = 1;
+      if (write(c->shared.space, &count, sizeof(count)) == -1) {
+        if (errno != EAGAIN) logSystemError("eventfd write");
+      }
+    }
+
+    handleRequest(c, &packetHandlers, packetHeader.type, (brlapi_packet_t *) content, packetHeader.size);
+  }
+}
+#endif /* SHARED_MEMORY_TRANSPORT */
+
+/* Function: handleConnectionInput */
+/* handles a connection whose fd, or shared memory ring, is readable */
+/* Returns 1 if the connection has been freed */
+static int handleConnectionInput(Connection *c) {
+  Tty *tty = c->tty;
+  int freed = 0;
+  int ready = 1;
+
+#ifdef SHARED_MEMORY_TRANSPORT
+  /* The ring is drained first since the client only uses the socket for
+   * requests which it sends after those it has put into the ring. */
+  if (c->shared.header) {
+    int drained;
+
+    if (!processSharedRequests(c, &drained)) {
+      logMessage(LOG_WARNING, "corrupted shared memory ring on fd %"PRIfd, c->fd);
+      closeSharedMemory(c);
+      /* Have processRequest() clean the connection up as if it had been closed. */
+      shutdown(c->fd, SHUT_RDWR);
+    } else if (!drained) {
+      /* Its later requests on the socket wait for the event written above
+       * to bring us back, and the rest of the ring to be handled first. */
+      ready = 0;
+    }
+  }
+#endif /* SHARED_MEMORY_TRANSPORT */
+
+  if (ready && processRequest(c, &packetHandlers)) {
+    removeFreeConnection(c);
+    freed = 1;
+  } else if (c->tty == tty) {
+    return 0;
+  }
+
+  if (tty) cleanTty(tty);
+  return freed;
+}
+
+/* Function: expireUnauthorizedConnections */
+/* removes connections which didn't authenticate in time */
+/* Returns the number of milliseconds until the next one expires, or -1 */
+static int expireUnauthorizedConnections(time_t currentTime) {
+  int timeout = -1;
+  Connection *c = notty.connections->next;
+
+  /* connections can't leave notty before being authorized */
+  while (c != notty.connections) {
+    Connection *next = c->next;
+
+    if (c->auth != 1) {
+      time_t elapsed = currentTime - c->upTime;
+
+      if (elapsed > UNAUTH_DELAY) {
+        logMessage(LOG_WARNING, "BrlAPI connection fd=%"PRIfd" didn't authenticate in time", c->fd);
+        removeFreeConnection(c);
+      } else {
+        int remaining = (UNAUTH_DELAY + 1 - elapsed) * 1000;
+        if ((timeout < 0) || (remaining < timeout)) timeout = remaining;
+      }
+    }
+
+    c = next;
+  }
+
+  return timeout;
+}
+#endif /* HAVE_SYS_EPOLL_H */
 
 #ifndef __MINGW32__
 static sigset_t blockedSignalsMask;
@@ -2127,6 +3054,74 @@ ASYNC_THREAD_FUNCTION(createServerSocket) {
   return NULL;
 }
 
+/* Function : addNewConnection */
+/* Sets up the connection of a newly accepted client */
+static void addNewConnection(FileDescriptor resfd, const char *source, time_t currentTime)
+{
+  Connection *c;
+
+  logMessage(LOG_NOTICE, "BrlAPI connection fd=%"PRIfd" accepted: %s", resfd, source);
+
+  if (unauthConnections>=UNAUTH_MAX) {
+    writeError(resfd, BRLAPI_ERROR_CONNREFUSED);
+    closeFileDescriptor(resfd);
+
+    if (unauthConnLog==0) {
+      logMessage(LOG_WARNING, "Too many simultaneous unauthorized connections");
+    }
+
+    unauthConnLog++;
+    return;
+  }
+
+#ifndef __MINGW32__
+  if (!setBlockingIo(resfd, 0)) {
+    logMessage(LOG_WARNING, "Failed to switch to non-blocking mode: %s",strerror(errno));
+    closeFileDescriptor(resfd);
+    return;
+  }
+#endif /* __MINGW32__ */
+
+  c = createConnection(resfd, currentTime);
+  if (c==NULL) {
+    logMessage(LOG_WARNING,"Failed to create connection structure");
+    return;
+  }
+
+  unauthConnections++;
+  addConnection(c, notty.connections);
+
+#if !defined(__MINGW32__) && defined(HAVE_SYS_EPOLL_H)
+  if (!watchDescriptor(resfd, c)) {
+    removeFreeConnection(c);
+    return;
+  }
+#endif /* HAVE_SYS_EPOLL_H */
+
+  handleNewConnection(c);
+}
+
+#if !defined(__MINGW32__) && defined(HAVE_SYS_EPOLL_H)
+/* Function : acceptConnection */
+/* Accepts a connection on a listening socket which is readable */
+static void acceptConnection(struct socketInfo *info, time_t currentTime)
+{
+  char source[0X100];
+  struct sockaddr_storage addr;
+  socklen_t addrlen = sizeof(addr);
+  FileDescriptor resfd = (FileDescriptor)accept((SocketDescriptor)info->fd, (struct sockaddr *) &addr, &addrlen);
+
+  if (resfd == INVALID_FILE_DESCRIPTOR) {
+    setSocketErrno();
+    logMessage(LOG_WARNING,"accept(%"PRIfd"): %s",info->fd,strerror(errno));
+    return;
+  }
+
+  formatAddress(source, sizeof(source), &addr, addrlen);
+  addNewConnection(resfd, source, currentTime);
+}
+#endif /* HAVE_SYS_EPOLL_H */
+
 /* Function : server */
 /* The server thread */
 /* Returns NULL in any case */
@@ -2135,18 +3130,26 @@ ASYNC_THREAD_FUNCTION(runServer) {
   pthread_attr_t attr;
   int i;
   int res;
+  time_t currentTime;
+
+#if defined(__MINGW32__)
   struct sockaddr_storage addr;
   socklen_t addrlen;
-  Connection *c;
-  time_t currentTime;
-  fd_set sockset;
   FileDescriptor resfd;
-
-#ifdef __MINGW32__
+  fd_set sockset;
   HANDLE *lpHandles;
   int nbAlloc;
   int nbHandles = 0;
+#elif defined(HAVE_SYS_EPOLL_H)
+  struct epoll_event events[0X10];
+  sigset_t waitMask;
+  int timeout;
+  int n;
 #else /* __MINGW32__ */
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+  FileDescriptor resfd;
+  fd_set sockset;
   int fdmax;
   struct timeval tv;
   int n;
@@ -2155,15 +3158,44 @@ ASYNC_THREAD_FUNCTION(runServer) {
   logMessage(LOG_CATEGORY(SERVER_EVENTS), "server thread started");
   if (!prepareThread()) goto finished;
 
-  socketHosts = splitString(hosts,'+',&numSockets);
-  if (numSockets>MAXSOCKETS) {
-    logMessage(LOG_ERR,"too many hosts specified (%d, max %d)",numSockets,MAXSOCKETS);
-    goto finished;
+#if !defined(__MINGW32__) && defined(HAVE_SYS_EPOLL_H)
+  /* The wait has no timeout when there are no unauthorized connections so
+   * the termination signal must only be deliverable while waiting, else it
+   * could arrive between checking running and calling epoll_pwait.
+   */
+  {
+    sigset_t mask;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR2);
+
+    if (pthread_sigmask(SIG_BLOCK, &mask, &waitMask) != 0) {
+      logSystemError("pthread_sigmask[SIG_BLOCK]");
+      goto finished;
+    }
+
+    sigdelset(&waitMask, SIGUSR2);
   }
+#endif /* HAVE_SYS_EPOLL_H */
+
+  socketHosts = splitString(hosts,'+',&numSockets);
   if (numSockets == 0) {
     logMessage(LOG_INFO,"no hosts specified");
     goto finished;
   }
+
+  if (!(socketInfo = calloc(numSockets, sizeof(*socketInfo))) ||
+      !(socketThreads = calloc(numSockets, sizeof(*socketThreads)))) {
+    logMallocError();
+    goto noSockets;
+  }
+
+#if !defined(__MINGW32__) && defined(HAVE_SYS_EPOLL_H)
+  if ((epollDescriptor = epoll_create(numSockets + UNAUTH_MAX)) == -1) {
+    logSystemError("epoll_create");
+    goto noSockets;
+  }
+#endif /* HAVE_SYS_EPOLL_H */
 #ifdef __MINGW32__
   nbAlloc = numSockets;
 #endif /* __MINGW32__ */
@@ -2182,7 +3214,7 @@ ASYNC_THREAD_FUNCTION(runServer) {
   if ((getaddrinfoProc && WSAStartup(MAKEWORD(2,0), &wsadata))
 	|| (!getaddrinfoProc && WSAStartup(MAKEWORD(1,1), &wsadata))) {
     logWindowsSocketError("Starting socket library");
-    goto finished;
+    goto noSockets;
   }
 #endif /* __MINGW32__ */
 
@@ -2215,7 +3247,7 @@ ASYNC_THREAD_FUNCTION(runServer) {
 #endif /* __MINGW32__ */
         }
 
-	goto finished;
+	goto noSockets;
       }
 
 #ifdef __MINGW32__
@@ -2264,6 +3296,33 @@ ASYNC_THREAD_FUNCTION(runServer) {
     }
 
     free(lpHandles);
+#elif defined(HAVE_SYS_EPOLL_H)
+    timeout = expireUnauthorizedConnections(time(NULL));
+
+    if ((n=epoll_pwait(epollDescriptor, events, ARRAY_COUNT(events), timeout, &waitMask))<0) {
+      if (errno == EINTR) continue;
+      logSystemError("epoll_pwait");
+      break;
+    }
+
+    time(&currentTime);
+
+    for (i=0;i<n;i++) {
+      void *data = events[i].data.ptr;
+
+      if (!data) continue;
+
+      if ((data >= (void *)socketInfo) && (data < (void *)(socketInfo + numSockets))) {
+        acceptConnection(data, currentTime);
+      } else if (handleConnectionInput(data)) {
+        int j;
+
+        /* its shared memory ring may also be in this batch */
+        for (j=i+1; j<n; j++) {
+          if (events[j].data.ptr == data) events[j].data.ptr = NULL;
+        }
+      }
+    }
 #else /* __MINGW32__ */
     /* Compute sockets set and fdmax */
     FD_ZERO(&sockset);
@@ -2294,6 +3353,7 @@ ASYNC_THREAD_FUNCTION(runServer) {
     }
 #endif /* __MINGW32__ */
 
+#if defined(__MINGW32__) || !defined(HAVE_SYS_EPOLL_H)
     time(&currentTime);
 
     for (i=0;i<numSockets;i++) {
@@ -2335,40 +3395,13 @@ ASYNC_THREAD_FUNCTION(runServer) {
 #ifdef __MINGW32__
         }
 #endif /* __MINGW32__ */
-        logMessage(LOG_NOTICE, "BrlAPI connection fd=%"PRIfd" accepted: %s", resfd, source);
-
-        if (unauthConnections>=UNAUTH_MAX) {
-          writeError(resfd, BRLAPI_ERROR_CONNREFUSED);
-          closeFileDescriptor(resfd);
-
-          if (unauthConnLog==0) {
-            logMessage(LOG_WARNING, "Too many simultaneous unauthorized connections");
-          }
-
-          unauthConnLog++;
-        } else {
-#ifndef __MINGW32__
-          if (!setBlockingIo(resfd, 0)) {
-            logMessage(LOG_WARNING, "Failed to switch to non-blocking mode: %s",strerror(errno));
-            break;
-          }
-#endif /* __MINGW32__ */
-
-          c = createConnection(resfd, currentTime);
-          if (c==NULL) {
-            logMessage(LOG_WARNING,"Failed to create connection structure");
-            closeFileDescriptor(resfd);
-          } else {
-	    unauthConnections++;
-	    addConnection(c, notty.connections);
-	    handleNewConnection(c);
-	  }
-        }
+        addNewConnection(resfd, source, currentTime);
       }
     }
 
     handleTtyFds(&sockset,currentTime,&notty);
     handleTtyFds(&sockset,currentTime,&ttys);
+#endif /* HAVE_SYS_EPOLL_H */
   }
 
   running = 0;
@@ -2378,6 +3411,20 @@ ASYNC_THREAD_FUNCTION(runServer) {
   closeSockets(NULL);
 #endif /* __MINGW32__ */
 
+noSockets:
+#if !defined(__MINGW32__) && defined(HAVE_SYS_EPOLL_H)
+  if (epollDescriptor != -1) {
+    close(epollDescriptor);
+    epollDescriptor = -1;
+  }
+#endif /* HAVE_SYS_EPOLL_H */
+
+  free(socketThreads);
+  socketThreads = NULL;
+  free(socketInfo);
+  socketInfo = NULL;
+  numSockets = 0;
+
 finished:
   logMessage(LOG_CATEGORY(SERVER_EVENTS), "server thread finished");
   return NULL;
@@ -2477,6 +3524,8 @@ static int initializeAcceptedKeys(Connection *c, int how)
         if (keyrange->action(first, last, &c->acceptedKeys) == -1) return -1;
         keyrange += 1;
       }
+
+      invalidateKeyrangeIndex(&c->acceptedKeysIndex);
     }
   }
 
@@ -2501,6 +3550,16 @@ static void ttyTerminationHandler(Tty *tty)
     }
   }
 
+  if (flushAlarm) {
+    asyncCancelRequest(flushAlarm);
+    flushAlarm = NULL;
+  }
+
+  if (keysAlarm) {
+    asyncCancelRequest(keysAlarm);
+    keysAlarm = NULL;
+  }
+
   if (flushEvent) {
     asyncDiscardEvent(flushEvent);
     flushEvent = NULL;
@@ -2560,7 +3619,14 @@ found:
 }
 
 static inline void setCurrentRootTty(void) {
-  ttys.focus = currentVirtualTerminal();
+  int focus = currentVirtualTerminal();
+
+  if (focus != ttys.focus) {
+    asyncLockMutex(&apiConnectionsMutex);
+    ttys.focus = focus;
+    keyRoutesGeneration++;
+    asyncUnlockMutex(&apiConnectionsMutex);
+  }
 }
 
 /* Function : api_writeWindow */
@@ -2595,7 +3661,7 @@ static Connection *whoGetsKey(Tty *tty, brlapi_keyCode_t code, unsigned int how)
   int passKey;
   for (c=tty->connections->next; c!=tty->connections; c = c->next) {
     asyncLockMutex(&c->acceptedKeysMutex);
-    passKey = (c->how==how) && (inKeyrangeList(c->acceptedKeys,code) != NULL);
+    passKey = (c->how==how) && (inKeyrangeIndex(&c->acceptedKeysIndex,c->acceptedKeys,code) != NULL);
     asyncUnlockMutex(&c->acceptedKeysMutex);
     if (passKey) goto found;
   }
@@ -2609,6 +3675,22 @@ found:
   return c;
 }
 
+/* Function: routeKey */
+/* Same as whoGetsKey, but remembers recent answers for the tty */
+static Connection *routeKey(Tty *tty, brlapi_keyCode_t code, unsigned int how)
+{
+  KeyRoute *route = &tty->keyRoutes[(code ^ (code >> 32) ^ how) % KEY_ROUTES_SIZE];
+
+  if ((route->generation != keyRoutesGeneration) || (route->code != code) || (route->how != how)) {
+    route->connection = whoGetsKey(tty, code, how);
+    route->code = code;
+    route->how = how;
+    route->generation = keyRoutesGeneration;
+  }
+
+  return route->connection;
+}
+
 /* Temporary function, until we implement proper generic support for variables.
  */
 static void broadcastKey(Tty *tty, brlapi_keyCode_t code, unsigned int how) {
@@ -2616,8 +3698,8 @@ static void broadcastKey(Tty *tty, brlapi_keyCode_t code, unsigned int how) {
   Tty *t;
   for (c=tty->connections->next; c!=tty->connections; c = c->next) {
     asyncLockMutex(&c->acceptedKeysMutex);
-    if ((c->how==how) && (inKeyrangeList(c->acceptedKeys,code) != NULL))
-      writeKey(c->fd,code);
+    if ((c->how==how) && (inKeyrangeIndex(&c->acceptedKeysIndex,c->acceptedKeys,code) != NULL))
+      sendKey(c,code);
     asyncUnlockMutex(&c->acceptedKeysMutex);
   }
   for (t = tty->subttys; t; t = t->next)
@@ -2633,9 +3715,9 @@ static int api__handleKeyEvent(brlapi_keyCode_t clientCode) {
     offline = 0;
   }
   /* somebody gets the raw code */
-  if ((c = whoGetsKey(&ttys,clientCode,BRL_KEYCODES))) {
+  if ((c = routeKey(&ttys,clientCode,BRL_KEYCODES))) {
     logMessage(LOG_CATEGORY(SERVER_EVENTS), "transmitting accepted key %016"BRLAPI_PRIxKEYCODE, clientCode);
-    writeKey(c->fd,clientCode);
+    sendKey(c,clientCode);
     return 1;
   }
   return 0;
@@ -2674,9 +3756,10 @@ static int api__handleCommand(int command) {
     clientCode = cmdBrlttyToBrlapi(command, retainDots);
     logMessage(LOG_CATEGORY(SERVER_EVENTS), "API got command %08x, thus client code %016"BRLAPI_PRIxKEYCODE, command, clientCode);
     /* nobody needs the raw code */
-    if ((c = whoGetsKey(&ttys,clientCode,BRL_COMMANDS))) {
+    if ((c = routeKey(&ttys,clientCode,BRL_COMMANDS))) {
+      clientCode = getContractedKey(c, clientCode);
       logMessage(LOG_CATEGORY(SERVER_EVENTS), "transmitting accepted command %lx as client code %016"BRLAPI_PRIxKEYCODE,(unsigned long)command, clientCode);
-      writeKey(c->fd,clientCode);
+      sendKey(c,clientCode);
       return EOF;
     }
   }
@@ -2765,9 +3848,12 @@ int api_flush(BrailleDisplay *brl) {
     if (c->brlbufstate==TODISPLAY) {
       unsigned char *oldbuf = disp->buffer, buf[displaySize];
       disp->buffer = buf;
+      if (c->contraction.text) applyContraction(c);
       getDots(&c->brailleWindow, buf);
       brl->cursor = c->brailleWindow.cursor-1;
       ok = trueBraille->writeWindow(brl, c->brailleWindow.text);
+      c->framePending = 0;
+      c->framesWritten++;
       drain = 1;
       disp->buffer = oldbuf;
     }
@@ -2792,25 +3878,71 @@ int api_flush(BrailleDisplay *brl) {
       asyncUnlockMutex(&apiRawMutex);
       goto out;
     }
+    if (!offline && !rawConnection && driverConstructed) {
+      /* Show the core's output again, e.g. once the last client has left */
+      unsigned char *oldbuf = disp->buffer;
+      disp->buffer = coreWindowDots;
+      brl->cursor = coreWindowCursor;
+      ok = trueBraille->writeWindow(brl, coreWindowText);
+      disp->buffer = oldbuf;
+    }
     asyncUnlockMutex(&apiDriverMutex);
   }
   if (!ok) {
     asyncUnlockMutex(&apiRawMutex);
     goto out;
   }
-  if (drain)
-    drainBrailleOutput(brl, 0);
+  if (drain) {
+    /* Don't wait for the device here: later frames are merged until then */
+    getMonotonicTime(&flushTime);
+    adjustTimeValue(&flushTime, brl->writeDelay + 1);
+    brl->writeDelay = 0;
+  }
   asyncUnlockMutex(&apiRawMutex);
 out:
   asyncUnlockMutex(&apiConnectionsMutex);
   return ok;
 }
 
+ASYNC_ALARM_CALLBACK(handleServerFlushAlarm) {
+  BrailleDisplay *brl = parameters->data;
+
+  asyncDiscardHandle(flushAlarm);
+  flushAlarm = NULL;
+  api_flush(brl);
+}
+
+/* Sends the latest frame at most once per device-ready interval */
 ASYNC_EVENT_CALLBACK(handleServerFlushEvent) {
   BrailleDisplay *brl = parameters->eventData;
+  TimeValue now;
+
+  asyncLockMutex(&apiFlushMutex);
+  flushRequested = 0;
+  asyncUnlockMutex(&apiFlushMutex);
+
+  if (flushAlarm) return;
+  getMonotonicTime(&now);
+
+  if (compareTimeValues(&now, &flushTime) < 0) {
+    if (asyncSetAlarmTo(&flushAlarm, &flushTime, handleServerFlushAlarm, brl)) return;
+  }
+
   api_flush(brl);
 }
 
+/* Only one flush event is outstanding at a time */
+static void requestFlush(void)
+{
+  int request;
+
+  asyncLockMutex(&apiFlushMutex);
+  if ((request = !flushRequested)) flushRequested = 1;
+  asyncUnlockMutex(&apiFlushMutex);
+
+  if (request) asyncSignalEvent(flushEvent, NULL);
+}
+
 int api_resume(BrailleDisplay *brl) {
   /* core is resuming or opening the device for the first time, let's try to go
    * to normal state */
@@ -2840,7 +3972,7 @@ void api_releaseDriver(BrailleDisplay *brl)
 void api_suspend(BrailleDisplay *brl) {
   /* core is suspending, going to core suspend state */
   coreActive = 0;
-  asyncSignalEvent(flushEvent, NULL);
+  requestFlush();
 }
 
 static void brlResize(BrailleDisplay *brl)
@@ -2995,6 +4127,7 @@ int api_start(BrailleDisplay *brl, char **parameters)
   pthread_mutex_init(&apiDriverMutex,&mattr);
   pthread_mutex_init(&apiRawMutex,&mattr);
   pthread_mutex_init(&apiSuspendMutex,&mattr);
+  pthread_mutex_init(&apiFlushMutex,&mattr);
 
   pthread_attr_init(&attr);
   pthread_attr_setstacksize(&attr,stackSize);
@@ -3004,6 +4137,8 @@ int api_start(BrailleDisplay *brl, char **parameters)
 #endif /* __MINGW32__ */
 
   if (!(flushEvent = asyncNewEvent(handleServerFlushEvent, brl))) goto noFlushEvent;
+  flushRequested = 0;
+  getMonotonicTime(&flushTime);
 
 #ifndef __MINGW32__
   initializeBlockedSignalsMask();
@@ -205,6 +205,11 @@ typedef enum {
   BRL_CMD_CLIP_SAVE /* save clipboard to disk */,
   BRL_CMD_CLIP_RESTORE /* restore clipboard from disk */,
 
+  BRL_CMD_HIST_PREV /* go back one screen into the scrollback history */,
+  BRL_CMD_HIST_NEXT /* go forward one screen through the scrollback history */,
+  BRL_CMD_HIST_TOP /* go to oldest line of the scrollback history */,
+  BRL_CMD_HIST_BOT /* go back to the live screen from the scrollback history */,
+
   BRL_driverCommandCount /* must be last */
 } BRL_DriverCommand;
 
@@ -0,0 +1,145 @@
+/*
+ * BRLTTY - A background process providing access to the console screen (when in
+ *          text mode) for a blind person using a refreshable braille display.
+ *
+ * Copyright (C) 1995-2014 by The BRLTTY Developers.
+ *
+ * BRLTTY comes with ABSOLUTELY NO WARRANTY.
+ *
+ * This is free software, placed under the terms of the
+ * GNU General Public License, as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any
+ * later version. Please see the file LICENSE-GPL for details.
+ *
+ * Web Page: http://mielke.cc/brltty/
+ *
+ * This software is maintained by Dave Mielke <dave@mielke.cc>.
+ */
+
+/* brlemu.c - Emulate a braille display on a pseudo-terminal
+ *
+ * The device side of a braille display protocol is emulated (see
+ * brl_emulator.c) on the master side of a pty so that an unmodified driver
+ * can be run against the slave (serial:/dev/pts/N). Key events are injected
+ * at a fixed interval and the resulting cell updates are timed in order to
+ * benchmark the whole path.
+ */
+
+#include "prologue.h"
+
+#include <stdio.h>
+
+#include "program.h"
+#include "options.h"
+#include "log.h"
+#include "parse.h"
+#include "brl_emulator.h"
+
+static char *opt_protocolName;
+static char *opt_cellCount;
+static char *opt_keyInterval;
+static char *opt_benchmarkDuration;
+static char *opt_linkPath;
+
+BEGIN_OPTION_TABLE(programOptions)
+  { .letter = 'p',
+    .word = "protocol",
+    .argument = "protocol",
+    .setting.string = &opt_protocolName,
+    .defaultSetting = "baum",
+    .description = "Braille display protocol to emulate (baum, handytech)."
+  },
+
+  { .letter = 'c',
+    .word = "cells",
+    .argument = "count",
+    .setting.string = &opt_cellCount,
+    .defaultSetting = "40",
+    .description = "Number of text cells."
+  },
+
+  { .letter = 'k',
+    .word = "key-interval",
+    .argument = "milliseconds",
+    .setting.string = &opt_keyInterval,
+    .defaultSetting = "1000",
+    .description = "Time between injected key events (0 for none)."
+  },
+
+  { .letter = 't',
+    .word = "duration",
+    .argument = "seconds",
+    .setting.string = &opt_benchmarkDuration,
+    .defaultSetting = "10",
+    .description = "How long to run the benchmark (0 for forever)."
+  },
+
+  { .letter = 'l',
+    .word = "link",
+    .argument = "path",
+    .setting.string = &opt_linkPath,
+    .description = "Symbolic link to create for the slave side of the pty."
+  },
+END_OPTION_TABLE
+
+int
+main (int argc, char *argv[]) {
+  const EmulatorProtocol *protocol;
+  Emulator emu;
+  int cellCount = 40;
+  int keyInterval = 0;
+  int duration = 0;
+
+  {
+    static const OptionsDescriptor descriptor = {
+      OPTION_TABLE(programOptions),
+      .applicationName = "brlemu"
+    };
+    PROCESS_OPTIONS(descriptor, argc, argv);
+  }
+
+  if (argc) {
+    logMessage(LOG_ERR, "too many parameters");
+    return PROG_EXIT_SYNTAX;
+  }
+
+  if (!(protocol = getEmulatorProtocol(opt_protocolName))) return PROG_EXIT_SYNTAX;
+
+  {
+    static const int minimum = 1;
+    static const int maximum = 0XFF;
+
+    if (!validateInteger(&cellCount, opt_cellCount, &minimum, &maximum)) {
+      logMessage(LOG_ERR, "invalid cell count: %s", opt_cellCount);
+      return PROG_EXIT_SYNTAX;
+    }
+  }
+
+  {
+    static const int minimum = 0;
+
+    if (!validateInteger(&keyInterval, opt_keyInterval, &minimum, NULL)) {
+      logMessage(LOG_ERR, "invalid key interval: %s", opt_keyInterval);
+      return PROG_EXIT_SYNTAX;
+    }
+
+    if (!validateInteger(&duration, opt_benchmarkDuration, &minimum, NULL)) {
+      logMessage(LOG_ERR, "invalid duration: %s", opt_benchmarkDuration);
+      return PROG_EXIT_SYNTAX;
+    }
+  }
+
+  if (!openEmulator(&emu, protocol, cellCount, opt_linkPath)) return PROG_EXIT_FATAL;
+  printf("%s protocol on serial:%s\n", protocol->name, emu.slavePath);
+  fflush(stdout);
+
+  {
+    int ok = runEmulator(&emu, keyInterval, duration);
+
+    showEmulatorResults(&emu);
+    closeEmulator(&emu);
+    if (!ok) return PROG_EXIT_FATAL;
+  }
+
+  return PROG_EXIT_SUCCESS;
+}
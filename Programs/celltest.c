@@ -0,0 +1,252 @@
+/*
+ * BRLTTY - A background process providing access to the console screen (when in
+ *          text mode) for a blind person using a refreshable braille display.
+ *
+ * Copyright (C) 1995-2014 by The BRLTTY Developers.
+ *
+ * BRLTTY comes with ABSOLUTELY NO WARRANTY.
+ *
+ * This is free software, placed under the terms of the
+ * GNU General Public License, as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any
+ * later version. Please see the file LICENSE-GPL for details.
+ *
+ * Web Page: http://mielke.cc/brltty/
+ *
+ * This software is maintained by Dave Mielke <dave@mielke.cc>.
+ */
+
+/* celltest.c - Check the segments which cellSegmentsHaveChanged reports
+ *
+ * Each case changes some cells of an otherwise blank display and lists the
+ * [from,to) segments which are expected back for a given gap and limit.
+ */
+
+#include "prologue.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "program.h"
+#include "options.h"
+#include "log.h"
+#include "brl.h"
+
+BEGIN_OPTION_TABLE(programOptions)
+END_OPTION_TABLE
+
+#define CELL_COUNT 40
+#define SEGMENT_LIMIT 8
+#define CHANGE_LIMIT 8
+
+typedef struct {
+  const char *name;
+  unsigned int limit;
+  unsigned int gap;
+  unsigned char force;
+
+  unsigned int changes[CHANGE_LIMIT];
+  unsigned int changeCount;
+
+  CellSegment segments[SEGMENT_LIMIT];
+  unsigned int segmentCount;
+} TestCase;
+
+#define CHANGES(...) .changes = {__VA_ARGS__}, \
+  .changeCount = ARRAY_COUNT(((const unsigned int []){__VA_ARGS__}))
+#define SEGMENTS(...) .segments = {__VA_ARGS__}, \
+  .segmentCount = ARRAY_COUNT(((const CellSegment []){__VA_ARGS__}))
+
+static const TestCase testCases[] = {
+  { .name = "unchanged",
+    .limit = 4, .gap = 10,
+    .changeCount = 0,
+    .segmentCount = 0
+  },
+
+  { .name = "forced",
+    .limit = 4, .gap = 10, .force = 1,
+    .changeCount = 0,
+    SEGMENTS({0, CELL_COUNT})
+  },
+
+  { .name = "first cell",
+    .limit = 4, .gap = 10,
+    CHANGES(0),
+    SEGMENTS({0, 1})
+  },
+
+  { .name = "last cell",
+    .limit = 4, .gap = CELL_COUNT,
+    CHANGES(CELL_COUNT-1),
+    SEGMENTS({CELL_COUNT-1, CELL_COUNT})
+  },
+
+  { .name = "both edges",
+    .limit = 4, .gap = 10,
+    CHANGES(0, CELL_COUNT-1),
+    SEGMENTS({0, 1}, {CELL_COUNT-1, CELL_COUNT})
+  },
+
+  { .name = "every cell",
+    .limit = 4, .gap = 0,
+    CHANGES(0, 1, 2, 3, 4, 5, 6, 7),
+    SEGMENTS({0, 8})
+  },
+
+  { .name = "gap within threshold",
+    .limit = 4, .gap = 2,
+    CHANGES(10, 13),
+    SEGMENTS({10, 14})
+  },
+
+  { .name = "gap beyond threshold",
+    .limit = 4, .gap = 1,
+    CHANGES(10, 13),
+    SEGMENTS({10, 11}, {13, 14})
+  },
+
+  { .name = "no gap",
+    .limit = 4, .gap = 0,
+    CHANGES(10, 12),
+    SEGMENTS({10, 11}, {12, 13})
+  },
+
+  { .name = "trailing unchanged cells",
+    .limit = 4, .gap = 10,
+    CHANGES(CELL_COUNT-5),
+    SEGMENTS({CELL_COUNT-5, CELL_COUNT-4})
+  },
+
+  { .name = "single segment",
+    .limit = 1, .gap = 0,
+    CHANGES(3, 20, 37),
+    SEGMENTS({3, 38})
+  },
+
+  { .name = "shortest gaps merged",
+    .limit = 3, .gap = 0,
+    CHANGES(0, 5, 7, 20, 30),
+    SEGMENTS({0, 8}, {20, 21}, {30, 31})
+  },
+
+  { .name = "last gap merged",
+    .limit = 2, .gap = 0,
+    CHANGES(0, 20, 22),
+    SEGMENTS({0, 1}, {20, 23})
+  },
+
+  { .name = "limit reached exactly",
+    .limit = 3, .gap = 0,
+    CHANGES(0, 20, CELL_COUNT-1),
+    SEGMENTS({0, 1}, {20, 21}, {CELL_COUNT-1, CELL_COUNT})
+  },
+};
+
+static void
+logSegments (const char *label, const CellSegment *segments, unsigned int count) {
+  char buffer[0X100];
+  size_t length = 0;
+  unsigned int index;
+
+  buffer[0] = 0;
+
+  for (index=0; index<count; index+=1) {
+    int written = snprintf(&buffer[length], sizeof(buffer)-length, " [%u,%u)",
+                           segments[index].from, segments[index].to);
+
+    if ((written < 0) || (written >= (sizeof(buffer) - length))) break;
+    length += written;
+  }
+
+  logMessage(LOG_WARNING, "  %s:%s", label, (count? buffer: " none"));
+}
+
+static int
+runTestCase (const TestCase *test) {
+  unsigned char cells[CELL_COUNT];
+  unsigned char new[CELL_COUNT];
+  CellSegment segments[SEGMENT_LIMIT];
+  int force = test->force;
+  unsigned int total;
+  int ok = 1;
+
+  memset(cells, 0, sizeof(cells));
+  memset(new, 0, sizeof(new));
+
+  {
+    unsigned int index;
+
+    for (index=0; index<test->changeCount; index+=1) {
+      new[test->changes[index]] = 0XFF;
+    }
+  }
+
+  total = cellSegmentsHaveChanged(cells, new, CELL_COUNT,
+                                  segments, test->limit, test->gap,
+                                  (test->force? &force: NULL));
+
+  if ((total != test->segmentCount) ||
+      (memcmp(segments, test->segments, (total * sizeof(*segments))) != 0)) {
+    logMessage(LOG_WARNING, "%s: wrong segments", test->name);
+    logSegments("expected", test->segments, test->segmentCount);
+    logSegments("reported", segments, total);
+    ok = 0;
+  }
+
+  if (memcmp(cells, new, sizeof(cells)) != 0) {
+    logMessage(LOG_WARNING, "%s: cells not updated", test->name);
+    ok = 0;
+  }
+
+  if (force) {
+    logMessage(LOG_WARNING, "%s: force not reset", test->name);
+    ok = 0;
+  }
+
+  if (total) {
+    /* once updated, the same cells mustn't be reported again */
+    if (cellSegmentsHaveChanged(cells, new, CELL_COUNT,
+                                segments, test->limit, test->gap, NULL)) {
+      logMessage(LOG_WARNING, "%s: change reported twice", test->name);
+      ok = 0;
+    }
+  }
+
+  return ok;
+}
+
+int
+main (int argc, char *argv[]) {
+  unsigned int failures = 0;
+
+  {
+    static const OptionsDescriptor descriptor = {
+      OPTION_TABLE(programOptions),
+      .applicationName = "celltest"
+    };
+    PROCESS_OPTIONS(descriptor, argc, argv);
+  }
+
+  if (argc) {
+    logMessage(LOG_ERR, "too many parameters");
+    return PROG_EXIT_SYNTAX;
+  }
+
+  {
+    unsigned int index;
+
+    for (index=0; index<ARRAY_COUNT(testCases); index+=1) {
+      if (!runTestCase(&testCases[index])) failures += 1;
+    }
+  }
+
+  if (failures) {
+    logMessage(LOG_ERR, "%u of %u cell segment tests failed",
+               failures, (unsigned int)ARRAY_COUNT(testCases));
+    return PROG_EXIT_FATAL;
+  }
+
+  printf("%u cell segment tests passed\n", (unsigned int)ARRAY_COUNT(testCases));
+  return PROG_EXIT_SUCCESS;
+}
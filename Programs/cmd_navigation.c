@@ -590,6 +590,17 @@ handleNavigationCommand (int command, void *datga) {
             }
             line += increment;
           }
+
+          if (!found) {
+            int column;
+            int row;
+
+            if (searchScreenHistory(characters, count, (increment < 0), &column, &row)) {
+              ses->winy = MIN(row, (int)(scr.rows - brl.textRows));
+              ses->winx = column / textCount * textCount;
+              found = 1;
+            }
+          }
         }
 
         if (!found) playTune(&tune_bounce);
@@ -30,6 +30,7 @@
 #include "ktbdefs.h"
 #include "scr.h"
 #include "brltty.h"
+#include "brl_thread.h"
 
 #define LOG_LEVEL LOG_DEBUG
 
@@ -222,6 +223,10 @@ cancelCommandAlarm (void) {
 
 int
 enqueueCommand (int command) {
+  if (isBrailleDriverThread()) {
+    return brailleMessage_command(command);
+  }
+
   if (command != EOF) {
     Queue *queue = getCommandQueue(1);
 
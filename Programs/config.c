@@ -57,6 +57,7 @@
 #include "service.h"
 #include "options.h"
 #include "brl_input.h"
+#include "brl_thread.h"
 #include "cmd_queue.h"
 #include "brltty.h"
 #include "api_control.h"
@@ -66,6 +67,7 @@
 #include "io_serial.h"
 #include "io_usb.h"
 #include "io_bluetooth.h"
+#include "timing.h"
 
 #ifdef __MINGW32__
 int isWindowsService = 0;
@@ -75,6 +77,13 @@ int isWindowsService = 0;
 #include "system_msdos.h"
 #endif /* __MSDOS__ */
 
+#if !defined(__MINGW32__) && !defined(__MSDOS__) && !defined(GRUB_RUNTIME)
+#define PROBE_BRAILLE_DEVICES_CONCURRENTLY
+#include <signal.h>
+#include <poll.h>
+#include <sys/wait.h>
+#endif /* concurrent braille device probing */
+
 #define SERVICE_NAME "BrlAPI"
 #define SERVICE_DESCRIPTION "Braille API (BrlAPI)"
 
@@ -114,7 +123,11 @@ static char *opt_writableDirectory;
 static char *opt_driversDirectory;
 
 static char *opt_brailleDevice;
+#ifdef PROBE_BRAILLE_DEVICES_CONCURRENTLY
+static char *opt_probeBrailleDevice;
+#endif /* PROBE_BRAILLE_DEVICES_CONCURRENTLY */
 int opt_releaseDevice;
+static int opt_brailleThread;
 static char **brailleDevices = NULL;
 static const char *brailleDevice = NULL;
 static int brailleConstructed;
@@ -318,6 +331,16 @@ BEGIN_OPTION_TABLE(programOptions)
     .description = strtext("Path to device for accessing braille display.")
   },
 
+#ifdef PROBE_BRAILLE_DEVICES_CONCURRENTLY
+  { .letter = 'Z',
+    .word = "probe-braille-device",
+    .flags = OPT_Hidden,
+    .argument = strtext("device"),
+    .setting.string = &opt_probeBrailleDevice,
+    .description = strtext("Write the code of the braille driver which recognizes a device, and then exit.")
+  },
+#endif /* PROBE_BRAILLE_DEVICES_CONCURRENTLY */
+
   { .letter = 'r',
     .word = "release-device",
     .flags = OPT_Hidden | OPT_Config | OPT_Environ,
@@ -330,6 +353,14 @@ BEGIN_OPTION_TABLE(programOptions)
     .description = strtext("Release braille device when screen or window is unreadable.")
   },
 
+  { .letter = 'u',
+    .word = "braille-thread",
+    .flags = OPT_Hidden | OPT_Config | OPT_Environ,
+    .setting.flag = &opt_brailleThread,
+    .defaultSetting = FLAG_FALSE_WORD,
+    .description = strtext("Run the braille driver on its own thread.")
+  },
+
   { .letter = 'T',
     .word = "tables-directory",
     .flags = OPT_Hidden | OPT_Config | OPT_Environ,
@@ -981,6 +1012,7 @@ initializeBraille (void) {
 int
 constructBrailleDriver (void) {
   initializeBraille();
+  if (opt_brailleThread) linkBrailleDriverThread();
 
   if (braille->construct(&brl, brailleParameters, brailleDevice)) {
     if (ensureBrailleBuffer(&brl, LOG_INFO)) {
@@ -1070,6 +1102,7 @@ constructBrailleDriver (void) {
                braille->definition.code, brailleDevice);
   }
 
+  unlinkBrailleDriverThread();
   return 0;
 }
 
@@ -1080,6 +1113,7 @@ destructBrailleDriver (void) {
 
   brailleConstructed = 0;
   braille->destruct(&brl);
+  unlinkBrailleDriverThread();
   disableHelpPage(brailleHelpPageNumber);
 
   if (brl.keyTable) {
@@ -1154,6 +1188,400 @@ initializeBrailleDriver (const char *code, int verify) {
   return 0;
 }
 
+static const char *const *
+getAutodetectableBrailleDrivers (const char *device) {
+  const char *const *autodetectableDrivers;
+
+  if (isSerialDevice(&device)) {
+    static const char *const serialDrivers[] = {
+      "md", "pm", "ts", "ht", "bn", "al", "bm", "pg", "sk",
+      NULL
+    };
+    autodetectableDrivers = serialDrivers;
+  } else if (isUsbDevice(&device)) {
+    static const char *const usbDrivers[] = {
+      "al", "bm", "eu", "fs", "ht", "hm", "hw", "mt", "pg", "pm", "sk", "vo",
+      NULL
+    };
+    autodetectableDrivers = usbDrivers;
+  } else if (isBluetoothDevice(&device)) {
+    if (!(autodetectableDrivers = bthGetDriverCodes(device, BLUETOOTH_DEVICE_NAME_OBTAIN_TIMEOUT))) {
+      static const char *bluetoothDrivers[] = {
+        "np", "ht", "al", "bm",
+        NULL
+      };
+      autodetectableDrivers = bluetoothDrivers;
+    }
+  } else {
+    static const char *noDrivers[] = {NULL};
+    autodetectableDrivers = noDrivers;
+  }
+
+  return autodetectableDrivers;
+}
+
+static int
+activateBrailleDevice (
+  const char *device, const char *const *drivers,
+  int (*initializeDriver) (const char *code, int verify),
+  int verify
+) {
+  brailleDevice = device;
+  logMessage(LOG_DEBUG, "checking braille device: %s", brailleDevice);
+
+  {
+    const DriverActivationData data = {
+      .driverType = "braille",
+      .requestedDrivers = drivers,
+      .autodetectableDrivers = getAutodetectableBrailleDrivers(brailleDevice),
+      .getDefaultDriver = getDefaultBrailleDriver,
+      .haveDriver = haveBrailleDriver,
+      .initializeDriver = initializeDriver
+    };
+
+    return activateDriver(&data, verify);
+  }
+}
+
+#ifdef PROBE_BRAILLE_DEVICES_CONCURRENTLY
+typedef enum {
+  BRAILLE_PROBE_PENDING,
+  BRAILLE_PROBE_FOUND,
+  BRAILLE_PROBE_FAILED
+} BrailleProbeState;
+
+typedef struct {
+  pid_t process;
+  int descriptor;
+  BrailleProbeState state;
+  char driver[0X10];
+} BrailleDeviceProbe;
+
+static int
+probeBrailleDriver (const char *code, int verify) {
+  if ((braille = loadBrailleDriver(code, &brailleObject, opt_driversDirectory))) {
+    if ((brailleParameters = getParameters(braille->parameters,
+                                           braille->definition.code,
+                                           opt_brailleParameters))) {
+      int found = 0;
+
+      logMessage(LOG_DEBUG, "probing braille driver: %s -> %s",
+                 braille->definition.code, brailleDevice);
+
+      initializeBraille();
+
+      if (braille->construct(&brl, brailleParameters, brailleDevice)) {
+        braille->destruct(&brl);
+        found = 1;
+      }
+
+      deallocateStrings(brailleParameters);
+      brailleParameters = NULL;
+
+      if (found) return 1;
+    }
+
+    unloadDriverObject(&brailleObject);
+  } else {
+    logMessage(LOG_ERR, "%s: %s", gettext("braille driver not loadable"), code);
+  }
+
+  braille = &noBraille;
+  return 0;
+}
+
+/* Run, instead of the rest of brltty, by the hidden probe-braille-device
+ * option: the code of the driver which recognizes the device is written to
+ * standard output.
+ */
+static ProgramExitStatus
+runBrailleDeviceProbe (const char *device) {
+  /* the main process cancels a probe which is no longer needed */
+  {
+    sigset_t mask;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    sigprocmask(SIG_UNBLOCK, &mask, NULL);
+    signal(SIGTERM, SIG_DFL);
+  }
+
+  pushLogPrefix(device);
+  changeBrailleDriver(opt_brailleDriver);
+
+  if (activateBrailleDevice(device, (const char *const *)brailleDrivers, probeBrailleDriver, 0)) {
+    printf("%s", braille->definition.code);
+    fflush(stdout);
+  }
+
+  return PROG_EXIT_FORCE;
+}
+
+static char *
+getBrailleDriverList (void) {
+  unsigned int count = 0;
+
+  while (brailleDrivers[count]) count += 1;
+
+  {
+    const char *strings[(count * 2) + 1];
+    unsigned int length = 0;
+    unsigned int index;
+
+    for (index=0; index<count; index+=1) {
+      if (index) strings[length++] = ",";
+      strings[length++] = brailleDrivers[index];
+    }
+
+    if (!length) strings[length++] = "";
+    return joinStrings(strings, length);
+  }
+}
+
+static int
+startBrailleDeviceProbe (BrailleDeviceProbe *probe, const char *device, const char *drivers) {
+  /* The probe is a new instance of brltty so that nothing the main process
+   * has going (alarms, input monitors, threads, held locks) is copied into it.
+   */
+  const char *arguments[0X20];
+  unsigned int count = 0;
+  long int descriptorLimit = sysconf(_SC_OPEN_MAX);
+  int fds[2];
+
+  arguments[count++] = programPath;
+  arguments[count++] = "-Z";
+  arguments[count++] = device;
+  arguments[count++] = "-b";
+  arguments[count++] = drivers;
+  arguments[count++] = "-f";
+  arguments[count++] = "/dev/null";
+
+  {
+    /* a setting which hasn't been given is left to its default */
+    const struct {
+      const char *option;
+      const char *value;
+    } settings[] = {
+      { .option = "-B", .value = opt_brailleParameters },
+      { .option = "-D", .value = opt_driversDirectory },
+      { .option = "-l", .value = opt_logLevel },
+    };
+    unsigned int index;
+
+    for (index=0; index<ARRAY_COUNT(settings); index+=1) {
+      const char *value = settings[index].value;
+
+      if (value && *value) {
+        arguments[count++] = settings[index].option;
+        arguments[count++] = value;
+      }
+    }
+  }
+
+  if (opt_standardError) arguments[count++] = "-e";
+  arguments[count] = NULL;
+
+  if (pipe(fds) == -1) {
+    logSystemError("pipe");
+    return 0;
+  }
+
+  fflush(stdout);
+  fflush(stderr);
+
+  if ((probe->process = fork()) == -1) {
+    logSystemError("fork");
+    close(fds[0]);
+    close(fds[1]);
+    return 0;
+  }
+
+  if (!probe->process) {
+    /* only async-signal-safe calls until the exec */
+    if (dup2(fds[1], STDOUT_FILENO) != -1) {
+      int descriptor;
+
+      if (descriptorLimit < 0) descriptorLimit = 0X100;
+      for (descriptor=STDERR_FILENO+1; descriptor<descriptorLimit; descriptor+=1) close(descriptor);
+
+      execv(programPath, (char *const *)arguments);
+    }
+
+    _exit(PROG_EXIT_FATAL);
+  }
+
+  if (close(fds[1]) == -1) logSystemError("close");
+  probe->descriptor = fds[0];
+  probe->state = BRAILLE_PROBE_PENDING;
+  probe->driver[0] = 0;
+  return 1;
+}
+
+static void
+stopBrailleDeviceProbe (BrailleDeviceProbe *probe, int cancel) {
+  TimePeriod period;
+
+  if (cancel) {
+    logMessage(LOG_DEBUG, "cancelling braille device probe: %d", (int)probe->process);
+    if (kill(probe->process, SIGTERM) == -1) logSystemError("kill");
+    startTimePeriod(&period, BRAILLE_DEVICE_PROBE_CANCEL_TIMEOUT);
+  }
+
+  if (close(probe->descriptor) == -1) logSystemError("close");
+  probe->descriptor = -1;
+
+  while (1) {
+    pid_t process = waitpid(probe->process, NULL, (cancel? WNOHANG: 0));
+
+    if (process == probe->process) break;
+
+    if (process == -1) {
+      if (errno == EINTR) continue;
+      logSystemError("waitpid");
+      break;
+    }
+
+    /* it may not have got far enough to be terminated cleanly */
+    if (afterTimePeriod(&period, NULL)) {
+      if (kill(probe->process, SIGKILL) == -1) logSystemError("kill");
+      cancel = 0;
+      continue;
+    }
+
+    approximateDelay(10);
+  }
+
+  if (probe->state == BRAILLE_PROBE_PENDING) probe->state = BRAILLE_PROBE_FAILED;
+}
+
+static void
+finishBrailleDeviceProbe (BrailleDeviceProbe *probe) {
+  ssize_t count;
+
+  do {
+    count = read(probe->descriptor, probe->driver, sizeof(probe->driver)-1);
+  } while ((count == -1) && (errno == EINTR));
+
+  if (count > 0) {
+    probe->driver[count] = 0;
+    probe->state = BRAILLE_PROBE_FOUND;
+  } else if (count == -1) {
+    logSystemError("read");
+  }
+
+  stopBrailleDeviceProbe(probe, 0);
+}
+
+static int
+probeBrailleDevices (
+  const char *const *devices, unsigned int count,
+  unsigned int *index, char *driver, size_t size
+) {
+  BrailleDeviceProbe probes[count];
+  unsigned int started = 0;
+  int result = -1;
+  char *drivers;
+
+  if (!(drivers = getBrailleDriverList())) {
+    logMallocError();
+    return -1;
+  }
+
+  logMessage(LOG_DEBUG, "probing %u braille devices concurrently", count);
+
+  while (started < count) {
+    if (!startBrailleDeviceProbe(&probes[started], devices[started], drivers)) break;
+    started += 1;
+  }
+
+  free(drivers);
+
+  if (started == count) {
+    TimePeriod period;
+
+    startTimePeriod(&period, BRAILLE_DEVICE_PROBE_TIMEOUT);
+
+    while (1) {
+      struct pollfd descriptors[count];
+      BrailleDeviceProbe *pending[count];
+      unsigned int pendingCount = 0;
+      long int elapsed;
+
+      {
+        BrailleDeviceProbe *probe = probes;
+        const BrailleDeviceProbe *end = probe + count;
+
+        while ((probe < end) && (probe->state == BRAILLE_PROBE_FAILED)) probe += 1;
+
+        if (probe == end) {
+          result = 0;
+          break;
+        }
+
+        if (probe->state == BRAILLE_PROBE_FOUND) {
+          *index = probe - probes;
+          snprintf(driver, size, "%s", probe->driver);
+          result = 1;
+          break;
+        }
+
+        while (probe < end) {
+          if (probe->state == BRAILLE_PROBE_PENDING) {
+            struct pollfd *descriptor = &descriptors[pendingCount];
+
+            descriptor->fd = probe->descriptor;
+            descriptor->events = POLLIN;
+            descriptor->revents = 0;
+            pending[pendingCount++] = probe;
+          }
+
+          probe += 1;
+        }
+      }
+
+      if (afterTimePeriod(&period, &elapsed)) {
+        unsigned int i;
+
+        logMessage(LOG_WARNING, "braille device probe timed out");
+        for (i=0; i<pendingCount; i+=1) stopBrailleDeviceProbe(pending[i], 1);
+        continue;
+      }
+
+      if (poll(descriptors, pendingCount, BRAILLE_DEVICE_PROBE_TIMEOUT-elapsed) == -1) {
+        if (errno == EINTR) continue;
+        logSystemError("poll");
+        break;
+      }
+
+      {
+        unsigned int i;
+
+        for (i=0; i<pendingCount; i+=1) {
+          if (descriptors[i].revents) finishBrailleDeviceProbe(pending[i]);
+        }
+      }
+    }
+  }
+
+  {
+    unsigned int i;
+
+    for (i=0; i<started; i+=1) {
+      BrailleDeviceProbe *probe = &probes[i];
+
+      if (probe->state == BRAILLE_PROBE_PENDING) stopBrailleDeviceProbe(probe, 1);
+    }
+  }
+
+  if (result == 1) {
+    logMessage(LOG_DEBUG, "braille device probe succeeded: %s -> %s",
+               driver, devices[*index]);
+  }
+
+  return result;
+}
+#endif /* PROBE_BRAILLE_DEVICES_CONCURRENTLY */
+
 static int
 activateBrailleDriver (int verify) {
   int oneDevice = brailleDevices[0] && !brailleDevices[1];
@@ -1161,51 +1589,33 @@ activateBrailleDriver (int verify) {
 
   if (!oneDevice) verify = 0;
 
-  while (*device) {
-    const char *const *autodetectableDrivers;
+#ifdef PROBE_BRAILLE_DEVICES_CONCURRENTLY
+  if (!oneDevice && *device) {
+    unsigned int count = 0;
+    unsigned int index;
+    char driver[0X10];
+    int found;
 
-    brailleDevice = *device;
-    logMessage(LOG_DEBUG, "checking braille device: %s", brailleDevice);
+    while (device[count]) count += 1;
+    found = probeBrailleDevices(device, count, &index, driver, sizeof(driver));
 
-    {
-      const char *dev = brailleDevice;
-
-      if (isSerialDevice(&dev)) {
-        static const char *const serialDrivers[] = {
-          "md", "pm", "ts", "ht", "bn", "al", "bm", "pg", "sk",
-          NULL
-        };
-        autodetectableDrivers = serialDrivers;
-      } else if (isUsbDevice(&dev)) {
-        static const char *const usbDrivers[] = {
-          "al", "bm", "eu", "fs", "ht", "hm", "hw", "mt", "pg", "pm", "sk", "vo",
-          NULL
-        };
-        autodetectableDrivers = usbDrivers;
-      } else if (isBluetoothDevice(&dev)) {
-        if (!(autodetectableDrivers = bthGetDriverCodes(dev, BLUETOOTH_DEVICE_NAME_OBTAIN_TIMEOUT))) {
-          static const char *bluetoothDrivers[] = {
-            "np", "ht", "al", "bm",
-            NULL
-          };
-          autodetectableDrivers = bluetoothDrivers;
-        }
-      } else {
-        static const char *noDrivers[] = {NULL};
-        autodetectableDrivers = noDrivers;
-      }
+    if (found == 1) {
+      const char *const drivers[] = {driver, NULL};
+
+      if (activateBrailleDevice(device[index], drivers, initializeBrailleDriver, 0)) return 1;
     }
 
-    {
-      const DriverActivationData data = {
-        .driverType = "braille",
-        .requestedDrivers = (const char *const *)brailleDrivers,
-        .autodetectableDrivers = autodetectableDrivers,
-        .getDefaultDriver = getDefaultBrailleDriver,
-        .haveDriver = haveBrailleDriver,
-        .initializeDriver = initializeBrailleDriver
-      };
-      if (activateDriver(&data, verify)) return 1;
+    if (found != -1) {
+      brailleDevice = NULL;
+      return 0;
+    }
+  }
+#endif /* PROBE_BRAILLE_DEVICES_CONCURRENTLY */
+
+  while (*device) {
+    if (activateBrailleDevice(*device, (const char *const *)brailleDrivers,
+                              initializeBrailleDriver, verify)) {
+      return 1;
     }
 
     device += 1;
@@ -2005,6 +2415,10 @@ brlttyStart (int argc, char *argv[]) {
     closeSystemLog();
   }
 
+#ifdef PROBE_BRAILLE_DEVICES_CONCURRENTLY
+  if (*opt_probeBrailleDevice) return runBrailleDeviceProbe(opt_probeBrailleDevice);
+#endif /* PROBE_BRAILLE_DEVICES_CONCURRENTLY */
+
   {
     char banner[0X100];
     makeProgramBanner(banner, sizeof(banner));
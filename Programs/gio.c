@@ -23,6 +23,7 @@
 
 #include "log.h"
 #include "async_wait.h"
+#include "async_alarm.h"
 #include "io_generic.h"
 #include "gio_internal.h"
 #include "io_serial.h"
@@ -135,6 +136,11 @@ gioConnectResource (
       endpoint->input.from = 0;
       endpoint->input.to = 0;
 
+      endpoint->output.error = 0;
+      endpoint->output.queue = NULL;
+      endpoint->output.alarm = NULL;
+      memset(&endpoint->output.statistics, 0, sizeof(endpoint->output.statistics));
+
       endpoint->hidReportItems.address = NULL;
       endpoint->hidReportItems.size = 0;
 
@@ -179,17 +185,39 @@ gioConnectResource (
   return NULL;
 }
 
+static int flushOutput (GioEndpoint *endpoint);
+
 int
 gioDisconnectResource (GioEndpoint *endpoint) {
   int ok = 0;
   GioDisconnectResourceMethod *method = endpoint->methods->disconnectResource;
 
+  /* what's still queued (e.g. the last cell update) is written now */
+  if (!flushOutput(endpoint)) logSystemError("queued output");
+
   if (!method) {
     logUnsupportedOperation("disconnectResource");
   } else if (method(endpoint->handle)) {
     ok = 1;
   }
 
+  if (endpoint->output.alarm) asyncCancelRequest(endpoint->output.alarm);
+
+  if (endpoint->output.queue) {
+    const GioOutputStatistics *statistics = &endpoint->output.statistics;
+
+    logMessage(LOG_DEBUG, "output queue: %lu queued, %lu replaced, %u deepest",
+               statistics->queuedWrites, statistics->replacedWrites,
+               statistics->maximumDepth);
+
+    if (statistics->currentDepth) {
+      logMessage(LOG_WARNING, "queued output not written: %u writes",
+                 statistics->currentDepth);
+    }
+
+    deallocateQueue(endpoint->output.queue);
+  }
+
   if (endpoint->hidReportItems.address) free(endpoint->hidReportItems.address);
   free(endpoint);
   return ok;
@@ -214,8 +242,8 @@ gioGetResourceName (GioEndpoint *endpoint) {
   return name;
 }
 
-ssize_t
-gioWriteData (GioEndpoint *endpoint, const void *data, size_t size) {
+static ssize_t
+writeData (GioEndpoint *endpoint, const void *data, size_t size) {
   GioWriteDataMethod *method = endpoint->methods->writeData;
 
   if (!method) {
@@ -227,6 +255,188 @@ gioWriteData (GioEndpoint *endpoint, const void *data, size_t size) {
                 endpoint->options.outputTimeout);
 }
 
+typedef struct {
+  unsigned int tag;
+  size_t size;
+  void *data;
+} OutputItem;
+
+static void
+deallocateOutputItem (void *item, void *data) {
+  OutputItem *oi = item;
+
+  free(oi->data);
+  free(oi);
+}
+
+static int
+testOutputTag (const void *item, const void *data) {
+  const OutputItem *oi = item;
+  const unsigned int *tag = data;
+
+  return oi->tag == *tag;
+}
+
+static ASYNC_ALARM_CALLBACK(handleOutputAlarm);
+
+static int
+writeOutput (GioEndpoint *endpoint, const void *data, size_t size) {
+  if (writeData(endpoint, data, size) == -1) {
+    endpoint->output.error = errno;
+    return 0;
+  }
+
+  {
+    /* hold back whatever's queued until the line should be free again */
+    unsigned int delay = gioGetMillisecondsToTransfer(endpoint, size);
+
+    if (delay && !endpoint->output.alarm) {
+      asyncSetAlarmIn(&endpoint->output.alarm, delay, handleOutputAlarm, endpoint);
+    }
+  }
+
+  return 1;
+}
+
+static int
+writeQueuedOutput (GioEndpoint *endpoint) {
+  OutputItem *oi;
+
+  if (!endpoint->output.queue) return 1;
+  if (!(oi = dequeueItem(endpoint->output.queue))) return 1;
+  endpoint->output.statistics.currentDepth -= 1;
+
+  {
+    int written = writeOutput(endpoint, oi->data, oi->size);
+
+    deallocateOutputItem(oi, NULL);
+    return written;
+  }
+}
+
+static ASYNC_ALARM_CALLBACK(handleOutputAlarm) {
+  GioEndpoint *endpoint = parameters->data;
+
+  asyncDiscardHandle(endpoint->output.alarm);
+  endpoint->output.alarm = NULL;
+
+  if (!writeQueuedOutput(endpoint)) {
+    logMessage(LOG_WARNING, "queued output error: %s", strerror(endpoint->output.error));
+  }
+}
+
+static int
+flushOutput (GioEndpoint *endpoint) {
+  if (endpoint->output.error) {
+    errno = endpoint->output.error;
+    endpoint->output.error = 0;
+    return 0;
+  }
+
+  while (endpoint->output.statistics.currentDepth) {
+    if (!writeQueuedOutput(endpoint)) {
+      errno = endpoint->output.error;
+      endpoint->output.error = 0;
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+ssize_t
+gioWriteData (GioEndpoint *endpoint, const void *data, size_t size) {
+  if (!flushOutput(endpoint)) return -1;
+  return writeData(endpoint, data, size);
+}
+
+/* Returns size if the data has been written, and 0 if it's been held back
+ * until the endpoint is no longer busy.
+ */
+ssize_t
+gioQueueData (GioEndpoint *endpoint, const void *data, size_t size, unsigned int tag) {
+  if (endpoint->output.error) {
+    errno = endpoint->output.error;
+    endpoint->output.error = 0;
+    return -1;
+  }
+
+  if (!endpoint->output.alarm) {
+    if (!flushOutput(endpoint)) return -1;
+
+    if (!writeOutput(endpoint, data, size)) {
+      endpoint->output.error = 0;
+      return -1;
+    }
+
+    return size;
+  }
+
+  if (!endpoint->output.queue) {
+    if (!(endpoint->output.queue = newQueue(deallocateOutputItem, NULL))) return -1;
+  }
+
+  {
+    void *copy;
+
+    if (!(copy = malloc(size))) {
+      logMallocError();
+      return -1;
+    }
+
+    memcpy(copy, data, size);
+
+    if (tag) {
+      OutputItem *oi = findItem(endpoint->output.queue, testOutputTag, &tag);
+
+      if (oi) {
+        free(oi->data);
+        oi->data = copy;
+        oi->size = size;
+
+        endpoint->output.statistics.replacedWrites += 1;
+        return 0;
+      }
+    }
+
+    {
+      OutputItem *oi;
+
+      if ((oi = malloc(sizeof(*oi)))) {
+        oi->tag = tag;
+        oi->size = size;
+        oi->data = copy;
+
+        if (enqueueItem(endpoint->output.queue, oi)) {
+          GioOutputStatistics *statistics = &endpoint->output.statistics;
+
+          statistics->queuedWrites += 1;
+          statistics->currentDepth += 1;
+
+          if (statistics->currentDepth > statistics->maximumDepth) {
+            statistics->maximumDepth = statistics->currentDepth;
+          }
+
+          return 0;
+        }
+
+        free(oi);
+      } else {
+        logMallocError();
+      }
+    }
+
+    free(copy);
+  }
+
+  return -1;
+}
+
+void
+gioGetOutputStatistics (GioEndpoint *endpoint, GioOutputStatistics *statistics) {
+  *statistics = endpoint->output.statistics;
+}
+
 int
 gioMonitorInput (GioEndpoint *endpoint, AsyncMonitorCallback *callback, void *data) {
   GioMonitorInputMethod *method = endpoint->methods->monitorInput;
@@ -254,6 +464,21 @@ gioAwaitInput (GioEndpoint *endpoint, int timeout) {
   return method(endpoint->handle, timeout);
 }
 
+static ssize_t
+readInput (GioEndpoint *endpoint, GioReadDataMethod *method, int wait) {
+  ssize_t result = method(endpoint->handle,
+                          &endpoint->input.buffer[endpoint->input.to],
+                          sizeof(endpoint->input.buffer) - endpoint->input.to,
+                          (wait? endpoint->options.inputTimeout: 0), 0);
+
+  if (result > 0) {
+    logBytes(LOG_CATEGORY(GENERIC_INPUT), NULL, &endpoint->input.buffer[endpoint->input.to], result);
+    endpoint->input.to += result;
+  }
+
+  return result;
+}
+
 ssize_t
 gioReadData (GioEndpoint *endpoint, void *buffer, size_t size, int wait) {
   GioReadDataMethod *method = endpoint->methods->readData;
@@ -292,14 +517,9 @@ gioReadData (GioEndpoint *endpoint, void *buffer, size_t size, int wait) {
       }
 
       {
-        ssize_t result = method(endpoint->handle,
-                                &endpoint->input.buffer[endpoint->input.to],
-                                sizeof(endpoint->input.buffer) - endpoint->input.to,
-                                (wait? endpoint->options.inputTimeout: 0), 0);
+        ssize_t result = readInput(endpoint, method, wait);
 
         if (result > 0) {
-          logBytes(LOG_CATEGORY(GENERIC_INPUT), NULL, &endpoint->input.buffer[endpoint->input.to], result);
-          endpoint->input.to += result;
           wait = 1;
         } else {
           if (!result) break;
@@ -314,6 +534,54 @@ gioReadData (GioEndpoint *endpoint, void *buffer, size_t size, int wait) {
   }
 }
 
+ssize_t
+gioPeekInput (GioEndpoint *endpoint, const unsigned char **bytes, int wait) {
+  GioReadDataMethod *method = endpoint->methods->readData;
+
+  if (!method) {
+    logUnsupportedOperation("readData");
+    return -1;
+  }
+
+  while (1) {
+    unsigned int count = endpoint->input.to - endpoint->input.from;
+
+    if (count) {
+      *bytes = &endpoint->input.buffer[endpoint->input.from];
+      return count;
+    }
+
+    endpoint->input.from = endpoint->input.to = 0;
+
+    if (endpoint->input.error) {
+      errno = endpoint->input.error;
+      endpoint->input.error = 0;
+      return -1;
+    }
+
+    {
+      ssize_t result = readInput(endpoint, method, wait);
+
+      if (result <= 0) {
+        if (!result) break;
+        if (errno == EAGAIN) break;
+        return -1;
+      }
+    }
+  }
+
+  errno = EAGAIN;
+  return 0;
+}
+
+void
+gioSkipInput (GioEndpoint *endpoint, size_t count) {
+  unsigned int available = endpoint->input.to - endpoint->input.from;
+
+  if (count > available) count = available;
+  endpoint->input.from += count;
+}
+
 int
 gioReadByte (GioEndpoint *endpoint, unsigned char *byte, int wait) {
   ssize_t result = gioReadData(endpoint, byte, 1, wait);
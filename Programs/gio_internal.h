@@ -19,6 +19,9 @@
 #ifndef BRLTTY_INCLUDED_GIO_INTERNAL
 #define BRLTTY_INCLUDED_GIO_INTERNAL
 
+#include "queue.h"
+#include "async.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif /* __cplusplus */
@@ -121,6 +124,13 @@ struct GioEndpointStruct {
     unsigned int to;
     unsigned char buffer[0X40];
   } input;
+
+  struct {
+    int error;
+    Queue *queue;
+    AsyncHandle alarm;
+    GioOutputStatistics statistics;
+  } output;
 };
 
 typedef int GioIsSupportedMethod (const GioDescriptor *descriptor);
@@ -0,0 +1,315 @@
+/*
+ * BRLTTY - A background process providing access to the console screen (when in
+ *          text mode) for a blind person using a refreshable braille display.
+ *
+ * Copyright (C) 1995-2014 by The BRLTTY Developers.
+ *
+ * BRLTTY comes with ABSOLUTELY NO WARRANTY.
+ *
+ * This is free software, placed under the terms of the
+ * GNU General Public License, as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any
+ * later version. Please see the file LICENSE-GPL for details.
+ *
+ * Web Page: http://mielke.cc/brltty/
+ *
+ * This software is maintained by Dave Mielke <dave@mielke.cc>.
+ */
+
+/* giotest.c - Check the generic I/O output queue against a slow device
+ *
+ * A serial endpoint is connected to the slave side of a pty whose master side
+ * is an emulated Baum display (see brl_emulator.c). The endpoint's bit rate
+ * is what paces queued output, so the emulator sees each cell update arrive
+ * when a real 9600 baud display would have been ready for it.
+ */
+
+#include "prologue.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "program.h"
+#include "options.h"
+#include "log.h"
+#include "timing.h"
+#include "async_wait.h"
+#include "ascii.h"
+#include "io_generic.h"
+#include "brl_emulator.h"
+
+BEGIN_OPTION_TABLE(programOptions)
+END_OPTION_TABLE
+
+#define CELL_COUNT 40
+#define FRAME_SIZE (2 + CELL_COUNT)
+#define SERIAL_BAUD 9600
+
+/* how much earlier than the transfer time a paced write may be seen */
+#define PACING_TOLERANCE 2
+
+typedef struct {
+  Emulator emulator;
+  GioEndpoint *endpoint;
+  unsigned int frameTime;
+} TestDevice;
+
+static int
+openTestDevice (TestDevice *device) {
+  const EmulatorProtocol *protocol = getEmulatorProtocol("baum");
+
+  if (protocol) {
+    if (openEmulator(&device->emulator, protocol, CELL_COUNT, NULL)) {
+      char identifier[0X100];
+      SerialParameters serial = SERIAL_PARAMETERS_INITIALIZER;
+      GioDescriptor descriptor;
+
+      snprintf(identifier, sizeof(identifier), "serial:%s", device->emulator.slavePath);
+      serial.baud = SERIAL_BAUD;
+
+      gioInitializeDescriptor(&descriptor);
+      descriptor.serial.parameters = &serial;
+
+      if ((device->endpoint = gioConnectResource(identifier, &descriptor))) {
+        device->frameTime = gioGetMillisecondsToTransfer(device->endpoint, FRAME_SIZE);
+        return 1;
+      }
+
+      closeEmulator(&device->emulator);
+    }
+  }
+
+  return 0;
+}
+
+static void
+closeTestDevice (TestDevice *device) {
+  if (device->endpoint) {
+    gioDisconnectResource(device->endpoint);
+    device->endpoint = NULL;
+  }
+
+  closeEmulator(&device->emulator);
+}
+
+static size_t
+makeFrame (unsigned char *frame, unsigned char value) {
+  /* a Baum DisplayData packet - the values are kept clear of ESC */
+  frame[0] = ESC;
+  frame[1] = 0X01;
+  memset(&frame[2], value, CELL_COUNT);
+  return FRAME_SIZE;
+}
+
+static ssize_t
+queueFrame (TestDevice *device, unsigned char value, unsigned int tag) {
+  unsigned char frame[FRAME_SIZE];
+  size_t size = makeFrame(frame, value);
+
+  return gioQueueData(device->endpoint, frame, size, tag);
+}
+
+static int
+settleTestDevice (TestDevice *device, long int duration) {
+  TimePeriod period;
+  startTimePeriod(&period, duration);
+
+  /* let the endpoint's alarms run, handling what arrives as soon as it does */
+  while (!afterTimePeriod(&period, NULL)) {
+    asyncWait(1);
+    if (!processEmulatorInput(&device->emulator, 0)) return 0;
+  }
+
+  return 1;
+}
+
+static int
+checkDisplay (const char *test, const TestDevice *device, unsigned char value) {
+  const Emulator *emu = &device->emulator;
+  unsigned char cells[CELL_COUNT];
+
+  memset(cells, value, sizeof(cells));
+
+  if ((emu->display.count == CELL_COUNT) &&
+      (memcmp(emu->display.cells, cells, CELL_COUNT) == 0)) {
+    return 1;
+  }
+
+  logMessage(LOG_WARNING, "%s: frame %u not shown", test, value);
+  return 0;
+}
+
+static int
+checkRefreshCount (const char *test, const TestDevice *device, unsigned long int expected) {
+  unsigned long int actual = getEmulatorRefreshCount(&device->emulator);
+
+  if (actual == expected) return 1;
+  logMessage(LOG_WARNING, "%s: %lu frames received (%lu expected)", test, actual, expected);
+  return 0;
+}
+
+static int
+checkQueueResult (const char *test, unsigned char value, ssize_t actual, ssize_t expected) {
+  if (actual == expected) return 1;
+
+  logMessage(LOG_WARNING, "%s: frame %u queue result %d (%d expected)",
+             test, value, (int)actual, (int)expected);
+  return 0;
+}
+
+static int
+testCoalescing (const char *test, TestDevice *device) {
+  static const unsigned char frameCount = 10;
+  GioOutputStatistics statistics;
+  unsigned char value;
+  int ok = 1;
+
+  /* the first frame goes out at once, and the rest replace one another */
+  for (value=1; value<=frameCount; value+=1) {
+    ssize_t expected = (value == 1)? FRAME_SIZE: 0;
+
+    if (!checkQueueResult(test, value, queueFrame(device, value, 1), expected)) ok = 0;
+  }
+
+  gioGetOutputStatistics(device->endpoint, &statistics);
+
+  if ((statistics.queuedWrites != 1) || (statistics.replacedWrites != (frameCount - 2)) ||
+      (statistics.currentDepth != 1)) {
+    logMessage(LOG_WARNING, "%s: %lu queued, %lu replaced, depth %u",
+               test, statistics.queuedWrites, statistics.replacedWrites,
+               statistics.currentDepth);
+    ok = 0;
+  }
+
+  if (!settleTestDevice(device, device->frameTime * 4)) return 0;
+  if (!checkRefreshCount(test, device, 2)) ok = 0;
+  if (!checkDisplay(test, device, frameCount)) ok = 0;
+  return ok;
+}
+
+static int
+testPacing (const char *test, TestDevice *device) {
+  static const unsigned int tags[] = {1, 2, 3, 4, 1};
+  const EmulatorStatistic *interval = &device->emulator.statistics.refreshInterval;
+  unsigned char value;
+  int ok = 1;
+
+  /* different regions don't replace one another, so every frame is written */
+  for (value=1; value<=ARRAY_COUNT(tags); value+=1) {
+    queueFrame(device, value, tags[value-1]);
+  }
+
+  if (!settleTestDevice(device, device->frameTime * (ARRAY_COUNT(tags) + 2))) return 0;
+  if (!checkRefreshCount(test, device, ARRAY_COUNT(tags))) ok = 0;
+  if (!checkDisplay(test, device, ARRAY_COUNT(tags))) ok = 0;
+
+  if (interval->count) {
+    long int shortest = (device->frameTime - PACING_TOLERANCE) * USECS_PER_MSEC;
+
+    if (interval->minimum < shortest) {
+      logMessage(LOG_WARNING, "%s: frames %.3fms apart (%ums to transfer)",
+                 test, (double)interval->minimum / USECS_PER_MSEC,
+                 device->frameTime);
+      ok = 0;
+    }
+  }
+
+  return ok;
+}
+
+static int
+testOrdering (const char *test, TestDevice *device) {
+  unsigned char frame[FRAME_SIZE];
+  size_t size = makeFrame(frame, 3);
+  GioOutputStatistics statistics;
+  int ok = 1;
+
+  queueFrame(device, 1, 1);
+  if (!checkQueueResult(test, 2, queueFrame(device, 2, 1), 0)) ok = 0;
+
+  /* an untagged write mustn't overtake what's already queued */
+  if (gioWriteData(device->endpoint, frame, size) != size) {
+    logSystemError("gio write");
+    return 0;
+  }
+
+  gioGetOutputStatistics(device->endpoint, &statistics);
+
+  if (statistics.currentDepth) {
+    logMessage(LOG_WARNING, "%s: queue not flushed before write", test);
+    ok = 0;
+  }
+
+  if (!settleTestDevice(device, device->frameTime * 2)) return 0;
+  if (!checkRefreshCount(test, device, 3)) ok = 0;
+  if (!checkDisplay(test, device, 3)) ok = 0;
+  return ok;
+}
+
+static int
+testDisconnect (const char *test, TestDevice *device) {
+  int ok = 1;
+
+  queueFrame(device, 1, 1);
+  if (!checkQueueResult(test, 2, queueFrame(device, 2, 1), 0)) ok = 0;
+
+  /* the last cell update is written, not dropped, when the device is closed */
+  gioDisconnectResource(device->endpoint);
+  device->endpoint = NULL;
+
+  if (!settleTestDevice(device, device->frameTime)) return 0;
+  if (!checkRefreshCount(test, device, 2)) ok = 0;
+  if (!checkDisplay(test, device, 2)) ok = 0;
+  return ok;
+}
+
+typedef struct {
+  const char *name;
+  int (*run) (const char *test, TestDevice *device);
+} TestEntry;
+
+static const TestEntry testTable[] = {
+  { .name = "coalescing", .run = testCoalescing },
+  { .name = "pacing", .run = testPacing },
+  { .name = "ordering", .run = testOrdering },
+  { .name = "disconnect", .run = testDisconnect },
+};
+
+int
+main (int argc, char *argv[]) {
+  unsigned int failures = 0;
+
+  {
+    static const OptionsDescriptor descriptor = {
+      OPTION_TABLE(programOptions),
+      .applicationName = "giotest"
+    };
+    PROCESS_OPTIONS(descriptor, argc, argv);
+  }
+
+  if (argc) {
+    logMessage(LOG_ERR, "too many parameters");
+    return PROG_EXIT_SYNTAX;
+  }
+
+  {
+    const TestEntry *test;
+
+    for (test=testTable; test<(testTable + ARRAY_COUNT(testTable)); test+=1) {
+      TestDevice device;
+
+      if (!openTestDevice(&device)) return PROG_EXIT_FATAL;
+      if (!test->run(test->name, &device)) failures += 1;
+      closeTestDevice(&device);
+    }
+  }
+
+  if (failures) {
+    logMessage(LOG_ERR, "%u of %u output queue tests failed",
+               failures, (unsigned int)ARRAY_COUNT(testTable));
+    return PROG_EXIT_FATAL;
+  }
+
+  printf("%u output queue tests passed\n", (unsigned int)ARRAY_COUNT(testTable));
+  return PROG_EXIT_SUCCESS;
+}
@@ -99,10 +99,22 @@ extern const void *gioGetApplicationData (GioEndpoint *endpoint);
 extern char *gioGetResourceName (GioEndpoint *endpoint);
 
 extern ssize_t gioWriteData (GioEndpoint *endpoint, const void *data, size_t size);
+extern ssize_t gioQueueData (GioEndpoint *endpoint, const void *data, size_t size, unsigned int tag);
+
+typedef struct {
+  unsigned int currentDepth;
+  unsigned int maximumDepth;
+  unsigned long queuedWrites;
+  unsigned long replacedWrites;
+} GioOutputStatistics;
+
+extern void gioGetOutputStatistics (GioEndpoint *endpoint, GioOutputStatistics *statistics);
 extern int gioMonitorInput (GioEndpoint *endpoint, AsyncMonitorCallback *callback, void *data);
 extern int gioAwaitInput (GioEndpoint *endpoint, int timeout);
 extern ssize_t gioReadData (GioEndpoint *endpoint, void *buffer, size_t size, int wait);
 extern int gioReadByte (GioEndpoint *endpoint, unsigned char *byte, int wait);
+extern ssize_t gioPeekInput (GioEndpoint *endpoint, const unsigned char **bytes, int wait);
+extern void gioSkipInput (GioEndpoint *endpoint, size_t count);
 extern int gioDiscardInput (GioEndpoint *endpoint);
 
 extern int gioReconfigureResource (
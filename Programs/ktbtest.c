@@ -277,3 +277,20 @@ KeyTableCommandContext
 getScreenCommandContext (void) {
   return KTB_CTX_DEFAULT;
 }
+
+#include "brl_thread.h"
+
+int
+isBrailleDriverThread (void) {
+  return 0;
+}
+
+int
+brailleMessage_keyEvent (unsigned char set, unsigned char key, int press) {
+  return 0;
+}
+
+int
+brailleMessage_command (int command) {
+  return 0;
+}
@@ -30,6 +30,7 @@
 #include "update.h"
 #include "cmd_queue.h"
 #include "api_control.h"
+#include "brl_thread.h"
 #include "brltty.h"
 
 int messageHoldTimeout = DEFAULT_MESSAGE_HOLD_TIMEOUT;
@@ -152,6 +153,10 @@ message (const char *mode, const char *text, MessageOptions options) {
   MessageParameters *mgp;
   size_t size = sizeof(*mgp) + strlen(text);
 
+  if (isBrailleDriverThread()) {
+    return brailleMessage_message(mode, text, options);
+  }
+
   if ((mgp = malloc(size))) {
     memset(mgp, 0, size);
     mgp->mode = mode? mode: "";
@@ -28,6 +28,12 @@ extern "C" {
 
 #define BRAILLE_DRIVER_START_RETRY_INTERVAL 5000
 #define BRAILLE_INPUT_POLL_INTERVAL 40
+#define BRAILLE_DEVICE_PROBE_TIMEOUT 30000
+#define BRAILLE_DEVICE_PROBE_CANCEL_TIMEOUT 1000
+
+#define BRAILLE_DRIVER_THREAD_START_TIMEOUT 30000
+#define BRAILLE_DRIVER_THREAD_STOP_TIMEOUT 5000
+#define BRAILLE_DRIVER_THREAD_COMMAND_LIMIT 0X40
 
 #define SPEECH_DRIVER_START_RETRY_INTERVAL 5000
 #define SPEECH_DRIVER_START_AUTOSPEAK_DELAY 4000
@@ -64,7 +70,6 @@ extern "C" {
 
 #define USB_INPUT_AWAIT_RETRY_INTERVAL_MINIMUM 10
 #define USB_INPUT_READ_INITIAL_TIMEOUT_DEFAULT 20
-#define USB_INPUT_URB_RESUBMIT_DELAY 40
 #define USB_INPUT_INTERRUPT_URB_COUNT 8
 
 #define BLUETOOTH_DEVICE_NAME_OBTAIN_TIMEOUT 5000
@@ -74,6 +79,7 @@ extern "C" {
 
 #define LINUX_INPUT_DEVICE_OPEN_DELAY 1000
 #define LINUX_USB_INPUT_PIPE_DISABLE 0
+#define LINUX_USB_INPUT_URB_COUNT 4
 #define LINUX_USB_INPUT_TREAT_INTERRUPT_AS_BULK 0
 #define LINUX_BLUETOOTH_NAME_OBTAIN_ASYNCHRONOUS 1
 #define LINUX_BLUETOOTH_CHANNEL_DISCOVER_ASYNCHRONOUS 1
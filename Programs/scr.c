@@ -277,6 +277,11 @@ userVirtualTerminal (int number) {
   return mainScreen.userVirtualTerminal(number);
 }
 
+int
+searchScreenHistory (const wchar_t *characters, size_t count, int backward, int *column, int *row) {
+  return currentScreen->searchHistory(characters, count, backward, column, row);
+}
+
 int
 handleScreenCommand (int command, void *data) {
   return currentScreen->handleCommand(command);
@@ -69,6 +69,7 @@ extern int selectScreenVirtualTerminal (int vt);
 extern int switchScreenVirtualTerminal (int vt);
 extern int currentVirtualTerminal (void);
 extern int userVirtualTerminal (int number);
+extern int searchScreenHistory (const wchar_t *characters, size_t count, int backward, int *column, int *row);
 extern CommandHandler handleScreenCommand;
 extern KeyTableCommandContext getScreenCommandContext (void);
 
@@ -159,6 +159,11 @@ getPointer_BaseScreen (int *column, int *row) {
   return 0;
 }
 
+static int
+searchHistory_BaseScreen (const wchar_t *characters, size_t count, int backward, int *column, int *row) {
+  return 0;
+}
+
 static int
 handleCommand_BaseScreen (int command) {
   return 0;
@@ -189,6 +194,7 @@ initializeBaseScreen (BaseScreen *base) {
   base->switchVirtualTerminal = switchVirtualTerminal_BaseScreen;
   base->currentVirtualTerminal = currentVirtualTerminal_BaseScreen;
 
+  base->searchHistory = searchHistory_BaseScreen;
   base->handleCommand = handleCommand_BaseScreen;
   base->getCommandContext = getCommandContext_BaseScreen;
 }
@@ -42,6 +42,7 @@ typedef struct {
   int (*selectVirtualTerminal) (int vt);
   int (*switchVirtualTerminal) (int vt);
   int (*currentVirtualTerminal) (void);
+  int (*searchHistory) (const wchar_t *characters, size_t count, int backward, int *column, int *row);
   int (*handleCommand) (int command);
   KeyTableCommandContext (*getCommandContext) (void);
 } BaseScreen;
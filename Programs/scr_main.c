@@ -20,7 +20,9 @@
 
 #include <stdio.h>
 
+#include "log.h"
 #include "update.h"
+#include "tunes.h"
 #include "scr.h"
 #include "scr_main.h"
 
@@ -70,3 +72,9 @@ void
 mainScreenUpdated (void) {
   if (isMainScreen()) scheduleUpdate("main screen updated");
 }
+
+void
+mainScreenActivity (int vt) {
+  logMessage(LOG_DEBUG, "activity on virtual terminal %d", vt);
+  playTune(&tune_screen_activity);
+}
@@ -48,6 +48,7 @@ struct ScreenDriverStruct {
 };
 
 extern void mainScreenUpdated (void);
+extern void mainScreenActivity (int vt);
 
 #ifdef __cplusplus
 }
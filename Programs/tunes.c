@@ -217,6 +217,16 @@ const TuneDefinition tune_screen_unfrozen = {
   strtext("Unfrozen"), 0, elements_screen_unfrozen
 };
 
+static const TuneElement elements_screen_activity[] = {
+  TUNE_NOTE(  8,  84),
+  TUNE_REST( 30),
+  TUNE_NOTE(  8,  88),
+  TUNE_STOP()
+};
+const TuneDefinition tune_screen_activity = {
+  NULL, TUNE_TACTILE(20,BRL_DOT3|BRL_DOT6|BRL_DOT7|BRL_DOT8), elements_screen_activity
+};
+
 static const TuneElement elements_wrap_down[] = {
   TUNE_NOTE(  6,  86),
   TUNE_NOTE(  6,  74),
@@ -57,6 +57,7 @@ extern const TuneDefinition tune_cursor_linked;
 extern const TuneDefinition tune_cursor_unlinked;
 extern const TuneDefinition tune_screen_frozen;
 extern const TuneDefinition tune_screen_unfrozen;
+extern const TuneDefinition tune_screen_activity;
 extern const TuneDefinition tune_wrap_down;
 extern const TuneDefinition tune_wrap_up;
 extern const TuneDefinition tune_skip_first;
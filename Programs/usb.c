@@ -1153,7 +1153,175 @@ usbWriteData (
   return -1;
 }
 
+/* The channel definitions of a driver are indexed by vendor and product so
+ * that each device which is found is only tested against the ones which
+ * could match it. The indexes outlive the drivers which they're for, so a
+ * copy of each table is kept for checking that it's still the same one.
+ */
+typedef struct {
+  uint16_t vendor;
+  uint16_t product;
+  unsigned int position;
+} UsbChannelIndexEntry;
+
 typedef struct {
+  const UsbChannelDefinition *definitions;
+  UsbChannelDefinition *copy;
+  unsigned int count;
+  UsbChannelIndexEntry entries[0];
+} UsbChannelIndex;
+
+static void
+usbDeallocateChannelIndex (void *item, void *data) {
+  UsbChannelIndex *index = item;
+
+  free(index->copy);
+  free(index);
+}
+
+static Queue *
+usbCreateChannelIndexQueue (void *data) {
+  return newQueue(usbDeallocateChannelIndex, NULL);
+}
+
+static Queue *
+usbGetChannelIndexQueue (int create) {
+  static Queue *indexes = NULL;
+
+  return getProgramQueue(&indexes, "usb-channel-index-queue", create,
+                         usbCreateChannelIndexQueue, NULL);
+}
+
+static int
+usbTestChannelIndex (const void *item, const void *data) {
+  const UsbChannelIndex *index = item;
+  const UsbChannelDefinition *definitions = data;
+
+  return index->definitions == definitions;
+}
+
+static int
+usbCompareChannelIndexEntries (const void *element1, const void *element2) {
+  const UsbChannelIndexEntry *entry1 = element1;
+  const UsbChannelIndexEntry *entry2 = element2;
+
+  if (entry1->vendor < entry2->vendor) return -1;
+  if (entry1->vendor > entry2->vendor) return 1;
+
+  if (entry1->product < entry2->product) return -1;
+  if (entry1->product > entry2->product) return 1;
+
+  if (entry1->position < entry2->position) return -1;
+  if (entry1->position > entry2->position) return 1;
+  return 0;
+}
+
+static UsbChannelIndex *
+usbMakeChannelIndex (const UsbChannelDefinition *definitions, unsigned int count) {
+  UsbChannelIndex *index;
+
+  if ((index = malloc(sizeof(*index) + ARRAY_SIZE(index->entries, count)))) {
+    size_t size = ARRAY_SIZE(definitions, count);
+
+    if ((index->copy = malloc(size))) {
+      unsigned int position;
+
+      memcpy(index->copy, definitions, size);
+      index->definitions = definitions;
+      index->count = count;
+
+      for (position=0; position<count; position+=1) {
+        UsbChannelIndexEntry *entry = &index->entries[position];
+        const UsbChannelDefinition *definition = &definitions[position];
+
+        entry->vendor = definition->vendor;
+        entry->product = definition->product;
+        entry->position = position;
+      }
+
+      qsort(index->entries, count, sizeof(*index->entries), usbCompareChannelIndexEntries);
+      return index;
+    } else {
+      logMallocError();
+    }
+
+    free(index);
+  } else {
+    logMallocError();
+  }
+
+  return NULL;
+}
+
+static const UsbChannelIndex *
+usbGetChannelIndex (const UsbChannelDefinition *definitions) {
+  Queue *indexes = usbGetChannelIndexQueue(1);
+
+  if (indexes) {
+    unsigned int count = 0;
+    Element *element;
+
+    while (definitions[count].vendor) count += 1;
+
+    if ((element = findElement(indexes, usbTestChannelIndex, definitions))) {
+      UsbChannelIndex *index = getElementItem(element);
+
+      if ((index->count == count) &&
+          (memcmp(index->copy, definitions, ARRAY_SIZE(definitions, count)) == 0)) {
+        return index;
+      }
+
+      logMessage(LOG_CATEGORY(USB_IO), "USB channel definitions replaced");
+      deleteElement(element);
+    }
+
+    {
+      UsbChannelIndex *index = usbMakeChannelIndex(definitions, count);
+
+      if (index) {
+        if (enqueueItem(indexes, index)) return index;
+        usbDeallocateChannelIndex(index, NULL);
+      }
+    }
+  }
+
+  return NULL;
+}
+
+static const UsbChannelIndexEntry *
+usbFindChannelIndexEntry (const UsbChannelIndex *index, uint16_t vendor, uint16_t product) {
+  const UsbChannelIndexEntry key = {
+    .vendor = vendor,
+    .product = product,
+    .position = 0
+  };
+
+  int first = 0;
+  int last = index->count - 1;
+
+  /* find the first entry for the device, i.e. its earliest definition */
+  while (first <= last) {
+    int current = (first + last) / 2;
+
+    if (usbCompareChannelIndexEntries(&index->entries[current], &key) < 0) {
+      first = current + 1;
+    } else {
+      last = current - 1;
+    }
+  }
+
+  if (first < index->count) {
+    const UsbChannelIndexEntry *entry = &index->entries[first];
+
+    if ((entry->vendor == vendor) && (entry->product == product)) return entry;
+  }
+
+  return NULL;
+}
+
+typedef struct {
+  const UsbChannelDefinition *definitions;
+  const UsbChannelIndex *index;
   const UsbChannelDefinition *definition;
 
   const char *serialNumber;
@@ -1165,9 +1333,17 @@ static int
 usbChooseChannel (UsbDevice *device, void *data) {
   const UsbDeviceDescriptor *descriptor = usbDeviceDescriptor(device);
   UsbChooseChannelData *choose = data;
-  const UsbChannelDefinition *definition = choose->definition;
+  const UsbChannelIndex *index = choose->index;
+  const UsbChannelIndexEntry *entry = usbFindChannelIndexEntry(index,
+                                                               getLittleEndian16(descriptor->idVendor),
+                                                               getLittleEndian16(descriptor->idProduct));
+
+  if (!entry) return 0;
+
+  while ((entry < (index->entries + index->count)) &&
+         USB_IS_PRODUCT(descriptor, entry->vendor, entry->product)) {
+    const UsbChannelDefinition *definition = &choose->definitions[entry->position];
 
-  while (definition->vendor) {
     if (!definition->version || (definition->version == getLittleEndian16(descriptor->bcdUSB))) {
       if (USB_IS_PRODUCT(descriptor, definition->vendor, definition->product)) {
         if (!(descriptor->iManufacturer ||
@@ -1246,7 +1422,7 @@ usbChooseChannel (UsbDevice *device, void *data) {
       }
     }
 
-    definition += 1;
+    entry += 1;
   }
   return 0;
 }
@@ -1255,6 +1431,8 @@ static UsbChannel *
 usbNewChannel (UsbChooseChannelData *choose) {
   UsbChannel *channel;
 
+  if (!(choose->index = usbGetChannelIndex(choose->definitions))) return NULL;
+
   if ((channel = malloc(sizeof(*channel)))) {
     memset(channel, 0, sizeof(*channel));
 
@@ -1299,7 +1477,7 @@ usbOpenChannel (const UsbChannelDefinition *definitions, const char *identifier)
     int ok = 1;
 
     UsbChooseChannelData choose = {
-      .definition = definitions,
+      .definitions = definitions,
       .serialNumber = parameters[USB_CHAN_SERIAL_NUMBER]
     };
 
@@ -27,6 +27,8 @@
 #include <sys/stat.h>
 #include <sys/vfs.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
 #include <linux/usbdevice_fs.h>
 
 #ifndef USBDEVFS_DISCONNECT
@@ -45,8 +47,8 @@
 #include "async_wait.h"
 #include "async_alarm.h"
 #include "async_io.h"
-#include "async_signal.h"
 #include "mntpt.h"
+#include "program.h"
 #include "io_usb.h"
 #include "usb_internal.h"
 
@@ -54,26 +56,31 @@ typedef struct {
   char *sysfsPath;
   char *usbfsPath;
   UsbDeviceDescriptor usbDescriptor;
+  unsigned int references;
 } UsbHostDevice;
 
 static Queue *usbHostDevices = NULL;
+static char *usbHostRoot = NULL;
 
 struct UsbDeviceExtensionStruct {
-  const UsbHostDevice *host;
+  UsbHostDevice *host;
   int usbfsFile;
+  AsyncHandle completionMonitor;
 };
 
 struct UsbEndpointExtensionStruct {
   Queue *completedRequests;
 
-#ifdef ASYNC_CAN_OBTAIN_SIGNALS
   struct {
-    struct usbdevfs_urb *urb;
-    AsyncHandle signalHandle;
+    struct usbdevfs_urb *urbs[LINUX_USB_INPUT_URB_COUNT];
+    unsigned int count;
+
+    struct usbdevfs_urb *parked[LINUX_USB_INPUT_URB_COUNT];
+    unsigned int parkedCount;
+
     AsyncHandle alarmHandle;
     int submitDelay;
   } monitor;
-#endif /* ASYNC_CAN_OBTAIN_SIGNALS */
 };
 
 static int
@@ -91,6 +98,11 @@ usbOpenUsbfsFile (UsbDeviceExtension *devx) {
 
 static void
 usbCloseUsbfsFile (UsbDeviceExtension *devx) {
+  if (devx->completionMonitor) {
+    asyncCancelRequest(devx->completionMonitor);
+    devx->completionMonitor = NULL;
+  }
+
   if (devx->usbfsFile != -1) {
     close(devx->usbfsFile);
     devx->usbfsFile = -1;
@@ -384,6 +396,39 @@ usbControlTransfer (
   return -1;
 }
 
+static void usbHandleInputURB (UsbEndpoint *endpoint, struct usbdevfs_urb *urb);
+
+static int
+usbIsInputMonitorURB (const UsbEndpointExtension *eptx, const struct usbdevfs_urb *urb) {
+  unsigned int index;
+
+  for (index=0; index<eptx->monitor.count; index+=1) {
+    if (eptx->monitor.urbs[index] == urb) return 1;
+  }
+
+  return 0;
+}
+
+static int
+usbHandleReapedURB (UsbDevice *device, struct usbdevfs_urb *urb) {
+  UsbEndpoint *endpoint;
+
+  if ((endpoint = usbGetEndpoint(device, urb->endpoint))) {
+    UsbEndpointExtension *eptx = endpoint->extension;
+
+    if (usbIsInputMonitorURB(eptx, urb)) {
+      usbHandleInputURB(endpoint, urb);
+      return 1;
+    }
+
+    if (enqueueItem(eptx->completedRequests, urb)) return 1;
+    logSystemError("USB completed request enqueue");
+    free(urb);
+  }
+
+  return 0;
+}
+
 static int
 usbReapUrb (
   UsbDevice *device,
@@ -398,15 +443,7 @@ usbReapUrb (
               wait? USBDEVFS_REAPURB: USBDEVFS_REAPURBNDELAY,
               &urb) != -1) {
       if (urb) {
-        UsbEndpoint *endpoint;
-
-        if ((endpoint = usbGetEndpoint(device, urb->endpoint))) {
-          UsbEndpointExtension *eptx = endpoint->extension;
-
-          if (enqueueItem(eptx->completedRequests, urb)) return 1;
-          logSystemError("USB completed request enqueue");
-          free(urb);
-        }
+        if (usbHandleReapedURB(device, urb)) return 1;
       } else {
         errno = EAGAIN;
       }
@@ -801,8 +838,9 @@ usbInterruptTransfer (
     if (timeout) startTimePeriod(&period, timeout);
 
     do {
-      if (usbReapUrb(device, 0) &&
-          deleteItem(eptx->completedRequests, urb)) {
+      usbReapUrb(device, 0);
+
+      if (deleteItem(eptx->completedRequests, urb)) {
         if (!urb->status) return urb;
         if ((errno = urb->status) < 0) errno = -errno;
         free(urb);
@@ -924,23 +962,25 @@ usbReadDeviceDescriptor (UsbDevice *device) {
   return 1;
 }
 
-#ifdef ASYNC_CAN_OBTAIN_SIGNALS
 static void
 usbLogInputProblem (UsbEndpoint *endpoint, const char *problem) {
   logMessage(LOG_WARNING, "%s: Ept:%02X",
              problem, endpoint->descriptor->bEndpointAddress);
 }
 
-static unsigned char
-usbGetResubmitDelay (UsbEndpoint *endpoint) {
-  unsigned char interval = endpoint->descriptor->bInterval;
+static int
+usbIsParkedInputURB (const UsbEndpointExtension *eptx, const struct usbdevfs_urb *urb) {
+  unsigned int index;
+
+  for (index=0; index<eptx->monitor.parkedCount; index+=1) {
+    if (eptx->monitor.parked[index] == urb) return 1;
+  }
 
-  if (!interval) interval = USB_INPUT_URB_RESUBMIT_DELAY;
-  return interval;
+  return 0;
 }
 
 static int
-usbResubmitInputURB (struct usbdevfs_urb *urb, UsbEndpoint *endpoint) {
+usbResubmitInputURB (UsbEndpoint *endpoint, struct usbdevfs_urb *urb) {
   urb->actual_length = 0;
   if (usbSubmitURB(urb, endpoint)) return 1;
 
@@ -948,76 +988,136 @@ usbResubmitInputURB (struct usbdevfs_urb *urb, UsbEndpoint *endpoint) {
   return 0;
 }
 
+static int
+usbResubmitParkedInputURBs (UsbEndpoint *endpoint) {
+  UsbEndpointExtension *eptx = endpoint->extension;
+
+  if (eptx->monitor.alarmHandle) {
+    asyncCancelRequest(eptx->monitor.alarmHandle);
+    eptx->monitor.alarmHandle = NULL;
+  }
+
+  while (eptx->monitor.parkedCount) {
+    struct usbdevfs_urb *urb = eptx->monitor.parked[eptx->monitor.parkedCount - 1];
+
+    if (!usbResubmitInputURB(endpoint, urb)) return 0;
+    eptx->monitor.parkedCount -= 1;
+  }
+
+  return 1;
+}
+
 ASYNC_ALARM_CALLBACK(usbHandleInputAlarm) {
   UsbEndpoint *endpoint = parameters->data;
   UsbEndpointExtension *eptx = endpoint->extension;
-  struct usbdevfs_urb *urb = eptx->monitor.urb;
+  struct usbdevfs_urb *urb = eptx->monitor.parked[eptx->monitor.parkedCount - 1];
 
   asyncDiscardHandle(eptx->monitor.alarmHandle);
   eptx->monitor.alarmHandle = NULL;
 
-  usbResubmitInputURB(urb, endpoint);
+  if (usbResubmitInputURB(endpoint, urb)) {
+    eptx->monitor.parkedCount -= 1;
+  } else {
+    usbSetInputError(endpoint, errno);
+  }
 }
 
-ASYNC_SIGNAL_CALLBACK(usbHandleInputSignal) {
-  UsbEndpoint *endpoint = parameters->data;
+static void
+usbHandleInputURB (UsbEndpoint *endpoint, struct usbdevfs_urb *urb) {
   UsbEndpointExtension *eptx = endpoint->extension;
 
-  UsbResponse response;
-  void *request = usbReapResponse(endpoint->device,
-                                  endpoint->descriptor->bEndpointAddress,
-                                  &response, 0);
+  usbLogURB(urb, "reaped");
 
-  if (request) {
-    struct usbdevfs_urb *urb = eptx->monitor.urb;
+  if (urb->status) {
+    if ((errno = urb->status) < 0) errno = -errno;
+    usbLogInputProblem(endpoint, "input URB failed");
+  } else {
+    ssize_t count = urb->actual_length;
 
-    if (request == urb) {
-      int written = 0;
-      int *const delay = &eptx->monitor.submitDelay;
+    if (!usbApplyInputFilters(endpoint->device, urb->buffer, urb->buffer_length, &count)) {
+      usbLogInputProblem(endpoint, "input data not filtered");
+      errno = EIO;
+    } else if (count > 0) {
+      if (usbEnqueueInput(endpoint, urb->buffer, count)) {
+        eptx->monitor.submitDelay = 0;
 
-      if (response.count == 0) {
-        written = 1;
-        *delay = *delay? (*delay << 1): 1;
-        *delay = MIN(*delay, BRAILLE_INPUT_POLL_INTERVAL);
-      } else if (response.count > 0) {
-        if (usbEnqueueInput(endpoint, response.buffer, response.count)) {
-          written = 1;
-          *delay = usbGetResubmitDelay(endpoint);
-        } else {
-          usbLogInputProblem(endpoint, "input data not enqueued");
+        if (usbResubmitInputURB(endpoint, urb)) {
+          if (!usbResubmitParkedInputURBs(endpoint)) usbSetInputError(endpoint, errno);
+          return;
         }
       } else {
-        usbLogInputProblem(endpoint, "input data not available");
-        errno = response.error;
+        usbLogInputProblem(endpoint, "input data not enqueued");
       }
+    } else {
+      /* Some adapters (e.g. FTDI) complete a status-only transfer, which has
+       * been filtered down to nothing, every time their latency timer
+       * expires. While idle, therefore, the URBs are parked as they come
+       * back, and only the last one is kept going - with an increasing
+       * delay - until data arrives again.
+       */
+      int *const delay = &eptx->monitor.submitDelay;
 
-      if (written) {
-        if (*delay) {
-          if (asyncSetAlarmIn(&eptx->monitor.alarmHandle, *delay, usbHandleInputAlarm, endpoint)) {
-            return 1;
-          } else {
-            usbLogInputProblem(endpoint, "input URB resubmit not scheduled");
-          }
-        } else if (usbResubmitInputURB(urb, endpoint)) {
-          return 1;
-        }
-      }
+      eptx->monitor.parked[eptx->monitor.parkedCount++] = urb;
+      if (eptx->monitor.parkedCount < eptx->monitor.count) return;
 
-      asyncRelinquishSignalNumber(urb->signr);
-      eptx->monitor.urb = NULL;
-    } else {
-      usbLogInputProblem(endpoint, "unexpected input URB");
-      errno = EIO;
-    }
+      *delay = *delay? (*delay << 1): 1;
+      *delay = MIN(*delay, BRAILLE_INPUT_POLL_INTERVAL);
 
-    free(request);
-  } else {
-    usbLogInputProblem(endpoint, "input URB not available");
+      if (asyncSetAlarmIn(&eptx->monitor.alarmHandle, *delay, usbHandleInputAlarm, endpoint)) return;
+      usbLogInputProblem(endpoint, "input URB resubmit not scheduled");
+    }
   }
 
+  /* It isn't the kernel's any more so it mustn't be waited for when discarded. */
+  if (!usbIsParkedInputURB(eptx, urb)) eptx->monitor.parked[eptx->monitor.parkedCount++] = urb;
   usbSetInputError(endpoint, errno);
-  asyncDiscardHandle(eptx->monitor.signalHandle);
-  eptx->monitor.signalHandle = NULL;
+}
+
+static int
+usbFailInputMonitor (void *item, void *data) {
+  UsbEndpoint *endpoint = item;
+  const int *error = data;
+
+  if (USB_ENDPOINT_DIRECTION(endpoint->descriptor) == UsbEndpointDirection_Input) {
+    UsbEndpointExtension *eptx = endpoint->extension;
+
+    if (eptx->monitor.count) usbSetInputError(endpoint, *error);
+  }
+
+  return 0;
+}
+
+ASYNC_MONITOR_CALLBACK(usbHandleCompletedRequests) {
+  UsbDevice *device = parameters->data;
+  UsbDeviceExtension *devx = device->extension;
+
+  while (usbReapUrb(device, 0));
+  if (errno != ENODEV) return 1;
+
+  {
+    int error = errno;
+
+    processQueue(device->endpoints, usbFailInputMonitor, &error);
+  }
+
+  asyncDiscardHandle(devx->completionMonitor);
+  devx->completionMonitor = NULL;
+  return 0;
+}
+
+static int
+usbMonitorCompletedRequests (UsbDevice *device) {
+  UsbDeviceExtension *devx = device->extension;
+
+  if (devx->completionMonitor) return 1;
+
+  if (usbOpenUsbfsFile(devx)) {
+    if (asyncMonitorFileOutput(&devx->completionMonitor, devx->usbfsFile,
+                               usbHandleCompletedRequests, device)) {
+      return 1;
+    }
+  }
+
   return 0;
 }
 
@@ -1028,36 +1128,34 @@ usbPrepareInputEndpoint (UsbEndpoint *endpoint) {
   if (LINUX_USB_INPUT_PIPE_DISABLE) return 1;
 
   if (usbMakeInputPipe(endpoint)) {
-    const UsbEndpointDescriptor *descriptor = endpoint->descriptor;
-    size_t size = getLittleEndian16(descriptor->wMaxPacketSize);
-
-    if ((eptx->monitor.urb = usbMakeURB(descriptor, NULL, size, endpoint))) {
-      if ((eptx->monitor.urb->signr = asyncObtainSignalNumber())) {
-        if (asyncMonitorSignal(&eptx->monitor.signalHandle,
-                               eptx->monitor.urb->signr,
-                               usbHandleInputSignal, endpoint)) {
-          if (usbSubmitURB(eptx->monitor.urb, endpoint)) {
-            endpoint->direction.input.asynchronous = 0;
-            return 1;
-          } else {
-            usbLogInputProblem(endpoint, "input URB not submitted");
-          }
+    if (usbMonitorCompletedRequests(endpoint->device)) {
+      const UsbEndpointDescriptor *descriptor = endpoint->descriptor;
+      size_t size = getLittleEndian16(descriptor->wMaxPacketSize);
+
+      while (eptx->monitor.count < ARRAY_COUNT(eptx->monitor.urbs)) {
+        struct usbdevfs_urb *urb;
 
-          asyncCancelRequest(eptx->monitor.signalHandle);
-          eptx->monitor.signalHandle = NULL;
-        } else {
-          usbLogInputProblem(endpoint, "input monitor not registered");
+        if (!(urb = usbMakeURB(descriptor, NULL, size, endpoint))) break;
+
+        if (!usbSubmitURB(urb, endpoint)) {
+          free(urb);
+          break;
         }
 
-        asyncRelinquishSignalNumber(eptx->monitor.urb->signr);
-      } else {
-        usbLogInputProblem(endpoint, "input signal number not obtained");
+        eptx->monitor.urbs[eptx->monitor.count++] = urb;
       }
 
-      free(eptx->monitor.urb);
-      eptx->monitor.urb = NULL;
+      if (eptx->monitor.count) {
+        logMessage(LOG_CATEGORY(USB_IO), "input URBs submitted: Ept:%02X Count:%u",
+                   descriptor->bEndpointAddress, eptx->monitor.count);
+
+        endpoint->direction.input.asynchronous = 0;
+        return 1;
+      } else {
+        usbLogInputProblem(endpoint, "input URB not submitted");
+      }
     } else {
-      usbLogInputProblem(endpoint, "input URB not created");
+      usbLogInputProblem(endpoint, "input completion monitor not registered");
     }
 
     usbDestroyInputPipe(endpoint);
@@ -1067,7 +1165,6 @@ usbPrepareInputEndpoint (UsbEndpoint *endpoint) {
 
   return 0;
 }
-#endif /* ASYNC_CAN_OBTAIN_SIGNALS */
 
 int
 usbAllocateEndpointExtension (UsbEndpoint *endpoint) {
@@ -1075,20 +1172,15 @@ usbAllocateEndpointExtension (UsbEndpoint *endpoint) {
 
   if ((eptx = malloc(sizeof(*eptx)))) {
     memset(eptx, 0, sizeof(*eptx));
-
-#ifdef ASYNC_CAN_OBTAIN_SIGNALS
-    eptx->monitor.urb = NULL;
-    eptx->monitor.signalHandle = NULL;
+    eptx->monitor.count = 0;
+    eptx->monitor.parkedCount = 0;
     eptx->monitor.alarmHandle = NULL;
-    eptx->monitor.submitDelay = usbGetResubmitDelay(endpoint);
-#endif /* ASYNC_CAN_OBTAIN_SIGNALS */
+    eptx->monitor.submitDelay = 0;
 
     if ((eptx->completedRequests = newQueue(NULL, NULL))) {
       switch (USB_ENDPOINT_DIRECTION(endpoint->descriptor)) {
         case UsbEndpointDirection_Input:
-#ifdef ASYNC_CAN_OBTAIN_SIGNALS
           endpoint->prepare = usbPrepareInputEndpoint;
-#endif /* ASYNC_CAN_OBTAIN_SIGNALS */
           break;
       }
 
@@ -1106,32 +1198,69 @@ usbAllocateEndpointExtension (UsbEndpoint *endpoint) {
   return 0;
 }
 
-void
-usbDeallocateEndpointExtension (UsbEndpointExtension *eptx) {
-#ifdef ASYNC_CAN_OBTAIN_SIGNALS
+static void
+usbDiscardInputURBs (UsbEndpointExtension *eptx) {
+  UsbEndpoint *endpoint = eptx->monitor.urbs[0]->usercontext;
+  UsbDevice *device = endpoint->device;
+  UsbDeviceExtension *devx = device->extension;
+  unsigned int pending = 0;
+  unsigned int index;
+
   if (eptx->monitor.alarmHandle) {
     asyncCancelRequest(eptx->monitor.alarmHandle);
     eptx->monitor.alarmHandle = NULL;
-  } else if (eptx->monitor.urb) {
-    UsbEndpoint *endpoint = eptx->monitor.urb->usercontext;
-    UsbDevice *device = endpoint->device;
-    UsbDeviceExtension *devx = device->extension;
+  }
 
-    ioctl(devx->usbfsFile, USBDEVFS_DISCARDURB, eptx->monitor.urb);
+  for (index=0; index<eptx->monitor.count; index+=1) {
+    struct usbdevfs_urb *urb = eptx->monitor.urbs[index];
+
+    if (usbIsParkedInputURB(eptx, urb) || (devx->usbfsFile == -1)) {
+      eptx->monitor.urbs[index] = NULL;
+      free(urb);
+    } else {
+      ioctl(devx->usbfsFile, USBDEVFS_DISCARDURB, urb);
+      pending += 1;
+    }
   }
 
-  if (eptx->monitor.urb) {
-    asyncRelinquishSignalNumber(eptx->monitor.urb->signr);
+  eptx->monitor.parkedCount = 0;
+
+  /* A discarded URB still belongs to the kernel until it's been reaped. */
+  while (pending) {
+    struct usbdevfs_urb *urb;
+
+    if (ioctl(devx->usbfsFile, USBDEVFS_REAPURB, &urb) == -1) {
+      if (errno == EINTR) continue;
+      logSystemError("USB URB reap");
+      break;
+    }
+
+    for (index=0; index<eptx->monitor.count; index+=1) {
+      if (eptx->monitor.urbs[index] == urb) break;
+    }
 
-    free(eptx->monitor.urb);
-    eptx->monitor.urb = NULL;
+    if (index < eptx->monitor.count) {
+      usbLogURB(urb, "discarded");
+      eptx->monitor.urbs[index] = NULL;
+      free(urb);
+      pending -= 1;
+    } else {
+      usbHandleReapedURB(device, urb);
+    }
   }
 
-  if (eptx->monitor.signalHandle) {
-    asyncCancelRequest(eptx->monitor.signalHandle);
-    eptx->monitor.signalHandle = NULL;
+  if (pending) {
+    /* The kernel may still write into them so they mustn't be freed. */
+    logMessage(LOG_WARNING, "discarded input URBs not reaped: Ept:%02X Count:%u",
+               endpoint->descriptor->bEndpointAddress, pending);
   }
-#endif /* ASYNC_CAN_OBTAIN_SIGNALS */
+
+  eptx->monitor.count = 0;
+}
+
+void
+usbDeallocateEndpointExtension (UsbEndpointExtension *eptx) {
+  if (eptx->monitor.count) usbDiscardInputURBs(eptx);
 
   if (eptx->completedRequests) {
     deallocateQueue(eptx->completedRequests);
@@ -1141,9 +1270,19 @@ usbDeallocateEndpointExtension (UsbEndpointExtension *eptx) {
   free(eptx);
 }
 
+static void
+usbReleaseHostDevice (UsbHostDevice *host) {
+  if (!--host->references) {
+    if (host->sysfsPath) free(host->sysfsPath);
+    if (host->usbfsPath) free(host->usbfsPath);
+    free(host);
+  }
+}
+
 void
 usbDeallocateDeviceExtension (UsbDeviceExtension *devx) {
   usbCloseUsbfsFile(devx);
+  usbReleaseHostDevice(devx->host);
   free(devx);
 }
 
@@ -1151,9 +1290,7 @@ static void
 usbDeallocateHostDevice (void *item, void *data) {
   UsbHostDevice *host = item;
 
-  if (host->sysfsPath) free(host->sysfsPath);
-  if (host->usbfsPath) free(host->usbfsPath);
-  free(host);
+  usbReleaseHostDevice(host);
 }
 
 typedef struct {
@@ -1164,7 +1301,7 @@ typedef struct {
 
 static int
 usbTestHostDevice (void *item, void *data) {
-  const UsbHostDevice *host = item;
+  UsbHostDevice *host = item;
   UsbTestHostDeviceData *test = data;
   UsbDeviceExtension *devx;
 
@@ -1172,6 +1309,7 @@ usbTestHostDevice (void *item, void *data) {
     memset(devx, 0, sizeof(*devx));
     devx->host = host;
     devx->usbfsFile = -1;
+    host->references += 1;
 
     if ((test->device = usbTestDevice(devx, test->chooser, test->data))) return 1;
 
@@ -1288,12 +1426,15 @@ usbAddHostDevice (const char *path) {
   UsbHostDevice *host;
 
   if ((host = malloc(sizeof(*host)))) {
+    host->references = 1;
+
     if ((host->usbfsPath = strdup(path))) {
       host->sysfsPath = usbMakeSysfsPath(host->usbfsPath);
 
       if (!usbReadHostDeviceDescriptor(host)) {
         ok = 1;
       } else if (enqueueItem(usbHostDevices, host)) {
+        logMessage(LOG_CATEGORY(USB_IO), "USB device added: %s", path);
         return 1;
       }
 
@@ -1440,27 +1581,255 @@ usbGetUsbfs (void) {
   return usbGetFileSystem("usbfs", usbfsCandidates, usbTestUsbfs, usbVerifyUsbfs);
 }
 
+static void
+usbDiscardHostDevices (void) {
+  if (usbHostDevices) {
+    deallocateQueue(usbHostDevices);
+    usbHostDevices = NULL;
+  }
+
+  if (usbHostRoot) {
+    free(usbHostRoot);
+    usbHostRoot = NULL;
+  }
+}
+
+#ifdef NETLINK_KOBJECT_UEVENT
+typedef enum {
+  USB_UEVENT_OTHER,
+  USB_UEVENT_ADD,
+  USB_UEVENT_REMOVE
+} UsbUeventAction;
+
+typedef struct {
+  int socket;
+  AsyncHandle inputHandle;
+
+  unsigned long long sequenceNumber;
+  unsigned haveSequenceNumber:1;
+
+  struct {
+    UsbUeventAction action;
+    unsigned int bus;
+    unsigned int device;
+    unsigned isDevice:1;
+  } event;
+} UsbUeventMonitor;
+
+static UsbUeventMonitor usbUeventMonitor = {
+  .socket = -1
+};
+
+static void
+usbStopUeventMonitor (void) {
+  if (usbUeventMonitor.socket != -1) {
+    if (usbUeventMonitor.inputHandle) {
+      asyncCancelRequest(usbUeventMonitor.inputHandle);
+      usbUeventMonitor.inputHandle = NULL;
+    }
+
+    close(usbUeventMonitor.socket);
+    usbUeventMonitor.socket = -1;
+  }
+}
+
+static int
+usbTestHostDevicePath (const void *item, const void *data) {
+  const UsbHostDevice *host = item;
+  const char *path = data;
+
+  return strcmp(host->usbfsPath, path) == 0;
+}
+
+static void
+usbHandleUevent (void) {
+  if (usbHostDevices && usbUeventMonitor.event.isDevice) {
+    char path[strlen(usbHostRoot) + (2 * 0X10) + 1];
+    Element *element;
+
+    snprintf(path, sizeof(path), "%s/%03u/%03u", usbHostRoot,
+             usbUeventMonitor.event.bus, usbUeventMonitor.event.device);
+    element = findElement(usbHostDevices, usbTestHostDevicePath, path);
+
+    switch (usbUeventMonitor.event.action) {
+      case USB_UEVENT_ADD:
+        if (!element) {
+          usbAddHostDevice(path);
+
+          if (!findElement(usbHostDevices, usbTestHostDevicePath, path)) {
+            logMessage(LOG_CATEGORY(USB_IO), "USB device not added: %s", path);
+            usbDiscardHostDevices();
+          }
+        }
+        break;
+
+      case USB_UEVENT_REMOVE:
+        if (element) {
+          logMessage(LOG_CATEGORY(USB_IO), "USB device removed: %s", path);
+          deleteElement(element);
+        }
+        break;
+
+      default:
+        break;
+    }
+  }
+}
+
+static void
+usbHandleUeventString (const char *string) {
+  const char *delimiter;
+
+  if ((delimiter = strchr(string, '@'))) {
+    const char *action = string;
+    int actionLength = delimiter - action;
+
+    memset(&usbUeventMonitor.event, 0, sizeof(usbUeventMonitor.event));
+
+    if (strncmp(action, "add", actionLength) == 0) {
+      usbUeventMonitor.event.action = USB_UEVENT_ADD;
+    } else if (strncmp(action, "remove", actionLength) == 0) {
+      usbUeventMonitor.event.action = USB_UEVENT_REMOVE;
+    } else {
+      usbUeventMonitor.event.action = USB_UEVENT_OTHER;
+    }
+  } else if ((delimiter = strchr(string, '='))) {
+    const char *name = string;
+    int nameLength = delimiter++ - name;
+    const char *value = delimiter;
+
+#define USB_UEVENT_VARIABLE(variable) \
+  ((nameLength == (sizeof(variable) - 1)) && (strncmp(name, (variable), nameLength) == 0))
+
+    if (USB_UEVENT_VARIABLE("DEVTYPE")) {
+      if (strcmp(value, "usb_device") == 0) usbUeventMonitor.event.isDevice = 1;
+    } else if (USB_UEVENT_VARIABLE("BUSNUM")) {
+      usbUeventMonitor.event.bus = strtoul(value, NULL, 10);
+    } else if (USB_UEVENT_VARIABLE("DEVNUM")) {
+      usbUeventMonitor.event.device = strtoul(value, NULL, 10);
+    } else if (USB_UEVENT_VARIABLE("SEQNUM")) {
+      unsigned long long sequenceNumber = strtoull(value, NULL, 10);
+
+      if (usbUeventMonitor.haveSequenceNumber &&
+          (sequenceNumber != (usbUeventMonitor.sequenceNumber + 1))) {
+        logMessage(LOG_CATEGORY(USB_IO), "kobject uevents lost: %llu -> %llu",
+                   usbUeventMonitor.sequenceNumber, sequenceNumber);
+        usbDiscardHostDevices();
+      }
+
+      usbUeventMonitor.sequenceNumber = sequenceNumber;
+      usbUeventMonitor.haveSequenceNumber = 1;
+      usbHandleUevent();
+    }
+
+#undef USB_UEVENT_VARIABLE
+  }
+}
+
+ASYNC_INPUT_CALLBACK(usbHandleKobjectUeventString) {
+  if (parameters->error) {
+    logMessage(LOG_CATEGORY(USB_IO), "netlink read error: %s", strerror(parameters->error));
+  } else if (parameters->end) {
+    logMessage(LOG_CATEGORY(USB_IO), "netlink end-of-file");
+  } else {
+    const char *buffer = parameters->buffer;
+    const char *end = memchr(buffer, 0, parameters->length);
+
+    if (end) {
+      usbHandleUeventString(buffer);
+      return end - buffer + 1;
+    }
+
+    return 0;
+  }
+
+  usbUeventMonitor.inputHandle = NULL;
+  usbStopUeventMonitor();
+  usbDiscardHostDevices();
+  return 0;
+}
+
+static int
+usbStartUeventMonitor (void) {
+  if (usbUeventMonitor.socket == -1) {
+    const struct sockaddr_nl socketAddress = {
+      .nl_family = AF_NETLINK,
+      .nl_pid = 0,
+      .nl_groups = 1
+    };
+
+    if ((usbUeventMonitor.socket = socket(PF_NETLINK, SOCK_DGRAM, NETLINK_KOBJECT_UEVENT)) != -1) {
+      if (bind(usbUeventMonitor.socket, (const struct sockaddr *)&socketAddress, sizeof(socketAddress)) != -1) {
+        usbUeventMonitor.haveSequenceNumber = 0;
+
+        if (asyncReadFile(&usbUeventMonitor.inputHandle, usbUeventMonitor.socket, 0X1000,
+                          usbHandleKobjectUeventString, NULL)) {
+          logMessage(LOG_CATEGORY(USB_IO), "monitoring kobject uevents");
+          return 1;
+        }
+      } else {
+        logSystemError("bind");
+      }
+
+      close(usbUeventMonitor.socket);
+      usbUeventMonitor.socket = -1;
+    } else {
+      logSystemError("socket");
+    }
+
+    return 0;
+  }
+
+  return 1;
+}
+
+static int
+usbIsUeventMonitorActive (void) {
+  return usbUeventMonitor.socket != -1;
+}
+#else /* NETLINK_KOBJECT_UEVENT */
+static void
+usbStopUeventMonitor (void) {
+}
+
+static int
+usbStartUeventMonitor (void) {
+  return 0;
+}
+
+static int
+usbIsUeventMonitorActive (void) {
+  return 0;
+}
+#endif /* NETLINK_KOBJECT_UEVENT */
+
+static void
+usbExitHostDevices (void *data) {
+  usbStopUeventMonitor();
+  usbDiscardHostDevices();
+}
+
 UsbDevice *
 usbFindDevice (UsbDeviceChooser chooser, void *data) {
   if (!usbHostDevices) {
+    static int exitRegistered = 0;
     int ok = 0;
 
-    if ((usbHostDevices = newQueue(usbDeallocateHostDevice, NULL))) {
-      char *root;
-
-      if ((root = usbGetUsbfs())) {
-        logMessage(LOG_CATEGORY(USB_IO), "USBFS root: %s", root);
-        if (usbAddHostDevices(root)) ok = 1;
+    if (!exitRegistered) {
+      onProgramExit("usb-devices", usbExitHostDevices, NULL);
+      exitRegistered = 1;
+    }
 
-        free(root);
+    if ((usbHostDevices = newQueue(usbDeallocateHostDevice, NULL))) {
+      if ((usbHostRoot = usbGetUsbfs())) {
+        logMessage(LOG_CATEGORY(USB_IO), "USBFS root: %s", usbHostRoot);
+        usbStartUeventMonitor();
+        if (usbAddHostDevices(usbHostRoot)) ok = 1;
       } else {
         logMessage(LOG_CATEGORY(USB_IO), "USBFS not mounted");
       }
 
-      if (!ok) {
-        deallocateQueue(usbHostDevices);
-        usbHostDevices = NULL;
-      }
+      if (!ok) usbDiscardHostDevices();
     }
   }
 
@@ -1479,8 +1848,9 @@ usbFindDevice (UsbDeviceChooser chooser, void *data) {
 
 void
 usbForgetDevices (void) {
-  if (usbHostDevices) {
-    deallocateQueue(usbHostDevices);
-    usbHostDevices = NULL;
+  if (usbIsUeventMonitorActive()) {
+    logMessage(LOG_CATEGORY(USB_IO), "keeping USB device cache");
+  } else {
+    usbDiscardHostDevices();
   }
 }
@@ -0,0 +1,1240 @@
+/*
+ * BRLTTY - A background process providing access to the console screen (when in
+ *          text mode) for a blind person using a refreshable braille display.
+ *
+ * Copyright (C) 1995-2014 by The BRLTTY Developers.
+ *
+ * BRLTTY comes with ABSOLUTELY NO WARRANTY.
+ *
+ * This is free software, placed under the terms of the
+ * GNU General Public License, as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any
+ * later version. Please see the file LICENSE-GPL for details.
+ *
+ * Web Page: http://mielke.cc/brltty/
+ *
+ * This software is maintained by Dave Mielke <dave@mielke.cc>.
+ */
+
+/* usbtest.c - Check the Linux USB support against a fake device tree
+ *
+ * usb_linux.c is compiled into this test with some of its system calls
+ * redirected. The usbfs root (/dev/bus/usb) and sysfs (/sys) are
+ * directories under a temporary one, the kobject uevent socket is one end of
+ * a socket pair whose other end synthetic uevents are written to, and the
+ * ioctls which are made on an open usbfs device file are answered for a
+ * simple emulated device. Its URBs are only given back when the test
+ * completes them, and a discarded one isn't given back until it's been
+ * waited for, which is what the kernel may do too.
+ */
+
+#include "prologue.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "program.h"
+#include "options.h"
+#include "log.h"
+
+BEGIN_OPTION_TABLE(programOptions)
+END_OPTION_TABLE
+
+#ifdef __linux__
+#include <stdarg.h>
+#include <ftw.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <linux/netlink.h>
+#include <linux/usbdevice_fs.h>
+
+#include "parameters.h"
+#include "file.h"
+#include "parse.h"
+#include "timing.h"
+#include "async_wait.h"
+#include "async_alarm.h"
+#include "async_io.h"
+#include "mntpt.h"
+#include "io_usb.h"
+#include "usb_internal.h"
+
+static int mockOpen (const char *path, int flags, ...);
+static int mockClose (int file);
+static int mockAccess (const char *path, int mode);
+static int mockStat (const char *path, struct stat *status);
+static DIR *mockOpendir (const char *path);
+static int mockIoctl (int file, unsigned long int request, ...);
+static int mockSocket (int domain, int type, int protocol);
+static int mockBind (int socket, const struct sockaddr *address, socklen_t length);
+static void mockFree (void *pointer);
+
+#define open(...) mockOpen(__VA_ARGS__)
+#define close(file) mockClose((file))
+#define access(path, mode) mockAccess((path), (mode))
+#define stat(path, status) mockStat((path), (status))
+#define opendir(path) mockOpendir((path))
+#define ioctl(...) mockIoctl(__VA_ARGS__)
+#define socket(domain, type, protocol) mockSocket((domain), (type), (protocol))
+#define bind(socket, address, length) mockBind((socket), (address), (length))
+#define free(pointer) mockFree((pointer))
+
+#include "usb_linux.c"
+
+#undef open
+#undef close
+#undef access
+#undef stat
+#undef opendir
+#undef ioctl
+#undef socket
+#undef bind
+#undef free
+
+#define USBFS_ROOT "/dev/bus/usb"
+#define SYSFS_ROOT "/sys/"
+
+#define TEST_VENDOR 0XF0F0
+#define TEST_BUS 1
+#define USBFS_FILE_LIMIT 4
+#define USBFS_URB_LIMIT 0X10
+
+static const unsigned char testDescriptors[] = {
+  /* device: vendor-specific class, USB 2.0, the product is filled in */
+  18, UsbDescriptorType_Device, 0X00, 0X02, 0XFF, 0X00, 0X00, 8,
+  (TEST_VENDOR & 0XFF), (TEST_VENDOR >> 8), 0X00, 0X00, 0X00, 0X01,
+  0, 0, 0, 1,
+
+  /* configuration 1 */
+  9, UsbDescriptorType_Configuration, 25, 0, 1, 1, 0, 0X80, 50,
+
+  /* interface 0: one interrupt input endpoint */
+  9, UsbDescriptorType_Interface, 0, 0, 1, 0XFF, 0X00, 0X00, 0,
+  7, UsbDescriptorType_Endpoint, 0X81, 0X03, 8, 0, 1
+};
+
+typedef struct {
+  struct usbdevfs_urb *urbs[USBFS_URB_LIMIT];
+  unsigned int count;
+} MockUrbList;
+
+typedef struct {
+  int file;
+  unsigned char descriptors[sizeof(testDescriptors)];
+  unsigned writable:1;
+
+  MockUrbList submitted;
+  MockUrbList discarded;
+  MockUrbList completed;
+  int submitError;
+} MockUsbfsFile;
+
+typedef struct {
+  char *root;
+  unsigned int scans;
+
+  struct {
+    int monitor;
+    int peer;
+    unsigned long long sequenceNumber;
+  } uevents;
+
+  MockUsbfsFile files[USBFS_FILE_LIMIT];
+  unsigned int discardedURBs;
+  unsigned int blockedReaps;
+  unsigned int abandonedURBs;
+
+  const void *watchedPointer;
+  unsigned watchedPointerFreed:1;
+} MockState;
+
+static MockState mock = {
+  .uevents = {
+    .monitor = -1,
+    .peer = -1
+  }
+};
+
+static const char *
+mockPath (const char *path, char *buffer, size_t size) {
+  static const char *const roots[][2] = {
+    {USBFS_ROOT, "usbfs"},
+    {SYSFS_ROOT, "sysfs/"}
+  };
+  unsigned int index;
+
+  for (index=0; index<ARRAY_COUNT(roots); index+=1) {
+    const char *root = roots[index][0];
+    size_t length = strlen(root);
+
+    if (strncmp(path, root, length) == 0) {
+      snprintf(buffer, size, "%s/%s%s", mock.root, roots[index][1], &path[length]);
+      return buffer;
+    }
+  }
+
+  return path;
+}
+
+static void
+addURB (MockUrbList *list, struct usbdevfs_urb *urb) {
+  list->urbs[list->count++] = urb;
+}
+
+static struct usbdevfs_urb *
+removeURB (MockUrbList *list, unsigned int index) {
+  struct usbdevfs_urb *urb = list->urbs[index];
+
+  memmove(&list->urbs[index], &list->urbs[index+1],
+          ARRAY_SIZE(list->urbs, (--list->count - index)));
+  return urb;
+}
+
+static int
+findURB (const MockUrbList *list, const struct usbdevfs_urb *urb) {
+  unsigned int index;
+
+  for (index=0; index<list->count; index+=1) {
+    if (list->urbs[index] == urb) return index;
+  }
+
+  return -1;
+}
+
+/* The completion monitor waits for the file to be writable, which an
+ * eventfd is unless its counter is at its maximum.
+ */
+static void
+signalCompletedURBs (MockUsbfsFile *usbfs) {
+  int writable = usbfs->completed.count > 0;
+
+  if (writable != usbfs->writable) {
+    uint64_t counter = 0XFFFFFFFFFFFFFFFE;
+
+    if (writable) {
+      if (read(usbfs->file, &counter, sizeof(counter)) == -1) logSystemError("eventfd read");
+    } else {
+      if (write(usbfs->file, &counter, sizeof(counter)) == -1) logSystemError("eventfd write");
+    }
+
+    usbfs->writable = writable;
+  }
+}
+
+static MockUsbfsFile *
+getUsbfsFile (int file) {
+  unsigned int index;
+
+  for (index=0; index<ARRAY_COUNT(mock.files); index+=1) {
+    MockUsbfsFile *usbfs = &mock.files[index];
+
+    if (usbfs->file == -1) continue;
+    if (usbfs->file == file) return usbfs;
+  }
+
+  return NULL;
+}
+
+static int
+openUsbfsFile (const char *path) {
+  unsigned int index;
+
+  for (index=0; index<ARRAY_COUNT(mock.files); index+=1) {
+    MockUsbfsFile *usbfs = &mock.files[index];
+
+    if (usbfs->file == -1) {
+      int file;
+
+      /* the descriptors are the first bytes of a usbfs device file */
+      if ((file = open(path, O_RDONLY)) == -1) return -1;
+
+      {
+        ssize_t count = read(file, usbfs->descriptors, sizeof(usbfs->descriptors));
+
+        close(file);
+        if (count != sizeof(usbfs->descriptors)) {
+          errno = EIO;
+          return -1;
+        }
+      }
+
+      if ((usbfs->file = eventfd(0, EFD_NONBLOCK)) == -1) return -1;
+      usbfs->writable = 1;
+      usbfs->submitted.count = usbfs->discarded.count = usbfs->completed.count = 0;
+      usbfs->submitError = 0;
+
+      signalCompletedURBs(usbfs);
+      return usbfs->file;
+    }
+  }
+
+  errno = EMFILE;
+  return -1;
+}
+
+static int
+mockOpen (const char *path, int flags, ...) {
+  int mode = 0;
+
+  if (flags & O_CREAT) {
+    va_list arguments;
+
+    va_start(arguments, flags);
+    mode = va_arg(arguments, int);
+    va_end(arguments);
+  }
+
+  {
+    char buffer[PATH_MAX];
+    const char *mockedPath = mockPath(path, buffer, sizeof(buffer));
+
+    if (strncmp(path, USBFS_ROOT, strlen(USBFS_ROOT)) == 0) {
+      if ((flags & O_ACCMODE) == O_RDWR) return openUsbfsFile(mockedPath);
+    }
+
+    return open(mockedPath, flags, mode);
+  }
+}
+
+static int
+mockClose (int file) {
+  MockUsbfsFile *usbfs = getUsbfsFile(file);
+
+  if (usbfs) {
+    /* the kernel would still write into these */
+    mock.abandonedURBs += usbfs->submitted.count + usbfs->discarded.count + usbfs->completed.count;
+    usbfs->file = -1;
+  } else if (file == mock.uevents.monitor) {
+    close(mock.uevents.peer);
+    mock.uevents.peer = -1;
+    mock.uevents.monitor = -1;
+  }
+
+  return close(file);
+}
+
+static int
+mockAccess (const char *path, int mode) {
+  char buffer[PATH_MAX];
+  return access(mockPath(path, buffer, sizeof(buffer)), mode);
+}
+
+static int
+mockStat (const char *path, struct stat *status) {
+  char buffer[PATH_MAX];
+  return stat(mockPath(path, buffer, sizeof(buffer)), status);
+}
+
+static DIR *
+mockOpendir (const char *path) {
+  char buffer[PATH_MAX];
+
+  if (strcmp(path, USBFS_ROOT) == 0) mock.scans += 1;
+  return opendir(mockPath(path, buffer, sizeof(buffer)));
+}
+
+static int
+mockControlTransfer (MockUsbfsFile *usbfs, struct usbdevfs_ctrltransfer *transfer) {
+  if ((transfer->bRequestType == (UsbControlDirection_Input | UsbControlRecipient_Device | UsbControlType_Standard)) &&
+      (transfer->bRequest == UsbStandardRequest_GetDescriptor)) {
+    const unsigned char *descriptor = NULL;
+    size_t size = 0;
+
+    switch (transfer->wValue) {
+      case UsbDescriptorType_Device << 8:
+        descriptor = usbfs->descriptors;
+        size = UsbDescriptorSize_Device;
+        break;
+
+      case UsbDescriptorType_Configuration << 8:
+        descriptor = &usbfs->descriptors[UsbDescriptorSize_Device];
+        size = sizeof(usbfs->descriptors) - UsbDescriptorSize_Device;
+        break;
+
+      default:
+        break;
+    }
+
+    if (descriptor) {
+      if (size > transfer->wLength) size = transfer->wLength;
+      memcpy(transfer->data, descriptor, size);
+      return size;
+    }
+  }
+
+  /* a stall */
+  errno = EPIPE;
+  return -1;
+}
+
+static int
+mockSubmitURB (MockUsbfsFile *usbfs, struct usbdevfs_urb *urb) {
+  if (usbfs->submitError) {
+    errno = usbfs->submitError;
+    return -1;
+  }
+
+  if (usbfs->submitted.count == ARRAY_COUNT(usbfs->submitted.urbs)) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  urb->status = -EINPROGRESS;
+  urb->actual_length = 0;
+  addURB(&usbfs->submitted, urb);
+  return 0;
+}
+
+static int
+mockDiscardURB (MockUsbfsFile *usbfs, struct usbdevfs_urb *urb) {
+  int index = findURB(&usbfs->submitted, urb);
+
+  /* as for the kernel, it's too late once it's been completed */
+  if (index == -1) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  removeURB(&usbfs->submitted, index);
+  urb->status = -ENOENT;
+  addURB(&usbfs->discarded, urb);
+  mock.discardedURBs += 1;
+  return 0;
+}
+
+static int
+mockReapURB (MockUsbfsFile *usbfs, struct usbdevfs_urb **urb, int wait) {
+  if (wait && !usbfs->completed.count && usbfs->discarded.count) {
+    addURB(&usbfs->completed, removeURB(&usbfs->discarded, 0));
+  }
+
+  if (!usbfs->completed.count) {
+    if (wait) {
+      /* the kernel would wait forever */
+      mock.blockedReaps += 1;
+      errno = EDEADLK;
+    } else {
+      errno = EAGAIN;
+    }
+
+    return -1;
+  }
+
+  *urb = removeURB(&usbfs->completed, 0);
+  signalCompletedURBs(usbfs);
+  return 0;
+}
+
+static int
+mockIoctl (int file, unsigned long int request, ...) {
+  MockUsbfsFile *usbfs = getUsbfsFile(file);
+  void *argument;
+
+  {
+    va_list arguments;
+
+    va_start(arguments, request);
+    argument = va_arg(arguments, void *);
+    va_end(arguments);
+  }
+
+  if (!usbfs) return ioctl(file, request, argument);
+
+  switch (request) {
+    case USBDEVFS_CONTROL:
+      return mockControlTransfer(usbfs, argument);
+
+    case USBDEVFS_SETCONFIGURATION:
+    case USBDEVFS_CLAIMINTERFACE:
+    case USBDEVFS_RELEASEINTERFACE:
+    case USBDEVFS_SETINTERFACE:
+    case USBDEVFS_CLEAR_HALT:
+      return 0;
+
+    case USBDEVFS_SUBMITURB:
+      return mockSubmitURB(usbfs, argument);
+
+    case USBDEVFS_DISCARDURB:
+      return mockDiscardURB(usbfs, argument);
+
+    case USBDEVFS_REAPURB:
+      return mockReapURB(usbfs, argument, 1);
+
+    case USBDEVFS_REAPURBNDELAY:
+      return mockReapURB(usbfs, argument, 0);
+
+    default:
+      errno = ENOTTY;
+      return -1;
+  }
+}
+
+static int
+mockSocket (int domain, int type, int protocol) {
+  if ((domain == PF_NETLINK) && (protocol == NETLINK_KOBJECT_UEVENT)) {
+    int sockets[2];
+
+    if (socketpair(AF_UNIX, SOCK_DGRAM, 0, sockets) == -1) return -1;
+    mock.uevents.monitor = sockets[0];
+    mock.uevents.peer = sockets[1];
+    return mock.uevents.monitor;
+  }
+
+  return socket(domain, type, protocol);
+}
+
+static int
+mockBind (int socket, const struct sockaddr *address, socklen_t length) {
+  if (socket == mock.uevents.monitor) return 0;
+  return bind(socket, address, length);
+}
+
+static void
+mockFree (void *pointer) {
+  if (pointer && (pointer == mock.watchedPointer)) mock.watchedPointerFreed = 1;
+  free(pointer);
+}
+
+static void
+processEvents (int duration) {
+  TimePeriod period;
+  startTimePeriod(&period, duration);
+
+  do {
+    asyncWait(1);
+  } while (!afterTimePeriod(&period, NULL));
+}
+
+static int
+makeFakeFile (const char *path, const void *data, size_t size) {
+  char directory[strlen(path) + 1];
+  char *delimiter = &directory[strlen(mock.root)];
+  FILE *stream;
+  int ok = 0;
+
+  strcpy(directory, path);
+
+  while ((delimiter = strchr(delimiter+1, '/'))) {
+    *delimiter = 0;
+
+    if ((mkdir(directory, S_IRWXU) == -1) && (errno != EEXIST)) {
+      logSystemError(directory);
+      return 0;
+    }
+
+    *delimiter = '/';
+  }
+
+  if ((stream = fopen(path, "w"))) {
+    if (fwrite(data, 1, size, stream) == size) ok = 1;
+    if (fclose(stream) == EOF) ok = 0;
+  }
+
+  if (!ok) logSystemError(path);
+  return ok;
+}
+
+static int
+addFakeDevice (unsigned int device, uint16_t product, int sysfs) {
+  unsigned char descriptors[sizeof(testDescriptors)];
+  char path[PATH_MAX];
+
+  memcpy(descriptors, testDescriptors, sizeof(descriptors));
+  descriptors[10] = product & 0XFF;
+  descriptors[11] = product >> 8;
+
+  snprintf(path, sizeof(path), "%s/usbfs/%03u/%03u", mock.root, TEST_BUS, device);
+  if (!makeFakeFile(path, descriptors, sizeof(descriptors))) return 0;
+
+  if (sysfs) {
+    snprintf(path, sizeof(path), "%s/sysfs/dev/char/189:%u/descriptors",
+             mock.root, ((TEST_BUS - 1) << 7) | (device - 1));
+    if (!makeFakeFile(path, descriptors, sizeof(descriptors))) return 0;
+  }
+
+  return 1;
+}
+
+static int
+removeFakeFile (const char *path, const struct stat *status, int type, struct FTW *ftw) {
+  return remove(path);
+}
+
+static int
+makeFakeRoot (void) {
+  char root[] = "/tmp/brltty-usb.XXXXXX";
+
+  if (mkdtemp(root)) {
+    if ((mock.root = strdup(root))) return 1;
+    logMallocError();
+    rmdir(root);
+  } else {
+    logSystemError("mkdtemp");
+  }
+
+  return 0;
+}
+
+static void
+removeFakeRoot (void) {
+  if (mock.root) {
+    nftw(mock.root, removeFakeFile, 0X10, FTW_DEPTH|FTW_PHYS);
+    free(mock.root);
+    mock.root = NULL;
+  }
+}
+
+static int
+sendUevent (const char *action, unsigned int device, unsigned long long sequenceNumber) {
+  char buffer[0X200];
+  size_t length = 0;
+
+  {
+    char devicePath[0X40];
+    const char *strings[9];
+    unsigned int count = 0;
+    char bus[0X10], number[0X10], sequence[0X20];
+    char header[0X80], actionVariable[0X20], pathVariable[0X50];
+
+    snprintf(devicePath, sizeof(devicePath), "/devices/pci0000:00/usb%u/%u-%u", TEST_BUS, TEST_BUS, device);
+    snprintf(header, sizeof(header), "%s@%s", action, devicePath);
+    snprintf(actionVariable, sizeof(actionVariable), "ACTION=%s", action);
+    snprintf(pathVariable, sizeof(pathVariable), "DEVPATH=%s", devicePath);
+    snprintf(bus, sizeof(bus), "BUSNUM=%03u", TEST_BUS);
+    snprintf(number, sizeof(number), "DEVNUM=%03u", device);
+    snprintf(sequence, sizeof(sequence), "SEQNUM=%llu", sequenceNumber);
+
+    strings[count++] = header;
+    strings[count++] = actionVariable;
+    strings[count++] = pathVariable;
+    strings[count++] = "SUBSYSTEM=usb";
+    strings[count++] = "DEVTYPE=usb_device";
+    strings[count++] = bus;
+    strings[count++] = number;
+    strings[count++] = sequence;
+
+    {
+      unsigned int index;
+
+      for (index=0; index<count; index+=1) {
+        size_t size = strlen(strings[index]) + 1;
+
+        memcpy(&buffer[length], strings[index], size);
+        length += size;
+      }
+    }
+  }
+
+  if (mock.uevents.peer == -1) {
+    logMessage(LOG_WARNING, "uevent monitor not started");
+    return 0;
+  }
+
+  if (send(mock.uevents.peer, buffer, length, 0) == -1) {
+    logSystemError("uevent send");
+    return 0;
+  }
+
+  mock.uevents.sequenceNumber = sequenceNumber;
+  processEvents(50);
+  return 1;
+}
+
+static int
+sendNextUevent (const char *action, unsigned int device) {
+  return sendUevent(action, device, mock.uevents.sequenceNumber+1);
+}
+
+static const UsbChannelDefinition testDefinitions[] = {
+  { /* doesn't match the version of any device */
+    .vendor=TEST_VENDOR, .product=0X0001, .version=0X0110,
+    .configuration=1, .interface=0, .alternative=0,
+    .data="old"
+  },
+
+  { .vendor=TEST_VENDOR, .product=0X0002,
+    .configuration=1, .interface=0, .alternative=0,
+    .data="two"
+  },
+
+  { /* the earlier definition for the same device is chosen */
+    .vendor=TEST_VENDOR, .product=0X0002,
+    .configuration=1, .interface=0, .alternative=0,
+    .data="two again"
+  },
+
+  { .vendor=TEST_VENDOR, .product=0X0001,
+    .configuration=1, .interface=0, .alternative=0,
+    .data="one"
+  },
+
+  { .vendor=TEST_VENDOR, .product=0X0004,
+    .configuration=1, .interface=0, .alternative=0,
+    .data="four"
+  },
+
+  { .vendor=TEST_VENDOR, .product=0X0003,
+    .configuration=1, .interface=0, .alternative=0,
+    .inputEndpoint=1,
+    .data="input"
+  },
+
+  { .vendor=0 }
+};
+
+static UsbChannel *
+openTestChannel (const UsbChannelDefinition *definitions, uint16_t product) {
+  char identifier[0X40];
+
+  snprintf(identifier, sizeof(identifier), "productIdentifier=%u", product);
+  return usbOpenChannel(definitions, identifier);
+}
+
+static int
+checkChannel (const char *test, const UsbChannelDefinition *definitions, uint16_t product, const char *expected) {
+  UsbChannel *channel = openTestChannel(definitions, product);
+  const char *actual = channel? channel->definition.data: NULL;
+  int ok = 1;
+
+  if (!expected || !actual) {
+    if (expected != actual) ok = 0;
+  } else if (strcmp(actual, expected) != 0) {
+    ok = 0;
+  }
+
+  if (!ok) {
+    logMessage(LOG_WARNING, "%s: product %04X: %s chosen (%s expected)",
+               test, product, (actual? actual: "none"), (expected? expected: "none"));
+  }
+
+  if (channel) usbCloseChannel(channel);
+  return ok;
+}
+
+static int
+checkScans (const char *test, unsigned int expected) {
+  if (mock.scans == expected) return 1;
+  logMessage(LOG_WARNING, "%s: %u usbfs scans (%u expected)", test, mock.scans, expected);
+  return 0;
+}
+
+static int
+startTest (void) {
+  unsigned int index;
+
+  usbExitHostDevices(NULL);
+  removeFakeRoot();
+
+  for (index=0; index<ARRAY_COUNT(mock.files); index+=1) {
+    mock.files[index].file = -1;
+  }
+
+  mock.scans = 0;
+  mock.discardedURBs = 0;
+  mock.blockedReaps = 0;
+  mock.abandonedURBs = 0;
+  mock.uevents.sequenceNumber = 1000;
+  mock.watchedPointer = NULL;
+  mock.watchedPointerFreed = 0;
+
+  if (!makeFakeRoot()) return 0;
+  if (!addFakeDevice(2, 0X0001, 1)) return 0;
+  if (!addFakeDevice(3, 0X0002, 0)) return 0;
+  return 1;
+}
+
+static int
+testChannelIndex (const char *test) {
+  UsbChannelDefinition definitions[ARRAY_COUNT(testDefinitions)];
+  int ok = 1;
+
+  if (!checkChannel(test, testDefinitions, 0X0001, "one")) ok = 0;
+  if (!checkChannel(test, testDefinitions, 0X0002, "two")) ok = 0;
+  if (!checkChannel(test, testDefinitions, 0X0004, NULL)) ok = 0;
+
+  /* a table at the same address with different contents mustn't be mistaken for the old one */
+  memcpy(definitions, testDefinitions, sizeof(definitions));
+  definitions[1].product = definitions[2].product = 0X0005;
+  if (!checkChannel(test, definitions, 0X0002, NULL)) ok = 0;
+
+  definitions[1].product = 0X0002;
+  if (!checkChannel(test, definitions, 0X0002, "two")) ok = 0;
+
+  if (!checkScans(test, 1)) ok = 0;
+  return ok;
+}
+
+static int
+testDeviceAdded (const char *test) {
+  int ok = 1;
+
+  if (!checkChannel(test, testDefinitions, 0X0001, "one")) ok = 0;
+  if (!addFakeDevice(4, 0X0004, 0)) return 0;
+  if (!sendNextUevent("add", 4)) return 0;
+
+  /* only the added device is read - the usbfs root isn't scanned again */
+  if (!checkChannel(test, testDefinitions, 0X0004, "four")) ok = 0;
+  if (!checkScans(test, 1)) ok = 0;
+  return ok;
+}
+
+static int
+testDeviceRemoved (const char *test) {
+  int ok = 1;
+
+  if (!checkChannel(test, testDefinitions, 0X0001, "one")) ok = 0;
+  if (!sendNextUevent("remove", 2)) return 0;
+
+  /* its file is still there so it's only gone from the cache */
+  if (!checkChannel(test, testDefinitions, 0X0001, NULL)) ok = 0;
+  if (!checkChannel(test, testDefinitions, 0X0002, "two")) ok = 0;
+  if (!checkScans(test, 1)) ok = 0;
+  return ok;
+}
+
+static int
+testSequenceGap (const char *test) {
+  int ok = 1;
+
+  if (!checkChannel(test, testDefinitions, 0X0001, "one")) ok = 0;
+  if (!sendNextUevent("change", 3)) return 0;
+
+  /* a device whose uevent is lost */
+  if (!addFakeDevice(4, 0X0004, 0)) return 0;
+  if (!sendUevent("change", 3, mock.uevents.sequenceNumber+2)) return 0;
+
+  if (usbHostDevices) {
+    logMessage(LOG_WARNING, "%s: device cache kept after lost uevents", test);
+    ok = 0;
+  }
+
+  if (!checkChannel(test, testDefinitions, 0X0004, "four")) ok = 0;
+  if (!checkScans(test, 2)) ok = 0;
+  return ok;
+}
+
+static int
+testDeviceReference (const char *test) {
+  UsbChannel *channel = openTestChannel(testDefinitions, 0X0001);
+  UsbHostDevice *host;
+  int ok = 1;
+
+  if (!channel) {
+    logMessage(LOG_WARNING, "%s: channel not opened", test);
+    return 0;
+  }
+
+  host = channel->device->extension->host;
+  mock.watchedPointer = host;
+
+  if (host->references != 2) {
+    logMessage(LOG_WARNING, "%s: %u references to an open cached device", test, host->references);
+    ok = 0;
+  }
+
+  /* the open device keeps its host entry after it's been removed from the cache */
+  if (!sendNextUevent("remove", 2)) ok = 0;
+
+  if (mock.watchedPointerFreed) {
+    logMessage(LOG_WARNING, "%s: open device released", test);
+    usbCloseChannel(channel);
+    return 0;
+  }
+
+  if (host->references != 1) {
+    logMessage(LOG_WARNING, "%s: %u references to an open removed device", test, host->references);
+    ok = 0;
+  }
+
+  usbCloseChannel(channel);
+
+  if (!mock.watchedPointerFreed) {
+    logMessage(LOG_WARNING, "%s: closed removed device not released", test);
+    ok = 0;
+  }
+
+  return ok;
+}
+
+static int
+testForgetDevices (const char *test) {
+  int ok = 1;
+
+  if (!checkChannel(test, testDefinitions, 0X0001, "one")) ok = 0;
+
+  /* the cache is kept while it's being kept current */
+  usbForgetDevices();
+
+  if (!usbHostDevices || (getQueueSize(usbHostDevices) != 2)) {
+    logMessage(LOG_WARNING, "%s: monitored device cache not kept", test);
+    ok = 0;
+  }
+
+  if (!checkChannel(test, testDefinitions, 0X0002, "two")) ok = 0;
+  if (!checkScans(test, 1)) ok = 0;
+
+  /* but not once nothing is keeping it current */
+  usbStopUeventMonitor();
+  usbForgetDevices();
+
+  if (usbHostDevices) {
+    logMessage(LOG_WARNING, "%s: unmonitored device cache kept", test);
+    ok = 0;
+  }
+
+  if (!checkChannel(test, testDefinitions, 0X0001, "one")) ok = 0;
+  if (!checkScans(test, 2)) ok = 0;
+  return ok;
+}
+
+typedef struct {
+  UsbChannel *channel;
+  UsbEndpoint *endpoint;
+  UsbEndpointExtension *eptx;
+  MockUsbfsFile *usbfs;
+} InputDevice;
+
+static int
+openInputDevice (const char *test, InputDevice *input) {
+  if (addFakeDevice(5, 0X0003, 0)) {
+    if ((input->channel = openTestChannel(testDefinitions, 0X0003))) {
+      UsbDevice *device = input->channel->device;
+
+      if ((input->endpoint = usbGetInputEndpoint(device, 1))) {
+        input->eptx = input->endpoint->extension;
+
+        if ((input->usbfs = getUsbfsFile(device->extension->usbfsFile))) {
+          if (input->usbfs->submitted.count == LINUX_USB_INPUT_URB_COUNT) return 1;
+
+          logMessage(LOG_WARNING, "%s: %u input URBs submitted (%u expected)",
+                     test, input->usbfs->submitted.count, LINUX_USB_INPUT_URB_COUNT);
+        }
+      }
+
+      usbCloseChannel(input->channel);
+    } else {
+      logMessage(LOG_WARNING, "%s: input channel not opened", test);
+    }
+  }
+
+  return 0;
+}
+
+static int
+closeInputDevice (const char *test, InputDevice *input, unsigned int discarded) {
+  int ok = 1;
+
+  usbCloseChannel(input->channel);
+
+  if (mock.discardedURBs != discarded) {
+    logMessage(LOG_WARNING, "%s: %u input URBs discarded (%u expected)",
+               test, mock.discardedURBs, discarded);
+    ok = 0;
+  }
+
+  if (mock.blockedReaps) {
+    logMessage(LOG_WARNING, "%s: waited for a URB which isn't the kernel's", test);
+    ok = 0;
+  }
+
+  if (mock.abandonedURBs) {
+    logMessage(LOG_WARNING, "%s: %u input URBs still the kernel's when closed",
+               test, mock.abandonedURBs);
+    ok = 0;
+  }
+
+  return ok;
+}
+
+static int
+completeURB (MockUsbfsFile *usbfs, const void *data, size_t length) {
+  if (!usbfs->submitted.count) return 0;
+
+  {
+    struct usbdevfs_urb *urb = removeURB(&usbfs->submitted, 0);
+
+    memcpy(urb->buffer, data, length);
+    urb->actual_length = length;
+    urb->status = 0;
+    addURB(&usbfs->completed, urb);
+  }
+
+  signalCompletedURBs(usbfs);
+  return 1;
+}
+
+static int
+awaitSubmittedURBs (const char *test, const InputDevice *input, unsigned int count) {
+  TimePeriod period;
+  startTimePeriod(&period, 1000);
+
+  while (input->usbfs->submitted.count != count) {
+    if (afterTimePeriod(&period, NULL)) {
+      logMessage(LOG_WARNING, "%s: %u input URBs submitted (%u expected)",
+                 test, input->usbfs->submitted.count, count);
+      return 0;
+    }
+
+    asyncWait(1);
+  }
+
+  return 1;
+}
+
+static int
+awaitInputError (const char *test, const InputDevice *input, int expected) {
+  TimePeriod period;
+  startTimePeriod(&period, 1000);
+
+  while (1) {
+    unsigned char byte;
+
+    if (usbReadData(input->channel->device, 1, &byte, 1, 0, 0) == -1) {
+      if (errno == expected) return 1;
+      logMessage(LOG_WARNING, "%s: input error %d (%d expected)", test, errno, expected);
+      return 0;
+    }
+
+    if (afterTimePeriod(&period, NULL)) {
+      logMessage(LOG_WARNING, "%s: input error not reported", test);
+      return 0;
+    }
+
+    asyncWait(1);
+  }
+}
+
+static int
+checkInput (const char *test, const InputDevice *input, const unsigned char *expected, size_t length) {
+  unsigned char buffer[length + 1];
+  ssize_t count = usbReadData(input->channel->device, 1, buffer, sizeof(buffer), 0, 0);
+
+  if (count == -1) {
+    logSystemError("USB read");
+    return 0;
+  }
+
+  if ((count != length) || (memcmp(buffer, expected, length) != 0)) {
+    logMessage(LOG_WARNING, "%s: wrong input: %d bytes (%u expected)",
+               test, (int)count, (unsigned int)length);
+    return 0;
+  }
+
+  return 1;
+}
+
+static int
+testInputCompletion (const char *test) {
+  InputDevice input;
+  unsigned char data[0X800];
+  size_t length = 0;
+  size_t checked = 0;
+  unsigned int packet = 0;
+  int ok = 1;
+
+  if (!openInputDevice(test, &input)) return 0;
+
+  while (ok && (length < sizeof(data))) {
+    /* complete every URB which is in flight, each with a different amount */
+    while (input.usbfs->submitted.count) {
+      size_t size = (packet++ % 8) + 1;
+      size_t index;
+
+      if ((length + size) > sizeof(data)) break;
+      for (index=0; index<size; index+=1) data[length+index] = length + index + packet;
+
+      completeURB(input.usbfs, &data[length], size);
+      length += size;
+    }
+
+    /* they must be reaped, resubmitted, and read in the order they were completed */
+    if (!awaitSubmittedURBs(test, &input, LINUX_USB_INPUT_URB_COUNT)) ok = 0;
+    if (!checkInput(test, &input, &data[checked], (length - checked))) ok = 0;
+    checked = length;
+  }
+
+  if (!closeInputDevice(test, &input, LINUX_USB_INPUT_URB_COUNT)) ok = 0;
+  return ok;
+}
+
+static int
+testIdleBackoff (const char *test) {
+  static const int delays[] = {1, 2, 4, 8, 16, 32, BRAILLE_INPUT_POLL_INTERVAL, BRAILLE_INPUT_POLL_INTERVAL};
+  static const unsigned char byte = 0X55;
+  InputDevice input;
+  unsigned int index;
+  int ok = 1;
+
+  if (!openInputDevice(test, &input)) return 0;
+
+  /* all of them come back empty, and only the last one is kept going */
+  while (completeURB(input.usbfs, NULL, 0));
+
+  for (index=0; index<ARRAY_COUNT(delays); index+=1) {
+    if (!awaitSubmittedURBs(test, &input, 1)) {
+      ok = 0;
+      break;
+    }
+
+    if ((input.eptx->monitor.submitDelay != delays[index]) ||
+        (input.eptx->monitor.parkedCount != (LINUX_USB_INPUT_URB_COUNT - 1))) {
+      logMessage(LOG_WARNING, "%s: idle URB %u resubmitted after %dms with %u parked (%dms with %u expected)",
+                 test, index+1, input.eptx->monitor.submitDelay, input.eptx->monitor.parkedCount,
+                 delays[index], (LINUX_USB_INPUT_URB_COUNT - 1));
+      ok = 0;
+    }
+
+    if (index < (ARRAY_COUNT(delays) - 1)) completeURB(input.usbfs, NULL, 0);
+  }
+
+  /* input brings all of them back at once */
+  if (ok) {
+    completeURB(input.usbfs, &byte, 1);
+    if (!awaitSubmittedURBs(test, &input, LINUX_USB_INPUT_URB_COUNT)) ok = 0;
+
+    if (input.eptx->monitor.submitDelay || input.eptx->monitor.parkedCount) {
+      logMessage(LOG_WARNING, "%s: still idle after input", test);
+      ok = 0;
+    }
+
+    if (!checkInput(test, &input, &byte, 1)) ok = 0;
+  }
+
+  if (!closeInputDevice(test, &input, LINUX_USB_INPUT_URB_COUNT)) ok = 0;
+  return ok;
+}
+
+static int
+testIdleSubmitFailure (const char *test) {
+  InputDevice input;
+  int ok = 1;
+
+  if (!openInputDevice(test, &input)) return 0;
+
+  input.usbfs->submitError = EIO;
+  while (completeURB(input.usbfs, NULL, 0));
+  if (!awaitInputError(test, &input, EIO)) ok = 0;
+
+  /* the one which wasn't resubmitted stays parked, so none are discarded */
+  if (input.eptx->monitor.parkedCount != LINUX_USB_INPUT_URB_COUNT) {
+    logMessage(LOG_WARNING, "%s: %u input URBs parked (%u expected)",
+               test, input.eptx->monitor.parkedCount, LINUX_USB_INPUT_URB_COUNT);
+    ok = 0;
+  }
+
+  if (!closeInputDevice(test, &input, 0)) ok = 0;
+  return ok;
+}
+
+static int
+testInputSubmitFailure (const char *test) {
+  static const unsigned char byte = 0XAA;
+  InputDevice input;
+  int ok = 1;
+
+  if (!openInputDevice(test, &input)) return 0;
+
+  input.usbfs->submitError = EIO;
+  completeURB(input.usbfs, &byte, 1);
+  if (!awaitInputError(test, &input, EIO)) ok = 0;
+
+  /* the others are still in flight */
+  if (!closeInputDevice(test, &input, LINUX_USB_INPUT_URB_COUNT-1)) ok = 0;
+  return ok;
+}
+
+static int
+testDiscardInFlight (const char *test) {
+  static const unsigned char byte = 0X5A;
+  InputDevice input;
+  int ok = 1;
+
+  if (!openInputDevice(test, &input)) return 0;
+
+  /* one has been completed but not yet reaped, and the rest are in flight */
+  completeURB(input.usbfs, &byte, 1);
+
+  if (!closeInputDevice(test, &input, LINUX_USB_INPUT_URB_COUNT-1)) ok = 0;
+  return ok;
+}
+
+typedef struct {
+  const char *name;
+  int (*run) (const char *test);
+} TestEntry;
+
+static const TestEntry testTable[] = {
+  { .name = "channel index", .run = testChannelIndex },
+  { .name = "device added", .run = testDeviceAdded },
+  { .name = "device removed", .run = testDeviceRemoved },
+  { .name = "sequence gap", .run = testSequenceGap },
+  { .name = "device reference", .run = testDeviceReference },
+  { .name = "forget devices", .run = testForgetDevices },
+  { .name = "input completion", .run = testInputCompletion },
+  { .name = "idle backoff", .run = testIdleBackoff },
+  { .name = "idle submit failure", .run = testIdleSubmitFailure },
+  { .name = "input submit failure", .run = testInputSubmitFailure },
+  { .name = "discard in flight", .run = testDiscardInFlight },
+};
+
+static unsigned int
+runTests (unsigned int *failures) {
+  const TestEntry *test;
+
+  for (test=testTable; test<(testTable + ARRAY_COUNT(testTable)); test+=1) {
+    if (!startTest()) {
+      *failures = ARRAY_COUNT(testTable);
+      break;
+    }
+
+    if (!test->run(test->name)) *failures += 1;
+  }
+
+  usbExitHostDevices(NULL);
+  removeFakeRoot();
+  return ARRAY_COUNT(testTable);
+}
+#else /* __linux__ */
+#include "usb_none.c"
+
+static unsigned int
+runTests (unsigned int *failures) {
+  logMessage(LOG_NOTICE, "the Linux USB support can't be tested on this platform");
+  return 0;
+}
+#endif /* __linux__ */
+
+int
+main (int argc, char *argv[]) {
+  unsigned int failures = 0;
+  unsigned int count;
+
+  {
+    static const OptionsDescriptor descriptor = {
+      OPTION_TABLE(programOptions),
+      .applicationName = "usbtest"
+    };
+    PROCESS_OPTIONS(descriptor, argc, argv);
+  }
+
+  if (argc) {
+    logMessage(LOG_ERR, "too many parameters");
+    return PROG_EXIT_SYNTAX;
+  }
+
+  count = runTests(&failures);
+
+  if (failures) {
+    logMessage(LOG_ERR, "%u of %u Linux USB tests failed", failures, count);
+    return PROG_EXIT_FATAL;
+  }
+
+  printf("%u Linux USB tests passed\n", count);
+  return PROG_EXIT_SUCCESS;
+}